@@ -0,0 +1,240 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "accounts.h"
+
+#define ACCT_HASH_SIZE      4096
+
+typedef struct acct_entry {
+    TAILQ_ENTRY(acct_entry) lru;
+    struct acct_entry *hnext;
+    uint32_t gc;
+    uint32_t acc;
+    uint32_t priv;
+    time_t expires;
+    time_t priv_expires;
+} acct_entry_t;
+
+TAILQ_HEAD(acct_lru, acct_entry);
+
+extern sylverant_dbconn_t conn;
+
+static acct_entry_t *entries;
+static acct_entry_t *hash[ACCT_HASH_SIZE];
+static struct acct_lru lru = TAILQ_HEAD_INITIALIZER(lru);
+static struct acct_lru free_list = TAILQ_HEAD_INITIALIZER(free_list);
+
+static acct_entry_t *cache_find(uint32_t gc) {
+    acct_entry_t *i = hash[gc & (ACCT_HASH_SIZE - 1)];
+
+    while(i) {
+        if(i->gc == gc)
+            return i;
+
+        i = i->hnext;
+    }
+
+    return NULL;
+}
+
+static void cache_remove(acct_entry_t *ent) {
+    acct_entry_t **i = &hash[ent->gc & (ACCT_HASH_SIZE - 1)];
+
+    while(*i) {
+        if(*i == ent) {
+            *i = ent->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    TAILQ_REMOVE(&lru, ent, lru);
+    TAILQ_INSERT_TAIL(&free_list, ent, lru);
+}
+
+static void cache_insert(uint32_t gc, uint32_t acc, uint32_t priv) {
+    acct_entry_t *ent;
+    int bucket = gc & (ACCT_HASH_SIZE - 1);
+    time_t now = time(NULL);
+
+    if(!entries)
+        return;
+
+    if((ent = cache_find(gc))) {
+        TAILQ_REMOVE(&lru, ent, lru);
+    }
+    else {
+        /* Grab a free entry, or evict the least recently used one. */
+        if(!(ent = TAILQ_FIRST(&free_list)))
+            cache_remove(TAILQ_LAST(&lru, acct_lru));
+
+        ent = TAILQ_FIRST(&free_list);
+        TAILQ_REMOVE(&free_list, ent, lru);
+
+        ent->gc = gc;
+        ent->hnext = hash[bucket];
+        hash[bucket] = ent;
+    }
+
+    ent->acc = acc;
+    ent->priv = priv;
+    ent->expires = now + ACCT_CACHE_TTL;
+    ent->priv_expires = now + ACCT_PRIV_TTL;
+    TAILQ_INSERT_HEAD(&lru, ent, lru);
+}
+
+int acct_init(void) {
+    int i;
+
+    if(!(entries = (acct_entry_t *)malloc(ACCT_CACHE_SIZE *
+                                          sizeof(acct_entry_t)))) {
+        debug(DBG_ERROR, "Cannot allocate account cache\n");
+        return -1;
+    }
+
+    memset(hash, 0, sizeof(hash));
+    TAILQ_INIT(&lru);
+    TAILQ_INIT(&free_list);
+
+    for(i = 0; i < ACCT_CACHE_SIZE; ++i) {
+        TAILQ_INSERT_TAIL(&free_list, &entries[i], lru);
+    }
+
+    return 0;
+}
+
+void acct_cleanup(void) {
+    free(entries);
+    entries = NULL;
+
+    memset(hash, 0, sizeof(hash));
+    TAILQ_INIT(&lru);
+    TAILQ_INIT(&free_list);
+}
+
+static int lookup(uint32_t gc, uint32_t *acc, uint32_t *priv, int need_priv) {
+    acct_entry_t *ent;
+    char query[256];
+    void *result;
+    char **row;
+    int status;
+    uint32_t a = 0, p = 0;
+    time_t now = time(NULL);
+
+    /* Check the cache first. */
+    if((ent = cache_find(gc))) {
+        if(ent->expires > now && (!need_priv || ent->priv_expires > now)) {
+            TAILQ_REMOVE(&lru, ent, lru);
+            TAILQ_INSERT_HEAD(&lru, ent, lru);
+
+            if(acc)
+                *acc = ent->acc;
+
+            if(priv)
+                *priv = ent->priv;
+
+            return ACCT_OK;
+        }
+
+        cache_remove(ent);
+    }
+
+    /* Only registered guildcards are cached. Anything else is checked every
+       time, since it could have been registered through the website since the
+       last lookup. */
+    sprintf(query, "SELECT guildcards.account_id, account_data.privlevel FROM "
+            "guildcards LEFT JOIN account_data ON guildcards.account_id = "
+            "account_data.account_id WHERE guildcards.guildcard='%" PRIu32 "'",
+            gc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't fetch account data (%" PRIu32 ")\n", gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return ACCT_ERROR;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't store account data (%" PRIu32 ")\n", gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return ACCT_ERROR;
+    }
+
+    if(!(row = sylverant_db_result_fetch(result))) {
+        status = ACCT_NO_GUILDCARD;
+    }
+    else if(!row[0]) {
+        status = ACCT_UNREGISTERED;
+    }
+    else {
+        status = ACCT_OK;
+        a = (uint32_t)strtoul(row[0], NULL, 0);
+
+        if(row[1])
+            p = (uint32_t)strtoul(row[1], NULL, 0);
+    }
+
+    sylverant_db_result_free(result);
+
+    if(status == ACCT_OK)
+        cache_insert(gc, a, p);
+
+    if(acc)
+        *acc = a;
+
+    if(priv)
+        *priv = p;
+
+    return status;
+}
+
+int acct_lookup(uint32_t gc, uint32_t *acc, uint32_t *priv) {
+    return lookup(gc, acc, priv, 0);
+}
+
+int acct_lookup_priv(uint32_t gc, uint32_t *acc, uint32_t *priv) {
+    return lookup(gc, acc, priv, 1);
+}
+
+void acct_cache_set(uint32_t gc, uint32_t acc, uint32_t priv) {
+    cache_insert(gc, acc, priv);
+}
+
+void acct_cache_invalidate(uint32_t gc) {
+    acct_entry_t *ent;
+
+    if((ent = cache_find(gc)))
+        cache_remove(ent);
+}
+
+void acct_cache_reload(void) {
+    acct_entry_t *ent;
+
+    while((ent = TAILQ_FIRST(&lru))) {
+        cache_remove(ent);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ACCOUNTS_H
+#define ACCOUNTS_H
+
+#include <stdint.h>
+
+/* Number of guildcards that can be held in the account cache. */
+#ifndef ACCT_CACHE_SIZE
+#define ACCT_CACHE_SIZE         8192
+#endif
+
+/* How long (in seconds) a cached guildcard -> account mapping is trusted. */
+#ifndef ACCT_CACHE_TTL
+#define ACCT_CACHE_TTL          900
+#endif
+
+/* How long (in seconds) a cached privilege level is trusted for authorizing
+   GM actions (kicks, bans, global messages). */
+#ifndef ACCT_PRIV_TTL
+#define ACCT_PRIV_TTL           120
+#endif
+
+/* Return values for acct_lookup(). */
+#define ACCT_ERROR              -1  /* Database error */
+#define ACCT_OK                 0   /* Found the account */
+#define ACCT_UNREGISTERED       1   /* Guildcard has no account */
+#define ACCT_NO_GUILDCARD       2   /* Guildcard doesn't exist */
+
+/* Set up the account cache. */
+int acct_init(void);
+
+/* Clean up the account cache. */
+void acct_cleanup(void);
+
+/* Look up the account and privilege level associated with a guildcard. Either
+   of acc or priv may be NULL if the caller doesn't care. Only registered
+   guildcards are cached, so a guildcard that isn't is always checked in the
+   database. */
+int acct_lookup(uint32_t gc, uint32_t *acc, uint32_t *priv);
+
+/* Look up the account and privilege level associated with a guildcard, for
+   authorizing something. This only trusts cached privilege levels that are
+   newer than ACCT_PRIV_TTL, going to the database otherwise. */
+int acct_lookup_priv(uint32_t gc, uint32_t *acc, uint32_t *priv);
+
+/* Record a known guildcard -> account mapping and privilege level (for
+   instance, after a successful login), so that later lookups don't have to hit
+   the database. */
+void acct_cache_set(uint32_t gc, uint32_t acc, uint32_t priv);
+
+/* Drop any cached information about a guildcard. */
+void acct_cache_invalidate(uint32_t gc);
+
+/* Drop everything from the cache. */
+void acct_cache_reload(void);
+
+#endif /* !ACCOUNTS_H */
@@ -0,0 +1,345 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef HAVE_CRYPT_R
+#include <crypt.h>
+#endif
+
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/md5.h>
+
+#include "auth.h"
+#include "workq.h"
+
+/* Password hashes that are slow on purpose can't be checked on the main
+   thread without holding up everything else, so all the checking is done in
+   its own pool of worker threads (so logins don't wait behind character data
+   either). */
+
+#define AUTH_MAX_VERIFIERS  8
+
+typedef struct auth_job {
+    auth_cb_t cb;
+    void *data;
+    int result;
+    int unknown;
+    char *new_hash;
+    char password[32];
+    char salt[32];
+    char stored[AUTH_HASH_MAX];
+} auth_job_t;
+
+static const auth_verifier_t *verifiers[AUTH_MAX_VERIFIERS];
+static int verifier_count;
+static int auth_pool = -1;
+static char *rehash_setting;
+
+/* Compare two strings without bailing out at the first difference, so how
+   long it takes doesn't say how close a guess was. */
+static int same_str(const char *a, const char *b) {
+    size_t la = strlen(a), lb = strlen(b), i;
+    unsigned char diff = (la != lb);
+
+    for(i = 0; i < la && i < lb; ++i) {
+        diff |= (unsigned char)a[i] ^ (unsigned char)b[i];
+    }
+
+    return !diff;
+}
+
+/* The old style of hash: the MD5 of "password_regtime_salt", in hex. */
+static int md5_handles(const char *stored) {
+    int i;
+
+    for(i = 0; stored[i]; ++i) {
+        if(!isxdigit((unsigned char)stored[i]))
+            return 0;
+    }
+
+    return i == 32;
+}
+
+static int md5_verify(const char *password, const char *salt,
+                      const char *stored) {
+    static const char hexdig[] = "0123456789abcdef";
+    char buf[128], hex[33], lower[33];
+    unsigned char hash[16];
+    int i;
+
+    snprintf(buf, sizeof(buf), "%s_%s_salt", password, salt);
+    md5((unsigned char *)buf, strlen(buf), hash);
+    memset(buf, 0, sizeof(buf));
+
+    for(i = 0; i < 16; ++i) {
+        hex[i * 2] = hexdig[hash[i] >> 4];
+        hex[i * 2 + 1] = hexdig[hash[i] & 0x0F];
+    }
+
+    hex[32] = '\0';
+
+    for(i = 0; i < 32; ++i) {
+        lower[i] = tolower((unsigned char)stored[i]);
+    }
+
+    lower[32] = '\0';
+
+    return same_str(hex, lower) ? AUTH_OK : AUTH_BAD_PASSWORD;
+}
+
+static const auth_verifier_t md5_verifier = {
+    "md5", &md5_handles, &md5_verify
+};
+
+#ifdef HAVE_CRYPT_R
+
+/* Anything crypt(3) knows how to do, like bcrypt ("$2b$"), SHA-512 ("$6$") or
+   yescrypt ("$y$"), depending on what the system's crypt library supports. */
+static int crypt_handles(const char *stored) {
+    return stored[0] == '$';
+}
+
+static int crypt_verify(const char *password, const char *salt,
+                        const char *stored) {
+    struct crypt_data *cd;
+    const char *out;
+    int rv;
+
+    (void)salt;
+
+    /* This is too big to put on a worker's stack. */
+    if(!(cd = (struct crypt_data *)calloc(1, sizeof(struct crypt_data))))
+        return AUTH_ERROR;
+
+    out = crypt_r(password, stored, cd);
+
+    /* Some versions return NULL on failure, and some return a string starting
+       with '*' instead. Either way, the stored hash is one the crypt library
+       can't use, so nothing can match it. */
+    if(!out || out[0] == '*')
+        rv = AUTH_BAD_PASSWORD;
+    else
+        rv = same_str(out, stored) ? AUTH_OK : AUTH_BAD_PASSWORD;
+
+    memset(cd, 0, sizeof(struct crypt_data));
+    free(cd);
+
+    return rv;
+}
+
+static const auth_verifier_t crypt_verifier = {
+    "crypt", &crypt_handles, &crypt_verify
+};
+
+/* Make a new hash of a password with the configured setting. Returns a newly
+   allocated string, or NULL on error. */
+static char *make_hash(const char *password) {
+    static const char itoa64[] =
+        "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    char setting[AUTH_HASH_MAX];
+    struct crypt_data *cd;
+    const char *out;
+    char *rv = NULL;
+#ifndef HAVE_CRYPT_GENSALT_RN
+    unsigned char rnd[16];
+    size_t len;
+    int i;
+#endif
+
+#ifdef HAVE_CRYPT_GENSALT_RN
+    (void)itoa64;
+
+    if(!crypt_gensalt_rn(rehash_setting, 0, NULL, 0, setting, sizeof(setting)))
+        return NULL;
+#else
+    /* Without crypt_gensalt_rn(), the setting has to be one that takes a plain
+       salt after it (like "$6$" or "$5$rounds=100000$"). */
+    len = strlen(rehash_setting);
+
+    if(len + sizeof(rnd) + 2 > sizeof(setting) ||
+       gnutls_rnd(GNUTLS_RND_NONCE, rnd, sizeof(rnd)))
+        return NULL;
+
+    memcpy(setting, rehash_setting, len);
+
+    for(i = 0; i < (int)sizeof(rnd); ++i) {
+        setting[len++] = itoa64[rnd[i] & 0x3F];
+    }
+
+    setting[len++] = '$';
+    setting[len] = '\0';
+#endif
+
+    if(!(cd = (struct crypt_data *)calloc(1, sizeof(struct crypt_data))))
+        return NULL;
+
+    out = crypt_r(password, setting, cd);
+
+    if(out && out[0] != '*' && strlen(out) < AUTH_HASH_MAX)
+        rv = strdup(out);
+
+    memset(cd, 0, sizeof(struct crypt_data));
+    free(cd);
+
+    return rv;
+}
+
+#endif /* HAVE_CRYPT_R */
+
+/* Check the password (on an auth thread). */
+static void check_work(void *d) {
+    auth_job_t *job = (auth_job_t *)d;
+    const auth_verifier_t *v = NULL;
+    int i;
+
+    for(i = verifier_count - 1; i >= 0; --i) {
+        if(verifiers[i]->handles(job->stored)) {
+            v = verifiers[i];
+            break;
+        }
+    }
+
+    /* Nothing can match a hash we don't understand, so it's just a bad
+       password, like it always was. */
+    if(!v) {
+        job->unknown = 1;
+        job->result = AUTH_BAD_PASSWORD;
+        return;
+    }
+
+    job->result = v->verify(job->password, job->salt, job->stored);
+
+#ifdef HAVE_CRYPT_R
+    /* Now that we know the password, store it the new way if it isn't
+       already. */
+    if(job->result == AUTH_OK && rehash_setting &&
+       strncmp(job->stored, rehash_setting, strlen(rehash_setting)))
+        job->new_hash = make_hash(job->password);
+#endif
+}
+
+static void check_done(void *d) {
+    auth_job_t *job = (auth_job_t *)d;
+
+    if(job->unknown)
+        debug(DBG_WARN, "Unsupported password hash stored for a user\n");
+
+    job->cb(job->result, job->new_hash, job->data);
+
+    memset(job->password, 0, sizeof(job->password));
+    free(job->new_hash);
+    free(job);
+}
+
+int auth_register(const auth_verifier_t *v) {
+    if(verifier_count == AUTH_MAX_VERIFIERS) {
+        debug(DBG_ERROR, "Too many password verifiers\n");
+        return -1;
+    }
+
+    verifiers[verifier_count++] = v;
+    return 0;
+}
+
+int auth_init(int threads, const char *hash) {
+    verifier_count = 0;
+
+    if(auth_register(&md5_verifier))
+        return -1;
+
+#ifdef HAVE_CRYPT_R
+    if(auth_register(&crypt_verifier))
+        return -1;
+
+    if(hash) {
+        char *test;
+
+        if(!(rehash_setting = strdup(hash)))
+            return -1;
+
+        /* Make sure the system can actually do what was asked for. */
+        if(!(test = make_hash("test")) ||
+           crypt_verify("test", NULL, test) != AUTH_OK) {
+            debug(DBG_ERROR, "Password hash setting not supported: %s\n",
+                  hash);
+            free(test);
+            auth_cleanup();
+            return -1;
+        }
+
+        free(test);
+    }
+#else
+    if(hash) {
+        debug(DBG_ERROR, "Rehashing passwords requires crypt_r\n");
+        return -1;
+    }
+#endif
+
+    if((auth_pool = workq_pool_add(threads)) < 0) {
+        auth_cleanup();
+        return -1;
+    }
+
+    return 0;
+}
+
+void auth_cleanup(void) {
+    free(rehash_setting);
+    rehash_setting = NULL;
+    auth_pool = -1;
+    verifier_count = 0;
+}
+
+void auth_check(uint32_t key, const char *password, const char *salt,
+                const char *stored, auth_cb_t cb, void *data) {
+    auth_job_t *job;
+
+    if(!(job = (auth_job_t *)malloc(sizeof(auth_job_t)))) {
+        debug(DBG_WARN, "Couldn't allocate password check\n");
+        cb(AUTH_ERROR, NULL, data);
+        return;
+    }
+
+    memset(job, 0, sizeof(auth_job_t));
+    job->cb = cb;
+    job->data = data;
+
+    if(strlen(password) >= sizeof(job->password) ||
+       strlen(salt) >= sizeof(job->salt) ||
+       strlen(stored) >= sizeof(job->stored)) {
+        free(job);
+        cb(AUTH_ERROR, NULL, data);
+        return;
+    }
+
+    strcpy(job->password, password);
+    strcpy(job->salt, salt);
+    strcpy(job->stored, stored);
+
+    if(workq_submit_pool(auth_pool, key, &check_work, &check_done, job)) {
+        free(job);
+        cb(AUTH_ERROR, NULL, data);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUTH_H
+#define AUTH_H
+
+#include <stdint.h>
+
+/* Default number of threads for checking passwords. */
+#ifndef AUTH_THREADS
+#define AUTH_THREADS        2
+#endif
+
+/* Longest password hash that can be stored. */
+#define AUTH_HASH_MAX       128
+
+#define AUTH_ERROR          -1
+#define AUTH_BAD_PASSWORD   0
+#define AUTH_OK             1
+
+/* A way of checking passwords against the hashes stored in the database. */
+typedef struct auth_verifier {
+    const char *name;
+
+    /* Returns non-zero if the stored hash is in a format this handles. */
+    int (*handles)(const char *stored);
+
+    /* Check a password against a stored hash. The salt is only used by the old
+       MD5 hashes (it's the account's registration time). This is run on an
+       auth thread. Returns AUTH_OK, AUTH_BAD_PASSWORD, or AUTH_ERROR. */
+    int (*verify)(const char *password, const char *salt, const char *stored);
+} auth_verifier_t;
+
+/* Called on the main thread once a password has been checked. If the password
+   was right and the stored hash should be replaced, new_hash is the hash to
+   replace it with. Otherwise it's NULL. */
+typedef void (*auth_cb_t)(int result, const char *new_hash, void *data);
+
+/* Start up the threads for checking passwords. This has to be called after
+   workq_init(). If hash is non-NULL, it's the crypt(3) setting (like "$2b$" or
+   "$6$") to rehash passwords with when they're stored any other way. */
+int auth_init(int threads, const char *hash);
+
+/* Clean up. The threads themselves are stopped by workq_cleanup(). */
+void auth_cleanup(void);
+
+/* Add a way of checking passwords. Verifiers added later are tried first. */
+int auth_register(const auth_verifier_t *v);
+
+/* Check a password against a stored hash on an auth thread. The callback is
+   run on the main thread with the result. Checks with the same key are done in
+   the order they were started. */
+void auth_check(uint32_t key, const char *password, const char *salt,
+                const char *stored, auth_cb_t cb, void *data);
+
+#endif /* !AUTH_H */
@@ -0,0 +1,366 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Simulate a storm of logins against the password checking threads and report
+   how many checks per second they manage and how long each one takes from
+   being started on the main thread until its result comes back. The main loop
+   also has a timer tick, like the shipgate's timers and pings, and how late
+   each tick runs shows how responsive the main thread stays during the storm.
+   Running it with -t 0 checks everything on the main thread instead, like the
+   shipgate did before there were auth threads. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/md5.h>
+
+#include "auth.h"
+#include "workq.h"
+
+#define DEFAULT_CHECKS      10000
+#define DEFAULT_INFLIGHT    256
+#define DEFAULT_TICK        10
+
+#define BENCH_PASSWORD      "password"
+#define BENCH_SALT          "1234567890"
+
+typedef struct bench_check {
+    struct timespec start;
+} bench_check_t;
+
+static long checks = DEFAULT_CHECKS;
+static long inflight = DEFAULT_INFLIGHT;
+static int threads = AUTH_THREADS;
+static const char *password = BENCH_PASSWORD;
+static const char *stored = NULL;
+static const char *hash = NULL;
+static long tick_ms = DEFAULT_TICK;
+
+static long started, finished, failed;
+static double *latency;
+static double *lateness;
+static long ticks, ticks_size;
+
+/* Print help to the user to stdout. */
+static void print_help(const char *bin) {
+    printf("Usage: %s [arguments]\n"
+           "-----------------------------------------------------------------\n"
+           "-n checks       Number of passwords to check (default: %d)\n"
+           "-c count        Most checks to have going at once, which is\n"
+           "                also how many arrive at a time (default: %d)\n"
+           "-t threads      Number of auth threads, or 0 to check on the\n"
+           "                main thread (default: %d)\n"
+           "-p password     Password to check (default: %s)\n"
+           "-s hash         Stored hash to check against, like one made\n"
+           "                with mkpasswd (default: an old style MD5 hash\n"
+           "                of the password)\n"
+           "-H setting      Rehash passwords with this crypt(3) setting,\n"
+           "                like the shipgate's --auth-hash\n"
+           "-i ms           Main loop timer tick interval (default: %d)\n"
+           "--help          Print this help and exit\n", bin, DEFAULT_CHECKS,
+           DEFAULT_INFLIGHT, AUTH_THREADS, BENCH_PASSWORD, DEFAULT_TICK);
+}
+
+/* Parse any command-line arguments passed in. */
+static void parse_command_line(int argc, char *argv[]) {
+    int i;
+
+    for(i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-n") || !strcmp(argv[i], "-c") ||
+           !strcmp(argv[i], "-t") || !strcmp(argv[i], "-p") ||
+           !strcmp(argv[i], "-s") || !strcmp(argv[i], "-H") ||
+           !strcmp(argv[i], "-i")) {
+            if(i == argc - 1) {
+                printf("%s requires an argument!\n\n", argv[i]);
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            switch(argv[i][1]) {
+                case 'n':
+                    checks = strtol(argv[++i], NULL, 0);
+                    break;
+
+                case 'c':
+                    inflight = strtol(argv[++i], NULL, 0);
+                    break;
+
+                case 't':
+                    threads = (int)strtol(argv[++i], NULL, 0);
+                    break;
+
+                case 'p':
+                    password = argv[++i];
+                    break;
+
+                case 's':
+                    stored = argv[++i];
+                    break;
+
+                case 'H':
+                    hash = argv[++i];
+                    break;
+
+                case 'i':
+                    tick_ms = strtol(argv[++i], NULL, 0);
+                    break;
+            }
+        }
+        else if(!strcmp(argv[i], "--help")) {
+            print_help(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else {
+            printf("Illegal command line argument: %s\n", argv[i]);
+            print_help(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(checks <= 0 || inflight <= 0 || threads < 0 ||
+       threads > WORKQ_MAX_THREADS || tick_ms <= 0) {
+        print_help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Make an old style hash of the password, the same way md5_verify() checks
+   it. */
+static const char *make_md5(void) {
+    static const char hexdig[] = "0123456789abcdef";
+    static char hex[33];
+    char buf[128];
+    unsigned char h[16];
+    int i;
+
+    snprintf(buf, sizeof(buf), "%s_%s_salt", password, BENCH_SALT);
+    md5((unsigned char *)buf, strlen(buf), h);
+
+    for(i = 0; i < 16; ++i) {
+        hex[i * 2] = hexdig[h[i] >> 4];
+        hex[i * 2 + 1] = hexdig[h[i] & 0x0F];
+    }
+
+    hex[32] = '\0';
+    return hex;
+}
+
+static double elapsed(const struct timespec *a, const struct timespec *b) {
+    return (double)(b->tv_sec - a->tv_sec) +
+        (double)(b->tv_nsec - a->tv_nsec) / 1000000000.0;
+}
+
+static void check_done(int result, const char *new_hash, void *data) {
+    bench_check_t *c = (bench_check_t *)data;
+    struct timespec now;
+
+    (void)new_hash;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    latency[finished++] = elapsed(&c->start, &now);
+
+    if(result != AUTH_OK)
+        ++failed;
+
+    free(c);
+}
+
+static void start_check(void) {
+    bench_check_t *c;
+
+    if(!(c = (bench_check_t *)malloc(sizeof(bench_check_t)))) {
+        printf("Out of memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &c->start);
+
+    /* Every check gets its own key, like every player logging in does. */
+    auth_check((uint32_t)started++, password, BENCH_SALT, stored, &check_done,
+               c);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *v, long count, double p) {
+    long i = (long)(p * (double)(count - 1) + 0.5);
+
+    return v[i];
+}
+
+static void add_timespec(struct timespec *t, long ms) {
+    t->tv_sec += ms / 1000;
+    t->tv_nsec += (ms % 1000) * 1000000;
+
+    if(t->tv_nsec >= 1000000000) {
+        ++t->tv_sec;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+/* Run the timer tick if it's due, keeping track of how late it was. Like the
+   shipgate's timers, the next one is scheduled from when this one ran. */
+static void run_tick(struct timespec *next) {
+    struct timespec now;
+    double *tmp;
+    double late;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if((late = elapsed(next, &now)) < 0.0)
+        return;
+
+    if(ticks == ticks_size) {
+        ticks_size = ticks_size ? ticks_size * 2 : 1024;
+
+        if(!(tmp = (double *)realloc(lateness, ticks_size * sizeof(double)))) {
+            printf("Out of memory!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        lateness = tmp;
+    }
+
+    lateness[ticks++] = late;
+    *next = now;
+    add_timespec(next, tick_ms);
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec begin, end, next_tick, now;
+    struct timeval timeout;
+    fd_set readfds;
+    double total, sum = 0.0, wait;
+    long i, n;
+    int fd;
+
+    parse_command_line(argc, argv);
+
+    if(!stored)
+        stored = make_md5();
+
+    if(!(latency = (double *)malloc(checks * sizeof(double)))) {
+        printf("Out of memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The default pool isn't used, only the auth pool. */
+    if(workq_init(0)) {
+        printf("Couldn't start work queue\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(auth_init(threads, hash)) {
+        printf("Couldn't start auth threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Checking %ld passwords, %ld at a time, on %d thread(s)...\n",
+           checks, inflight, threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    next_tick = begin;
+    add_timespec(&next_tick, tick_ms);
+
+    while(finished < checks) {
+        /* Keep the same number of checks going, like a steady stream of
+           players trying to log in. With no auth threads, each one is done
+           before the next starts, so only let one burst in each time through
+           the loop, like the logins read from the ships in one go would. */
+        for(n = 0; n < inflight && started < checks &&
+            started - finished < inflight; ++n) {
+            start_check();
+        }
+
+        /* Don't sit around waiting for the tick if there's more to start. */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if((wait = elapsed(&now, &next_tick)) < 0.0 ||
+           (started < checks && started - finished < inflight))
+            wait = 0.0;
+
+        timeout.tv_sec = (time_t)wait;
+        timeout.tv_usec = (long)((wait - (double)timeout.tv_sec) * 1000000.0);
+
+        FD_ZERO(&readfds);
+
+        if((fd = workq_fd()) >= 0)
+            FD_SET(fd, &readfds);
+
+        if(select(fd + 1, &readfds, NULL, NULL, &timeout) < 0) {
+            if(errno == EINTR)
+                continue;
+
+            perror("select");
+            exit(EXIT_FAILURE);
+        }
+
+        run_tick(&next_tick);
+
+        if(fd >= 0 && FD_ISSET(fd, &readfds))
+            workq_complete();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    workq_cleanup();
+    auth_cleanup();
+
+    total = elapsed(&begin, &end);
+
+    for(i = 0; i < finished; ++i) {
+        sum += latency[i];
+    }
+
+    qsort(latency, finished, sizeof(double), &cmp_double);
+
+    printf("Checked:     %ld (%ld failed)\n", finished, failed);
+    printf("Time:        %.3f s\n", total);
+    printf("Throughput:  %.1f checks/s\n", (double)finished / total);
+    printf("Latency:     avg %.3f ms, p50 %.3f ms, p99 %.3f ms, "
+           "max %.3f ms\n", sum * 1000.0 / (double)finished,
+           percentile(latency, finished, 0.50) * 1000.0,
+           percentile(latency, finished, 0.99) * 1000.0,
+           latency[finished - 1] * 1000.0);
+
+    if(ticks) {
+        qsort(lateness, ticks, sizeof(double), &cmp_double);
+
+        printf("Tick delay:  %ld ticks every %ld ms, p50 %.3f ms, "
+               "p99 %.3f ms, max %.3f ms\n", ticks, tick_ms,
+               percentile(lateness, ticks, 0.50) * 1000.0,
+               percentile(lateness, ticks, 0.99) * 1000.0,
+               lateness[ticks - 1] * 1000.0);
+    }
+    else {
+        printf("Tick delay:  no ticks ran\n");
+    }
+
+    free(lateness);
+    free(latency);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
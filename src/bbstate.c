@@ -0,0 +1,1286 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "bbstate.h"
+#include "journal.h"
+#include "timer.h"
+
+/* Blue Burst clients send their whole options blob back every time they're
+   saved, and usually nothing in it has changed. Each player's options and
+   guildcard list are read from the database once, the first time they're
+   needed, and kept in memory after that. Anything sent that's the same as
+   what's already there is dropped, and real changes are written a batch at a
+   time a few seconds later (or when the player logs off). Like quest flags,
+   each change is written to a journal (and synced to disk) first, so nothing
+   is lost if the shipgate crashes before it gets to the database. The ship is
+   only sent an error if that fails, and then the change is undone.
+
+   Deleting and sorting guildcards are left to the stored procedures in the
+   database, since they renumber the rest of the list. Anything still waiting
+   to be written for the player goes out first, so they see the whole list.
+   Deletes are journaled too (before the procedure is called), so that older
+   changes to the card in the journal aren't put back if it's replayed. */
+
+#define BBS_HASH_SIZE       256
+#define BBS_JOURNAL_MAGIC   0x4A534242  /* "BBSJ" */
+#define BBS_JOURNAL_VERSION 1
+
+/* Kinds of journal records. */
+#define BBS_REC_OPTS        1
+#define BBS_REC_CARD        2
+#define BBS_REC_COMMENT     3
+#define BBS_REC_DELETE      4
+
+/* Longest a single row of each query can be. */
+#define BBS_OPTS_ROW_MAX    (sizeof(sylverant_bb_db_opts_t) * 2 + 64)
+#define BBS_CARD_ROW_MAX    640
+#define BBS_COMMENT_ROW_MAX (BBSTATE_COMMENT_MAX * 2 + 128)
+
+/* Biggest record there is (the options). */
+#define BBS_REC_MAX         sizeof(sylverant_bb_db_opts_t)
+
+#define BBS_DIRTY_CARD      0x01
+#define BBS_DIRTY_COMMENT   0x02
+
+#ifdef PACKED
+#undef PACKED
+#endif
+
+#define PACKED __attribute__((packed))
+
+/* What's stored for a guildcard being added. Comments are separate. */
+typedef struct bbs_card_rec {
+    uint8_t name[48];
+    uint8_t team_name[32];
+    uint8_t text[176];
+    uint8_t language;
+    uint8_t section;
+    uint8_t char_class;
+} PACKED bbs_card_rec_t;
+
+#undef PACKED
+
+typedef struct bbs_card {
+    uint32_t fr_gc;
+    uint8_t name[48];
+    uint8_t team_name[32];
+    uint8_t text[176];
+    uint8_t language;
+    uint8_t section;
+    uint8_t char_class;
+    uint8_t dirty;
+    uint8_t has_comment;
+    uint16_t comment_len;
+    uint8_t comment[BBSTATE_COMMENT_MAX];
+} bbs_card_t;
+
+typedef struct bbs_entry {
+    TAILQ_ENTRY(bbs_entry) lru;
+    TAILQ_ENTRY(bbs_entry) dentry;
+    struct bbs_entry *hnext;
+    uint32_t gc;
+    int cards_loaded;
+    int opts_dirty;
+    int drop;
+    int ndirty;
+    time_t dirty_since;
+    sylverant_bb_db_opts_t *opts;
+    bbs_card_t *cards;
+    int count;
+    int size;
+} bbs_entry_t;
+
+TAILQ_HEAD(bbs_list, bbs_entry);
+
+/* What was there before a change that isn't in the journal yet, so the change
+   can be undone if it can't be put there. */
+typedef struct bbs_undo {
+    int type;
+    uint32_t gc;
+    uint32_t fr_gc;
+    int existed;
+    int opts_dirty;
+    sylverant_bb_db_opts_t *opts;
+    bbs_card_t card;
+} bbs_undo_t;
+
+extern sylverant_dbconn_t conn;
+
+static bbs_entry_t *hash[BBS_HASH_SIZE];
+static struct bbs_list lru = TAILQ_HEAD_INITIALIZER(lru);
+static struct bbs_list dirty = TAILQ_HEAD_INITIALIZER(dirty);
+static int entry_count, dirty_count;
+
+static journal_t *jnl;
+
+static int flush_timer = -1, stats_timer = -1;
+
+static struct {
+    unsigned long reads;
+    unsigned long loads;
+    unsigned long writes;
+    unsigned long unchanged;
+    unsigned long batches;
+    unsigned long rows;
+    unsigned long failed;
+    unsigned long syncs;
+    unsigned long undone;
+} stats;
+
+static bbs_entry_t *find_entry(uint32_t gc) {
+    bbs_entry_t *i = hash[gc & (BBS_HASH_SIZE - 1)];
+
+    while(i) {
+        if(i->gc == gc)
+            return i;
+
+        i = i->hnext;
+    }
+
+    return NULL;
+}
+
+static void remove_entry(bbs_entry_t *e) {
+    bbs_entry_t **i = &hash[e->gc & (BBS_HASH_SIZE - 1)];
+
+    while(*i) {
+        if(*i == e) {
+            *i = e->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    if(e->ndirty) {
+        TAILQ_REMOVE(&dirty, e, dentry);
+        dirty_count -= e->ndirty;
+    }
+
+    TAILQ_REMOVE(&lru, e, lru);
+    --entry_count;
+    free(e->opts);
+    free(e->cards);
+    free(e);
+}
+
+/* Find the entry for a guildcard, adding it if it isn't there. */
+static bbs_entry_t *get_entry(uint32_t gc) {
+    bbs_entry_t *e, *i, *tmp;
+    int b = gc & (BBS_HASH_SIZE - 1);
+
+    if((e = find_entry(gc))) {
+        TAILQ_REMOVE(&lru, e, lru);
+        TAILQ_INSERT_TAIL(&lru, e, lru);
+        e->drop = 0;
+        return e;
+    }
+
+    /* Make room, skipping over anything that hasn't been written yet. */
+    i = TAILQ_FIRST(&lru);
+    while(i && entry_count >= BBSTATE_CACHE_MAX) {
+        tmp = TAILQ_NEXT(i, lru);
+
+        if(!i->ndirty)
+            remove_entry(i);
+
+        i = tmp;
+    }
+
+    if(!(e = (bbs_entry_t *)malloc(sizeof(bbs_entry_t)))) {
+        debug(DBG_WARN, "Couldn't allocate Blue Burst state (%" PRIu32 ")\n",
+              gc);
+        return NULL;
+    }
+
+    memset(e, 0, sizeof(bbs_entry_t));
+    e->gc = gc;
+    e->hnext = hash[b];
+    hash[b] = e;
+    TAILQ_INSERT_TAIL(&lru, e, lru);
+    ++entry_count;
+
+    return e;
+}
+
+/* Note that something in an entry needs to be written. */
+static void mark_dirty(bbs_entry_t *e) {
+    ++dirty_count;
+    ++stats.writes;
+
+    if(!e->ndirty++) {
+        e->dirty_since = time(NULL);
+        TAILQ_INSERT_TAIL(&dirty, e, dentry);
+    }
+}
+
+/* Note that something in an entry has been written (or undone). */
+static void clear_dirty(bbs_entry_t *e) {
+    --dirty_count;
+
+    if(!--e->ndirty)
+        TAILQ_REMOVE(&dirty, e, dentry);
+}
+
+/* Find where a guildcard is (or would go) in an entry's sorted list. */
+static int card_pos(bbs_entry_t *e, uint32_t fr_gc, int *found) {
+    int lo = 0, hi = e->count, mid;
+
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if(e->cards[mid].fr_gc == fr_gc) {
+            *found = 1;
+            return mid;
+        }
+
+        if(e->cards[mid].fr_gc < fr_gc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *found = 0;
+    return lo;
+}
+
+static bbs_card_t *add_card(bbs_entry_t *e, uint32_t fr_gc) {
+    bbs_card_t *tmp;
+    int pos, found;
+
+    pos = card_pos(e, fr_gc, &found);
+
+    if(found)
+        return &e->cards[pos];
+
+    if(e->count == e->size) {
+        if(!(tmp = (bbs_card_t *)realloc(e->cards, (e->size + 16) *
+                                         sizeof(bbs_card_t))))
+            return NULL;
+
+        e->cards = tmp;
+        e->size += 16;
+    }
+
+    memmove(&e->cards[pos + 1], &e->cards[pos],
+            (e->count - pos) * sizeof(bbs_card_t));
+    ++e->count;
+
+    tmp = &e->cards[pos];
+    memset(tmp, 0, sizeof(bbs_card_t));
+    tmp->fr_gc = fr_gc;
+
+    return tmp;
+}
+
+/* Copy a column into a fixed size field, padding it out with zeroes. */
+static void copy_col(uint8_t *dst, size_t size, const char *src,
+                     unsigned long len) {
+    memset(dst, 0, size);
+
+    if(src)
+        memcpy(dst, src, len < size ? len : size);
+}
+
+static int load_opts(bbs_entry_t *e) {
+    char query[256];
+    void *result;
+    char **row;
+    unsigned long *len;
+
+    sprintf(query, "SELECT options FROM blueburst_options WHERE guildcard='%"
+            PRIu32 "'", e->gc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(row = sylverant_db_result_fetch(result)) ||
+       !(len = sylverant_db_result_lengths(result))) {
+        debug(DBG_WARN, "No Blue Burst options for %" PRIu32 "\n", e->gc);
+        sylverant_db_result_free(result);
+        return -1;
+    }
+
+    if(!(e->opts = (sylverant_bb_db_opts_t *)
+         malloc(sizeof(sylverant_bb_db_opts_t)))) {
+        debug(DBG_WARN, "Couldn't allocate Blue Burst options (%" PRIu32
+              ")\n", e->gc);
+        sylverant_db_result_free(result);
+        return -1;
+    }
+
+    copy_col((uint8_t *)e->opts, sizeof(sylverant_bb_db_opts_t), row[0],
+             len[0]);
+    sylverant_db_result_free(result);
+    ++stats.loads;
+
+    return 0;
+}
+
+/* Read a player's guildcard list from the database. Anything that's been
+   changed in memory is newer, so it's kept. */
+static int load_cards(bbs_entry_t *e) {
+    char query[384];
+    void *result;
+    char **row;
+    unsigned long *len;
+    bbs_card_t *c;
+    uint32_t fr_gc;
+
+    sprintf(query, "SELECT friend_gc, name, team_name, text, language, "
+            "section_id, class, comment FROM blueburst_guildcards WHERE "
+            "guildcard='%" PRIu32 "'", e->gc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't read bb guildcards (%" PRIu32 ")\n", e->gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't store bb guildcards (%" PRIu32 ")\n", e->gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        if(!(len = sylverant_db_result_lengths(result)))
+            continue;
+
+        fr_gc = (uint32_t)strtoul(row[0], NULL, 0);
+
+        if(!(c = add_card(e, fr_gc))) {
+            debug(DBG_WARN, "Couldn't allocate bb guildcards (%" PRIu32 ")\n",
+                  e->gc);
+            sylverant_db_result_free(result);
+            return -1;
+        }
+
+        /* A card that was only commented on (from the journal) still needs
+           the rest of it filled in. */
+        if(!(c->dirty & BBS_DIRTY_CARD)) {
+            copy_col(c->name, sizeof(c->name), row[1], len[1]);
+            copy_col(c->team_name, sizeof(c->team_name), row[2], len[2]);
+            copy_col(c->text, sizeof(c->text), row[3], len[3]);
+            c->language = (uint8_t)strtoul(row[4], NULL, 0);
+            c->section = (uint8_t)strtoul(row[5], NULL, 0);
+            c->char_class = (uint8_t)strtoul(row[6], NULL, 0);
+        }
+
+        if(row[7] && !(c->dirty & BBS_DIRTY_COMMENT)) {
+            c->has_comment = 1;
+            c->comment_len = (uint16_t)(len[7] < BBSTATE_COMMENT_MAX ?
+                                        len[7] : BBSTATE_COMMENT_MAX);
+            memcpy(c->comment, row[7], c->comment_len);
+        }
+    }
+
+    sylverant_db_result_free(result);
+    e->cards_loaded = 1;
+    ++stats.loads;
+
+    return 0;
+}
+
+static bbs_entry_t *get_cards(uint32_t gc) {
+    bbs_entry_t *e;
+
+    if(!(e = get_entry(gc)))
+        return NULL;
+
+    if(!e->cards_loaded && load_cards(e))
+        return NULL;
+
+    return e;
+}
+
+static char *escape(char *pos, const void *data, unsigned long len) {
+    sylverant_db_escape_str(&conn, pos, (const char *)data, len);
+    return pos + strlen(pos);
+}
+
+static int run_query(char *query, const char *what) {
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't store %s\n", what);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        ++stats.failed;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int flush_opts(bbs_entry_t **batch, int n, int rows) {
+    char *query, *pos;
+    int i, j;
+
+    if(!(query = (char *)malloc(rows * (BBS_OPTS_ROW_MAX + 16) + 256))) {
+        debug(DBG_WARN, "Couldn't allocate Blue Burst options query\n");
+        return -1;
+    }
+
+    strcpy(query, "UPDATE blueburst_options SET options=CASE guildcard");
+    pos = query + strlen(query);
+
+    for(i = 0; i < n; ++i) {
+        if(!batch[i]->opts_dirty)
+            continue;
+
+        pos += sprintf(pos, " WHEN '%" PRIu32 "' THEN '", batch[i]->gc);
+        pos = escape(pos, batch[i]->opts, sizeof(sylverant_bb_db_opts_t));
+        *pos++ = '\'';
+    }
+
+    pos += sprintf(pos, " END WHERE guildcard IN (");
+
+    for(i = 0, j = 0; i < n; ++i) {
+        if(batch[i]->opts_dirty)
+            pos += sprintf(pos, "%s'%" PRIu32 "'", j++ ? ", " : "",
+                           batch[i]->gc);
+    }
+
+    strcpy(pos, ")");
+
+    i = run_query(query, "Blue Burst options");
+    free(query);
+
+    return i;
+}
+
+static int flush_cards(bbs_entry_t **batch, int n, int rows) {
+    char *query, *pos;
+    bbs_card_t *c;
+    int i, j, k = 0;
+
+    if(!(query = (char *)malloc(rows * BBS_CARD_ROW_MAX + 512))) {
+        debug(DBG_WARN, "Couldn't allocate bb guildcard query\n");
+        return -1;
+    }
+
+    strcpy(query, "INSERT INTO blueburst_guildcards (guildcard, friend_gc, "
+           "name, team_name, text, language, section_id, class) VALUES ");
+    pos = query + strlen(query);
+
+    for(i = 0; i < n; ++i) {
+        for(j = 0; j < batch[i]->count; ++j) {
+            c = &batch[i]->cards[j];
+
+            if(!(c->dirty & BBS_DIRTY_CARD))
+                continue;
+
+            pos += sprintf(pos, "%s('%" PRIu32 "', '%" PRIu32 "', '",
+                           k++ ? ", " : "", batch[i]->gc, c->fr_gc);
+            pos = escape(pos, c->name, sizeof(c->name));
+            pos += sprintf(pos, "', '");
+            pos = escape(pos, c->team_name, sizeof(c->team_name));
+            pos += sprintf(pos, "', '");
+            pos = escape(pos, c->text, sizeof(c->text));
+            pos += sprintf(pos, "', '%" PRIu8 "', '%" PRIu8 "', '%" PRIu8
+                           "')", c->language, c->section, c->char_class);
+        }
+    }
+
+    /* Like when they were written one at a time, the team name is left alone
+       if the card is already there. */
+    strcpy(pos, " ON DUPLICATE KEY UPDATE name=VALUES(name), "
+           "text=VALUES(text), language=VALUES(language), "
+           "section_id=VALUES(section_id), class=VALUES(class)");
+
+    i = run_query(query, "bb guildcards");
+    free(query);
+
+    return i;
+}
+
+static int flush_comments(bbs_entry_t **batch, int n, int rows) {
+    char *query, *pos;
+    bbs_card_t *c;
+    int i, j, k;
+
+    if(!(query = (char *)malloc(rows * (BBS_COMMENT_ROW_MAX + 32) + 256))) {
+        debug(DBG_WARN, "Couldn't allocate guildcard comment query\n");
+        return -1;
+    }
+
+    strcpy(query, "UPDATE blueburst_guildcards SET comment=CASE");
+    pos = query + strlen(query);
+
+    for(i = 0; i < n; ++i) {
+        for(j = 0; j < batch[i]->count; ++j) {
+            c = &batch[i]->cards[j];
+
+            if(!(c->dirty & BBS_DIRTY_COMMENT))
+                continue;
+
+            pos += sprintf(pos, " WHEN guildcard='%" PRIu32 "' AND "
+                           "friend_gc='%" PRIu32 "' THEN '", batch[i]->gc,
+                           c->fr_gc);
+            pos = escape(pos, c->comment, c->comment_len);
+            *pos++ = '\'';
+        }
+    }
+
+    pos += sprintf(pos, " END WHERE (guildcard, friend_gc) IN (");
+
+    for(i = 0, k = 0; i < n; ++i) {
+        for(j = 0; j < batch[i]->count; ++j) {
+            c = &batch[i]->cards[j];
+
+            if(c->dirty & BBS_DIRTY_COMMENT)
+                pos += sprintf(pos, "%s(%" PRIu32 ", %" PRIu32 ")",
+                               k++ ? ", " : "", batch[i]->gc, c->fr_gc);
+        }
+    }
+
+    strcpy(pos, ")");
+
+    i = run_query(query, "guildcard comments");
+    free(query);
+
+    return i;
+}
+
+/* Write out the changes for a batch of players, with one query for each kind
+   of change. New guildcards go in before any comments on them. */
+static int flush_batch(bbs_entry_t **batch, int n) {
+    int opts = 0, cards = 0, comments = 0, i, j;
+    bbs_entry_t *e;
+
+    for(i = 0; i < n; ++i) {
+        opts += batch[i]->opts_dirty;
+
+        for(j = 0; j < batch[i]->count; ++j) {
+            cards += !!(batch[i]->cards[j].dirty & BBS_DIRTY_CARD);
+            comments += !!(batch[i]->cards[j].dirty & BBS_DIRTY_COMMENT);
+        }
+    }
+
+    if((opts && flush_opts(batch, n, opts)) ||
+       (cards && flush_cards(batch, n, cards)) ||
+       (comments && flush_comments(batch, n, comments)))
+        return -1;
+
+    for(i = 0; i < n; ++i) {
+        e = batch[i];
+        e->opts_dirty = 0;
+
+        for(j = 0; j < e->count; ++j) {
+            e->cards[j].dirty = 0;
+        }
+
+        dirty_count -= e->ndirty;
+        e->ndirty = 0;
+        TAILQ_REMOVE(&dirty, e, dentry);
+
+        if(e->drop)
+            remove_entry(e);
+    }
+
+    ++stats.batches;
+    stats.rows += opts + cards + comments;
+
+    return 0;
+}
+
+/* Move a player whose changes couldn't be written to the back of the line, so
+   they don't hold up everyone else. They're tried again once they've waited
+   as long as a new change would. */
+static void park_entry(bbs_entry_t *e) {
+    debug(DBG_WARN, "Couldn't store %d Blue Burst changes for %" PRIu32
+          ", will try again later\n", e->ndirty, e->gc);
+
+    e->dirty_since = time(NULL);
+    TAILQ_REMOVE(&dirty, e, dentry);
+    TAILQ_INSERT_TAIL(&dirty, e, dentry);
+}
+
+/* Write out everything that's been waiting since before the cutoff (or all of
+   it, with a cutoff of 0). */
+static int flush_dirty(time_t cutoff) {
+    static bbs_entry_t *batch[BBSTATE_BATCH_PLAYERS];
+    bbs_entry_t *e, *last;
+    int n, i, ok, done = 0, rv = 0;
+
+    /* Changes can't go to the database before they're in the journal, or they
+       couldn't be undone if that fails. */
+    bbstate_sync();
+
+    /* Anyone that gets parked goes after this, so stop here to only try each
+       player once. */
+    last = TAILQ_LAST(&dirty, bbs_list);
+
+    while(!done && (e = TAILQ_FIRST(&dirty))) {
+        if(cutoff && e->dirty_since > cutoff)
+            break;
+
+        n = 0;
+
+        while(e && n < BBSTATE_BATCH_PLAYERS &&
+              (!cutoff || e->dirty_since <= cutoff)) {
+            batch[n++] = e;
+
+            if(e == last) {
+                done = 1;
+                break;
+            }
+
+            e = TAILQ_NEXT(e, dentry);
+        }
+
+        if(!flush_batch(batch, n))
+            continue;
+
+        /* Something in the batch was bad, so write each player on their own
+           to find out who, and get the rest written anyway. */
+        for(i = 0, ok = 0; i < n; ++i) {
+            if(n > 1 && !flush_batch(&batch[i], 1)) {
+                ++ok;
+                continue;
+            }
+
+            park_entry(batch[i]);
+        }
+
+        rv = -1;
+
+        /* If none of it worked, it's likely the database that's the problem,
+           so don't keep at it until next time. */
+        if(!ok)
+            break;
+    }
+
+    return rv;
+}
+
+/* Write out anything waiting for one player, so the database has their whole
+   guildcard list. */
+static int flush_entry(bbs_entry_t *e) {
+    bbstate_sync();
+
+    if(!e->ndirty)
+        return 0;
+
+    return flush_batch(&e, 1);
+}
+
+static void card_rec(bbs_card_rec_t *r, const bbs_card_t *c) {
+    memcpy(r->name, c->name, sizeof(r->name));
+    memcpy(r->team_name, c->team_name, sizeof(r->team_name));
+    memcpy(r->text, c->text, sizeof(r->text));
+    r->language = c->language;
+    r->section = c->section;
+    r->char_class = c->char_class;
+}
+
+/* Write all the changes that aren't in the database yet to a new journal. */
+static int rewrite_state(journal_t *j) {
+    bbs_card_rec_t r;
+    bbs_entry_t *e;
+    bbs_card_t *c;
+    int i;
+
+    TAILQ_FOREACH(e, &dirty, dentry) {
+        if(e->opts_dirty &&
+           journal_put(j, BBS_REC_OPTS, e->gc, 0, e->opts,
+                       sizeof(sylverant_bb_db_opts_t)))
+            return -1;
+
+        for(i = 0; i < e->count; ++i) {
+            c = &e->cards[i];
+
+            if((c->dirty & BBS_DIRTY_CARD)) {
+                card_rec(&r, c);
+
+                if(journal_put(j, BBS_REC_CARD, e->gc, c->fr_gc, &r,
+                               sizeof(r)))
+                    return -1;
+            }
+
+            if((c->dirty & BBS_DIRTY_COMMENT) &&
+               journal_put(j, BBS_REC_COMMENT, e->gc, c->fr_gc, c->comment,
+                           c->comment_len))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int apply_opts(bbs_entry_t *e, const sylverant_bb_db_opts_t *opts) {
+    if(!e->opts && !(e->opts = (sylverant_bb_db_opts_t *)
+                     malloc(sizeof(sylverant_bb_db_opts_t)))) {
+        debug(DBG_WARN, "Couldn't allocate Blue Burst options (%" PRIu32
+              ")\n", e->gc);
+        return -1;
+    }
+
+    memcpy(e->opts, opts, sizeof(sylverant_bb_db_opts_t));
+
+    if(!e->opts_dirty) {
+        e->opts_dirty = 1;
+        mark_dirty(e);
+    }
+
+    return 0;
+}
+
+static bbs_card_t *apply_card(bbs_entry_t *e, uint32_t fr_gc,
+                              const bbs_card_rec_t *r) {
+    bbs_card_t *c;
+    int found;
+
+    card_pos(e, fr_gc, &found);
+
+    if(!(c = add_card(e, fr_gc))) {
+        debug(DBG_WARN, "Couldn't allocate bb guildcards (%" PRIu32 ")\n",
+              e->gc);
+        return NULL;
+    }
+
+    /* Like when they were written one at a time, the team name is left alone
+       if the card is already there. */
+    if(!found)
+        memcpy(c->team_name, r->team_name, sizeof(c->team_name));
+
+    memcpy(c->name, r->name, sizeof(c->name));
+    memcpy(c->text, r->text, sizeof(c->text));
+    c->language = r->language;
+    c->section = r->section;
+    c->char_class = r->char_class;
+
+    if(!c->dirty)
+        mark_dirty(e);
+
+    c->dirty |= BBS_DIRTY_CARD;
+
+    return c;
+}
+
+static void apply_comment(bbs_entry_t *e, bbs_card_t *c,
+                          const uint8_t *comment, int len) {
+    memcpy(c->comment, comment, len);
+    c->comment_len = (uint16_t)len;
+    c->has_comment = 1;
+
+    if(!c->dirty)
+        mark_dirty(e);
+
+    c->dirty |= BBS_DIRTY_COMMENT;
+}
+
+static void forget_card(bbs_entry_t *e, int pos) {
+    if(e->cards[pos].dirty)
+        clear_dirty(e);
+
+    --e->count;
+    memmove(&e->cards[pos], &e->cards[pos + 1],
+            (e->count - pos) * sizeof(bbs_card_t));
+}
+
+/* Put things back how they were before a change that couldn't be journaled.
+   Nothing is written to the database until it's in the journal, so it's all
+   still just as the change left it. */
+static void undo_change(bbs_undo_t *u) {
+    bbs_entry_t *e;
+    int pos, found, was_dirty;
+
+    if(!(e = find_entry(u->gc)))
+        goto out;
+
+    switch(u->type) {
+        case BBS_REC_OPTS:
+            if(!u->existed) {
+                free(e->opts);
+                e->opts = NULL;
+            }
+            else {
+                memcpy(e->opts, u->opts, sizeof(sylverant_bb_db_opts_t));
+            }
+
+            if(e->opts_dirty && !u->opts_dirty) {
+                e->opts_dirty = 0;
+                clear_dirty(e);
+            }
+
+            break;
+
+        case BBS_REC_CARD:
+        case BBS_REC_COMMENT:
+            pos = card_pos(e, u->fr_gc, &found);
+
+            if(!found)
+                break;
+
+            was_dirty = e->cards[pos].dirty;
+
+            if(!u->existed) {
+                forget_card(e, pos);
+                break;
+            }
+
+            e->cards[pos] = u->card;
+
+            if(was_dirty && !u->card.dirty)
+                clear_dirty(e);
+
+            break;
+    }
+
+out:
+    free(u->opts);
+    u->opts = NULL;
+}
+
+static void undo_rec(const journal_rec_t *hdr, const uint8_t *data,
+                     void *undo) {
+    (void)hdr;
+    (void)data;
+
+    undo_change((bbs_undo_t *)undo);
+    ++stats.undone;
+}
+
+static void release_rec(void *undo) {
+    free(((bbs_undo_t *)undo)->opts);
+}
+
+/* Put a change from the journal left from the last run back into memory. */
+static int replay_rec(const journal_rec_t *hdr, const uint8_t *data) {
+    bbs_entry_t *e;
+    bbs_card_t *c;
+    int pos, found;
+
+    if(!(e = get_entry(hdr->guildcard)))
+        return -1;
+
+    switch(hdr->type) {
+        case BBS_REC_OPTS:
+            if(hdr->len != sizeof(sylverant_bb_db_opts_t))
+                return -1;
+
+            return apply_opts(e, (const sylverant_bb_db_opts_t *)data);
+
+        case BBS_REC_CARD:
+            if(hdr->len != sizeof(bbs_card_rec_t))
+                return -1;
+
+            return apply_card(e, hdr->key,
+                              (const bbs_card_rec_t *)data) ? 0 : -1;
+
+        case BBS_REC_COMMENT:
+            /* The card might not be in memory, since the list isn't read in
+               here. The rest of it gets filled in when it is. */
+            if(hdr->len > BBSTATE_COMMENT_MAX ||
+               !(c = add_card(e, hdr->key)))
+                return -1;
+
+            apply_comment(e, c, data, (int)hdr->len);
+            return 0;
+
+        case BBS_REC_DELETE:
+            pos = card_pos(e, hdr->key, &found);
+
+            if(found)
+                forget_card(e, pos);
+
+            return 0;
+    }
+
+    return -1;
+}
+
+static const journal_ops_t journal_ops = {
+    "Blue Burst", BBS_JOURNAL_MAGIC, BBS_JOURNAL_VERSION, BBS_REC_MAX,
+    BBSTATE_JOURNAL_MAX, sizeof(bbs_undo_t), &replay_rec, NULL, &undo_rec,
+    &release_rec, &rewrite_state
+};
+
+/* Write everything that's changed since last time to the journal and sync it,
+   then run the callbacks. Returns -1 if the changes couldn't be journaled, in
+   which case they've been undone. */
+static int sync_journal(void) {
+    int rv = journal_sync(jnl);
+
+    if(rv)
+        ++stats.syncs;
+
+    return rv < 0 ? -1 : 0;
+}
+
+static void flush_timer_cb(time_t now, void *data) {
+    (void)data;
+
+    flush_dirty(now - BBSTATE_FLUSH_DELAY);
+    journal_check(jnl, dirty_count);
+}
+
+static void stats_timer_cb(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    debug(DBG_LOG, "Blue Burst state: %lu reads, %lu loads, %lu changes "
+          "(%lu unchanged skipped), %lu rows stored in %lu batches, %lu "
+          "failed, %lu journal syncs (%lu changes undone), %d unwritten, %d "
+          "players cached\n", stats.reads, stats.loads, stats.writes,
+          stats.unchanged, stats.rows, stats.batches, stats.failed,
+          stats.syncs, stats.undone, dirty_count, entry_count);
+}
+
+int bbstate_init(const char *journal) {
+    bbs_entry_t *e, *tmp;
+
+    memset(hash, 0, sizeof(hash));
+    memset(&stats, 0, sizeof(stats));
+    TAILQ_INIT(&lru);
+    TAILQ_INIT(&dirty);
+    entry_count = dirty_count = 0;
+
+    /* Get whatever was left over into the database before anything else. If
+       that doesn't work, it'll go in the new journal. */
+    if(!(jnl = journal_open(journal, &journal_ops)))
+        return -1;
+
+    flush_dirty(0);
+
+    /* Nothing was read from the database for the players in the journal, so
+       don't keep them around once they're written. */
+    e = TAILQ_FIRST(&lru);
+    while(e) {
+        tmp = TAILQ_NEXT(e, lru);
+
+        if(!e->ndirty)
+            remove_entry(e);
+
+        e = tmp;
+    }
+
+    if(journal_rewrite(jnl))
+        return -1;
+
+    flush_timer = timer_add(1, &flush_timer_cb, NULL);
+    stats_timer = timer_add(BBSTATE_STATS_INTERVAL, &stats_timer_cb, NULL);
+
+    return 0;
+}
+
+void bbstate_cleanup(void) {
+    bbs_entry_t *e;
+
+    bbstate_sync();
+    flush_dirty(0);
+    stats_timer_cb(0, NULL);
+
+    timer_remove(flush_timer);
+    timer_remove(stats_timer);
+    flush_timer = stats_timer = -1;
+
+    /* If everything made it to the database, the journal isn't needed anymore.
+       Otherwise, it'll get replayed on the next startup. */
+    if(dirty_count)
+        debug(DBG_WARN, "%d Blue Burst changes left in the journal\n",
+              dirty_count);
+
+    journal_close(jnl, dirty_count);
+    jnl = NULL;
+
+    while((e = TAILQ_FIRST(&lru))) {
+        remove_entry(e);
+    }
+}
+
+int bbstate_get_opts(uint32_t gc, sylverant_bb_db_opts_t *opts) {
+    bbs_entry_t *e;
+
+    ++stats.reads;
+
+    if(!(e = get_entry(gc)))
+        return -1;
+
+    if(!e->opts && load_opts(e))
+        return -1;
+
+    memcpy(opts, e->opts, sizeof(sylverant_bb_db_opts_t));
+    return 0;
+}
+
+int bbstate_set_opts(uint32_t gc, const sylverant_bb_db_opts_t *opts,
+                     bbstate_cb_t cb, void *cbdata) {
+    bbs_entry_t *e;
+    bbs_undo_t u;
+
+    if(!(e = get_entry(gc)))
+        return -1;
+
+    if(e->opts && !memcmp(e->opts, opts, sizeof(sylverant_bb_db_opts_t))) {
+        ++stats.unchanged;
+        return journal_wait(jnl, cb, cbdata, 0);
+    }
+
+    memset(&u, 0, sizeof(bbs_undo_t));
+    u.type = BBS_REC_OPTS;
+    u.gc = gc;
+    u.existed = e->opts != NULL;
+    u.opts_dirty = e->opts_dirty;
+
+    if(e->opts) {
+        if(!(u.opts = (sylverant_bb_db_opts_t *)
+             malloc(sizeof(sylverant_bb_db_opts_t)))) {
+            debug(DBG_WARN, "Couldn't allocate Blue Burst options (%" PRIu32
+                  ")\n", gc);
+            return -1;
+        }
+
+        memcpy(u.opts, e->opts, sizeof(sylverant_bb_db_opts_t));
+    }
+
+    if(apply_opts(e, opts)) {
+        free(u.opts);
+        return -1;
+    }
+
+    if(journal_add(jnl, BBS_REC_OPTS, gc, 0, opts, sizeof(sylverant_bb_db_opts_t),
+                   &u, cb, cbdata)) {
+        undo_change(&u);
+        return -1;
+    }
+
+    return 0;
+}
+
+int bbstate_gc_add(uint32_t gc, uint32_t fr_gc, const uint8_t *name,
+                   const uint8_t *team_name, const uint8_t *text,
+                   uint8_t language, uint8_t section, uint8_t char_class,
+                   bbstate_cb_t cb, void *cbdata) {
+    bbs_entry_t *e;
+    bbs_card_t *c;
+    bbs_card_rec_t r;
+    bbs_undo_t u;
+    int pos, found;
+
+    if(!(e = get_cards(gc)))
+        return -1;
+
+    pos = card_pos(e, fr_gc, &found);
+
+    memset(&u, 0, sizeof(bbs_undo_t));
+    u.type = BBS_REC_CARD;
+    u.gc = gc;
+    u.fr_gc = fr_gc;
+    u.existed = found;
+
+    if(found) {
+        c = &e->cards[pos];
+
+        if(!memcmp(c->name, name, sizeof(c->name)) &&
+           !memcmp(c->text, text, sizeof(c->text)) &&
+           c->language == language && c->section == section &&
+           c->char_class == char_class) {
+            ++stats.unchanged;
+            return journal_wait(jnl, cb, cbdata, 0);
+        }
+
+        u.card = *c;
+    }
+
+    memcpy(r.name, name, sizeof(r.name));
+    memcpy(r.team_name, team_name, sizeof(r.team_name));
+    memcpy(r.text, text, sizeof(r.text));
+    r.language = language;
+    r.section = section;
+    r.char_class = char_class;
+
+    if(!apply_card(e, fr_gc, &r))
+        return -1;
+
+    if(journal_add(jnl, BBS_REC_CARD, gc, fr_gc, &r, sizeof(r), &u, cb, cbdata)) {
+        undo_change(&u);
+        return -1;
+    }
+
+    return 0;
+}
+
+int bbstate_gc_del(uint32_t gc, uint32_t fr_gc) {
+    char query[256];
+    bbs_entry_t *e;
+    bbs_undo_t u;
+    int pos, found;
+
+    if(!(e = get_cards(gc)))
+        return -1;
+
+    /* The procedure renumbers the rest of the list, so everything else for
+       the player has to be in the database first. */
+    if(flush_entry(e))
+        return -1;
+
+    card_pos(e, fr_gc, &found);
+
+    /* If it's not on their list, there's nothing to delete. */
+    if(!found) {
+        ++stats.unchanged;
+        return 0;
+    }
+
+    /* The delete has to be in the journal before it happens, so that older
+       changes to the card aren't put back if the journal is replayed. */
+    memset(&u, 0, sizeof(bbs_undo_t));
+    u.type = BBS_REC_DELETE;
+
+    if(journal_add(jnl, BBS_REC_DELETE, gc, fr_gc, NULL, 0, &u, NULL, NULL) ||
+       sync_journal())
+        return -1;
+
+    sprintf(query, "CALL blueburst_guildcard_delete('%" PRIu32 "', '%" PRIu32
+            "')", gc, fr_gc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't delete bb guildcard (%" PRIu32 ": %" PRIu32
+              ")\n", gc, fr_gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    pos = card_pos(e, fr_gc, &found);
+
+    if(found)
+        forget_card(e, pos);
+
+    ++stats.writes;
+
+    return 0;
+}
+
+int bbstate_gc_sort(uint32_t gc, uint32_t fr_gc1, uint32_t fr_gc2) {
+    char query[256];
+    bbs_entry_t *e;
+
+    if((e = find_entry(gc)) && flush_entry(e))
+        return -1;
+
+    sprintf(query, "CALL blueburst_guildcard_sort('%" PRIu32 "', '%" PRIu32
+            "', '%" PRIu32 "')", gc, fr_gc1, fr_gc2);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't sort bb guildcards (%" PRIu32 ": %" PRIu32
+              " - %" PRIu32 ")\n", gc, fr_gc1, fr_gc2);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    ++stats.writes;
+
+    return 0;
+}
+
+int bbstate_gc_comment(uint32_t gc, uint32_t fr_gc, const uint8_t *comment,
+                       int len, bbstate_cb_t cb, void *cbdata) {
+    bbs_entry_t *e;
+    bbs_card_t *c;
+    bbs_undo_t u;
+    int pos, found;
+
+    if(len > BBSTATE_COMMENT_MAX)
+        len = BBSTATE_COMMENT_MAX;
+
+    if(!(e = get_cards(gc)))
+        return -1;
+
+    pos = card_pos(e, fr_gc, &found);
+
+    /* Comments can only go on cards that are on the list. */
+    if(!found) {
+        ++stats.unchanged;
+        return journal_wait(jnl, cb, cbdata, 0);
+    }
+
+    c = &e->cards[pos];
+
+    if(c->has_comment && c->comment_len == len &&
+       !memcmp(c->comment, comment, len)) {
+        ++stats.unchanged;
+        return journal_wait(jnl, cb, cbdata, 0);
+    }
+
+    memset(&u, 0, sizeof(bbs_undo_t));
+    u.type = BBS_REC_COMMENT;
+    u.gc = gc;
+    u.fr_gc = fr_gc;
+    u.existed = 1;
+    u.card = *c;
+
+    apply_comment(e, c, comment, len);
+
+    if(journal_add(jnl, BBS_REC_COMMENT, gc, fr_gc, comment, (size_t)len, &u, cb,
+                   cbdata)) {
+        undo_change(&u);
+        return -1;
+    }
+
+    return 0;
+}
+
+void bbstate_sync(void) {
+    sync_journal();
+    journal_check(jnl, dirty_count);
+}
+
+int bbstate_pending(void) {
+    return journal_pending(jnl);
+}
+
+void bbstate_flush_gc(uint32_t gc) {
+    bbs_entry_t *e;
+
+    if(!(e = find_entry(gc)))
+        return;
+
+    /* The player's last changes have to be in the journal before they can go
+       to the database. */
+    bbstate_sync();
+
+    /* Once it's written, there's no need to keep it around. If that doesn't
+       work, it'll get written (and dropped) along with everything else. */
+    e->drop = 1;
+
+    if(!e->ndirty)
+        remove_entry(e);
+    else if(!flush_batch(&e, 1))
+        journal_check(jnl, dirty_count);
+}
+
+void bbstate_flush_all(void) {
+    flush_dirty(0);
+    journal_check(jnl, dirty_count);
+}
@@ -0,0 +1,113 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BBSTATE_H
+#define BBSTATE_H
+
+#include <stdint.h>
+
+#include <sylverant/characters.h>
+
+/* How long (in seconds) a change is held before it is written to the
+   database. */
+#ifndef BBSTATE_FLUSH_DELAY
+#define BBSTATE_FLUSH_DELAY     5
+#endif
+
+/* Most players to write changes for in one go. */
+#ifndef BBSTATE_BATCH_PLAYERS
+#define BBSTATE_BATCH_PLAYERS   16
+#endif
+
+/* Number of players to keep options and guildcards in memory for. Those that
+   have changes that haven't been written yet are always kept. */
+#ifndef BBSTATE_CACHE_MAX
+#define BBSTATE_CACHE_MAX       1024
+#endif
+
+/* Once the journal gets this big, it is rewritten with just the changes that
+   aren't in the database yet. */
+#ifndef BBSTATE_JOURNAL_MAX
+#define BBSTATE_JOURNAL_MAX     (16 * 1024 * 1024)
+#endif
+
+/* How often (in seconds) to log statistics. */
+#ifndef BBSTATE_STATS_INTERVAL
+#define BBSTATE_STATS_INTERVAL  600
+#endif
+
+/* Longest guildcard comment that is stored, in bytes. */
+#define BBSTATE_COMMENT_MAX     (0x88 * 2)
+
+#define BBSTATE_JOURNAL_DEFAULT "bbstate.journal"
+
+/* Called once a change is safely in the journal (or if that failed, in which
+   case the change has been undone). Changes that didn't change anything never
+   fail. */
+typedef void (*bbstate_cb_t)(void *data, int err);
+
+/* Set up the Blue Burst options and guildcard cache, writing anything left in
+   the journal from the last run to the database. */
+int bbstate_init(const char *journal);
+
+/* Write out any changes and clean up. Anything that can't be written to the
+   database is left in the journal for next time. */
+void bbstate_cleanup(void);
+
+/* Read a player's options. They're read from the database the first time
+   they're asked for. */
+int bbstate_get_opts(uint32_t gc, sylverant_bb_db_opts_t *opts);
+
+/* Change a player's options. Nothing is written if they're the same as what's
+   already there. The callback (if there is one) is called from
+   bbstate_sync(), like for all of the changes below. */
+int bbstate_set_opts(uint32_t gc, const sylverant_bb_db_opts_t *opts,
+                     bbstate_cb_t cb, void *cbdata);
+
+/* Add (or update) a guildcard on a player's list. The name, team name, and
+   text are stored as they came from the client (48, 32, and 176 bytes). */
+int bbstate_gc_add(uint32_t gc, uint32_t fr_gc, const uint8_t *name,
+                   const uint8_t *team_name, const uint8_t *text,
+                   uint8_t language, uint8_t section, uint8_t char_class,
+                   bbstate_cb_t cb, void *cbdata);
+
+/* Delete a guildcard from a player's list. This is done in the database right
+   away. */
+int bbstate_gc_del(uint32_t gc, uint32_t fr_gc);
+
+/* Move a guildcard on a player's list in front of another one. */
+int bbstate_gc_sort(uint32_t gc, uint32_t fr_gc1, uint32_t fr_gc2);
+
+/* Set the comment on a guildcard on a player's list. */
+int bbstate_gc_comment(uint32_t gc, uint32_t fr_gc, const uint8_t *comment,
+                       int len, bbstate_cb_t cb, void *cbdata);
+
+/* Write any changes to the journal and sync it to disk, then run their
+   callbacks. This is called from the main loop. */
+void bbstate_sync(void);
+
+/* Returns non-zero if there are changes waiting for bbstate_sync(). */
+int bbstate_pending(void);
+
+/* Write a player's changes to the database now and forget about them, since
+   they've logged off. */
+void bbstate_flush_gc(uint32_t gc);
+
+/* Write all changes to the database now. */
+void bbstate_flush_all(void);
+
+#endif /* !BBSTATE_H */
@@ -0,0 +1,226 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include <zlib.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "bkcache.h"
+
+/* Players tend to back up the same character over and over without anything
+   changing, so the hash of each backup is kept (in the raw_hash column of
+   character_backup, and in memory for recently used ones) to skip storing
+   those. A hash is only trusted once the backup it belongs to is stored. While
+   a backup is being stored, its entry can't be evicted, so that the database
+   never gets asked about a backup that's still on its way there. */
+
+#define BKCACHE_HASH_SIZE   4096
+
+extern sylverant_dbconn_t conn;
+
+typedef struct bk_entry {
+    TAILQ_ENTRY(bk_entry) lru;
+    struct bk_entry *hnext;
+    uint32_t gc;
+    char name[32];
+    uint64_t hash;
+    int valid;
+    int pending;
+} bk_entry_t;
+
+TAILQ_HEAD(bk_lru, bk_entry);
+
+static bk_entry_t *hash_tbl[BKCACHE_HASH_SIZE];
+static struct bk_lru lru = TAILQ_HEAD_INITIALIZER(lru);
+static int entry_count;
+
+static inline int bucket(uint32_t gc, const char *name) {
+    uint32_t h = gc;
+
+    while(*name) {
+        h = h * 31 + (uint8_t)*name++;
+    }
+
+    return h & (BKCACHE_HASH_SIZE - 1);
+}
+
+static bk_entry_t *find_entry(uint32_t gc, const char *name) {
+    bk_entry_t *i = hash_tbl[bucket(gc, name)];
+
+    while(i) {
+        if(i->gc == gc && !strcmp(i->name, name)) {
+            /* Move it to the end of the LRU list. */
+            TAILQ_REMOVE(&lru, i, lru);
+            TAILQ_INSERT_TAIL(&lru, i, lru);
+            return i;
+        }
+
+        i = i->hnext;
+    }
+
+    return NULL;
+}
+
+static void remove_entry(bk_entry_t *e) {
+    bk_entry_t **i = &hash_tbl[bucket(e->gc, e->name)];
+
+    while(*i) {
+        if(*i == e) {
+            *i = e->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    TAILQ_REMOVE(&lru, e, lru);
+    --entry_count;
+    free(e);
+}
+
+static bk_entry_t *add_entry(uint32_t gc, const char *name) {
+    bk_entry_t *e, *i, *tmp;
+    int b = bucket(gc, name);
+
+    /* Make room, skipping over anything still being stored. */
+    i = TAILQ_FIRST(&lru);
+    while(i && entry_count >= BKCACHE_MAX) {
+        tmp = TAILQ_NEXT(i, lru);
+
+        if(!i->pending)
+            remove_entry(i);
+
+        i = tmp;
+    }
+
+    if(!(e = (bk_entry_t *)malloc(sizeof(bk_entry_t))))
+        return NULL;
+
+    memset(e, 0, sizeof(bk_entry_t));
+    e->gc = gc;
+    strncpy(e->name, name, 31);
+
+    e->hnext = hash_tbl[b];
+    hash_tbl[b] = e;
+    TAILQ_INSERT_TAIL(&lru, e, lru);
+    ++entry_count;
+
+    return e;
+}
+
+int bkcache_init(void) {
+    memset(hash_tbl, 0, sizeof(hash_tbl));
+    TAILQ_INIT(&lru);
+    entry_count = 0;
+
+    return 0;
+}
+
+void bkcache_cleanup(void) {
+    bk_entry_t *i;
+
+    while((i = TAILQ_FIRST(&lru))) {
+        remove_entry(i);
+    }
+}
+
+uint64_t bkcache_hash(const void *data, size_t len) {
+    uint64_t h;
+
+    h = (uint64_t)crc32(0, (const Bytef *)data, len) << 32;
+    h |= (uint64_t)adler32(1, (const Bytef *)data, len);
+
+    return h;
+}
+
+int bkcache_same(uint32_t gc, const char *name, uint64_t hash) {
+    char query[256], name2[65];
+    bk_entry_t *e;
+    void *result;
+    char **row;
+
+    /* While a backup is still being stored, there's no telling yet whether it
+       will make it, so anything sent in the meantime has to be stored too. */
+    if((e = find_entry(gc, name))) {
+        if(e->pending)
+            return 0;
+
+        if(e->valid)
+            return e->hash == hash;
+    }
+
+    /* Nothing's on its way to the database, so what's there is current. */
+    sylverant_db_escape_str(&conn, name2, name, strlen(name));
+    sprintf(query, "SELECT raw_hash FROM character_backup WHERE "
+            "guildcard='%u' AND name='%s'", gc, name2);
+
+    if(sylverant_db_query(&conn, query) ||
+       !(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't look up backup hash (%u: %s)\n", gc, name);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return 0;
+    }
+
+    if(!(row = sylverant_db_result_fetch(result)) || !row[0]) {
+        sylverant_db_result_free(result);
+        return 0;
+    }
+
+    if(!e && !(e = add_entry(gc, name))) {
+        sylverant_db_result_free(result);
+        return 0;
+    }
+
+    e->hash = (uint64_t)strtoull(row[0], NULL, 0);
+    e->valid = 1;
+    sylverant_db_result_free(result);
+
+    return e->hash == hash;
+}
+
+void bkcache_begin(uint32_t gc, const char *name, uint64_t hash) {
+    bk_entry_t *e;
+
+    if(!(e = find_entry(gc, name)) && !(e = add_entry(gc, name)))
+        return;
+
+    /* Compare against this from now on, since it'll be the newest once it's
+       stored. */
+    e->hash = hash;
+    e->valid = 1;
+    ++e->pending;
+}
+
+void bkcache_end(uint32_t gc, const char *name, int ok) {
+    bk_entry_t *e;
+
+    if(!(e = find_entry(gc, name)))
+        return;
+
+    if(e->pending)
+        --e->pending;
+
+    /* If it didn't get stored, there's no telling what's in the database. */
+    if(!ok)
+        e->valid = 0;
+}
@@ -0,0 +1,50 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BKCACHE_H
+#define BKCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Number of backups to remember the hash of. */
+#ifndef BKCACHE_MAX
+#define BKCACHE_MAX     65536
+#endif
+
+/* Set up the backup hash cache. */
+int bkcache_init(void);
+
+/* Clean up the backup hash cache. */
+void bkcache_cleanup(void);
+
+/* Hash the (uncompressed) data of a character backup. */
+uint64_t bkcache_hash(const void *data, size_t len);
+
+/* Returns non-zero if the backup stored for the given guildcard and name has
+   the given hash, meaning there's no need to store it again. If the hash isn't
+   known, it's read from the database. This is always zero while a backup for
+   that character is still being stored. */
+int bkcache_same(uint32_t gc, const char *name, uint64_t hash);
+
+/* Note that a backup with the given hash is being stored. */
+void bkcache_begin(uint32_t gc, const char *name, uint64_t hash);
+
+/* Note that storing a backup started with bkcache_begin() is done. */
+void bkcache_end(uint32_t gc, const char *name, int ok);
+
+#endif /* !BKCACHE_H */
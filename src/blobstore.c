@@ -0,0 +1,652 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+
+#include <sylverant/debug.h>
+
+#include "blobstore.h"
+
+/* The store is a directory of append-only segment files. Each one is just a
+   series of records, each a header followed by the blob itself. Segments are
+   mapped into memory for reading, so reading a blob that was used recently is
+   just a page cache hit. There's no index on disk -- it's rebuilt by scanning
+   the record headers when the store is opened. */
+
+#define BLOB_MAGIC          0x31424C42  /* "BLB1" */
+#define BLOB_PATH_MAX       1024
+
+#ifdef PACKED
+#undef PACKED
+#endif
+
+#define PACKED __attribute__((packed))
+
+typedef struct blob_rec_hdr {
+    uint32_t magic;
+    uint32_t len;
+    uint8_t hash[BLOB_HASH_LEN];
+} PACKED blob_rec_hdr_t;
+
+#undef PACKED
+
+typedef struct blob_seg {
+    uint32_t id;
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    size_t size;
+    size_t synced;
+} blob_seg_t;
+
+typedef struct blob_loc {
+    uint8_t hash[BLOB_HASH_LEN];
+    uint32_t seg;
+    uint32_t off;
+    uint32_t len;
+    uint32_t used;
+} blob_loc_t;
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static char *path;
+static int lock_fd = -1;
+
+static blob_seg_t *segs;
+static int seg_count, seg_size;
+static int active = -1;
+
+static blob_loc_t *index_tbl;
+static size_t index_size, index_count;
+
+static void seg_name(char *buf, uint32_t id) {
+    sprintf(buf, "%s/seg-%08x.dat", path, id);
+}
+
+static blob_loc_t *index_find(const uint8_t hash[BLOB_HASH_LEN]) {
+    uint64_t h;
+    size_t i;
+
+    if(!index_size)
+        return NULL;
+
+    /* The hash is already uniformly distributed, so just use part of it. */
+    memcpy(&h, hash, sizeof(h));
+    i = (size_t)h & (index_size - 1);
+
+    while(index_tbl[i].used) {
+        if(!memcmp(index_tbl[i].hash, hash, BLOB_HASH_LEN))
+            return &index_tbl[i];
+
+        i = (i + 1) & (index_size - 1);
+    }
+
+    return NULL;
+}
+
+static int index_insert(const uint8_t hash[BLOB_HASH_LEN], uint32_t seg,
+                        uint32_t off, uint32_t len) {
+    blob_loc_t *old = index_tbl, *ent;
+    size_t old_size = index_size, i;
+    uint64_t h;
+
+    /* Keep the table at most half full. */
+    if((index_count + 1) * 2 > index_size) {
+        index_size = index_size ? index_size * 2 : 4096;
+
+        if(!(index_tbl = (blob_loc_t *)calloc(index_size, sizeof(blob_loc_t)))) {
+            index_tbl = old;
+            index_size = old_size;
+            return -1;
+        }
+
+        index_count = 0;
+
+        for(i = 0; i < old_size; ++i) {
+            if(old[i].used)
+                index_insert(old[i].hash, old[i].seg, old[i].off, old[i].len);
+        }
+
+        free(old);
+    }
+
+    if(!(ent = index_find(hash))) {
+        memcpy(&h, hash, sizeof(h));
+        i = (size_t)h & (index_size - 1);
+
+        while(index_tbl[i].used) {
+            i = (i + 1) & (index_size - 1);
+        }
+
+        ent = &index_tbl[i];
+        memcpy(ent->hash, hash, BLOB_HASH_LEN);
+        ent->used = 1;
+        ++index_count;
+    }
+
+    ent->seg = seg;
+    ent->off = off;
+    ent->len = len;
+
+    return 0;
+}
+
+/* Scan a segment's records, adding them to the index. If the segment is the
+   active one, a partial record at the end (from a crash in the middle of a
+   write) is cut off. */
+static int seg_scan(int idx, int is_active) {
+    blob_seg_t *s = &segs[idx];
+    blob_rec_hdr_t hdr;
+    uint8_t hash[BLOB_HASH_LEN];
+    size_t off = 0;
+
+    while(off + sizeof(blob_rec_hdr_t) <= s->size) {
+        memcpy(&hdr, s->map + off, sizeof(blob_rec_hdr_t));
+
+        if(hdr.magic != BLOB_MAGIC || hdr.len > BLOB_MAX_SIZE ||
+           off + sizeof(blob_rec_hdr_t) + hdr.len > s->size)
+            break;
+
+        if(is_active) {
+            blob_hash(s->map + off + sizeof(blob_rec_hdr_t), hdr.len, hash);
+
+            if(memcmp(hash, hdr.hash, BLOB_HASH_LEN))
+                break;
+        }
+
+        if(index_insert(hdr.hash, (uint32_t)idx,
+                        (uint32_t)(off + sizeof(blob_rec_hdr_t)), hdr.len))
+            return -1;
+
+        off += sizeof(blob_rec_hdr_t) + hdr.len;
+    }
+
+    if(off != s->size) {
+        if(is_active) {
+            debug(DBG_WARN, "Truncating partial record in blob segment %08x\n",
+                  s->id);
+
+            if(ftruncate(s->fd, (off_t)off))
+                return -1;
+
+            s->size = off;
+        }
+        else {
+            debug(DBG_WARN, "Blob segment %08x is damaged at offset %lu\n",
+                  s->id, (unsigned long)off);
+        }
+    }
+
+    s->synced = s->size;
+    return 0;
+}
+
+static int seg_open(uint32_t id, int is_active, int create) {
+    char fn[BLOB_PATH_MAX];
+    blob_seg_t *s, *tmp;
+    struct stat st;
+    int fd;
+
+    if(seg_count == seg_size) {
+        if(!(tmp = (blob_seg_t *)realloc(segs, (seg_size + 16) *
+                                         sizeof(blob_seg_t))))
+            return -1;
+
+        segs = tmp;
+        seg_size += 16;
+    }
+
+    seg_name(fn, id);
+
+    if((fd = open(fn, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0600)) < 0) {
+        debug(DBG_ERROR, "Cannot open blob segment %s: %s\n", fn,
+              strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    s = &segs[seg_count];
+    s->id = id;
+    s->fd = fd;
+    s->size = s->synced = (size_t)st.st_size;
+
+    /* The active segment gets mapped at its full size up front, so that the
+       mapping doesn't need to change as it grows. */
+    s->map_size = is_active && s->size < BLOB_SEGMENT_MAX ? BLOB_SEGMENT_MAX :
+        s->size;
+    s->map = NULL;
+
+    if(s->map_size) {
+        s->map = (uint8_t *)mmap(NULL, s->map_size, PROT_READ, MAP_SHARED, fd,
+                                 0);
+
+        if(s->map == MAP_FAILED) {
+            debug(DBG_ERROR, "Cannot map blob segment %s: %s\n", fn,
+                  strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    return seg_count++;
+}
+
+static void seg_close(blob_seg_t *s) {
+    if(s->map)
+        munmap(s->map, s->map_size);
+
+    if(s->fd != -1)
+        close(s->fd);
+
+    s->map = NULL;
+    s->fd = -1;
+}
+
+/* Seal the active segment and start a new one. */
+static int seg_rotate(void) {
+    uint32_t id = active >= 0 ? segs[active].id + 1 : 1;
+    int idx;
+
+    if((idx = seg_open(id, 1, 1)) < 0)
+        return -1;
+
+    active = idx;
+    return 0;
+}
+
+static int cmp_id(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Open all the segments in the store's directory and index them. */
+static int load_segments(void) {
+    DIR *d;
+    struct dirent *ent;
+    uint32_t *ids = NULL, *tmp, id;
+    int count = 0, size = 0, i, idx;
+
+    if(!(d = opendir(path))) {
+        debug(DBG_ERROR, "Cannot open blob store %s: %s\n", path,
+              strerror(errno));
+        return -1;
+    }
+
+    while((ent = readdir(d))) {
+        if(sscanf(ent->d_name, "seg-%08x.dat", &id) != 1)
+            continue;
+
+        if(count == size) {
+            if(!(tmp = (uint32_t *)realloc(ids, (size + 64) *
+                                           sizeof(uint32_t)))) {
+                closedir(d);
+                free(ids);
+                return -1;
+            }
+
+            ids = tmp;
+            size += 64;
+        }
+
+        ids[count++] = id;
+    }
+
+    closedir(d);
+    qsort(ids, count, sizeof(uint32_t), &cmp_id);
+
+    for(i = 0; i < count; ++i) {
+        if((idx = seg_open(ids[i], i == count - 1, 0)) < 0 ||
+           seg_scan(idx, i == count - 1)) {
+            free(ids);
+            return -1;
+        }
+
+        if(i == count - 1)
+            active = idx;
+    }
+
+    free(ids);
+
+    if(active < 0 && seg_rotate())
+        return -1;
+
+    return 0;
+}
+
+int blob_open(const char *dir) {
+    char fn[BLOB_PATH_MAX];
+
+    if(path) {
+        debug(DBG_ERROR, "Blob store is already open\n");
+        return -1;
+    }
+
+    if(strlen(dir) > BLOB_PATH_MAX - 32) {
+        debug(DBG_ERROR, "Blob store path is too long: %s\n", dir);
+        return -1;
+    }
+
+    if(mkdir(dir, 0700) && errno != EEXIST) {
+        debug(DBG_ERROR, "Cannot create blob store %s: %s\n", dir,
+              strerror(errno));
+        return -1;
+    }
+
+    if(!(path = strdup(dir)))
+        return -1;
+
+    /* Make sure nothing else (like the compaction tool) is using it. */
+    sprintf(fn, "%s/lock", path);
+
+    if((lock_fd = open(fn, O_RDWR | O_CREAT, 0600)) < 0 ||
+       flock(lock_fd, LOCK_EX | LOCK_NB)) {
+        debug(DBG_ERROR, "Cannot lock blob store %s: %s\n", dir,
+              strerror(errno));
+        blob_close();
+        return -1;
+    }
+
+    if(load_segments()) {
+        blob_close();
+        return -1;
+    }
+
+    debug(DBG_LOG, "Opened blob store %s (%d segments, %lu blobs)\n", dir,
+          seg_count, (unsigned long)index_count);
+    return 0;
+}
+
+void blob_close(void) {
+    int i;
+
+    for(i = 0; i < seg_count; ++i) {
+        seg_close(&segs[i]);
+    }
+
+    free(segs);
+    segs = NULL;
+    seg_count = seg_size = 0;
+    active = -1;
+
+    free(index_tbl);
+    index_tbl = NULL;
+    index_size = index_count = 0;
+
+    if(lock_fd != -1) {
+        close(lock_fd);
+        lock_fd = -1;
+    }
+
+    free(path);
+    path = NULL;
+}
+
+int blob_enabled(void) {
+    return path != NULL;
+}
+
+void blob_hash(const void *data, size_t len, uint8_t hash[BLOB_HASH_LEN]) {
+    gnutls_hash_fast(GNUTLS_DIG_SHA256, data, len, hash);
+}
+
+void blob_hash_hex(const uint8_t hash[BLOB_HASH_LEN], char hex[]) {
+    int i;
+
+    for(i = 0; i < BLOB_HASH_LEN; ++i) {
+        sprintf(hex + i * 2, "%02x", hash[i]);
+    }
+}
+
+int blob_hash_parse(const char *hex, uint8_t hash[BLOB_HASH_LEN]) {
+    unsigned int b;
+    int i;
+
+    if(strlen(hex) != BLOB_HASH_HEX_LEN)
+        return -1;
+
+    for(i = 0; i < BLOB_HASH_LEN; ++i) {
+        if(sscanf(hex + i * 2, "%2x", &b) != 1)
+            return -1;
+
+        hash[i] = (uint8_t)b;
+    }
+
+    return 0;
+}
+
+/* Append a record to the active segment. Must be called with the lock held.
+   The record isn't synced to disk yet when this returns. */
+static int append(const uint8_t hash[BLOB_HASH_LEN], const void *data,
+                  size_t len, size_t *end) {
+    blob_rec_hdr_t hdr;
+    blob_seg_t *s = &segs[active];
+
+    if(s->size + sizeof(blob_rec_hdr_t) + len > BLOB_SEGMENT_MAX &&
+       s->size && seg_rotate())
+        return -1;
+
+    s = &segs[active];
+    hdr.magic = BLOB_MAGIC;
+    hdr.len = (uint32_t)len;
+    memcpy(hdr.hash, hash, BLOB_HASH_LEN);
+
+    if(pwrite(s->fd, &hdr, sizeof(hdr), (off_t)s->size) != sizeof(hdr) ||
+       pwrite(s->fd, data, len, (off_t)(s->size + sizeof(hdr))) !=
+       (ssize_t)len) {
+        debug(DBG_WARN, "Couldn't write to blob segment %08x: %s\n", s->id,
+              strerror(errno));
+        return -1;
+    }
+
+    if(index_insert(hash, (uint32_t)active,
+                    (uint32_t)(s->size + sizeof(hdr)), (uint32_t)len))
+        return -1;
+
+    s->size += sizeof(hdr) + len;
+    *end = s->size;
+    return 0;
+}
+
+int blob_put(const uint8_t hash[BLOB_HASH_LEN], const void *data, size_t len) {
+    blob_loc_t *loc;
+    blob_seg_t *s;
+    size_t end;
+    int fd, idx;
+
+    if(len > BLOB_MAX_SIZE)
+        return -1;
+
+    pthread_mutex_lock(&mtx);
+
+    if(!path) {
+        pthread_mutex_unlock(&mtx);
+        return -1;
+    }
+
+    /* If it's already there, it only needs syncing if another thread wrote it
+       and hasn't gotten around to syncing it yet. */
+    if((loc = index_find(hash))) {
+        idx = (int)loc->seg;
+        end = loc->off + loc->len;
+    }
+    else {
+        idx = active;
+
+        if(append(hash, data, len, &end)) {
+            pthread_mutex_unlock(&mtx);
+            return -1;
+        }
+
+        idx = active;
+    }
+
+    s = &segs[idx];
+
+    if(s->synced >= end) {
+        pthread_mutex_unlock(&mtx);
+        return 0;
+    }
+
+    fd = s->fd;
+    pthread_mutex_unlock(&mtx);
+
+    /* Sync without holding the lock, so other threads aren't held up. */
+    if(fdatasync(fd)) {
+        debug(DBG_WARN, "Couldn't sync blob segment: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&mtx);
+
+    if(segs[idx].synced < end)
+        segs[idx].synced = end;
+
+    pthread_mutex_unlock(&mtx);
+    return 0;
+}
+
+int blob_store(const void *data, size_t len, uint8_t hash[BLOB_HASH_LEN]) {
+    if(!path)
+        return -1;
+
+    blob_hash(data, len, hash);
+    return blob_put(hash, data, len);
+}
+
+int blob_get(const uint8_t hash[BLOB_HASH_LEN], const uint8_t **data,
+             size_t *len) {
+    blob_loc_t *loc;
+    int rv = -1;
+
+    pthread_mutex_lock(&mtx);
+
+    if((loc = index_find(hash))) {
+        *data = segs[loc->seg].map + loc->off;
+        *len = loc->len;
+        rv = 0;
+    }
+
+    pthread_mutex_unlock(&mtx);
+    return rv;
+}
+
+long blob_compact(int (*live)(const uint8_t hash[BLOB_HASH_LEN], void *d),
+                  void *d) {
+    char fn[BLOB_PATH_MAX];
+    blob_rec_hdr_t hdr;
+    blob_loc_t *loc;
+    blob_seg_t *s;
+    int i, start;
+    size_t off, end;
+    long reclaimed = 0;
+
+    pthread_mutex_lock(&mtx);
+
+    /* Everything before the active segment is sealed. Start a new segment for
+       the copies, so the current active one can be compacted too. */
+    if(segs[active].size && seg_rotate()) {
+        pthread_mutex_unlock(&mtx);
+        return -1;
+    }
+
+    start = active;
+
+    for(i = 0; i < start; ++i) {
+        s = &segs[i];
+
+        if(s->fd == -1)
+            continue;
+
+        off = 0;
+        while(off + sizeof(blob_rec_hdr_t) <= s->size) {
+            memcpy(&hdr, s->map + off, sizeof(blob_rec_hdr_t));
+
+            if(hdr.magic != BLOB_MAGIC ||
+               off + sizeof(blob_rec_hdr_t) + hdr.len > s->size)
+                break;
+
+            /* Only copy the one the index knows about, in case it's in there
+               more than once. */
+            loc = index_find(hdr.hash);
+
+            if(loc && loc->seg == (uint32_t)i &&
+               loc->off == off + sizeof(blob_rec_hdr_t) && live(hdr.hash, d)) {
+                if(append(hdr.hash, s->map + off + sizeof(blob_rec_hdr_t),
+                          hdr.len, &end)) {
+                    pthread_mutex_unlock(&mtx);
+                    return -1;
+                }
+            }
+            else {
+                reclaimed += sizeof(blob_rec_hdr_t) + hdr.len;
+            }
+
+            off += sizeof(blob_rec_hdr_t) + hdr.len;
+        }
+    }
+
+    /* Make sure all the copies are on disk before the originals go away. */
+    for(i = start; i < seg_count; ++i) {
+        if(fdatasync(segs[i].fd)) {
+            pthread_mutex_unlock(&mtx);
+            return -1;
+        }
+
+        segs[i].synced = segs[i].size;
+    }
+
+    for(i = 0; i < start; ++i) {
+        if(segs[i].fd == -1)
+            continue;
+
+        seg_name(fn, segs[i].id);
+        seg_close(&segs[i]);
+        unlink(fn);
+    }
+
+    /* Rebuild the index, so that nothing points at the removed segments. */
+    free(index_tbl);
+    index_tbl = NULL;
+    index_size = index_count = 0;
+
+    for(i = start; i < seg_count; ++i) {
+        if(seg_scan(i, 0)) {
+            pthread_mutex_unlock(&mtx);
+            return -1;
+        }
+    }
+
+    pthread_mutex_unlock(&mtx);
+    return reclaimed;
+}
@@ -0,0 +1,76 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Blobs are identified by the SHA-256 hash of their contents. In the database,
+   the hash is stored as hex in the blob_hash column. */
+#define BLOB_HASH_LEN       32
+#define BLOB_HASH_HEX_LEN   64
+
+/* Maximum size of one segment file. Once a segment reaches this size, it's
+   sealed and a new one is started. */
+#ifndef BLOB_SEGMENT_MAX
+#define BLOB_SEGMENT_MAX    (64 * 1024 * 1024)
+#endif
+
+/* Largest blob that can be stored. */
+#define BLOB_MAX_SIZE       (1024 * 1024)
+
+/* Open the blob store in the given directory (creating it if needed), and
+   build the index of what's in it. Only one process can have the store open at
+   a time. */
+int blob_open(const char *dir);
+
+/* Close the blob store. */
+void blob_close(void);
+
+/* Returns non-zero if the blob store is open. */
+int blob_enabled(void);
+
+/* Hash some data to get its blob id. */
+void blob_hash(const void *data, size_t len, uint8_t hash[BLOB_HASH_LEN]);
+
+/* Convert a hash to/from the hex form used in the database. */
+void blob_hash_hex(const uint8_t hash[BLOB_HASH_LEN], char hex[]);
+int blob_hash_parse(const char *hex, uint8_t hash[BLOB_HASH_LEN]);
+
+/* Store a blob, which should have been hashed with blob_hash(). If a blob with
+   that hash is already stored, this does nothing. When this returns, the blob
+   is safely on disk. This is safe to call from any thread. */
+int blob_put(const uint8_t hash[BLOB_HASH_LEN], const void *data, size_t len);
+
+/* Hash and store a blob in one step, filling in its hash. Returns -1 if the
+   store isn't open or the write failed. */
+int blob_store(const void *data, size_t len, uint8_t hash[BLOB_HASH_LEN]);
+
+/* Look up a blob. The data pointer points into the mapped segment, and stays
+   valid until the store is closed. This is safe to call from any thread. */
+int blob_get(const uint8_t hash[BLOB_HASH_LEN], const uint8_t **data,
+             size_t *len);
+
+/* Rewrite the blobs in all sealed segments that the live callback says are
+   still in use into new segments, and remove the old segments. Returns the
+   number of bytes reclaimed, or -1 on error. */
+long blob_compact(int (*live)(const uint8_t hash[BLOB_HASH_LEN], void *d),
+                  void *d);
+
+#endif /* !BLOBSTORE_H */
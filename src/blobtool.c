@@ -0,0 +1,295 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Maintenance tool for the character data blob store. This moves character
+   data that is still stored in the database into the blob store, and compacts
+   the store by removing blobs that nothing refers to anymore. The shipgate has
+   to be stopped while this runs (the store can only be opened by one process
+   at a time anyway). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sylverant/config.h>
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "blobstore.h"
+
+/* How many rows to move at once when migrating. */
+#define MIGRATE_BATCH   1000
+
+static const char *config_file = NULL;
+static const char *command = NULL;
+static const char *blob_dir = NULL;
+
+static sylverant_dbconn_t conn;
+
+/* Print help to the user to stdout. */
+static void print_help(const char *bin) {
+    printf("Usage: %s [arguments] command directory\n"
+           "-----------------------------------------------------------------\n"
+           "-C configfile   Use the specified configuration instead of the\n"
+           "                default one.\n"
+           "--help          Print this help and exit\n\n"
+           "Commands:\n"
+           "migrate         Move character data and backups from the database\n"
+           "                into the blob store.\n"
+           "compact         Remove blobs that are no longer used from the\n"
+           "                blob store.\n\n"
+           "The shipgate must not be running while this is used.\n", bin);
+}
+
+/* Parse any command-line arguments passed in. */
+static void parse_command_line(int argc, char *argv[]) {
+    int i;
+
+    for(i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-C")) {
+            if(i == argc - 1) {
+                printf("-C requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            config_file = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--help")) {
+            print_help(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else if(argv[i][0] != '-' && !command) {
+            command = argv[i];
+        }
+        else if(argv[i][0] != '-' && !blob_dir) {
+            blob_dir = argv[i];
+        }
+        else {
+            printf("Illegal command line argument: %s\n", argv[i]);
+            print_help(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(!command || !blob_dir || (strcmp(command, "migrate") &&
+                                 strcmp(command, "compact"))) {
+        print_help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Move one batch of rows from a table into the blob store. The first column of
+   the query is the data, and the rest make up the where clause for updating
+   the row. Returns the number of rows moved, or -1 on error. */
+static long migrate_batch(int backups) {
+    static char query[512];
+    char hex[BLOB_HASH_HEX_LEN + 1], name2[65];
+    uint8_t hash[BLOB_HASH_LEN];
+    void *result;
+    char **row;
+    unsigned long *len;
+    long count = 0;
+
+    if(backups)
+        sprintf(query, "SELECT data, guildcard, name FROM character_backup "
+                "WHERE data IS NOT NULL AND blob_hash IS NULL LIMIT %d",
+                MIGRATE_BATCH);
+    else
+        sprintf(query, "SELECT data, guildcard, slot FROM character_data "
+                "WHERE data IS NOT NULL AND blob_hash IS NULL LIMIT %d",
+                MIGRATE_BATCH);
+
+    if(sylverant_db_query(&conn, query)) {
+        printf("Couldn't fetch character data: %s\n",
+               sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        printf("Couldn't fetch character data: %s\n",
+               sylverant_db_error(&conn));
+        return -1;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        if(!(len = sylverant_db_result_lengths(result)))
+            continue;
+
+        /* The blob has to be safely stored before the row stops pointing at
+           the data, which blob_store() takes care of. */
+        if(blob_store(row[0], len[0], hash)) {
+            printf("Couldn't store blob for %s: %s\n", row[1], row[2]);
+            sylverant_db_result_free(result);
+            return -1;
+        }
+
+        blob_hash_hex(hash, hex);
+
+        if(backups) {
+            sylverant_db_escape_str(&conn, name2, row[2], strlen(row[2]));
+            sprintf(query, "UPDATE character_backup SET data=NULL, "
+                    "blob_hash='%s' WHERE guildcard='%s' AND name='%s' AND "
+                    "blob_hash IS NULL", hex, row[1], name2);
+        }
+        else {
+            sprintf(query, "UPDATE character_data SET data=NULL, "
+                    "blob_hash='%s' WHERE guildcard='%s' AND slot='%s' AND "
+                    "blob_hash IS NULL", hex, row[1], row[2]);
+        }
+
+        if(sylverant_db_query(&conn, query)) {
+            printf("Couldn't update %s: %s\n", row[1],
+                   sylverant_db_error(&conn));
+            sylverant_db_result_free(result);
+            return -1;
+        }
+
+        ++count;
+    }
+
+    sylverant_db_result_free(result);
+    return count;
+}
+
+static int migrate(void) {
+    long count, total[2] = { 0, 0 };
+    int i;
+
+    for(i = 0; i < 2; ++i) {
+        while((count = migrate_batch(i)) > 0) {
+            total[i] += count;
+        }
+
+        if(count < 0)
+            return -1;
+    }
+
+    printf("Moved %ld characters and %ld backups into the blob store\n",
+           total[0], total[1]);
+    return 0;
+}
+
+typedef struct live_set {
+    uint8_t *hashes;
+    size_t count;
+} live_set_t;
+
+static int cmp_hash(const void *a, const void *b) {
+    return memcmp(a, b, BLOB_HASH_LEN);
+}
+
+static int is_live(const uint8_t hash[BLOB_HASH_LEN], void *d) {
+    live_set_t *set = (live_set_t *)d;
+
+    return bsearch(hash, set->hashes, set->count, BLOB_HASH_LEN,
+                   &cmp_hash) != NULL;
+}
+
+static int compact(void) {
+    live_set_t set = { NULL, 0 };
+    size_t alloc = 0;
+    uint8_t *tmp;
+    void *result;
+    char **row;
+    long reclaimed;
+
+    /* Everything the database refers to is still live. */
+    if(sylverant_db_query(&conn, "SELECT blob_hash FROM character_data WHERE "
+                          "blob_hash IS NOT NULL UNION SELECT blob_hash FROM "
+                          "character_backup WHERE blob_hash IS NOT NULL UNION "
+                          "SELECT blob_hash FROM character_history WHERE "
+                          "blob_hash IS NOT NULL")) {
+        printf("Couldn't fetch blob hashes: %s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        printf("Couldn't fetch blob hashes: %s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        if(set.count == alloc) {
+            alloc = alloc ? alloc * 2 : 4096;
+
+            if(!(tmp = (uint8_t *)realloc(set.hashes,
+                                          alloc * BLOB_HASH_LEN))) {
+                printf("Out of memory!\n");
+                sylverant_db_result_free(result);
+                free(set.hashes);
+                return -1;
+            }
+
+            set.hashes = tmp;
+        }
+
+        if(blob_hash_parse(row[0], set.hashes + set.count * BLOB_HASH_LEN)) {
+            printf("Ignoring bad blob hash: %s\n", row[0]);
+            continue;
+        }
+
+        ++set.count;
+    }
+
+    sylverant_db_result_free(result);
+    qsort(set.hashes, set.count, BLOB_HASH_LEN, &cmp_hash);
+
+    if((reclaimed = blob_compact(&is_live, &set)) < 0) {
+        printf("Compaction failed!\n");
+        free(set.hashes);
+        return -1;
+    }
+
+    printf("Reclaimed %ld bytes (%lu blobs live)\n", reclaimed,
+           (unsigned long)set.count);
+    free(set.hashes);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    sylverant_config_t *cfg;
+    int rv;
+
+    parse_command_line(argc, argv);
+
+    if(sylverant_read_config(config_file, &cfg)) {
+        printf("Cannot load configuration!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(sylverant_db_open(&cfg->dbcfg, &conn)) {
+        printf("Can't connect to the database\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(blob_open(blob_dir)) {
+        printf("Can't open the blob store (is the shipgate running?)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(!strcmp(command, "migrate"))
+        rv = migrate();
+    else
+        rv = compact();
+
+    blob_close();
+    sylverant_db_close(&conn);
+    sylverant_free_config(cfg);
+
+    return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Train a zstd dictionary for character data from the rows already stored in
+   the character_data table. The resulting file can be passed to the shipgate
+   with --cdata-dict. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <zdict.h>
+
+#include <sylverant/config.h>
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "codec.h"
+
+#define DEFAULT_SAMPLES     20000
+#define DEFAULT_DICT_SIZE   (64 * 1024)
+
+/* Big enough for a Blue Burst character. */
+#define MAX_SAMPLE_SIZE     16384
+
+static const char *config_file = NULL;
+static const char *out_file = NULL;
+static long max_samples = DEFAULT_SAMPLES;
+static size_t dict_size = DEFAULT_DICT_SIZE;
+
+/* Print help to the user to stdout. */
+static void print_help(const char *bin) {
+    printf("Usage: %s [arguments] output\n"
+           "-----------------------------------------------------------------\n"
+           "-C configfile   Use the specified configuration instead of the\n"
+           "                default one.\n"
+           "-d filename     Load an existing dictionary, so that rows that\n"
+           "                were compressed with it can be read.\n"
+           "-n samples      Use at most this many rows (default: %d)\n"
+           "-s size         Size of the dictionary to build (default: %d)\n"
+           "--help          Print this help and exit\n", bin, DEFAULT_SAMPLES,
+           DEFAULT_DICT_SIZE);
+}
+
+/* Parse any command-line arguments passed in. */
+static void parse_command_line(int argc, char *argv[]) {
+    int i;
+
+    for(i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-C") || !strcmp(argv[i], "-d") ||
+           !strcmp(argv[i], "-n") || !strcmp(argv[i], "-s")) {
+            if(i == argc - 1) {
+                printf("%s requires an argument!\n\n", argv[i]);
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            switch(argv[i][1]) {
+                case 'C':
+                    config_file = argv[++i];
+                    break;
+
+                case 'd':
+                    if(codec_load_dict(argv[++i]))
+                        exit(EXIT_FAILURE);
+                    break;
+
+                case 'n':
+                    max_samples = strtol(argv[++i], NULL, 0);
+                    break;
+
+                case 's':
+                    dict_size = (size_t)strtoul(argv[++i], NULL, 0);
+                    break;
+            }
+        }
+        else if(!strcmp(argv[i], "--help")) {
+            print_help(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else if(argv[i][0] != '-' && !out_file) {
+            out_file = argv[i];
+        }
+        else {
+            printf("Illegal command line argument: %s\n", argv[i]);
+            print_help(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(!out_file || max_samples <= 0 || !dict_size) {
+        print_help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    sylverant_config_t *cfg;
+    sylverant_dbconn_t conn;
+    char query[256];
+    void *result;
+    char **row;
+    unsigned long *len;
+    static uint8_t buf[MAX_SAMPLE_SIZE];
+    uint8_t *samples = NULL, *dict, *tmp;
+    size_t *sizes, total = 0, alloc = 0, sz;
+    unsigned count = 0;
+    FILE *fp;
+
+    parse_command_line(argc, argv);
+
+    if(sylverant_read_config(config_file, &cfg)) {
+        printf("Cannot load configuration!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(sylverant_db_open(&cfg->dbcfg, &conn)) {
+        printf("Can't connect to the database\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sizes = (size_t *)malloc(max_samples * sizeof(size_t));
+    dict = (uint8_t *)malloc(dict_size);
+
+    if(!sizes || !dict) {
+        printf("Out of memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sprintf(query, "SELECT data, size, codec FROM character_data LIMIT %ld",
+            max_samples);
+
+    if(sylverant_db_query(&conn, query)) {
+        printf("Couldn't fetch character data: %s\n",
+               sylverant_db_error(&conn));
+        exit(EXIT_FAILURE);
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        printf("Couldn't fetch character data: %s\n",
+               sylverant_db_error(&conn));
+        exit(EXIT_FAILURE);
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        /* Rows kept in the blob store don't have any data here. */
+        if(!(len = sylverant_db_result_lengths(result)) || !row[0])
+            continue;
+
+        if(codec_decode(codec_from_row(row[2], row[1]), row[0], len[0], buf,
+                        MAX_SAMPLE_SIZE, &sz)) {
+            printf("Skipping row that couldn't be decoded\n");
+            continue;
+        }
+
+        /* All the samples have to be in one contiguous buffer for training. */
+        if(total + sz > alloc) {
+            alloc = alloc ? alloc * 2 : 1024 * 1024;
+
+            if(!(tmp = (uint8_t *)realloc(samples, alloc))) {
+                printf("Out of memory!\n");
+                exit(EXIT_FAILURE);
+            }
+
+            samples = tmp;
+        }
+
+        memcpy(samples + total, buf, sz);
+        sizes[count++] = sz;
+        total += sz;
+    }
+
+    sylverant_db_result_free(result);
+    sylverant_db_close(&conn);
+    sylverant_free_config(cfg);
+
+    printf("Training dictionary from %u characters (%lu bytes)...\n", count,
+           (unsigned long)total);
+
+    sz = ZDICT_trainFromBuffer(dict, dict_size, samples, sizes, count);
+
+    if(ZDICT_isError(sz)) {
+        printf("Couldn't train dictionary: %s\n", ZDICT_getErrorName(sz));
+        exit(EXIT_FAILURE);
+    }
+
+    if(!(fp = fopen(out_file, "wb"))) {
+        printf("Couldn't open %s: %s\n", out_file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if(fwrite(dict, 1, sz, fp) != sz) {
+        printf("Couldn't write %s: %s\n", out_file, strerror(errno));
+        fclose(fp);
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(fp);
+    printf("Wrote %lu byte dictionary (id: %u) to %s\n", (unsigned long)sz,
+           ZDICT_getDictID(dict, sz), out_file);
+
+    codec_cleanup();
+    free(dict);
+    free(sizes);
+    free(samples);
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+
+#include "charcache.h"
+#include "timer.h"
+
+#define CCACHE_HASH_SIZE    4096
+
+typedef struct ccache_entry {
+    TAILQ_ENTRY(ccache_entry) lru;
+    struct ccache_entry *hnext;
+    uint32_t gc;
+    uint32_t slot;
+    int prefetched;
+    size_t len;
+    uint8_t data[];
+} ccache_entry_t;
+
+TAILQ_HEAD(ccache_lru, ccache_entry);
+
+static ccache_entry_t *hash[CCACHE_HASH_SIZE];
+static struct ccache_lru lru = TAILQ_HEAD_INITIALIZER(lru);
+static size_t max_size, cur_size;
+static int entry_count;
+static int stats_timer = -1;
+
+static struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long inserts;
+    unsigned long evictions;
+    unsigned long prefetched;
+    unsigned long prefetch_hits;
+    unsigned long prefetch_wasted;
+} stats;
+
+static inline int bucket(uint32_t gc, uint32_t slot) {
+    return (gc ^ (slot << 7)) & (CCACHE_HASH_SIZE - 1);
+}
+
+static ccache_entry_t *find_entry(uint32_t gc, uint32_t slot) {
+    ccache_entry_t *i = hash[bucket(gc, slot)];
+
+    while(i) {
+        if(i->gc == gc && i->slot == slot)
+            return i;
+
+        i = i->hnext;
+    }
+
+    return NULL;
+}
+
+static void remove_entry(ccache_entry_t *e) {
+    ccache_entry_t **i = &hash[bucket(e->gc, e->slot)];
+
+    while(*i) {
+        if(*i == e) {
+            *i = e->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    /* If it was prefetched and never used, then the prefetch was a waste. */
+    if(e->prefetched)
+        ++stats.prefetch_wasted;
+
+    TAILQ_REMOVE(&lru, e, lru);
+    cur_size -= sizeof(ccache_entry_t) + e->len;
+    --entry_count;
+    free(e);
+}
+
+static void stats_timer_cb(time_t now, void *data) {
+    unsigned long total = stats.hits + stats.misses;
+
+    (void)now;
+    (void)data;
+
+    debug(DBG_LOG, "Character cache: %lu hits, %lu misses (%.1f%% hit rate), "
+          "%lu inserts, %lu evictions, %d characters (%lu bytes)\n",
+          stats.hits, stats.misses, total ? 100.0 * stats.hits / total : 0.0,
+          stats.inserts, stats.evictions, entry_count,
+          (unsigned long)cur_size);
+
+    if(stats.prefetched)
+        debug(DBG_LOG, "Character prefetch: %lu prefetched, %lu used (%.1f%%), "
+              "%lu wasted\n", stats.prefetched, stats.prefetch_hits,
+              100.0 * stats.prefetch_hits / stats.prefetched,
+              stats.prefetch_wasted);
+}
+
+int ccache_init(size_t size) {
+    memset(hash, 0, sizeof(hash));
+    memset(&stats, 0, sizeof(stats));
+    TAILQ_INIT(&lru);
+    max_size = size;
+    cur_size = 0;
+    entry_count = 0;
+
+    if(size)
+        stats_timer = timer_add(CCACHE_STATS_INTERVAL, &stats_timer_cb, NULL);
+
+    return 0;
+}
+
+void ccache_cleanup(void) {
+    if(stats_timer != -1) {
+        stats_timer_cb(0, NULL);
+        timer_remove(stats_timer);
+        stats_timer = -1;
+    }
+
+    ccache_clear();
+    max_size = 0;
+}
+
+static void insert(uint32_t gc, uint32_t slot, const void *data, size_t len,
+                   int prefetched) {
+    ccache_entry_t *e;
+    size_t sz = sizeof(ccache_entry_t) + len;
+    int b = bucket(gc, slot);
+
+    if(sz > max_size)
+        return;
+
+    /* Make room for it. */
+    while(cur_size + sz > max_size) {
+        remove_entry(TAILQ_LAST(&lru, ccache_lru));
+        ++stats.evictions;
+    }
+
+    if(!(e = (ccache_entry_t *)malloc(sz)))
+        return;
+
+    e->gc = gc;
+    e->slot = slot;
+    e->prefetched = prefetched;
+    e->len = len;
+    memcpy(e->data, data, len);
+
+    e->hnext = hash[b];
+    hash[b] = e;
+    TAILQ_INSERT_HEAD(&lru, e, lru);
+    cur_size += sz;
+    ++entry_count;
+    ++stats.inserts;
+}
+
+void ccache_put(uint32_t gc, uint32_t slot, const void *data, size_t len) {
+    ccache_entry_t *e;
+
+    if(!max_size)
+        return;
+
+    if((e = find_entry(gc, slot)))
+        remove_entry(e);
+
+    insert(gc, slot, data, len, 0);
+}
+
+void ccache_prefetch(uint32_t gc, uint32_t slot, const void *data,
+                     size_t len) {
+    if(!max_size || find_entry(gc, slot))
+        return;
+
+    insert(gc, slot, data, len, 1);
+    ++stats.prefetched;
+}
+
+int ccache_enabled(void) {
+    return max_size != 0;
+}
+
+int ccache_has(uint32_t gc, uint32_t slot) {
+    return find_entry(gc, slot) != NULL;
+}
+
+int ccache_get(uint32_t gc, uint32_t slot, const uint8_t **data, size_t *len) {
+    ccache_entry_t *e;
+
+    if(!max_size)
+        return -1;
+
+    if(!(e = find_entry(gc, slot))) {
+        ++stats.misses;
+        return -1;
+    }
+
+    TAILQ_REMOVE(&lru, e, lru);
+    TAILQ_INSERT_HEAD(&lru, e, lru);
+    ++stats.hits;
+
+    if(e->prefetched) {
+        e->prefetched = 0;
+        ++stats.prefetch_hits;
+    }
+
+    *data = e->data;
+    *len = e->len;
+    return 0;
+}
+
+void ccache_invalidate(uint32_t gc, uint32_t slot) {
+    ccache_entry_t *e;
+
+    if((e = find_entry(gc, slot)))
+        remove_entry(e);
+}
+
+void ccache_clear(void) {
+    ccache_entry_t *e;
+
+    while((e = TAILQ_FIRST(&lru))) {
+        remove_entry(e);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHARCACHE_H
+#define CHARCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Default amount of memory (in bytes) to use for caching recently saved or
+   loaded characters. */
+#ifndef CCACHE_SIZE_DEFAULT
+#define CCACHE_SIZE_DEFAULT     (32 * 1024 * 1024)
+#endif
+
+/* How often (in seconds) to log cache statistics. */
+#ifndef CCACHE_STATS_INTERVAL
+#define CCACHE_STATS_INTERVAL   600
+#endif
+
+/* Set up the character cache, using at most the given number of bytes. A size
+   of 0 disables the cache. */
+int ccache_init(size_t size);
+
+/* Clean up the character cache. */
+void ccache_cleanup(void);
+
+/* Add (uncompressed) character data to the cache, replacing anything already
+   cached for that character. */
+void ccache_put(uint32_t gc, uint32_t slot, const void *data, size_t len);
+
+/* Add character data that was loaded ahead of time (because the player just
+   logged in) to the cache. If the character is already cached, then what's in
+   the cache is at least as new, so this does nothing. */
+void ccache_prefetch(uint32_t gc, uint32_t slot, const void *data,
+                     size_t len);
+
+/* Returns non-zero if the cache is enabled. */
+int ccache_enabled(void);
+
+/* Returns non-zero if the character is cached, without counting it as a hit
+   or a miss. */
+int ccache_has(uint32_t gc, uint32_t slot);
+
+/* Look up cached character data. Returns 0 and fills in data and len if found.
+   The data is only valid until the next call into the cache. */
+int ccache_get(uint32_t gc, uint32_t slot, const uint8_t **data, size_t *len);
+
+/* Drop a character from the cache. */
+void ccache_invalidate(uint32_t gc, uint32_t slot);
+
+/* Drop everything from the cache. */
+void ccache_clear(void);
+
+#endif /* !CHARCACHE_H */
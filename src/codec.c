@@ -0,0 +1,381 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <pthread.h>
+#endif
+
+#include <sylverant/debug.h>
+
+#include "codec.h"
+
+static const char *codec_names[CODEC_COUNT] = {
+    "none", "zlib", "zstd", "zstd+dict"
+};
+
+static int default_codec = CODEC_ZLIB;
+
+#ifdef HAVE_ZSTD
+typedef struct codec_dict {
+    unsigned id;
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddict;
+} codec_dict_t;
+
+static codec_dict_t dicts[CODEC_MAX_DICTS];
+static int dict_count;
+
+/* Compression contexts aren't safe to share between threads, but they're not
+   cheap to set up either, so keep one of each around per thread. They're freed
+   when the thread exits (or for the main thread, in codec_cleanup()). */
+typedef struct codec_ctx {
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+} codec_ctx_t;
+
+static pthread_key_t ctx_key;
+static pthread_once_t ctx_once = PTHREAD_ONCE_INIT;
+static int ctx_key_ok;
+
+static void free_ctx(void *data) {
+    codec_ctx_t *c = (codec_ctx_t *)data;
+
+    ZSTD_freeCCtx(c->cctx);
+    ZSTD_freeDCtx(c->dctx);
+    free(c);
+}
+
+static void make_ctx_key(void) {
+    if(pthread_key_create(&ctx_key, &free_ctx))
+        debug(DBG_ERROR, "Cannot create zstd context key\n");
+    else
+        ctx_key_ok = 1;
+}
+
+/* Get the calling thread's contexts, setting them up if it doesn't have any
+   yet. The contexts themselves are made when they're first needed. */
+static codec_ctx_t *get_ctx(void) {
+    codec_ctx_t *c;
+
+    pthread_once(&ctx_once, &make_ctx_key);
+
+    if(!ctx_key_ok)
+        return NULL;
+
+    if((c = (codec_ctx_t *)pthread_getspecific(ctx_key)))
+        return c;
+
+    if(!(c = (codec_ctx_t *)calloc(1, sizeof(codec_ctx_t))))
+        return NULL;
+
+    if(pthread_setspecific(ctx_key, c)) {
+        free(c);
+        return NULL;
+    }
+
+    return c;
+}
+#endif
+
+int codec_set_default(int codec) {
+    switch(codec) {
+        case CODEC_NONE:
+        case CODEC_ZLIB:
+            break;
+
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD:
+            if(dict_count)
+                codec = CODEC_ZSTD_DICT;
+            break;
+
+        case CODEC_ZSTD_DICT:
+            if(!dict_count)
+                return -1;
+            break;
+#endif
+
+        default:
+            return -1;
+    }
+
+    default_codec = codec;
+    return 0;
+}
+
+int codec_by_name(const char *name) {
+    int i;
+
+    for(i = 0; i < CODEC_COUNT; ++i) {
+        if(!strcmp(name, codec_names[i]))
+            return i;
+    }
+
+    return -1;
+}
+
+const char *codec_name(int codec) {
+    if(codec < 0 || codec >= CODEC_COUNT)
+        return "unknown";
+
+    return codec_names[codec];
+}
+
+int codec_load_dict(const char *fn) {
+#ifdef HAVE_ZSTD
+    FILE *fp;
+    long sz;
+    void *buf;
+    codec_dict_t *d;
+
+    if(dict_count == CODEC_MAX_DICTS) {
+        debug(DBG_ERROR, "Too many dictionaries loaded, ignoring %s\n", fn);
+        return -1;
+    }
+
+    if(!(fp = fopen(fn, "rb"))) {
+        debug(DBG_ERROR, "Cannot open dictionary %s: %s\n", fn,
+              strerror(errno));
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    sz = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if(sz <= 0 || !(buf = malloc(sz))) {
+        debug(DBG_ERROR, "Cannot read dictionary %s\n", fn);
+        fclose(fp);
+        return -1;
+    }
+
+    if(fread(buf, 1, sz, fp) != (size_t)sz) {
+        debug(DBG_ERROR, "Cannot read dictionary %s\n", fn);
+        free(buf);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    d = &dicts[dict_count];
+    d->id = ZSTD_getDictID_fromDict(buf, sz);
+    d->cdict = ZSTD_createCDict(buf, sz, CODEC_ZSTD_LEVEL);
+    d->ddict = ZSTD_createDDict(buf, sz);
+    free(buf);
+
+    if(!d->id || !d->cdict || !d->ddict) {
+        debug(DBG_ERROR, "Invalid dictionary: %s\n", fn);
+        ZSTD_freeCDict(d->cdict);
+        ZSTD_freeDDict(d->ddict);
+        return -1;
+    }
+
+    debug(DBG_LOG, "Loaded dictionary %s (id: %u)\n", fn, d->id);
+
+    if(++dict_count == 1 && default_codec == CODEC_ZSTD)
+        default_codec = CODEC_ZSTD_DICT;
+
+    return 0;
+#else
+    debug(DBG_ERROR, "Cannot load %s: built without zstd support\n", fn);
+    return -1;
+#endif
+}
+
+void codec_cleanup(void) {
+#ifdef HAVE_ZSTD
+    codec_ctx_t *c;
+    int i;
+
+    /* Thread-specific data isn't cleaned up when the main thread exits, so
+       free its contexts here. */
+    if(ctx_key_ok && (c = (codec_ctx_t *)pthread_getspecific(ctx_key))) {
+        pthread_setspecific(ctx_key, NULL);
+        free_ctx(c);
+    }
+
+    for(i = 0; i < dict_count; ++i) {
+        ZSTD_freeCDict(dicts[i].cdict);
+        ZSTD_freeDDict(dicts[i].ddict);
+    }
+
+    dict_count = 0;
+
+    if(default_codec == CODEC_ZSTD_DICT)
+        default_codec = CODEC_ZSTD;
+#endif
+}
+
+int codec_from_row(const char *codec_col, const char *size_col) {
+    if(codec_col)
+        return atoi(codec_col);
+
+    /* Old rows only have the size set when the data is compressed. */
+    return size_col ? CODEC_ZLIB : CODEC_NONE;
+}
+
+int codec_encode(const void *in, size_t len, uint8_t **out, size_t *out_len,
+                 int *codec) {
+    uint8_t *buf;
+    size_t sz;
+    uLong zsz;
+    int rv = -1;
+#ifdef HAVE_ZSTD
+    codec_ctx_t *c;
+#endif
+
+    *out = NULL;
+    *out_len = 0;
+    *codec = CODEC_NONE;
+
+    switch(default_codec) {
+        case CODEC_NONE:
+            return 0;
+
+        case CODEC_ZLIB:
+            zsz = compressBound((uLong)len);
+
+            if(!(buf = (uint8_t *)malloc(zsz)))
+                return -1;
+
+            if(compress2(buf, &zsz, (const Bytef *)in, (uLong)len,
+                         CODEC_ZLIB_LEVEL) == Z_OK) {
+                sz = (size_t)zsz;
+                rv = 0;
+            }
+            break;
+
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD:
+        case CODEC_ZSTD_DICT:
+            sz = ZSTD_compressBound(len);
+
+            if(!(buf = (uint8_t *)malloc(sz)))
+                return -1;
+
+            if(!(c = get_ctx()) ||
+               (!c->cctx && !(c->cctx = ZSTD_createCCtx()))) {
+                free(buf);
+                return -1;
+            }
+
+            if(default_codec == CODEC_ZSTD_DICT)
+                sz = ZSTD_compress_usingCDict(c->cctx, buf, sz, in, len,
+                                              dicts[0].cdict);
+            else
+                sz = ZSTD_compressCCtx(c->cctx, buf, sz, in, len,
+                                       CODEC_ZSTD_LEVEL);
+
+            if(!ZSTD_isError(sz))
+                rv = 0;
+            break;
+#endif
+
+        default:
+            return -1;
+    }
+
+    /* If it didn't shrink, then don't bother with it. */
+    if(rv || sz >= len) {
+        free(buf);
+        return rv;
+    }
+
+    *out = buf;
+    *out_len = sz;
+    *codec = default_codec;
+    return 0;
+}
+
+int codec_decode(int codec, const void *in, size_t len, void *out,
+                 size_t orig_len, size_t *out_len) {
+    uLong zsz;
+#ifdef HAVE_ZSTD
+    codec_ctx_t *c;
+    size_t sz;
+    unsigned id;
+    int i;
+#endif
+
+    switch(codec) {
+        case CODEC_NONE:
+            if(len > orig_len)
+                return -1;
+
+            memcpy(out, in, len);
+            *out_len = len;
+            return 0;
+
+        case CODEC_ZLIB:
+            zsz = (uLong)orig_len;
+
+            if(uncompress((Bytef *)out, &zsz, (const Bytef *)in,
+                          (uLong)len) != Z_OK)
+                return -1;
+
+            *out_len = (size_t)zsz;
+            return 0;
+
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD:
+        case CODEC_ZSTD_DICT:
+            if(!(c = get_ctx()) ||
+               (!c->dctx && !(c->dctx = ZSTD_createDCtx())))
+                return -1;
+
+            if(codec == CODEC_ZSTD) {
+                sz = ZSTD_decompressDCtx(c->dctx, out, orig_len, in, len);
+            }
+            else {
+                /* Find the dictionary it was compressed with. */
+                id = ZSTD_getDictID_fromFrame(in, len);
+
+                for(i = 0; i < dict_count; ++i) {
+                    if(dicts[i].id == id)
+                        break;
+                }
+
+                if(i == dict_count) {
+                    debug(DBG_WARN, "Data needs unknown dictionary %u\n", id);
+                    return -1;
+                }
+
+                sz = ZSTD_decompress_usingDDict(c->dctx, out, orig_len, in,
+                                                len, dicts[i].ddict);
+            }
+
+            if(ZSTD_isError(sz))
+                return -1;
+
+            *out_len = sz;
+            return 0;
+#endif
+
+        default:
+            debug(DBG_WARN, "Data stored with unsupported codec %d\n", codec);
+            return -1;
+    }
+}
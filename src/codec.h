@@ -0,0 +1,81 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Codec IDs, as stored in the codec column of the character_data and
+   character_backup tables. Rows where that column is NULL were written before
+   it existed, and are zlib compressed if the size column is set. */
+#define CODEC_NONE          0
+#define CODEC_ZLIB          1
+#define CODEC_ZSTD          2
+#define CODEC_ZSTD_DICT     3
+
+#define CODEC_COUNT         4
+
+/* Compression levels used when encoding. */
+#ifndef CODEC_ZLIB_LEVEL
+#define CODEC_ZLIB_LEVEL    6
+#endif
+
+#ifndef CODEC_ZSTD_LEVEL
+#define CODEC_ZSTD_LEVEL    3
+#endif
+
+/* Maximum number of dictionaries that can be loaded at once. The first one
+   loaded is used for compression, the rest are kept around so that data
+   compressed with older dictionaries can still be read. */
+#define CODEC_MAX_DICTS     8
+
+/* Pick the codec to use for new data. Returns -1 if the codec isn't supported
+   in this build. */
+int codec_set_default(int codec);
+
+/* Look up a codec by name ("none", "zlib", "zstd"). Returns -1 if unknown. */
+int codec_by_name(const char *name);
+
+/* Get the name of a codec. */
+const char *codec_name(int codec);
+
+/* Load a zstd dictionary from a file. Once a dictionary is loaded, the default
+   codec becomes CODEC_ZSTD_DICT if it was CODEC_ZSTD. */
+int codec_load_dict(const char *fn);
+
+/* Free any loaded dictionaries. */
+void codec_cleanup(void);
+
+/* Figure out the codec of a stored row from its codec and size columns. */
+int codec_from_row(const char *codec_col, const char *size_col);
+
+/* Encode data with the default codec. On success, *out points to a newly
+   allocated buffer with the encoded data and *codec holds the codec used. If
+   the data doesn't compress, *out is set to NULL and *codec to CODEC_NONE, and
+   the caller should store the data as-is. Returns 0 on success. */
+int codec_encode(const void *in, size_t len, uint8_t **out, size_t *out_len,
+                 int *codec);
+
+/* Decode data that was stored with the given codec into out, which should be
+   big enough for orig_len bytes. *out_len is set to the decoded length.
+   Returns 0 on success. */
+int codec_decode(int codec, const void *in, size_t len, void *out,
+                 size_t orig_len, size_t *out_len);
+
+#endif /* !CODEC_H */
@@ -0,0 +1,530 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "events.h"
+#include "leaders.h"
+#include "timer.h"
+
+extern sylverant_dbconn_t conn;
+
+uint32_t event_count;
+monster_event_t *events;
+
+/* The events going on right now, indexed by version, difficulty, and whether
+   the player is in a quest. Each slot is a range of the list, which is rebuilt
+   whenever an event starts or ends. */
+#define INDEX_VERSIONS      8
+#define INDEX_DIFFICULTIES  8
+#define INDEX_SLOTS         (INDEX_VERSIONS * INDEX_DIFFICULTIES * 2)
+
+static monster_event_t **active;
+static uint32_t active_count;
+static uint32_t slot_start[INDEX_SLOTS + 1];
+static monster_event_t **index_list;
+
+/* Everyone disqualified from an event that hasn't ended yet, sorted by event
+   and then account, so they can be found with a binary search. */
+typedef struct disq {
+    uint32_t event_id;
+    uint32_t acc;
+    int notified;
+} disq_t;
+
+static disq_t *disq;
+static uint32_t disq_count;
+
+static int reload_timer = -1;
+static int boundary_timer = -1;
+static int disq_timer = -1;
+
+static int load_events(int verbose);
+static int load_disq(void);
+static void rebuild_index(time_t now);
+
+static void boundary_timer_cb(time_t now, void *data) {
+    (void)data;
+
+    /* The timer is already gone, so don't try to remove it again. */
+    boundary_timer = -1;
+    rebuild_index(now);
+}
+
+static void reload_timer_cb(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    load_events(0);
+}
+
+static void disq_timer_cb(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    load_disq();
+}
+
+static int disq_cmp(const void *a, const void *b) {
+    const disq_t *x = (const disq_t *)a, *y = (const disq_t *)b;
+
+    if(x->event_id != y->event_id)
+        return x->event_id < y->event_id ? -1 : 1;
+    if(x->acc != y->acc)
+        return x->acc < y->acc ? -1 : 1;
+
+    return 0;
+}
+
+static disq_t *find_disq(uint32_t event_id, uint32_t acc) {
+    disq_t key;
+
+    if(!disq_count)
+        return NULL;
+
+    key.event_id = event_id;
+    key.acc = acc;
+
+    return (disq_t *)bsearch(&key, disq, disq_count, sizeof(disq_t),
+                             &disq_cmp);
+}
+
+static int load_disq(void) {
+    void *result;
+    char **row;
+    long long rows;
+    disq_t *list = NULL;
+    uint32_t count = 0, i;
+
+    if(sylverant_db_query(&conn, "SELECT d.event_id, d.account_id, d.flags "
+                          "FROM monster_event_disq d JOIN monster_events e ON "
+                          "e.event_id=d.event_id WHERE e.end_time > "
+                          "UNIX_TIMESTAMP()")) {
+        debug(DBG_WARN, "Couldn't fetch disqualifications from database!\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Could not store results of disqualification "
+              "select!\n");
+        return -1;
+    }
+
+    if((rows = sylverant_db_result_rows(result)) < 0) {
+        debug(DBG_WARN, "Couldn't fetch disqualification count!\n");
+        sylverant_db_result_free(result);
+        return -1;
+    }
+
+    if(rows && !(list = (disq_t *)malloc(rows * sizeof(disq_t)))) {
+        debug(DBG_WARN, "Error allocating memory for disqualifications!\n");
+        sylverant_db_result_free(result);
+        return -1;
+    }
+
+    while((row = sylverant_db_result_fetch(result)) && count < rows) {
+        list[count].event_id = (uint32_t)strtoul(row[0], NULL, 0);
+        list[count].acc = (uint32_t)strtoul(row[1], NULL, 0);
+        list[count].notified = row[2] && strtoul(row[2], NULL, 0);
+        ++count;
+    }
+
+    sylverant_db_result_free(result);
+
+    if(count)
+        qsort(list, count, sizeof(disq_t), &disq_cmp);
+
+    /* Anyone that's just been disqualified has to come off the leaderboards,
+       since their kills up until now are still on there. */
+    for(i = 0; i < count; ++i) {
+        if(!find_disq(list[i].event_id, list[i].acc))
+            leaders_remove(list[i].event_id, list[i].acc);
+    }
+
+    free(disq);
+    disq = list;
+    disq_count = count;
+
+    return 0;
+}
+
+static inline int slot_of(int ver, int difficulty, int questing) {
+    return (ver * INDEX_DIFFICULTIES + difficulty) * 2 + questing;
+}
+
+static int counts_for(monster_event_t *ev, int ver, int difficulty,
+                      int questing) {
+    return (ev->versions & (1 << ver)) &&
+        (ev->difficulties & (1 << difficulty)) &&
+        (ev->allow_quests || !questing);
+}
+
+/* Figure out which events are going on right now, and set up a timer for the
+   next time that changes. */
+static void rebuild_index(time_t now) {
+    monster_event_t **list = NULL, **all;
+    uint32_t i, n = 0, total = 0;
+    time_t next = 0;
+    int v, d, q, s;
+
+    if(boundary_timer != -1) {
+        timer_remove(boundary_timer);
+        boundary_timer = -1;
+    }
+
+    free(active);
+    free(index_list);
+    active = index_list = NULL;
+    active_count = 0;
+    memset(slot_start, 0, sizeof(slot_start));
+
+    /* An event is on from the second it starts through the second it ends. */
+    for(i = 0; i < event_count; ++i) {
+        if(events[i].start_time > now) {
+            if(!next || events[i].start_time < next)
+                next = events[i].start_time;
+        }
+        else if(events[i].end_time >= now) {
+            if(!next || (time_t)events[i].end_time + 1 < next)
+                next = (time_t)events[i].end_time + 1;
+
+            ++n;
+        }
+    }
+
+    if(next)
+        boundary_timer = timer_add_at(next, &boundary_timer_cb, NULL);
+
+    if(!n)
+        return;
+
+    if(!(all = (monster_event_t **)malloc(n * sizeof(monster_event_t *)))) {
+        debug(DBG_WARN, "Couldn't allocate event index!\n");
+        return;
+    }
+
+    for(i = 0; i < event_count; ++i) {
+        if(events[i].start_time <= now && events[i].end_time >= now)
+            all[active_count++] = &events[i];
+    }
+
+    /* Count up how big each slot is, then fill them in. */
+    for(s = 0, v = 0; v < INDEX_VERSIONS; ++v) {
+        for(d = 0; d < INDEX_DIFFICULTIES; ++d) {
+            for(q = 0; q < 2; ++q, ++s) {
+                slot_start[s] = total;
+
+                for(i = 0; i < active_count; ++i) {
+                    if(counts_for(all[i], v, d, q))
+                        ++total;
+                }
+            }
+        }
+    }
+
+    slot_start[INDEX_SLOTS] = total;
+
+    if(total && !(list = (monster_event_t **)malloc(total *
+                                                    sizeof(monster_event_t *)))) {
+        debug(DBG_WARN, "Couldn't allocate event index!\n");
+        free(all);
+        active_count = 0;
+        memset(slot_start, 0, sizeof(slot_start));
+        return;
+    }
+
+    for(s = 0, v = 0; v < INDEX_VERSIONS; ++v) {
+        for(d = 0; d < INDEX_DIFFICULTIES; ++d) {
+            for(q = 0; q < 2; ++q, ++s) {
+                n = slot_start[s];
+
+                for(i = 0; i < active_count; ++i) {
+                    if(counts_for(all[i], v, d, q))
+                        list[n++] = all[i];
+                }
+            }
+        }
+    }
+
+    active = all;
+    index_list = list;
+}
+
+/* Pack the events, their monsters, and their titles into one block. The
+   titles are given as offsets into the title buffer. */
+static monster_event_t *pack_events(monster_event_t *evs, uint32_t count,
+                                    event_monster_t *mons, uint32_t mcount,
+                                    const char *titles, size_t tlen) {
+    monster_event_t *rv;
+    event_monster_t *m;
+    char *t;
+    uint32_t i;
+
+    /* There's always at least a byte, so that an empty set isn't mistaken for
+       running out of memory. */
+    if(!(rv = (monster_event_t *)malloc(count * sizeof(monster_event_t) +
+                                        mcount * sizeof(event_monster_t) +
+                                        tlen + 1)))
+        return NULL;
+
+    m = (event_monster_t *)(rv + count);
+    t = (char *)(m + mcount);
+
+    memcpy(rv, evs, count * sizeof(monster_event_t));
+    memcpy(m, mons, mcount * sizeof(event_monster_t));
+    if(tlen)
+        memcpy(t, titles, tlen);
+
+    /* Until now, the pointers were just offsets. */
+    for(i = 0; i < count; ++i) {
+        rv[i].event_title = t + (uintptr_t)rv[i].event_title;
+        rv[i].monsters = m + (uintptr_t)rv[i].monsters;
+    }
+
+    return rv;
+}
+
+static int load_events(int verbose) {
+    void *result;
+    char **row;
+    long long rows;
+    monster_event_t *evs = NULL, *ev = NULL, *packed, *old;
+    event_monster_t *mons = NULL;
+    uint32_t count = 0, mcount = 0, id, i;
+    char *titles = NULL, *tmp;
+    const char *title;
+    size_t tlen = 0, tsize = 0, len;
+    int rv = -1;
+
+    /* Everything comes back in one go, with a row for each monster (or one
+       row with no monster, for an event that doesn't have any). */
+    if(sylverant_db_query(&conn, "SELECT e.event_id, e.title, e.start_time, "
+                          "e.end_time, e.difficulties, e.versions, "
+                          "e.allow_quests, m.monster_type, m.episode FROM "
+                          "monster_events e LEFT JOIN monster_event_monsters "
+                          "m ON m.event_id=e.event_id WHERE e.end_time > "
+                          "UNIX_TIMESTAMP() ORDER BY e.start_time, "
+                          "e.event_id")) {
+        debug(DBG_WARN, "Couldn't fetch events from database!\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Could not store results of event select!\n");
+        return -1;
+    }
+
+    if((rows = sylverant_db_result_rows(result)) < 0) {
+        debug(DBG_WARN, "Couldn't fetch event count!\n");
+        goto out;
+    }
+
+    /* There can't be more events or monsters than rows. */
+    if(rows && (!(evs = (monster_event_t *)malloc(rows *
+                                                  sizeof(monster_event_t))) ||
+                !(mons = (event_monster_t *)malloc(rows *
+                                                   sizeof(event_monster_t))))) {
+        debug(DBG_WARN, "Error allocating memory for events!\n");
+        goto out;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        id = (uint32_t)strtoul(row[0], NULL, 0);
+
+        /* Is this the start of a new event? */
+        if(!ev || ev->event_id != id) {
+            if(count == rows) {
+                debug(DBG_WARN, "Got more result rows than expected?!\n");
+                goto out;
+            }
+
+            title = row[1] ? row[1] : "";
+            len = strlen(title) + 1;
+
+            if(tlen + len > tsize) {
+                tsize = (tlen + len) * 2;
+
+                if(!(tmp = (char *)realloc(titles, tsize))) {
+                    debug(DBG_WARN, "Error copying event title!\n");
+                    goto out;
+                }
+
+                titles = tmp;
+            }
+
+            ev = &evs[count++];
+            memset(ev, 0, sizeof(monster_event_t));
+            ev->event_id = id;
+            ev->start_time = strtoul(row[2], NULL, 0);
+            ev->end_time = strtoul(row[3], NULL, 0);
+            ev->difficulties = (uint8_t)strtoul(row[4], NULL, 0);
+            ev->versions = (uint8_t)strtoul(row[5], NULL, 0);
+            ev->allow_quests = (uint8_t)strtoul(row[6], NULL, 0);
+
+            /* These are offsets until everything is packed together. */
+            ev->event_title = (char *)(uintptr_t)tlen;
+            ev->monsters = (event_monster_t *)(uintptr_t)mcount;
+
+            memcpy(titles + tlen, title, len);
+            tlen += len;
+        }
+
+        if(!row[7])
+            continue;
+
+        if(ev->monster_count == EVENTS_MAX_MONSTERS || mcount == rows) {
+            debug(DBG_WARN, "Too many monsters in event %" PRIu32 "\n", id);
+            goto out;
+        }
+
+        mons[mcount].monster = (uint16_t)strtoul(row[7], NULL, 0);
+        mons[mcount].episode = (uint8_t)strtoul(row[8], NULL, 0);
+        mons[mcount].reserved = 0;
+        ++mcount;
+        ++ev->monster_count;
+    }
+
+    if(!(packed = pack_events(evs, count, mons, mcount, titles, tlen))) {
+        debug(DBG_WARN, "Error allocating memory for events!\n");
+        goto out;
+    }
+
+    /* Swap in the new set. Nothing holds onto events between packets, so the
+       old one can go right away. */
+    old = events;
+    events = packed;
+    event_count = count;
+    rebuild_index(time(NULL));
+    free(old);
+
+    /* If this doesn't work, the last list is still better than nothing. */
+    load_disq();
+
+    if(verbose) {
+        for(i = 0; i < event_count; ++i) {
+            debug(DBG_LOG, "Event ID %" PRIu32 " (%s) - %" PRIu32
+                  " enemies.\n", events[i].event_id, events[i].event_title,
+                  events[i].monster_count);
+        }
+
+        debug(DBG_LOG, "Read %" PRIu32 " events successfully.\n",
+              event_count);
+    }
+
+    rv = 0;
+
+out:
+    sylverant_db_result_free(result);
+    free(titles);
+    free(mons);
+    free(evs);
+
+    return rv;
+}
+
+int events_reload(void) {
+    debug(DBG_LOG, "Reading events from the database...\n");
+    return load_events(1);
+}
+
+int events_init(void) {
+    if(events_reload())
+        return -1;
+
+    reload_timer = timer_add(EVENTS_RELOAD_INTERVAL, &reload_timer_cb, NULL);
+    disq_timer = timer_add(EVENTS_DISQ_INTERVAL, &disq_timer_cb, NULL);
+
+    return 0;
+}
+
+void events_cleanup(void) {
+    timer_remove(reload_timer);
+    reload_timer = -1;
+    timer_remove(boundary_timer);
+    boundary_timer = -1;
+    timer_remove(disq_timer);
+    disq_timer = -1;
+
+    free(disq);
+    disq = NULL;
+    disq_count = 0;
+
+    free(active);
+    free(index_list);
+    active = index_list = NULL;
+    active_count = 0;
+    memset(slot_start, 0, sizeof(slot_start));
+
+    free(events);
+    events = NULL;
+    event_count = 0;
+}
+
+uint32_t events_find(uint8_t difficulty, uint8_t ver, monster_event_t ***evs) {
+    int s;
+
+    /* Challenge and battle mode don't count towards any events. */
+    if((ver & 0xC0) || difficulty >= INDEX_DIFFICULTIES)
+        return 0;
+
+    s = slot_of(ver & 0x07, difficulty, (ver & 0x20) ? 1 : 0);
+    *evs = index_list + slot_start[s];
+
+    return slot_start[s + 1] - slot_start[s];
+}
+
+uint32_t events_find_all(monster_event_t ***evs) {
+    *evs = active;
+    return active_count;
+}
+
+int events_disqualified(uint32_t event_id, uint32_t acc, int *notified) {
+    disq_t *d = find_disq(event_id, acc);
+
+    if(!d)
+        return 0;
+
+    if(notified)
+        *notified = d->notified;
+
+    return 1;
+}
+
+void events_disq_notified(uint32_t event_id, uint32_t acc) {
+    char query[256];
+    disq_t *d = find_disq(event_id, acc);
+
+    if(d)
+        d->notified = 1;
+
+    sprintf(query, "UPDATE monster_event_disq SET flags='1' WHERE "
+            "event_id='%" PRIu32 "' AND account_id='%" PRIu32 "'", event_id,
+            acc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't mark disqualification as notified\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    }
+}
@@ -0,0 +1,73 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+#include "ship.h"
+
+/* How often (in seconds) the events are reloaded from the database, to pick up
+   any changes made to them. */
+#ifndef EVENTS_RELOAD_INTERVAL
+#define EVENTS_RELOAD_INTERVAL  300
+#endif
+
+/* How often (in seconds) the list of disqualified players is reloaded. This is
+   done more often than the events themselves, since it changes a lot more. */
+#ifndef EVENTS_DISQ_INTERVAL
+#define EVENTS_DISQ_INTERVAL    60
+#endif
+
+/* Most monsters an event can have. */
+#define EVENTS_MAX_MONSTERS     256
+
+/* The events that haven't ended yet, sorted by start time. The whole set (with
+   the titles and monster lists) is one allocation, which is swapped out all at
+   once when the events are reloaded. */
+extern uint32_t event_count;
+extern monster_event_t *events;
+
+/* Load the events and start reloading them periodically. */
+int events_init(void);
+
+/* Clean up the events. */
+void events_cleanup(void);
+
+/* Reload the events from the database. If that fails, the ones already loaded
+   are kept. */
+int events_reload(void);
+
+/* Find the events going on right now that count kills for the given
+   difficulty and version (with the questing and mode flags, as sent by the
+   ships). Returns the number of events, with the list of them stored in evs.
+   The list is only good until an event starts or ends, or the events are
+   reloaded, so it shouldn't be kept past handling one packet. */
+uint32_t events_find(uint8_t difficulty, uint8_t ver, monster_event_t ***evs);
+
+/* Find all of the events going on right now, like events_find(). */
+uint32_t events_find_all(monster_event_t ***evs);
+
+/* Returns non-zero if the account is disqualified from the event. If notified
+   is not NULL, it is set to whether they've been told about it yet. */
+int events_disqualified(uint32_t event_id, uint32_t acc, int *notified);
+
+/* Note that a disqualified player has been told about it. */
+void events_disq_notified(uint32_t event_id, uint32_t acc);
+
+#endif /* !EVENTS_H */
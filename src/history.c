@@ -0,0 +1,663 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include <zlib.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "history.h"
+#include "codec.h"
+#include "blobstore.h"
+
+/* Old versions of characters are kept in the character_history table. Each row
+   is either a full copy of the character (kind 0), stored the same way as in
+   character_data, or a delta against the version right before it (kind 1).
+   Since characters are a fixed size and most saves only change a few things,
+   the deltas are just the runs of bytes that changed. Each row also has the
+   CRC of the whole character at that version, so a broken chain gets noticed
+   when rebuilding instead of sending garbage to the ship. */
+
+#define HIST_HASH_SIZE      1024
+
+#define KIND_FULL           0
+#define KIND_DELTA          1
+
+/* Equal runs shorter than this are just included in the changed run, since it
+   would cost more to start a new one. */
+#define DELTA_MIN_GAP       4
+
+extern sylverant_dbconn_t conn;
+
+/* Whether a version was written. Each job gets one, and the job for the next
+   version of the same character holds on to it too, so that it can store a
+   full copy instead of a delta against a version that never made it in. It's
+   only set and read on the worker for the character (which runs its jobs in
+   order), and only counted on the main thread. */
+typedef struct hist_link {
+    int refs;
+    int err;
+} hist_link_t;
+
+/* The last version of a character that was recorded. The version is 0 if it
+   isn't known yet (it gets looked up by the worker). */
+typedef struct hist_entry {
+    TAILQ_ENTRY(hist_entry) lru;
+    struct hist_entry *hnext;
+    uint32_t gc;
+    uint32_t slot;
+    char name[32];
+    uint32_t version;
+    uint32_t id;
+    int since_full;
+    hist_link_t *link;
+    size_t len;
+    uint8_t data[];
+} hist_entry_t;
+
+TAILQ_HEAD(hist_lru, hist_entry);
+
+typedef struct hist_row {
+    int kind;
+    int codec;
+    uint32_t crc;
+    size_t size;
+    uint8_t *data;
+    size_t len;
+} hist_row_t;
+
+struct hist_chain {
+    int count;
+    hist_row_t rows[];
+};
+
+struct hist_job {
+    uint32_t gc;
+    uint32_t slot;
+    char name[32];
+    uint32_t version;
+    uint32_t id;
+    int kind;
+    hist_link_t *prev;
+    hist_link_t *link;
+    uint8_t *delta;
+    long dlen;
+    size_t len;
+    uint8_t data[];
+};
+
+static hist_entry_t *hash[HIST_HASH_SIZE];
+static struct hist_lru lru = TAILQ_HEAD_INITIALIZER(lru);
+static int entry_count;
+static int keep_versions;
+static uint32_t next_id;
+
+static inline int bucket(uint32_t gc, uint32_t slot) {
+    return (gc ^ (slot << 7)) & (HIST_HASH_SIZE - 1);
+}
+
+static void link_put(hist_link_t *l) {
+    if(l && !--l->refs)
+        free(l);
+}
+
+static hist_entry_t *find_entry(uint32_t gc, uint32_t slot, const char *name) {
+    hist_entry_t *i = hash[bucket(gc, slot)];
+
+    while(i) {
+        if(i->gc == gc && i->slot == slot && !strcmp(i->name, name))
+            return i;
+
+        i = i->hnext;
+    }
+
+    return NULL;
+}
+
+static void remove_entry(hist_entry_t *e) {
+    hist_entry_t **i = &hash[bucket(e->gc, e->slot)];
+
+    while(*i) {
+        if(*i == e) {
+            *i = e->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    TAILQ_REMOVE(&lru, e, lru);
+    --entry_count;
+    link_put(e->link);
+    free(e);
+}
+
+/* Remember the version a job is about to record, replacing the old entry if
+   there was one. */
+static void track(hist_entry_t *old, hist_job_t *job, int since_full) {
+    hist_entry_t *e;
+    int b = bucket(job->gc, job->slot);
+
+    if(old)
+        remove_entry(old);
+
+    if(!(e = (hist_entry_t *)malloc(sizeof(hist_entry_t) + job->len)))
+        return;
+
+    e->gc = job->gc;
+    e->slot = job->slot;
+    strcpy(e->name, job->name);
+    e->version = job->version;
+    e->id = job->id;
+    e->since_full = since_full;
+    e->link = job->link;
+    ++e->link->refs;
+    e->len = job->len;
+    memcpy(e->data, job->data, job->len);
+
+    e->hnext = hash[b];
+    hash[b] = e;
+    TAILQ_INSERT_TAIL(&lru, e, lru);
+    ++entry_count;
+
+    while(entry_count > HISTORY_TRACK_MAX) {
+        remove_entry(TAILQ_FIRST(&lru));
+    }
+}
+
+/* Build the delta between two versions. Returns the size of the delta, or -1
+   if it would be bigger than max. */
+static long make_delta(const uint8_t *old, const uint8_t *cur, size_t len,
+                       uint8_t *out, size_t max) {
+    size_t i = 0, last = 0, o = 0, start, end, j, n;
+    uint16_t gap, rlen;
+
+    while(i < len) {
+        if(old[i] == cur[i]) {
+            ++i;
+            continue;
+        }
+
+        /* Find the end of this run of changes. */
+        start = i;
+        end = i + 1;
+
+        while(end < len) {
+            if(old[end] != cur[end]) {
+                ++end;
+                continue;
+            }
+
+            for(j = end; j < len && j < end + DELTA_MIN_GAP &&
+                old[j] == cur[j]; ++j) {
+            }
+
+            if(j == len || j == end + DELTA_MIN_GAP)
+                break;
+
+            end = j;
+        }
+
+        /* Each run is the gap since the last one, its length, then the new
+           bytes. Both are 16 bits, so long gaps or runs get split up. */
+        while(start < end) {
+            if(start - last > 0xFFFF) {
+                gap = 0xFFFF;
+                n = 0;
+            }
+            else {
+                gap = (uint16_t)(start - last);
+                n = end - start > 0xFFFF ? 0xFFFF : end - start;
+            }
+
+            if(o + 4 + n > max)
+                return -1;
+
+            rlen = (uint16_t)n;
+            memcpy(out + o, &gap, 2);
+            memcpy(out + o + 2, &rlen, 2);
+            memcpy(out + o + 4, cur + last + gap, n);
+            o += 4 + n;
+            last += gap + n;
+
+            if(n)
+                start = last;
+        }
+
+        i = end;
+    }
+
+    return (long)o;
+}
+
+static int apply_delta(uint8_t *buf, size_t len, const uint8_t *delta,
+                       size_t dlen) {
+    size_t o = 0, pos = 0;
+    uint16_t gap, rlen;
+
+    while(o + 4 <= dlen) {
+        memcpy(&gap, delta + o, 2);
+        memcpy(&rlen, delta + o + 2, 2);
+        o += 4;
+        pos += gap;
+
+        if(pos + rlen > len || o + rlen > dlen)
+            return -1;
+
+        memcpy(buf + pos, delta + o, rlen);
+        o += rlen;
+        pos += rlen;
+    }
+
+    return o == dlen ? 0 : -1;
+}
+
+int hist_init(int keep) {
+    memset(hash, 0, sizeof(hash));
+    TAILQ_INIT(&lru);
+    entry_count = 0;
+    keep_versions = keep > 0 ? keep : 0;
+
+    if(keep_versions)
+        debug(DBG_LOG, "Keeping %d old versions of each character\n",
+              keep_versions);
+
+    return 0;
+}
+
+void hist_cleanup(void) {
+    hist_entry_t *i;
+
+    while((i = TAILQ_FIRST(&lru))) {
+        remove_entry(i);
+    }
+
+    keep_versions = 0;
+}
+
+int hist_enabled(void) {
+    return keep_versions != 0;
+}
+
+/* Find the newest version recorded for a character. Returns 0 if there isn't
+   one, or -1 on error. */
+static long last_version(sylverant_dbconn_t *db, const char *where) {
+    char query[256];
+    void *result;
+    char **row;
+    long rv = 0;
+
+    sprintf(query, "SELECT MAX(version) FROM character_history WHERE %s",
+            where);
+
+    if(sylverant_db_query(db, query) ||
+       !(result = sylverant_db_result_store(db))) {
+        debug(DBG_WARN, "Couldn't look up character history\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(db));
+        return -1;
+    }
+
+    if((row = sylverant_db_result_fetch(result)) && row[0])
+        rv = strtol(row[0], NULL, 0);
+
+    sylverant_db_result_free(result);
+    return rv;
+}
+
+/* Drop versions that are too old. Only versions from before a full copy can
+   go, otherwise the ones kept couldn't be rebuilt. */
+static void prune(sylverant_dbconn_t *db, const char *where,
+                  uint32_t version) {
+    char query[320];
+    void *result;
+    char **row;
+    long cutoff = 0;
+
+    if(version <= (uint32_t)keep_versions)
+        return;
+
+    sprintf(query, "SELECT MAX(version) FROM character_history WHERE %s AND "
+            "kind='%d' AND version<='%u'", where, KIND_FULL,
+            version - keep_versions);
+
+    if(sylverant_db_query(db, query) ||
+       !(result = sylverant_db_result_store(db))) {
+        debug(DBG_WARN, "Couldn't prune character history\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(db));
+        return;
+    }
+
+    if((row = sylverant_db_result_fetch(result)) && row[0])
+        cutoff = strtol(row[0], NULL, 0);
+
+    sylverant_db_result_free(result);
+
+    if(cutoff <= 1)
+        return;
+
+    sprintf(query, "DELETE FROM character_history WHERE %s AND version<'%ld'",
+            where, cutoff);
+
+    if(sylverant_db_query(db, query)) {
+        debug(DBG_WARN, "Couldn't prune character history\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(db));
+    }
+}
+
+static void job_free(hist_job_t *job) {
+    link_put(job->prev);
+    link_put(job->link);
+    free(job->delta);
+    free(job);
+}
+
+hist_job_t *hist_begin(uint32_t gc, uint32_t slot, const char *name,
+                       const uint8_t *data, size_t len) {
+    hist_job_t *job;
+    hist_entry_t *e;
+    int since_full = 0;
+
+    if(!keep_versions)
+        return NULL;
+
+    if(!(job = (hist_job_t *)malloc(sizeof(hist_job_t) + len)))
+        return NULL;
+
+    if(!(job->link = (hist_link_t *)malloc(sizeof(hist_link_t)))) {
+        free(job);
+        return NULL;
+    }
+
+    /* It doesn't count as written until the worker says so. */
+    job->link->refs = 1;
+    job->link->err = 1;
+    job->gc = gc;
+    job->slot = slot;
+    strcpy(job->name, name);
+    job->version = 0;
+    job->id = ++next_id;
+    job->kind = KIND_FULL;
+    job->prev = NULL;
+    job->delta = NULL;
+    job->dlen = 0;
+    job->len = len;
+    memcpy(job->data, data, len);
+
+    /* If we know what the last version was, try to store just what changed
+       since then. Otherwise, the worker finds out which version this is. */
+    if((e = find_entry(gc, slot, name))) {
+        if(e->version) {
+            job->version = e->version + 1;
+
+            if(e->len == len && e->since_full + 1 < HISTORY_SNAPSHOT_EVERY &&
+               (job->delta = (uint8_t *)malloc(len / 2))) {
+                job->dlen = make_delta(e->data, data, len, job->delta,
+                                       len / 2);
+
+                /* Nothing changed, so there's no new version. */
+                if(!job->dlen) {
+                    job_free(job);
+                    return NULL;
+                }
+
+                if(job->dlen > 0) {
+                    job->kind = KIND_DELTA;
+                    since_full = e->since_full + 1;
+                }
+            }
+        }
+
+        job->prev = e->link;
+        ++job->prev->refs;
+    }
+
+    track(e, job, since_full);
+    return job;
+}
+
+void hist_write(hist_job_t *job, sylverant_dbconn_t *db, const uint8_t *enc,
+                size_t enc_len, int codec, const uint8_t *blob_hash) {
+    char where[160], name2[65], hex[BLOB_HASH_HEX_LEN + 1];
+    char *query;
+    long last;
+
+    if(!job)
+        return;
+
+    sylverant_db_escape_str(db, name2, job->name, strlen(job->name));
+    sprintf(where, "guildcard='%u' AND slot='%u' AND name='%s'", job->gc,
+            job->slot, name2);
+
+    /* A delta against a version that didn't get written is no use. */
+    if(job->kind == KIND_DELTA && job->prev && job->prev->err)
+        job->kind = KIND_FULL;
+
+    if(!job->version) {
+        if((last = last_version(db, where)) < 0)
+            return;
+
+        job->version = (uint32_t)last + 1;
+    }
+
+    if(!(query = (char *)malloc(job->len * 2 + 512)))
+        return;
+
+    sprintf(query, "INSERT INTO character_history(guildcard, slot, name, "
+            "version, kind, size, codec, crc, saved, data, blob_hash) VALUES "
+            "('%u', '%u', '%s', '%u', '%d', '%u', '%d', '%u', NOW(), ",
+            job->gc, job->slot, name2, job->version, job->kind,
+            (unsigned)job->len,
+            job->kind == KIND_DELTA || !enc ? CODEC_NONE : codec,
+            (unsigned)crc32(0, job->data, job->len));
+
+    /* Full copies are stored the same way the character itself was, so if it
+       went in the blob store, this doesn't take any more space. */
+    if(job->kind == KIND_FULL && blob_hash) {
+        blob_hash_hex(blob_hash, hex);
+        sprintf(query + strlen(query), "NULL, '%s')", hex);
+    }
+    else {
+        strcat(query, "'");
+
+        if(job->kind == KIND_DELTA)
+            sylverant_db_escape_str(db, query + strlen(query),
+                                    (char *)job->delta, job->dlen);
+        else if(enc)
+            sylverant_db_escape_str(db, query + strlen(query), (char *)enc,
+                                    enc_len);
+        else
+            sylverant_db_escape_str(db, query + strlen(query),
+                                    (char *)job->data, job->len);
+
+        strcat(query, "', NULL)");
+    }
+
+    if(sylverant_db_query(db, query)) {
+        debug(DBG_WARN, "Couldn't save character history (%u: %u)\n",
+              job->gc, job->slot);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(db));
+        free(query);
+        return;
+    }
+
+    free(query);
+    job->link->err = 0;
+
+    if(job->kind == KIND_FULL)
+        prune(db, where, job->version);
+}
+
+void hist_end(hist_job_t *job) {
+    hist_entry_t *e;
+
+    if(!job)
+        return;
+
+    if((e = find_entry(job->gc, job->slot, job->name))) {
+        /* Start over with a full copy next time. */
+        if(job->link->err)
+            remove_entry(e);
+        else if(e->id == job->id) {
+            /* Nothing newer has come in, so fill in what the worker found. */
+            if(!e->version)
+                e->version = job->version;
+
+            if(job->kind == KIND_FULL)
+                e->since_full = 0;
+        }
+    }
+
+    job_free(job);
+}
+
+hist_chain_t *hist_fetch(uint32_t gc, uint32_t slot, const char *name,
+                         int back) {
+    char query[384], name2[65];
+    uint8_t hash[BLOB_HASH_LEN];
+    const uint8_t *bdata;
+    size_t blen;
+    hist_chain_t *chain = NULL;
+    hist_row_t *r;
+    void *result;
+    char **row;
+    unsigned long *len;
+    int i = 0, count, full = -1;
+
+    if(back < 0 || back > HISTORY_BACK_MAX)
+        return NULL;
+
+    /* Grab the versions from the one asked for back to the full copy before
+       it, newest first. */
+    sylverant_db_escape_str(&conn, name2, name, strlen(name));
+    sprintf(query, "SELECT kind, codec, crc, size, data, blob_hash FROM "
+            "character_history WHERE guildcard='%u' AND slot='%u' AND "
+            "name='%s' ORDER BY version DESC LIMIT %d, %d", gc, slot, name2,
+            back, HISTORY_SNAPSHOT_EVERY);
+
+    if(sylverant_db_query(&conn, query) ||
+       !(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't fetch character history (%u: %u)\n", gc,
+              slot);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return NULL;
+    }
+
+    chain = (hist_chain_t *)malloc(sizeof(hist_chain_t) +
+                                   HISTORY_SNAPSHOT_EVERY * sizeof(hist_row_t));
+
+    if(!chain) {
+        sylverant_db_result_free(result);
+        return NULL;
+    }
+
+    chain->count = 0;
+
+    while(full < 0 && (row = sylverant_db_result_fetch(result))) {
+        if(!(len = sylverant_db_result_lengths(result)))
+            break;
+
+        r = &chain->rows[chain->count];
+        r->kind = atoi(row[0]);
+        r->codec = codec_from_row(row[1], row[3]);
+        r->crc = (uint32_t)strtoul(row[2], NULL, 0);
+        r->size = (size_t)strtoul(row[3], NULL, 0);
+        bdata = (const uint8_t *)row[4];
+        blen = (size_t)len[4];
+
+        if(row[5] && (blob_hash_parse(row[5], hash) ||
+                      blob_get(hash, &bdata, &blen))) {
+            debug(DBG_WARN, "Missing blob for character history (%u: %u): "
+                  "%s\n", gc, slot, row[5]);
+            break;
+        }
+
+        if(!bdata || !(r->data = (uint8_t *)malloc(blen)))
+            break;
+
+        memcpy(r->data, bdata, blen);
+        r->len = blen;
+
+        if(r->kind == KIND_FULL)
+            full = chain->count;
+
+        ++chain->count;
+    }
+
+    sylverant_db_result_free(result);
+
+    if(full < 0) {
+        hist_chain_free(chain);
+        return NULL;
+    }
+
+    /* Flip it around so the full copy comes first. */
+    count = chain->count;
+
+    for(i = 0; i < count / 2; ++i) {
+        hist_row_t tmp = chain->rows[i];
+        chain->rows[i] = chain->rows[count - 1 - i];
+        chain->rows[count - 1 - i] = tmp;
+    }
+
+    return chain;
+}
+
+int hist_rebuild(hist_chain_t *chain, uint8_t **data, size_t *len) {
+    hist_row_t *r = &chain->rows[0];
+    uint8_t *buf;
+    size_t sz;
+    int i;
+
+    if(!(buf = (uint8_t *)malloc(r->size)))
+        return -1;
+
+    if(codec_decode(r->codec, r->data, r->len, buf, r->size, &sz) ||
+       sz != r->size || (uint32_t)crc32(0, buf, sz) != r->crc)
+        goto err;
+
+    for(i = 1; i < chain->count; ++i) {
+        r = &chain->rows[i];
+
+        if(r->size != sz || apply_delta(buf, sz, r->data, r->len) ||
+           (uint32_t)crc32(0, buf, sz) != r->crc)
+            goto err;
+    }
+
+    *data = buf;
+    *len = sz;
+    return 0;
+
+err:
+    debug(DBG_WARN, "Couldn't rebuild character history\n");
+    free(buf);
+    return -1;
+}
+
+void hist_chain_free(hist_chain_t *chain) {
+    int i;
+
+    for(i = 0; i < chain->count; ++i) {
+        free(chain->rows[i].data);
+    }
+
+    free(chain);
+}
@@ -0,0 +1,93 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sylverant/database.h>
+
+/* Number of old versions of each character and backup to keep by default. */
+#ifndef HISTORY_KEEP_DEFAULT
+#define HISTORY_KEEP_DEFAULT    32
+#endif
+
+/* Every this many versions, a full copy is stored instead of a delta. This is
+   also the most deltas that have to be applied to get any version back. */
+#ifndef HISTORY_SNAPSHOT_EVERY
+#define HISTORY_SNAPSHOT_EVERY  16
+#endif
+
+/* Number of characters to remember the last version of in memory, so that
+   deltas can be made without reading anything back from the database. */
+#ifndef HISTORY_TRACK_MAX
+#define HISTORY_TRACK_MAX       2048
+#endif
+
+/* The most versions back that can be asked for (it comes from the version
+   field of the packet header). */
+#define HISTORY_BACK_MAX        255
+
+typedef struct hist_chain hist_chain_t;
+typedef struct hist_job hist_job_t;
+
+/* Set up character history, keeping the given number of old versions of each
+   character. With 0, no history is kept. */
+int hist_init(int keep);
+
+/* Clean up character history. */
+void hist_cleanup(void);
+
+/* Returns non-zero if history is being kept. */
+int hist_enabled(void);
+
+/* Start recording a new version of a character that's about to be stored.
+   Regular saves use the slot and an empty name, backups use a slot of -1 and
+   the backup's name. This works out what to store from the last version kept
+   in memory, so it must be called on the main thread, in the same order the
+   saves are submitted to the work queue (keyed by guildcard). Returns NULL if
+   there's nothing to record. */
+hist_job_t *hist_begin(uint32_t gc, uint32_t slot, const char *name,
+                       const uint8_t *data, size_t len);
+
+/* Write the version to the database, on the worker that stored the character
+   (and only if that worked). If the data was compressed or put in the blob
+   store when it was stored, that is passed in too, so that it can be reused for
+   full copies. Does nothing if job is NULL. */
+void hist_write(hist_job_t *job, sylverant_dbconn_t *db, const uint8_t *enc,
+                size_t enc_len, int codec, const uint8_t *blob_hash);
+
+/* Finish up a version on the main thread once the work is done (or couldn't be
+   queued), and free the job. Does nothing if job is NULL. */
+void hist_end(hist_job_t *job);
+
+/* Read what's needed to rebuild the version of a character the given number of
+   versions before the current one (on the main thread). Returns NULL if that
+   version isn't available. */
+hist_chain_t *hist_fetch(uint32_t gc, uint32_t slot, const char *name,
+                         int back);
+
+/* Rebuild a version read with hist_fetch(). This is safe to call from a worker
+   thread. The data returned must be freed by the caller. */
+int hist_rebuild(hist_chain_t *chain, uint8_t **data, size_t *len);
+
+/* Free a chain read with hist_fetch(). */
+void hist_chain_free(hist_chain_t *chain);
+
+#endif /* !HISTORY_H */
@@ -0,0 +1,466 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <sylverant/debug.h>
+
+#include "journal.h"
+
+/* A journal is a header followed by records, which are only ever appended to
+   the end of it. Everything added between syncs goes out in one write and one
+   sync. Once everything in the journal is in the database (or it gets too
+   big), it's replaced by a new one holding just what isn't yet, which the
+   journal's owner provides. */
+
+#define JOURNAL_PATH_MAX    1024
+
+#ifdef PACKED
+#undef PACKED
+#endif
+
+#define PACKED __attribute__((packed))
+
+typedef struct journal_file_hdr {
+    uint32_t magic;
+    uint32_t version;
+} PACKED journal_file_hdr_t;
+
+#undef PACKED
+
+typedef struct journal_waiter {
+    journal_cb_t cb;
+    void *data;
+    int rec;
+    int need;
+} journal_waiter_t;
+
+struct journal {
+    const journal_ops_t *ops;
+    char *path;
+    int fd;
+    off_t size;
+    off_t base;
+
+    /* Records waiting for the next sync, where each one starts, and what's
+       needed to undo them. */
+    uint8_t *buf;
+    size_t buf_len, buf_size;
+    size_t *recs;
+    uint8_t *undos;
+    int rec_count, rec_size;
+
+    journal_waiter_t *waiters;
+    int waiter_count, waiter_size;
+
+    /* What's going into a new journal. */
+    uint8_t *rbuf;
+    size_t rbuf_len, rbuf_size;
+};
+
+static int write_all(int fd, const uint8_t *buf, size_t len) {
+    ssize_t rv;
+
+    while(len) {
+        if((rv = write(fd, buf, len)) < 0) {
+            if(errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        buf += rv;
+        len -= (size_t)rv;
+    }
+
+    return 0;
+}
+
+static uint32_t rec_crc(const journal_rec_t *hdr, const void *data) {
+    uLong crc = crc32(0, (const Bytef *)hdr, sizeof(journal_rec_t) - 4);
+
+    if(hdr->len)
+        crc = crc32(crc, (const Bytef *)data, (uInt)hdr->len);
+
+    return (uint32_t)crc;
+}
+
+static int append(uint8_t **buf, size_t *len, size_t *size, uint32_t type,
+                  uint32_t gc, uint32_t key, const void *data, size_t dlen) {
+    journal_rec_t hdr;
+    uint8_t *tmp;
+    size_t need = *len + sizeof(journal_rec_t) + dlen;
+
+    if(need > *size) {
+        if(!(tmp = (uint8_t *)realloc(*buf, need * 2)))
+            return -1;
+
+        *buf = tmp;
+        *size = need * 2;
+    }
+
+    hdr.type = type;
+    hdr.guildcard = gc;
+    hdr.key = key;
+    hdr.len = (uint32_t)dlen;
+    hdr.crc = rec_crc(&hdr, data);
+
+    memcpy(*buf + *len, &hdr, sizeof(journal_rec_t));
+
+    if(dlen)
+        memcpy(*buf + *len + sizeof(journal_rec_t), data, dlen);
+
+    *len = need;
+
+    return 0;
+}
+
+/* Write a new journal with what the owner gives it, followed by whatever is in
+   extra. It's written under a temporary name and renamed into place once it's
+   synced, so there's always a good journal there. */
+static int rewrite(journal_t *j, const uint8_t *extra, size_t extra_len) {
+    char tmp[JOURNAL_PATH_MAX];
+    journal_file_hdr_t hdr;
+    int fd;
+
+    j->rbuf_len = 0;
+
+    if(j->ops->rewrite(j)) {
+        debug(DBG_ERROR, "Cannot allocate %s journal\n", j->ops->what);
+        return -1;
+    }
+
+    hdr.magic = j->ops->magic;
+    hdr.version = j->ops->version;
+
+    sprintf(tmp, "%s.tmp", j->path);
+
+    if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+        debug(DBG_ERROR, "Cannot create journal %s: %s\n", tmp,
+              strerror(errno));
+        return -1;
+    }
+
+    if(write_all(fd, (const uint8_t *)&hdr, sizeof(hdr)) ||
+       write_all(fd, j->rbuf, j->rbuf_len) ||
+       write_all(fd, extra, extra_len) || fdatasync(fd) ||
+       rename(tmp, j->path)) {
+        debug(DBG_ERROR, "Cannot write journal %s: %s\n", j->path,
+              strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    if(j->fd != -1)
+        close(j->fd);
+
+    j->fd = fd;
+    j->size = j->base = (off_t)(sizeof(hdr) + j->rbuf_len + extra_len);
+
+    return 0;
+}
+
+/* Get rid of a partly written record at the end of the journal after a write
+   to it failed, by cutting it back to where it was, or by starting over if
+   that doesn't work. */
+static void recover(journal_t *j) {
+    if(j->fd != -1 && !ftruncate(j->fd, j->size) &&
+       lseek(j->fd, j->size, SEEK_SET) == j->size)
+        return;
+
+    if(rewrite(j, NULL, 0)) {
+        /* Don't write anything more to it until it can be fixed up. */
+        debug(DBG_WARN, "Cannot recover the %s journal\n", j->ops->what);
+
+        if(j->fd != -1) {
+            close(j->fd);
+            j->fd = -1;
+        }
+    }
+}
+
+/* Read the journal left from the last run into memory. */
+static int replay(journal_t *j) {
+    FILE *fp;
+    journal_file_hdr_t fhdr;
+    journal_rec_t hdr;
+    uint8_t *buf;
+    int count = 0;
+
+    if(!(fp = fopen(j->path, "rb")))
+        return 0;
+
+    if(fread(&fhdr, sizeof(fhdr), 1, fp) != 1 ||
+       fhdr.magic != j->ops->magic || fhdr.version != j->ops->version) {
+        debug(DBG_WARN, "Ignoring invalid journal %s\n", j->path);
+        fclose(fp);
+        return 0;
+    }
+
+    if(!(buf = (uint8_t *)malloc(j->ops->max_len + 1))) {
+        debug(DBG_ERROR, "Cannot allocate %s journal\n", j->ops->what);
+        fclose(fp);
+        return -1;
+    }
+
+    /* Anything after a bad record was cut off when the shipgate died, and was
+       never acknowledged, so it's safe to stop there. */
+    while(fread(&hdr, sizeof(hdr), 1, fp) == 1) {
+        if(hdr.len > j->ops->max_len || fread(buf, 1, hdr.len, fp) != hdr.len ||
+           rec_crc(&hdr, buf) != hdr.crc)
+            break;
+
+        if(!j->ops->replay(&hdr, buf))
+            ++count;
+    }
+
+    free(buf);
+    fclose(fp);
+
+    debug(DBG_LOG, "Recovered %d %s changes from %s\n", count, j->ops->what,
+          j->path);
+
+    return 0;
+}
+
+static int add_waiter(journal_t *j, journal_cb_t cb, void *cbdata, int rec,
+                      int need) {
+    void *tmp;
+
+    if(j->waiter_count == j->waiter_size) {
+        if(!(tmp = realloc(j->waiters, (j->waiter_size + 64) *
+                           sizeof(journal_waiter_t))))
+            return -1;
+
+        j->waiters = (journal_waiter_t *)tmp;
+        j->waiter_size += 64;
+    }
+
+    j->waiters[j->waiter_count].cb = cb;
+    j->waiters[j->waiter_count].data = cbdata;
+    j->waiters[j->waiter_count].rec = rec;
+    j->waiters[j->waiter_count].need = need;
+    ++j->waiter_count;
+
+    return 0;
+}
+
+journal_t *journal_open(const char *path, const journal_ops_t *ops) {
+    journal_t *j;
+
+    if(strlen(path) > JOURNAL_PATH_MAX - 8) {
+        debug(DBG_ERROR, "Journal path is too long: %s\n", path);
+        return NULL;
+    }
+
+    if(!(j = (journal_t *)malloc(sizeof(journal_t)))) {
+        debug(DBG_ERROR, "Cannot allocate %s journal\n", ops->what);
+        return NULL;
+    }
+
+    memset(j, 0, sizeof(journal_t));
+    j->ops = ops;
+    j->fd = -1;
+
+    if(!(j->path = strdup(path))) {
+        debug(DBG_ERROR, "Cannot allocate %s journal\n", ops->what);
+        free(j);
+        return NULL;
+    }
+
+    if(replay(j)) {
+        free(j->path);
+        free(j);
+        return NULL;
+    }
+
+    return j;
+}
+
+void journal_close(journal_t *j, int unstored) {
+    if(j->fd != -1)
+        close(j->fd);
+
+    if(!unstored)
+        unlink(j->path);
+
+    free(j->buf);
+    free(j->recs);
+    free(j->undos);
+    free(j->waiters);
+    free(j->rbuf);
+    free(j->path);
+    free(j);
+}
+
+int journal_add(journal_t *j, uint32_t type, uint32_t gc, uint32_t key,
+                const void *data, size_t len, const void *undo,
+                journal_cb_t cb, void *cbdata) {
+    size_t usize = j->ops->undo_size;
+    void *tmp;
+
+    if(len > j->ops->max_len)
+        return -1;
+
+    if(j->rec_count == j->rec_size) {
+        if(!(tmp = realloc(j->recs, (j->rec_size + 64) * sizeof(size_t))))
+            return -1;
+
+        j->recs = (size_t *)tmp;
+
+        if(usize) {
+            if(!(tmp = realloc(j->undos, (j->rec_size + 64) * usize)))
+                return -1;
+
+            j->undos = (uint8_t *)tmp;
+        }
+
+        j->rec_size += 64;
+    }
+
+    /* Even without a callback, there has to be a waiter so the record gets
+       written on the next sync. */
+    if(add_waiter(j, cb, cbdata, 1, 1))
+        return -1;
+
+    j->recs[j->rec_count] = j->buf_len;
+
+    if(append(&j->buf, &j->buf_len, &j->buf_size, type, gc, key, data, len)) {
+        --j->waiter_count;
+        return -1;
+    }
+
+    if(usize)
+        memcpy(j->undos + j->rec_count * usize, undo, usize);
+
+    ++j->rec_count;
+
+    return 0;
+}
+
+int journal_wait(journal_t *j, journal_cb_t cb, void *cbdata, int need) {
+    return add_waiter(j, cb, cbdata, 0, need);
+}
+
+int journal_sync(journal_t *j) {
+    const journal_ops_t *ops = j->ops;
+    size_t usize = ops->undo_size;
+    journal_waiter_t *w;
+    journal_rec_t *hdr;
+    int i, n = 0, rv, err = 0, count = j->rec_count;
+
+    if(!j->waiter_count)
+        return 0;
+
+    if(j->buf_len) {
+        /* If the journal had to be closed, starting a new one writes out
+           everything in memory. Changes that were made before being journaled
+           are already part of that, the rest go after it. */
+        if(j->fd == -1) {
+            if(ops->undo)
+                err = !!rewrite(j, NULL, 0);
+            else
+                err = !!rewrite(j, j->buf, j->buf_len);
+        }
+        else if(write_all(j->fd, j->buf, j->buf_len) || fdatasync(j->fd)) {
+            debug(DBG_WARN, "Couldn't write to the %s journal: %s\n",
+                  ops->what, strerror(errno));
+            err = 1;
+        }
+        else {
+            j->size += (off_t)j->buf_len;
+        }
+    }
+
+    if(err) {
+        /* None of it can be counted on, so take it all back out of memory and
+           cut off whatever part of it did make it into the journal. */
+        if(ops->undo) {
+            for(i = j->rec_count - 1; i >= 0; --i) {
+                hdr = (journal_rec_t *)(j->buf + j->recs[i]);
+                ops->undo(hdr, (const uint8_t *)(hdr + 1),
+                          j->undos + i * usize);
+            }
+        }
+
+        recover(j);
+    }
+    else if(ops->release) {
+        for(i = 0; i < j->rec_count; ++i) {
+            ops->release(j->undos + i * usize);
+        }
+    }
+
+    /* There's one waiter for each record, in the same order, along with any
+       that were just waiting on them. */
+    for(i = 0; i < j->waiter_count; ++i) {
+        w = &j->waiters[i];
+        rv = w->need ? err : 0;
+
+        if(w->rec) {
+            hdr = (journal_rec_t *)(j->buf + j->recs[n++]);
+
+            if(!err && ops->apply)
+                rv = ops->apply(hdr, (const uint8_t *)(hdr + 1));
+        }
+
+        if(w->cb)
+            w->cb(w->data, rv);
+    }
+
+    j->buf_len = 0;
+    j->rec_count = 0;
+    j->waiter_count = 0;
+
+    return err ? -1 : count;
+}
+
+int journal_pending(journal_t *j) {
+    return j->waiter_count;
+}
+
+int journal_rewrite(journal_t *j) {
+    return rewrite(j, NULL, 0);
+}
+
+int journal_put(journal_t *j, uint32_t type, uint32_t gc, uint32_t key,
+                const void *data, size_t len) {
+    return append(&j->rbuf, &j->rbuf_len, &j->rbuf_size, type, gc, key, data,
+                  len);
+}
+
+void journal_check(journal_t *j, int unstored) {
+    /* This can only be done when there's nothing waiting to go into the
+       current one. */
+    if(j->waiter_count || j->buf_len)
+        return;
+
+    /* If there's a lot that isn't in the database, the new journal will be
+       big too, so wait for it to grow well past that before doing it again. */
+    if(j->fd == -1 ||
+       (!unstored && j->size > (off_t)sizeof(journal_file_hdr_t)) ||
+       (j->size > (off_t)j->ops->max_size && j->size > j->base * 2))
+        rewrite(j, NULL, 0);
+}
@@ -0,0 +1,131 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef PACKED
+#undef PACKED
+#endif
+
+#define PACKED __attribute__((packed))
+
+/* Each record in a journal starts with this. What the type and key mean (and
+   what the data after it is) is up to whoever owns the journal. The crc covers
+   the rest of the header and the data. */
+typedef struct journal_rec {
+    uint32_t type;
+    uint32_t guildcard;
+    uint32_t key;
+    uint32_t len;
+    uint32_t crc;
+} PACKED journal_rec_t;
+
+#undef PACKED
+
+typedef struct journal journal_t;
+
+/* Called once a change is safely in the journal (or if that failed). */
+typedef void (*journal_cb_t)(void *data, int err);
+
+/* What a journal's owner does with its records. Changes are either made in
+   memory first and undone if they can't be journaled (if there's an undo
+   function), or only made once they're in the journal (with apply). */
+typedef struct journal_ops {
+    /* What's in it, for messages (like "quest flag"). */
+    const char *what;
+    uint32_t magic;
+    uint32_t version;
+
+    /* Biggest record data there can be. */
+    size_t max_len;
+
+    /* Once the journal gets this big, it's rewritten. */
+    size_t max_size;
+
+    /* Size of what's saved to undo each change. */
+    size_t undo_size;
+
+    /* Put a record left from the last run back into memory. Returns 0 if it
+       was used. */
+    int (*replay)(const journal_rec_t *rec, const uint8_t *data);
+
+    /* Make a change that's just been journaled. The return value is passed on
+       to the change's callback. */
+    int (*apply)(const journal_rec_t *rec, const uint8_t *data);
+
+    /* Take back a change that couldn't be journaled. These are called newest
+       first, and before the journal is rewritten. */
+    void (*undo)(const journal_rec_t *rec, const uint8_t *data, void *undo);
+
+    /* Let go of what was saved to undo a change once it's journaled. This
+       can be NULL. */
+    void (*release)(void *undo);
+
+    /* Write everything in memory that isn't in the database yet to a new
+       journal with journal_put(). Returns non-zero on error. */
+    int (*rewrite)(journal_t *j);
+} journal_ops_t;
+
+/* Set up a journal, putting anything left in it from the last run back into
+   memory with the replay function. Nothing is written to it until the owner
+   calls journal_rewrite() to start a new one. Returns NULL on error. */
+journal_t *journal_open(const char *path, const journal_ops_t *ops);
+
+/* Close the journal. If there's nothing left that isn't in the database, the
+   file is removed, otherwise it's left to be replayed on the next startup. */
+void journal_close(journal_t *j, int unstored);
+
+/* Add a record for a change, to be written on the next journal_sync(). If the
+   journal has an undo function, the change has already been made in memory
+   and undo holds what's needed to take it back. The callback can be NULL. */
+int journal_add(journal_t *j, uint32_t type, uint32_t gc, uint32_t key,
+                const void *data, size_t len, const void *undo,
+                journal_cb_t cb, void *cbdata);
+
+/* Have the callback called once everything added so far is in the journal.
+   If need is zero, it's told that it worked no matter what (for changes that
+   turned out not to change anything, but should still be answered in
+   order). */
+int journal_wait(journal_t *j, journal_cb_t cb, void *cbdata, int need);
+
+/* Write everything added since last time to the journal and sync it to disk,
+   then run the callbacks. Returns the number of records written, or -1 if
+   they couldn't be (in which case none of them count). */
+int journal_sync(journal_t *j);
+
+/* Returns non-zero if there's anything waiting for journal_sync(). */
+int journal_pending(journal_t *j);
+
+/* Replace the journal with a new one holding just what the rewrite function
+   puts in it. It's written under a temporary name and renamed into place once
+   it's synced, so there's always a good journal there. */
+int journal_rewrite(journal_t *j);
+
+/* Add a record to the new journal, from the rewrite function. */
+int journal_put(journal_t *j, uint32_t type, uint32_t gc, uint32_t key,
+                const void *data, size_t len);
+
+/* Start over with a smaller journal if there's any point to it: if nothing is
+   left that isn't in the database, it's gotten too big, or it had to be closed
+   after an error. */
+void journal_check(journal_t *j, int unstored);
+
+#endif /* !JOURNAL_H */
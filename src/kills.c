@@ -0,0 +1,267 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "kills.h"
+#include "timer.h"
+
+/* During an event, the ships send a monster kill update for each player every
+   so often, and each one would have been up to 0x60 upserts on its own. The
+   counts are added up here instead, and written every so often a batch at a
+   time. If writing them fails, they're kept to try again later, up to a
+   limit, after which new counts are dropped until there's room again. */
+
+#define KILLS_HASH_SIZE     4096
+
+/* Longest a single row of the insert can be. */
+#define KILLS_ROW_MAX       96
+
+typedef struct kill_entry {
+    TAILQ_ENTRY(kill_entry) qentry;
+    struct kill_entry *hnext;
+    uint32_t event_id;
+    uint32_t acc;
+    uint32_t gc;
+    uint32_t count;
+    uint8_t episode;
+    uint8_t difficulty;
+    uint8_t enemy;
+} kill_entry_t;
+
+TAILQ_HEAD(kill_queue, kill_entry);
+
+extern sylverant_dbconn_t conn;
+
+static kill_entry_t *hash_tbl[KILLS_HASH_SIZE];
+static struct kill_queue queue = TAILQ_HEAD_INITIALIZER(queue);
+static int entry_count;
+static int flush_failed, dropping;
+
+static int flush_timer = -1, stats_timer = -1;
+
+static struct {
+    unsigned long packets;
+    unsigned long updates;
+    unsigned long rows;
+    unsigned long queries;
+    unsigned long failed;
+    unsigned long dropped;
+} stats;
+
+static inline int bucket(uint32_t event_id, uint32_t gc, int enemy) {
+    return (event_id * 31 + gc * 97 + enemy) & (KILLS_HASH_SIZE - 1);
+}
+
+static void remove_entry(kill_entry_t *e) {
+    kill_entry_t **i = &hash_tbl[bucket(e->event_id, e->gc, e->enemy)];
+
+    while(*i) {
+        if(*i == e) {
+            *i = e->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    TAILQ_REMOVE(&queue, e, qentry);
+    --entry_count;
+    free(e);
+}
+
+/* Write out one batch from the front of the queue. */
+static int flush_batch(void) {
+    static char query[KILLS_BATCH_ROWS * KILLS_ROW_MAX + 256];
+    kill_entry_t *e, *tmp;
+    char *pos;
+    int i;
+
+    strcpy(query, "INSERT INTO monster_kills (event_id, account_id, "
+           "guildcard, episode, difficulty, enemy, count) VALUES ");
+    pos = query + strlen(query);
+
+    for(i = 0, e = TAILQ_FIRST(&queue); e && i < KILLS_BATCH_ROWS;
+        ++i, e = TAILQ_NEXT(e, qentry)) {
+        pos += sprintf(pos, "%s('%" PRIu32 "', '%" PRIu32 "', '%" PRIu32 "', "
+                       "'%u', '%u', '%u', '%" PRIu32 "')", i ? ", " : "",
+                       e->event_id, e->acc, e->gc, (unsigned int)e->episode,
+                       (unsigned int)e->difficulty, (unsigned int)e->enemy,
+                       e->count);
+    }
+
+    strcpy(pos, " ON DUPLICATE KEY UPDATE count=count+VALUES(count)");
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't store monster kills\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        ++stats.failed;
+        return -1;
+    }
+
+    ++stats.queries;
+    stats.rows += i;
+
+    /* Everything that was written can go now. */
+    e = TAILQ_FIRST(&queue);
+    while(i--) {
+        tmp = TAILQ_NEXT(e, qentry);
+        remove_entry(e);
+        e = tmp;
+    }
+
+    return 0;
+}
+
+static void flush_timer_cb(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    kills_flush();
+}
+
+static void stats_timer_cb(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    debug(DBG_LOG, "Monster kills: %lu packets, %lu counts, %lu rows stored "
+          "in %lu queries (%.2f rows per packet, %.1f counts per row), %lu "
+          "failed, %lu dropped, %d buffered\n", stats.packets, stats.updates,
+          stats.rows, stats.queries, stats.packets ?
+          (double)stats.rows / stats.packets : 0.0, stats.rows ?
+          (double)stats.updates / stats.rows : 0.0, stats.failed,
+          stats.dropped, entry_count);
+
+    /* The rates are for the last interval, not since startup. */
+    memset(&stats, 0, sizeof(stats));
+}
+
+int kills_init(void) {
+    memset(hash_tbl, 0, sizeof(hash_tbl));
+    memset(&stats, 0, sizeof(stats));
+    TAILQ_INIT(&queue);
+    entry_count = 0;
+    flush_failed = dropping = 0;
+
+    flush_timer = timer_add(KILLS_FLUSH_INTERVAL, &flush_timer_cb, NULL);
+    stats_timer = timer_add(KILLS_STATS_INTERVAL, &stats_timer_cb, NULL);
+
+    return 0;
+}
+
+void kills_cleanup(void) {
+    kill_entry_t *i;
+
+    if(flush_timer != -1) {
+        timer_remove(flush_timer);
+        flush_timer = -1;
+    }
+
+    if(stats_timer != -1) {
+        timer_remove(stats_timer);
+        stats_timer = -1;
+    }
+
+    if(kills_flush())
+        debug(DBG_WARN, "Dropping %d buffered monster kill counts!\n",
+              entry_count);
+
+    stats_timer_cb(0, NULL);
+
+    while((i = TAILQ_FIRST(&queue))) {
+        remove_entry(i);
+    }
+}
+
+void kills_packet(void) {
+    ++stats.packets;
+}
+
+int kills_add(uint32_t event_id, uint32_t acc, uint32_t gc, uint8_t episode,
+              uint8_t difficulty, int enemy, uint32_t count) {
+    int b = bucket(event_id, gc, enemy);
+    kill_entry_t *e = hash_tbl[b];
+
+    ++stats.updates;
+
+    while(e) {
+        if(e->event_id == event_id && e->gc == gc && e->enemy == enemy &&
+           e->acc == acc && e->episode == episode &&
+           e->difficulty == difficulty) {
+            e->count += count;
+            return 0;
+        }
+
+        e = e->hnext;
+    }
+
+    /* Make room if we can. If the database is down, don't try again for
+       every count that comes in, just leave it to the timer. */
+    if(entry_count >= KILLS_MAX && !flush_failed)
+        kills_flush();
+
+    if(entry_count >= KILLS_MAX) {
+        if(!dropping)
+            debug(DBG_WARN, "Too many monster kill counts buffered, dropping "
+                  "new ones until they can be written\n");
+
+        dropping = 1;
+        ++stats.dropped;
+        return 0;
+    }
+
+    dropping = 0;
+
+    if(!(e = (kill_entry_t *)malloc(sizeof(kill_entry_t)))) {
+        debug(DBG_WARN, "Couldn't allocate monster kill entry\n");
+        return -1;
+    }
+
+    e->event_id = event_id;
+    e->acc = acc;
+    e->gc = gc;
+    e->count = count;
+    e->episode = episode;
+    e->difficulty = difficulty;
+    e->enemy = (uint8_t)enemy;
+
+    e->hnext = hash_tbl[b];
+    hash_tbl[b] = e;
+    TAILQ_INSERT_TAIL(&queue, e, qentry);
+    ++entry_count;
+
+    return 0;
+}
+
+int kills_flush(void) {
+    while(!TAILQ_EMPTY(&queue)) {
+        if(flush_batch()) {
+            flush_failed = 1;
+            return -1;
+        }
+    }
+
+    flush_failed = 0;
+    return 0;
+}
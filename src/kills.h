@@ -0,0 +1,64 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KILLS_H
+#define KILLS_H
+
+#include <stdint.h>
+
+/* How often (in seconds) the monster kills counted up are written to the
+   database. */
+#ifndef KILLS_FLUSH_INTERVAL
+#define KILLS_FLUSH_INTERVAL    10
+#endif
+
+/* Most rows to write in one query. */
+#ifndef KILLS_BATCH_ROWS
+#define KILLS_BATCH_ROWS        256
+#endif
+
+/* Once this many rows are waiting, they're written right away rather than
+   waiting for the timer. If they can't be, new counts are dropped until some
+   of them are written. */
+#ifndef KILLS_MAX
+#define KILLS_MAX               65536
+#endif
+
+/* How often (in seconds) to log monster kill statistics. */
+#ifndef KILLS_STATS_INTERVAL
+#define KILLS_STATS_INTERVAL    600
+#endif
+
+/* Set up the monster kill buffer. */
+int kills_init(void);
+
+/* Write out anything still buffered and clean up. */
+void kills_cleanup(void);
+
+/* Note that a monster kill update packet is being counted. This is only used
+   for the statistics. */
+void kills_packet(void);
+
+/* Add to the number of kills of an enemy for a player in an event. */
+int kills_add(uint32_t event_id, uint32_t acc, uint32_t gc, uint8_t episode,
+              uint8_t difficulty, int enemy, uint32_t count);
+
+/* Write all of the buffered kills to the database now. Returns 0 if everything
+   was written. */
+int kills_flush(void);
+
+#endif /* !KILLS_H */
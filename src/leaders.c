@@ -0,0 +1,456 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "leaders.h"
+#include "events.h"
+#include "timer.h"
+
+/* Each event keeps every player's kill totals, along with the top few players
+   for each enemy and overall. Since totals only ever go up, a player can only
+   move up the standings, so each board is just a short sorted list that the
+   player is moved up in when their total changes. The boards are copied into
+   the monster_event_leaders table every so often, so that nobody has to add up
+   the monster_kills table to see who's winning. That table needs to support
+   transactions (InnoDB), since each board is replaced in one. */
+
+#define LEADERS_HASH_SIZE   1024
+
+/* Longest a single row of the insert can be. */
+#define LEADERS_ROW_MAX     80
+
+typedef struct lb_player {
+    struct lb_player *hnext;
+    uint32_t gc;
+    uint32_t acc;
+    uint32_t total;
+    uint32_t kills[LEADERS_ENEMIES];
+} lb_player_t;
+
+typedef struct lb_board {
+    struct lb_board *next;
+    uint32_t event_id;
+    int dirty;
+    int count[LEADERS_ENEMIES + 1];
+    leader_t top[LEADERS_ENEMIES + 1][LEADERS_TOP];
+    lb_player_t *hash[LEADERS_HASH_SIZE];
+} lb_board_t;
+
+extern sylverant_dbconn_t conn;
+
+static lb_board_t *boards;
+static int publish_timer = -1;
+
+static lb_board_t *find_board(uint32_t event_id, int create) {
+    lb_board_t *b;
+
+    for(b = boards; b; b = b->next) {
+        if(b->event_id == event_id)
+            return b;
+    }
+
+    if(!create)
+        return NULL;
+
+    if(!(b = (lb_board_t *)malloc(sizeof(lb_board_t)))) {
+        debug(DBG_WARN, "Couldn't allocate leaderboard for event %" PRIu32
+              "\n", event_id);
+        return NULL;
+    }
+
+    memset(b, 0, sizeof(lb_board_t));
+    b->event_id = event_id;
+    b->next = boards;
+    boards = b;
+
+    return b;
+}
+
+static lb_player_t *find_player(lb_board_t *b, uint32_t acc, uint32_t gc) {
+    int h = gc & (LEADERS_HASH_SIZE - 1);
+    lb_player_t *p;
+
+    for(p = b->hash[h]; p; p = p->hnext) {
+        if(p->gc == gc && p->acc == acc)
+            return p;
+    }
+
+    if(!(p = (lb_player_t *)malloc(sizeof(lb_player_t)))) {
+        debug(DBG_WARN, "Couldn't allocate leaderboard entry\n");
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(lb_player_t));
+    p->gc = gc;
+    p->acc = acc;
+    p->hnext = b->hash[h];
+    b->hash[h] = p;
+
+    return p;
+}
+
+static void free_board(lb_board_t *b) {
+    lb_player_t *p, *tmp;
+    int i;
+
+    for(i = 0; i < LEADERS_HASH_SIZE; ++i) {
+        p = b->hash[i];
+
+        while(p) {
+            tmp = p->hnext;
+            free(p);
+            p = tmp;
+        }
+    }
+
+    free(b);
+}
+
+/* Move a player into (or up) one of the lists, now that they've got a higher
+   total. */
+static void update_top(lb_board_t *b, int idx, lb_player_t *p,
+                       uint32_t total) {
+    leader_t *t = b->top[idx], tmp;
+    int n = b->count[idx], i;
+
+    for(i = 0; i < n; ++i) {
+        if(t[i].gc == p->gc && t[i].acc == p->acc)
+            break;
+    }
+
+    if(i == n) {
+        if(n < LEADERS_TOP)
+            ++b->count[idx];
+        else if(total > t[n - 1].kills)
+            i = n - 1;
+        else
+            return;
+
+        t[i].gc = p->gc;
+        t[i].acc = p->acc;
+    }
+
+    t[i].kills = total;
+
+    /* Ties go to whoever got there first. */
+    while(i > 0 && t[i - 1].kills < t[i].kills) {
+        tmp = t[i - 1];
+        t[i - 1] = t[i];
+        t[i] = tmp;
+        --i;
+    }
+
+    b->dirty = 1;
+}
+
+static void add_kills(lb_board_t *b, uint32_t acc, uint32_t gc, int enemy,
+                      uint32_t count) {
+    lb_player_t *p;
+
+    if(!(p = find_player(b, acc, gc)))
+        return;
+
+    p->kills[enemy] += count;
+    p->total += count;
+
+    update_top(b, enemy, p, p->kills[enemy]);
+    update_top(b, LEADERS_OVERALL, p, p->total);
+}
+
+/* Build one of the lists again from scratch, after someone has been taken off
+   of it. */
+static void rebuild_top(lb_board_t *b, int idx) {
+    lb_player_t *p;
+    uint32_t total;
+    int i;
+
+    b->count[idx] = 0;
+
+    for(i = 0; i < LEADERS_HASH_SIZE; ++i) {
+        for(p = b->hash[i]; p; p = p->hnext) {
+            total = idx == LEADERS_OVERALL ? p->total : p->kills[idx];
+
+            if(total)
+                update_top(b, idx, p, total);
+        }
+    }
+
+    b->dirty = 1;
+}
+
+/* Replace the stored copy of a board. The old rows are cleared and the new
+   ones put in as one transaction, so anyone reading the table never sees an
+   empty (or half written) board. */
+static int publish_board(lb_board_t *b) {
+    char *query, *pos;
+    int i, j, rows = 0;
+
+    if(!(query = (char *)malloc((LEADERS_ENEMIES + 1) * LEADERS_TOP *
+                                LEADERS_ROW_MAX + 256))) {
+        debug(DBG_WARN, "Couldn't allocate leaderboard query\n");
+        return -1;
+    }
+
+    if(sylverant_db_query(&conn, "START TRANSACTION")) {
+        debug(DBG_WARN, "Couldn't start leaderboard update\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        free(query);
+        return -1;
+    }
+
+    sprintf(query, "DELETE FROM monster_event_leaders WHERE event_id='%"
+            PRIu32 "'", b->event_id);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't clear leaderboard for event %" PRIu32 "\n",
+              b->event_id);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        goto err;
+    }
+
+    strcpy(query, "INSERT INTO monster_event_leaders (event_id, enemy, place, "
+           "account_id, guildcard, kills) VALUES ");
+    pos = query + strlen(query);
+
+    for(i = 0; i <= LEADERS_ENEMIES; ++i) {
+        for(j = 0; j < b->count[i]; ++j) {
+            pos += sprintf(pos, "%s('%" PRIu32 "', '%d', '%d', '%" PRIu32
+                           "', '%" PRIu32 "', '%" PRIu32 "')",
+                           rows++ ? ", " : "", b->event_id,
+                           i == LEADERS_OVERALL ? -1 : i, j + 1,
+                           b->top[i][j].acc, b->top[i][j].gc,
+                           b->top[i][j].kills);
+        }
+    }
+
+    if(rows && sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't store leaderboard for event %" PRIu32 "\n",
+              b->event_id);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        goto err;
+    }
+
+    if(sylverant_db_query(&conn, "COMMIT")) {
+        debug(DBG_WARN, "Couldn't store leaderboard for event %" PRIu32 "\n",
+              b->event_id);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        goto err;
+    }
+
+    free(query);
+    b->dirty = 0;
+
+    return 0;
+
+err:
+    /* Leave the old copy there. It'll be tried again next time. */
+    if(sylverant_db_query(&conn, "ROLLBACK"))
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+
+    free(query);
+    return -1;
+}
+
+static int event_loaded(uint32_t event_id) {
+    uint32_t i;
+
+    for(i = 0; i < event_count; ++i) {
+        if(events[i].event_id == event_id)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Write out the boards that have changed, and get rid of those for events that
+   are over. */
+static void publish_timer_cb(time_t now, void *data) {
+    lb_board_t **i = &boards, *b;
+
+    (void)now;
+    (void)data;
+
+    while((b = *i)) {
+        if(b->dirty && publish_board(b)) {
+            i = &b->next;
+            continue;
+        }
+
+        if(!event_loaded(b->event_id)) {
+            *i = b->next;
+            free_board(b);
+            continue;
+        }
+
+        i = &b->next;
+    }
+}
+
+int leaders_init(void) {
+    char *query, *pos;
+    void *result;
+    char **row;
+    lb_board_t *b;
+    uint32_t i, event_id, acc, gc, count;
+    int enemy;
+
+    boards = NULL;
+    publish_timer = timer_add(LEADERS_PUBLISH_INTERVAL, &publish_timer_cb,
+                              NULL);
+
+    if(!event_count)
+        return 0;
+
+    if(!(query = (char *)malloc(event_count * 16 + 512))) {
+        debug(DBG_ERROR, "Couldn't allocate leaderboard query\n");
+        return -1;
+    }
+
+    /* This is the only time the kills get added up in the database. Anyone
+       that's been disqualified is left out. */
+    strcpy(query, "SELECT event_id, account_id, guildcard, enemy, SUM(count) "
+           "FROM monster_kills k WHERE NOT EXISTS (SELECT 1 FROM "
+           "monster_event_disq d WHERE d.event_id=k.event_id AND "
+           "d.account_id=k.account_id) AND event_id IN (");
+    pos = query + strlen(query);
+
+    for(i = 0; i < event_count; ++i) {
+        pos += sprintf(pos, "%s'%" PRIu32 "'", i ? ", " : "",
+                       events[i].event_id);
+    }
+
+    strcpy(pos, ") GROUP BY event_id, account_id, guildcard, enemy");
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_ERROR, "Couldn't read event kills\n");
+        debug(DBG_ERROR, "%s\n", sylverant_db_error(&conn));
+        free(query);
+        return -1;
+    }
+
+    free(query);
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_ERROR, "Couldn't store event kills\n");
+        debug(DBG_ERROR, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        event_id = (uint32_t)strtoul(row[0], NULL, 0);
+        acc = (uint32_t)strtoul(row[1], NULL, 0);
+        gc = (uint32_t)strtoul(row[2], NULL, 0);
+        enemy = (int)strtol(row[3], NULL, 0);
+        count = (uint32_t)strtoul(row[4], NULL, 0);
+
+        if(enemy < 0 || enemy >= LEADERS_ENEMIES)
+            continue;
+
+        if((b = find_board(event_id, 1)))
+            add_kills(b, acc, gc, enemy, count);
+    }
+
+    sylverant_db_result_free(result);
+
+    return 0;
+}
+
+void leaders_cleanup(void) {
+    lb_board_t *b;
+
+    if(publish_timer != -1) {
+        timer_remove(publish_timer);
+        publish_timer = -1;
+    }
+
+    while((b = boards)) {
+        boards = b->next;
+
+        if(b->dirty)
+            publish_board(b);
+
+        free_board(b);
+    }
+}
+
+void leaders_add(uint32_t event_id, uint32_t acc, uint32_t gc, int enemy,
+                 uint32_t count) {
+    lb_board_t *b;
+
+    if(enemy < 0 || enemy >= LEADERS_ENEMIES || !count)
+        return;
+
+    if((b = find_board(event_id, 1)))
+        add_kills(b, acc, gc, enemy, count);
+}
+
+void leaders_remove(uint32_t event_id, uint32_t acc) {
+    lb_board_t *b;
+    lb_player_t **pp, *p;
+    int i, j, found = 0;
+
+    if(!(b = find_board(event_id, 0)))
+        return;
+
+    /* The player could have kills on any of their characters. */
+    for(i = 0; i < LEADERS_HASH_SIZE; ++i) {
+        pp = &b->hash[i];
+
+        while((p = *pp)) {
+            if(p->acc == acc) {
+                *pp = p->hnext;
+                free(p);
+                found = 1;
+                continue;
+            }
+
+            pp = &p->hnext;
+        }
+    }
+
+    if(!found)
+        return;
+
+    /* Only the lists they were on have to be built again. Everyone else on
+       those moves up a place, and whoever was just off the end takes the last
+       one. */
+    for(i = 0; i <= LEADERS_ENEMIES; ++i) {
+        for(j = 0; j < b->count[i]; ++j) {
+            if(b->top[i][j].acc == acc) {
+                rebuild_top(b, i);
+                break;
+            }
+        }
+    }
+}
+
+int leaders_top(uint32_t event_id, int enemy, const leader_t **list) {
+    lb_board_t *b;
+
+    if(enemy < 0 || enemy > LEADERS_OVERALL || !(b = find_board(event_id, 0)))
+        return 0;
+
+    *list = b->top[enemy];
+    return b->count[enemy];
+}
@@ -0,0 +1,66 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LEADERS_H
+#define LEADERS_H
+
+#include <stdint.h>
+
+/* How many players are kept on each leaderboard. */
+#ifndef LEADERS_TOP
+#define LEADERS_TOP                 10
+#endif
+
+/* How often (in seconds) changed leaderboards are written to the
+   monster_event_leaders table. */
+#ifndef LEADERS_PUBLISH_INTERVAL
+#define LEADERS_PUBLISH_INTERVAL    60
+#endif
+
+/* Number of enemy types kills are counted for. */
+#define LEADERS_ENEMIES             0x60
+
+/* Pass this as the enemy to get the standings for all enemies together. In the
+   database, these are stored with an enemy of -1. */
+#define LEADERS_OVERALL             LEADERS_ENEMIES
+
+typedef struct leader {
+    uint32_t gc;
+    uint32_t acc;
+    uint32_t kills;
+} leader_t;
+
+/* Set up the leaderboards, reading in the kills so far for the events that
+   haven't ended yet. */
+int leaders_init(void);
+
+/* Write out any leaderboards that have changed and clean up. */
+void leaders_cleanup(void);
+
+/* Add kills of an enemy for a player in an event. */
+void leaders_add(uint32_t event_id, uint32_t acc, uint32_t gc, int enemy,
+                 uint32_t count);
+
+/* Take a player that's been disqualified off of an event's leaderboards,
+   forgetting all of their kills in it. */
+void leaders_remove(uint32_t event_id, uint32_t acc);
+
+/* Get the leaderboard for an enemy (or LEADERS_OVERALL) in an event. Returns
+   the number of players on it, with the list (best first) stored in list. */
+int leaders_top(uint32_t event_id, int enemy, const leader_t **list);
+
+#endif /* !LEADERS_H */
@@ -0,0 +1,586 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <iconv.h>
+#include <pthread.h>
+
+#include <sylverant/config.h>
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "mail.h"
+#include "timer.h"
+
+#define MAIL_HASH_SIZE      1024
+
+#define MAIL_JOB_STORE      0
+#define MAIL_JOB_NOTIFIED   1
+
+typedef struct mail_count {
+    struct mail_count *next;
+    uint32_t account_id;
+    uint32_t queued;
+} mail_count_t;
+
+/* Work for the writer thread. This is either a message to store, or a note that
+   an account has been notified about its mail. */
+typedef struct mail_job {
+    struct mail_job *next;
+    int type;
+    uint32_t account_id;
+    unsigned long long mail_id;
+    uint32_t recipient;
+    uint32_t sender;
+    time_t when;
+    int name_enc;
+    int msg_enc;
+    size_t name_len;
+    size_t msg_len;
+    uint8_t name[MAIL_MAX_NAME];
+    uint8_t msg[MAIL_MAX_MSG];
+} mail_job_t;
+
+extern sylverant_config_t *cfg;
+extern sylverant_dbconn_t conn;
+
+/* Number of messages for each account that have been queued, but not stored
+   yet. Accounts that aren't in here don't have any. These are protected by the
+   writer's mutex, since the writer takes them out once the mail is stored. */
+static mail_count_t *counts[MAIL_HASH_SIZE];
+
+/* Jobs queued up by the main thread that haven't been handed off yet. */
+static mail_job_t *pending, *pending_tail;
+static int pending_count;
+static int flush_timer = -1;
+
+/* Jobs that have been handed off to the writer thread. The buffer is for
+   building queries (enough for a full batch of the largest messages). */
+static mail_job_t *writer_queue, *writer_tail;
+static int writer_stop;
+static pthread_t writer_thd;
+static pthread_mutex_t writer_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static char *wquery;
+
+/* Highest mail_id the writer has stored (or that was in the table at startup).
+   This is protected by the writer's mutex. */
+static unsigned long long last_mail_id;
+
+/* The writer has its own database connection and iconv contexts, since neither
+   of those can be shared with the main thread. */
+static sylverant_dbconn_t wconn;
+static iconv_t w_utf16_to_utf8;
+static iconv_t w_sjis_to_utf8;
+static iconv_t w_8859_to_utf8;
+
+static mail_count_t *find_count(uint32_t account_id) {
+    mail_count_t *i = counts[account_id & (MAIL_HASH_SIZE - 1)];
+
+    while(i) {
+        if(i->account_id == account_id)
+            return i;
+
+        i = i->next;
+    }
+
+    return NULL;
+}
+
+/* Convert a piece of text to UTF-8, returning the length of the result. */
+static size_t convert_text(int enc, const uint8_t *in, size_t len, char *out,
+                           size_t out_len) {
+    ICONV_CONST char *inptr = (ICONV_CONST char *)in;
+    char *outptr = out;
+    size_t left = out_len - 1;
+    iconv_t ic;
+
+    switch(enc) {
+        case MAIL_TEXT_8859:
+            ic = w_8859_to_utf8;
+            break;
+
+        case MAIL_TEXT_SJIS:
+            ic = w_sjis_to_utf8;
+            break;
+
+        case MAIL_TEXT_UTF16:
+            ic = w_utf16_to_utf8;
+            break;
+
+        default:
+            if(len > out_len - 1)
+                len = out_len - 1;
+
+            memcpy(out, in, len);
+            out[len] = 0;
+            return strlen(out);
+    }
+
+    iconv(ic, &inptr, &len, &outptr, &left);
+    out[out_len - 1 - left] = 0;
+    return out_len - 1 - left;
+}
+
+/* Take a run of messages back out of the queued counts, once the writer is done
+   with them. Must be called with the writer's mutex held. */
+static void count_sub(mail_job_t *i, mail_job_t *end) {
+    mail_count_t *ent, *prev;
+    int bucket;
+
+    for(; i != end; i = i->next) {
+        bucket = i->account_id & (MAIL_HASH_SIZE - 1);
+
+        for(ent = counts[bucket], prev = NULL; ent; prev = ent,
+            ent = ent->next) {
+            if(ent->account_id == i->account_id)
+                break;
+        }
+
+        if(!ent || --ent->queued)
+            continue;
+
+        if(prev)
+            prev->next = ent->next;
+        else
+            counts[bucket] = ent->next;
+
+        free(ent);
+    }
+}
+
+/* Store a run of messages with one INSERT. If that fails, nothing is taken off
+   the queue (so it can be tried again), unless this is the last try. */
+static mail_job_t *write_mail(mail_job_t *i, char *query, int last_try) {
+    char name[64], msg[512];
+    size_t len, nmlen, msglen;
+    int rows = 0;
+    mail_job_t *first = i;
+
+    len = sprintf(query, "INSERT INTO simple_mail(recipient, sender, "
+                  "sent_time, sender_name, message) VALUES ");
+
+    while(i && i->type == MAIL_JOB_STORE && rows < MAIL_FLUSH_BATCH) {
+        nmlen = convert_text(i->name_enc, i->name, i->name_len, name, 64);
+        msglen = convert_text(i->msg_enc, i->msg, i->msg_len, msg, 512);
+
+        len += sprintf(query + len, "%s('%" PRIu32 "', '%" PRIu32 "', '%ld', '",
+                       rows ? ", " : "", i->recipient, i->sender,
+                       (long)i->when);
+        len += sylverant_db_escape_str(&wconn, query + len, name, nmlen);
+        len += sprintf(query + len, "', '");
+        len += sylverant_db_escape_str(&wconn, query + len, msg, msglen);
+        len += sprintf(query + len, "')");
+
+        ++rows;
+        i = i->next;
+    }
+
+    if(sylverant_db_query(&wconn, query)) {
+        debug(DBG_WARN, "Couldn't save %d simple mail messages\n", rows);
+        debug(DBG_WARN, "    %s\n", sylverant_db_error(&wconn));
+
+        if(!last_try)
+            return first;
+
+        debug(DBG_WARN, "Dropping %d simple mail messages\n", rows);
+        pthread_mutex_lock(&writer_mtx);
+        count_sub(first, i);
+        pthread_mutex_unlock(&writer_mtx);
+        return i;
+    }
+
+    /* The rows of a single INSERT get consecutive ids, starting at the one
+       reported back. Both of these change together, so that a login sees each
+       message either in the table or in the queued counts, never both. */
+    pthread_mutex_lock(&writer_mtx);
+    last_mail_id = (unsigned long long)sylverant_db_insert_id(&wconn) + rows -
+        1;
+    count_sub(first, i);
+    pthread_mutex_unlock(&writer_mtx);
+
+    return i;
+}
+
+/* Mark a run of accounts as having been notified about their mail. Mail that
+   arrived after the user was notified must stay unread. Everything that was
+   queued for them went through this queue ahead of the notification, so only
+   mark mail up to the last one the writer has stored, or the last one that was
+   counted at login (if it was added by something else). */
+static mail_job_t *write_notified(mail_job_t *i, char *query) {
+    size_t len;
+    int rows = 0;
+    unsigned long long last;
+
+    pthread_mutex_lock(&writer_mtx);
+    last = last_mail_id;
+    pthread_mutex_unlock(&writer_mtx);
+
+    len = sprintf(query, "UPDATE simple_mail INNER JOIN guildcards ON "
+                  "simple_mail.recipient = guildcards.guildcard SET "
+                  "simple_mail.status='2' WHERE simple_mail.status='0' AND (");
+
+    while(i && i->type == MAIL_JOB_NOTIFIED && rows < MAIL_FLUSH_BATCH) {
+        len += sprintf(query + len, "%s(guildcards.account_id='%" PRIu32
+                       "' AND simple_mail.mail_id<='%llu')",
+                       rows ? " OR " : "", i->account_id,
+                       i->mail_id > last ? i->mail_id : last);
+        ++rows;
+        i = i->next;
+    }
+
+    strcpy(query + len, ")");
+
+    if(sylverant_db_query(&wconn, query)) {
+        debug(DBG_WARN, "Couldn't update mail status\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&wconn));
+    }
+
+    return i;
+}
+
+/* Wait a bit before trying to store mail again. Returns non-zero if the writer
+   was told to stop in the meantime. */
+static int retry_wait(void) {
+    struct timespec ts;
+    int rv;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += MAIL_RETRY_DELAY;
+
+    pthread_mutex_lock(&writer_mtx);
+
+    while(!writer_stop) {
+        if(pthread_cond_timedwait(&writer_cond, &writer_mtx, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    rv = writer_stop;
+    pthread_mutex_unlock(&writer_mtx);
+
+    return rv;
+}
+
+static void *writer_thd_func(void *arg) {
+    mail_job_t *jobs, *i, *next;
+    int done, got;
+
+    (void)arg;
+
+    for(;;) {
+        pthread_mutex_lock(&writer_mtx);
+
+        while(!writer_queue && !writer_stop) {
+            pthread_cond_wait(&writer_cond, &writer_mtx);
+        }
+
+        jobs = writer_queue;
+        writer_queue = writer_tail = NULL;
+        done = writer_stop;
+        got = jobs != NULL;
+        pthread_mutex_unlock(&writer_mtx);
+
+        /* Write out everything we got, in order. Mail that can't be stored is
+           kept at the front of the line and tried again in a bit, so nothing
+           behind it gets ahead of it. Once the shipgate is shutting down, it
+           gets one more try. */
+        i = jobs;
+        while(i) {
+            if(i->type == MAIL_JOB_STORE) {
+                if((next = write_mail(i, wquery, done)) == i) {
+                    done = retry_wait();
+                    continue;
+                }
+            }
+            else {
+                next = write_notified(i, wquery);
+            }
+
+            while(i != next) {
+                jobs = i->next;
+                free(i);
+                i = jobs;
+            }
+        }
+
+        /* Anything that was queued while retrying gets written before the
+           writer stops. */
+        if(done && !got)
+            break;
+    }
+
+    return NULL;
+}
+
+/* Hand everything that's been queued up to the writer thread. */
+static void flush_pending(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    if(!pending)
+        return;
+
+    pthread_mutex_lock(&writer_mtx);
+
+    if(writer_tail)
+        writer_tail->next = pending;
+    else
+        writer_queue = pending;
+
+    writer_tail = pending_tail;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mtx);
+
+    pending = pending_tail = NULL;
+    pending_count = 0;
+}
+
+static void queue_job(mail_job_t *job) {
+    job->next = NULL;
+
+    if(pending_tail)
+        pending_tail->next = job;
+    else
+        pending = job;
+
+    pending_tail = job;
+
+    if(++pending_count >= MAIL_FLUSH_BATCH)
+        flush_pending(0, NULL);
+}
+
+int mail_init(void) {
+    void *result;
+    char **row;
+
+    /* Mail that's already in the table gets counted at login. */
+    if(sylverant_db_query(&conn, "SELECT MAX(mail_id) FROM simple_mail")) {
+        debug(DBG_WARN, "Couldn't fetch last mail id!\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't store last mail id!\n");
+        return -1;
+    }
+
+    if((row = sylverant_db_result_fetch(result)) && row[0])
+        last_mail_id = strtoull(row[0], NULL, 0);
+    else
+        last_mail_id = 0;
+
+    sylverant_db_result_free(result);
+
+    /* Set up the writer thread's resources and start it. */
+    if(!(wquery = (char *)malloc(256 + MAIL_FLUSH_BATCH * 1280))) {
+        debug(DBG_ERROR, "Cannot allocate mail writer buffer!\n");
+        return -1;
+    }
+
+    if(sylverant_db_open(&cfg->dbcfg, &wconn)) {
+        debug(DBG_ERROR, "Mail writer can't connect to the database\n");
+        free(wquery);
+        return -1;
+    }
+
+    w_utf16_to_utf8 = iconv_open("UTF-8", "UTF-16LE");
+    w_sjis_to_utf8 = iconv_open("UTF-8", "SHIFT_JIS");
+    w_8859_to_utf8 = iconv_open("UTF-8", "ISO-8859-1");
+
+    if(w_utf16_to_utf8 == (iconv_t)-1 || w_sjis_to_utf8 == (iconv_t)-1 ||
+       w_8859_to_utf8 == (iconv_t)-1) {
+        debug(DBG_ERROR, "Cannot create iconv contexts for mail writer\n");
+        return -1;
+    }
+
+    writer_stop = 0;
+
+    if(pthread_create(&writer_thd, NULL, &writer_thd_func, NULL)) {
+        debug(DBG_ERROR, "Cannot start mail writer thread\n");
+        return -1;
+    }
+
+    flush_timer = timer_add(MAIL_FLUSH_INTERVAL, &flush_pending, NULL);
+    return 0;
+}
+
+void mail_cleanup(void) {
+    int i;
+    mail_count_t *j, *tmp;
+
+    timer_remove(flush_timer);
+    flush_timer = -1;
+
+    /* Hand off anything that's left and wait for the writer to finish it. */
+    flush_pending(0, NULL);
+
+    pthread_mutex_lock(&writer_mtx);
+    writer_stop = 1;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mtx);
+    pthread_join(writer_thd, NULL);
+
+    iconv_close(w_utf16_to_utf8);
+    iconv_close(w_sjis_to_utf8);
+    iconv_close(w_8859_to_utf8);
+    sylverant_db_close(&wconn);
+    free(wquery);
+    wquery = NULL;
+
+    for(i = 0; i < MAIL_HASH_SIZE; ++i) {
+        j = counts[i];
+
+        while(j) {
+            tmp = j->next;
+            free(j);
+            j = tmp;
+        }
+
+        counts[i] = NULL;
+    }
+}
+
+int mail_queue(uint32_t recipient, uint32_t sender, uint32_t account_id,
+               const void *name, size_t name_len, int name_enc,
+               const void *msg, size_t msg_len, int msg_enc) {
+    mail_job_t *job;
+    mail_count_t *ent;
+
+    if(!(job = (mail_job_t *)malloc(sizeof(mail_job_t)))) {
+        debug(DBG_WARN, "Couldn't queue simple mail (to: %" PRIu32 " from: %"
+              PRIu32 ")\n", recipient, sender);
+        return -1;
+    }
+
+    if(name_len > MAIL_MAX_NAME)
+        name_len = MAIL_MAX_NAME;
+
+    if(msg_len > MAIL_MAX_MSG)
+        msg_len = MAIL_MAX_MSG;
+
+    job->type = MAIL_JOB_STORE;
+    job->account_id = account_id;
+    job->recipient = recipient;
+    job->sender = sender;
+    job->when = time(NULL);
+    job->name_enc = name_enc;
+    job->msg_enc = msg_enc;
+    job->name_len = name_len;
+    job->msg_len = msg_len;
+    memcpy(job->name, name, name_len);
+    memcpy(job->msg, msg, msg_len);
+
+    /* Count it before the writer can possibly see it, so that it comes back
+       out of the count after it's been stored. */
+    pthread_mutex_lock(&writer_mtx);
+
+    if((ent = find_count(account_id))) {
+        ++ent->queued;
+    }
+    else if((ent = (mail_count_t *)malloc(sizeof(mail_count_t)))) {
+        ent->account_id = account_id;
+        ent->queued = 1;
+        ent->next = counts[account_id & (MAIL_HASH_SIZE - 1)];
+        counts[account_id & (MAIL_HASH_SIZE - 1)] = ent;
+    }
+    else {
+        /* It'll still be counted at login once it's been stored. */
+        debug(DBG_WARN, "Couldn't allocate mail count!\n");
+    }
+
+    pthread_mutex_unlock(&writer_mtx);
+    queue_job(job);
+
+    return 0;
+}
+
+uint32_t mail_count_take(uint32_t account_id) {
+    char query[320];
+    void *result;
+    char **row;
+    mail_count_t *ent;
+    mail_job_t *job;
+    unsigned long long last, counted = 0;
+    uint32_t queued = 0, rv = 0;
+    int len;
+
+    pthread_mutex_lock(&writer_mtx);
+    last = last_mail_id;
+
+    if((ent = find_count(account_id)))
+        queued = ent->queued;
+
+    pthread_mutex_unlock(&writer_mtx);
+
+    /* Count what's in the table. If they have mail that's still queued, only
+       count up to the last one the writer stored, since anything after that
+       is in the queued count. */
+    len = sprintf(query, "SELECT COUNT(*), MAX(simple_mail.mail_id) FROM "
+                  "simple_mail INNER JOIN guildcards ON simple_mail.recipient "
+                  "= guildcards.guildcard WHERE guildcards.account_id='%"
+                  PRIu32 "' AND simple_mail.status='0'", account_id);
+
+    if(queued)
+        sprintf(query + len, " AND simple_mail.mail_id<='%llu'", last);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't count unread mail (%" PRIu32 ")\n",
+              account_id);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    }
+    else if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't store unread mail count (%" PRIu32 ")\n",
+              account_id);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    }
+    else {
+        if((row = sylverant_db_result_fetch(result)) && row[0]) {
+            rv = (uint32_t)strtoul(row[0], NULL, 0);
+
+            if(row[1])
+                counted = strtoull(row[1], NULL, 0);
+        }
+
+        sylverant_db_result_free(result);
+    }
+
+    rv += queued;
+
+    if(!rv)
+        return 0;
+
+    /* Have the writer mark the mail as notified in the database. This goes
+       through the same queue as the mail itself, so anything that was queued
+       before now is guaranteed to be in the table by the time it runs. */
+    if(!(job = (mail_job_t *)malloc(sizeof(mail_job_t)))) {
+        debug(DBG_WARN, "Couldn't queue mail status update!\n");
+        return rv;
+    }
+
+    job->type = MAIL_JOB_NOTIFIED;
+    job->account_id = account_id;
+    job->mail_id = counted;
+    queue_job(job);
+
+    return rv;
+}
@@ -0,0 +1,70 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAIL_H
+#define MAIL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* How often (in seconds) queued mail is handed to the writer thread. */
+#ifndef MAIL_FLUSH_INTERVAL
+#define MAIL_FLUSH_INTERVAL     2
+#endif
+
+/* How long (in seconds) the writer waits before trying to store mail again,
+   if the database couldn't take it. */
+#ifndef MAIL_RETRY_DELAY
+#define MAIL_RETRY_DELAY        5
+#endif
+
+/* Number of queued messages that will cause an early hand-off to the writer,
+   as well as the most rows that will be put into one INSERT. */
+#define MAIL_FLUSH_BATCH        64
+
+/* Maximum lengths of the raw (unconverted) name and message text. */
+#define MAIL_MAX_NAME           32
+#define MAIL_MAX_MSG            352
+
+/* Text encodings for mail_queue(). */
+#define MAIL_TEXT_RAW           0   /* Stored as-is */
+#define MAIL_TEXT_8859          1   /* ISO-8859-1 */
+#define MAIL_TEXT_SJIS          2   /* Shift-JIS */
+#define MAIL_TEXT_UTF16         3   /* UTF-16LE */
+
+/* Start up the mail writer thread. */
+int mail_init(void);
+
+/* Write out any queued mail and status changes, then stop the writer. */
+void mail_cleanup(void);
+
+/* Queue a message to be stored for an offline user. The text is converted to
+   UTF-8 and inserted by the writer thread. It is counted for the account right
+   away, so the user will be notified of the message at their next login, even
+   if it hasn't been written out yet. If the database can't take it, the writer
+   keeps trying until it does (or the shipgate shuts down). */
+int mail_queue(uint32_t recipient, uint32_t sender, uint32_t account_id,
+               const void *name, size_t name_len, int name_enc,
+               const void *msg, size_t msg_len, int msg_enc);
+
+/* Grab the number of messages the account hasn't been notified about yet. This
+   counts what's in the database (including mail added by anything other than
+   the shipgate) along with anything still queued. The messages will be marked
+   as notified in the database by the writer thread. */
+uint32_t mail_count_take(uint32_t account_id);
+
+#endif /* !MAIL_H */
@@ -26,6 +26,7 @@
 
 #include "shipgate.h"
 #include "ship.h"
+#include "stream.h"
 
 static uint8_t sendbuf[65536];
 
@@ -279,9 +280,10 @@ int send_ping(ship_t *c, int reply) {
 int send_cdata(ship_t *c, uint32_t gc, uint32_t slot, void *cdata, int sz,
                uint32_t block) {
     shipgate_char_data_pkt *pkt = (shipgate_char_data_pkt *)sendbuf;
+    size_t len = sizeof(shipgate_char_data_pkt) + sz;
 
     /* Fill in the header. */
-    pkt->hdr.pkt_len = htons(sizeof(shipgate_char_data_pkt) + sz);
+    pkt->hdr.pkt_len = htons(len > 0xFFFF ? 0 : len);
     pkt->hdr.pkt_type = htons(SHDR_TYPE_CREQ);
     pkt->hdr.flags = htons(SHDR_RESPONSE);
     pkt->hdr.reserved = 0;
@@ -291,6 +293,12 @@ int send_cdata(ship_t *c, uint32_t gc, uint32_t slot, void *cdata, int sz,
     pkt->guildcard = htonl(gc);
     pkt->slot = htonl(slot);
     pkt->block = block;
+
+    /* Stream big characters, so they don't hold up everything else. */
+    if(stream_supported(c) && len > STREAM_CHUNK_SIZE)
+        return stream_send_mem(c, pkt, sizeof(shipgate_char_data_pkt), cdata,
+                               sz);
+
     memcpy(pkt->data, cdata, sz);
 
     /* Send it away. */
@@ -409,6 +417,88 @@ int send_friend_message(ship_t *c, int on, uint32_t dest_gc,
     return send_crypt(c, sizeof(shipgate_friend_login_4_pkt));
 }
 
+/* Queue a friend login/logout message for the ship. */
+int queue_friend_message(ship_t *c, int on, uint32_t dest_gc,
+                         uint32_t dest_block, uint32_t friend_gc,
+                         uint32_t friend_block, uint32_t friend_ship,
+                         const char *friend_name, const char *nickname) {
+    friend_status_t *ent;
+    void *tmp;
+
+    /* Older ships don't know about the batched packet, so send it now. */
+    if(c->proto_ver < 20)
+        return send_friend_message(c, on, dest_gc, dest_block, friend_gc,
+                                   friend_block, friend_ship, friend_name,
+                                   nickname);
+
+    /* Don't let a single packet get too big... */
+    if(c->frstatus_count == FRSTATUS_MAX_ENTRIES) {
+        if(send_friend_messages(c))
+            return -1;
+    }
+
+    /* Make sure we have space for the new entry. */
+    if(c->frstatus_count == c->frstatus_size) {
+        tmp = realloc(c->frstatus, (c->frstatus_size + 16) *
+                      sizeof(friend_status_t));
+
+        if(!tmp) {
+            debug(DBG_WARN, "Couldn't queue friend message: %s\n",
+                  strerror(errno));
+            return send_friend_message(c, on, dest_gc, dest_block, friend_gc,
+                                       friend_block, friend_ship, friend_name,
+                                       nickname);
+        }
+
+        c->frstatus = (friend_status_t *)tmp;
+        c->frstatus_size += 16;
+    }
+
+    /* Fill in the entry */
+    ent = &c->frstatus[c->frstatus_count++];
+    memset(ent, 0, sizeof(friend_status_t));
+
+    ent->dest_guildcard = htonl(dest_gc);
+    ent->dest_block = htonl(dest_block);
+    ent->friend_guildcard = htonl(friend_gc);
+    ent->friend_ship = htonl(friend_ship);
+    ent->friend_block = htonl(friend_block);
+    ent->on = htonl(on ? 1 : 0);
+    strncpy(ent->friend_name, friend_name, 31);
+
+    if(nickname)
+        strncpy(ent->friend_nick, nickname, 31);
+
+    return 0;
+}
+
+/* Send any queued friend login/logout messages to the ship. */
+int send_friend_messages(ship_t *c) {
+    shipgate_friend_status_pkt *pkt = (shipgate_friend_status_pkt *)sendbuf;
+    int count = c->frstatus_count;
+    uint16_t len;
+
+    if(!count)
+        return 0;
+
+    len = sizeof(shipgate_friend_status_pkt) + count * sizeof(friend_status_t);
+    c->frstatus_count = 0;
+
+    /* Fill in the header */
+    pkt->hdr.pkt_len = htons(len);
+    pkt->hdr.pkt_type = htons(SHDR_TYPE_FRSTATUS);
+    pkt->hdr.flags = 0;
+    pkt->hdr.reserved = 0;
+    pkt->hdr.version = 0;
+    pkt->count = htonl(count);
+    pkt->reserved = 0;
+
+    /* The entries are already in the right byte order. */
+    memcpy(pkt->entries, c->frstatus, count * sizeof(friend_status_t));
+
+    return send_crypt(c, len);
+}
+
 /* Send a kick packet */
 int send_kick(ship_t *c, uint32_t requester, uint32_t user, uint32_t block,
               const char *reason) {
@@ -602,27 +692,36 @@ int send_script_chunk(ship_t *c, const char *local_fn, const char *remote_fn,
         return 0;
 
     /* Make sure it isn't too large... */
-    if(file_len > 32768) {
+    if(file_len > 32768 && (!stream_supported(c) ||
+                            file_len > STREAM_MAX_SIZE -
+                            sizeof(shipgate_schunk_pkt))) {
         debug(DBG_ERROR, "Attempt to send a script that is too large %s\n",
               local_fn);
         return -1;
     }
 
-    /* Open up the file. */
-    if(!(fp = fopen(local_fn, "rb"))) {
-        debug(DBG_ERROR, "Cannot open script file %s\n", local_fn);
-        return -1;
-    }
-
     /* Fill in the header and such */
     memset(pkt, 0, sizeof(shipgate_schunk_pkt));
-    pkt->hdr.pkt_len = htons(file_len + sizeof(shipgate_schunk_pkt));
     pkt->hdr.pkt_type = htons(SHDR_TYPE_SCHUNK);
     pkt->chunk_type = type;
     pkt->chunk_length = htonl((uint32_t)file_len);
     pkt->chunk_crc = htonl(crc);
     strncpy(pkt->filename, remote_fn, 32);
 
+    /* Big scripts get streamed straight from the file. */
+    if(stream_supported(c) &&
+       file_len + sizeof(shipgate_schunk_pkt) > STREAM_CHUNK_SIZE)
+        return stream_send_file(c, pkt, sizeof(shipgate_schunk_pkt), local_fn,
+                                file_len);
+
+    pkt->hdr.pkt_len = htons(file_len + sizeof(shipgate_schunk_pkt));
+
+    /* Open up the file. */
+    if(!(fp = fopen(local_fn, "rb"))) {
+        debug(DBG_ERROR, "Cannot open script file %s\n", local_fn);
+        return -1;
+    }
+
     /* Copy in the chunk */
     if(fread(pkt->chunk, 1, file_len, fp) != file_len) {
         fclose(fp);
@@ -675,13 +774,8 @@ int send_script(ship_t *c, ship_script_t *scr) {
     debug(DBG_LOG, "Sending ship %s script file '%s' (%s)\n", c->name,
           scr->remote_fn, scr->local_fn);
 
-    pkt_len = sizeof(shipgate_schunk_pkt) + scr->len;
-    if(pkt_len & 0x07)
-        pkt_len = (pkt_len + 8) & 0xFFF8;
-
     /* Fill in the easy stuff */
-    memset(pkt, 0, pkt_len);
-    pkt->hdr.pkt_len = htons(pkt_len);
+    memset(pkt, 0, sizeof(shipgate_schunk_pkt));
     pkt->hdr.pkt_type = htons(SHDR_TYPE_SCHUNK);
     pkt->chunk_type = scr->module ? SCHUNK_TYPE_MODULE : SCHUNK_TYPE_SCRIPT;
     pkt->chunk_length = htonl(scr->len);
@@ -691,6 +785,26 @@ int send_script(ship_t *c, ship_script_t *scr) {
     if(scr->event)
         pkt->action = htonl(scr->event);
 
+    /* Big scripts get streamed straight from the file. Ships that can't do
+       that can't get scripts that won't fit in a packet. */
+    if(stream_supported(c) &&
+       sizeof(shipgate_schunk_pkt) + scr->len > STREAM_CHUNK_SIZE)
+        return stream_send_file(c, pkt, sizeof(shipgate_schunk_pkt),
+                                scr->local_fn, scr->len);
+
+    if(scr->len > 32768) {
+        debug(DBG_WARN, "Script '%s' is too big for ship %s\n",
+              scr->remote_fn, c->name);
+        return 0;
+    }
+
+    pkt_len = sizeof(shipgate_schunk_pkt) + scr->len;
+    if(pkt_len & 0x07)
+        pkt_len = (pkt_len + 8) & 0xFFF8;
+
+    memset(pkt->chunk, 0, pkt_len - sizeof(shipgate_schunk_pkt));
+    pkt->hdr.pkt_len = htons(pkt_len);
+
     /* Read the script file in... */
     if(!(fp = fopen(scr->local_fn, "rb"))) {
         debug(DBG_ERROR, "Cannot read script file '%s'\n", scr->local_fn);
@@ -743,29 +857,78 @@ int send_sdata(ship_t *c, uint32_t gc, uint32_t block, uint32_t event,
         return 0;
 
     /* Make sure the length is sane... */
-    if(len > 32768) {
+    if(len > 32768 && (!stream_supported(c) ||
+                       len > STREAM_MAX_SIZE - sizeof(shipgate_sdata_pkt))) {
         debug(DBG_WARN, "Dropping huge sdata packet\n");
         return -1;
     }
 
-    pkt_len = sizeof(shipgate_sdata_pkt) + len;
-    if(pkt_len & 0x07)
-        pkt_len = (pkt_len + 8) & 0xFFF8;
-
     /* Fill in the packet... */
-    memset(pkt, 0, pkt_len);
-    pkt->hdr.pkt_len = htons(pkt_len);
+    memset(pkt, 0, sizeof(shipgate_sdata_pkt));
     pkt->hdr.pkt_type = htons(SHDR_TYPE_SDATA);
     pkt->event_id = htonl(event);
     pkt->data_len = htonl(len);
     pkt->guildcard = htonl(gc);
     pkt->block = htonl(block);
+
+    if(stream_supported(c) && sizeof(shipgate_sdata_pkt) + len >
+       STREAM_CHUNK_SIZE)
+        return stream_send_mem(c, pkt, sizeof(shipgate_sdata_pkt), data, len);
+
+    pkt_len = sizeof(shipgate_sdata_pkt) + len;
+    if(pkt_len & 0x07)
+        pkt_len = (pkt_len + 8) & 0xFFF8;
+
+    memset(pkt->data, 0, pkt_len - sizeof(shipgate_sdata_pkt));
+    pkt->hdr.pkt_len = htons(pkt_len);
     memcpy(pkt->data, data, len);
 
     /* Send it away. */
     return send_crypt(c, pkt_len);
 }
 
+/* Send one piece of a streamed message to a ship. */
+int send_stream_chunk(ship_t *c, uint32_t id, uint32_t seq, uint32_t total,
+                      uint32_t offset, const void *data, uint16_t len) {
+    shipgate_stream_pkt *pkt = (shipgate_stream_pkt *)sendbuf;
+    uint16_t pkt_len = sizeof(shipgate_stream_pkt) + len;
+
+    /* Fill in the packet... */
+    pkt->hdr.pkt_len = htons(pkt_len);
+    pkt->hdr.pkt_type = htons(SHDR_TYPE_STREAM);
+    pkt->hdr.flags = 0;
+    pkt->hdr.reserved = 0;
+    pkt->hdr.version = 0;
+    pkt->stream_id = htonl(id);
+    pkt->seq = htonl(seq);
+    pkt->total_len = htonl(total);
+    pkt->offset = htonl(offset);
+    memcpy(pkt->data, data, len);
+
+    /* Send it away. */
+    return send_crypt(c, pkt_len);
+}
+
+/* Acknowledge (or reject) pieces of a streamed message from a ship. */
+int send_stream_ack(ship_t *c, uint32_t id, uint32_t seq, uint32_t offset,
+                    int fail) {
+    shipgate_stream_pkt *pkt = (shipgate_stream_pkt *)sendbuf;
+
+    /* Fill in the packet... */
+    pkt->hdr.pkt_len = htons(sizeof(shipgate_stream_pkt));
+    pkt->hdr.pkt_type = htons(SHDR_TYPE_STREAM);
+    pkt->hdr.flags = htons(SHDR_RESPONSE | (fail ? SHDR_FAILURE : 0));
+    pkt->hdr.reserved = 0;
+    pkt->hdr.version = 0;
+    pkt->stream_id = htonl(id);
+    pkt->seq = htonl(seq);
+    pkt->total_len = 0;
+    pkt->offset = htonl(offset);
+
+    /* Send it away. */
+    return send_crypt(c, sizeof(shipgate_stream_pkt));
+}
+
 /* Send a quest flag response */
 int send_qflag(ship_t *c, uint16_t type, uint32_t gc, uint32_t block,
                uint32_t fid, uint32_t qid, uint32_t value, uint32_t ctl) {
@@ -791,6 +954,33 @@ int send_qflag(ship_t *c, uint16_t type, uint32_t gc, uint32_t block,
     return send_crypt(c, sizeof(shipgate_qflag_pkt));
 }
 
+/* Send a bulk quest flag response */
+int send_qflags(ship_t *c, uint32_t gc, uint32_t block, uint32_t qid,
+                uint32_t flags, const shipgate_qflag_ent_t *ents,
+                uint32_t count) {
+    shipgate_qflags_pkt *pkt = (shipgate_qflags_pkt *)sendbuf;
+    int len = sizeof(shipgate_qflags_pkt) + count * sizeof(shipgate_qflag_ent_t);
+
+    /* Don't try to send these to a ship that won't know what to do with them */
+    if(c->proto_ver < 22)
+        return 0;
+
+    /* Fill in the packet... */
+    memset(pkt, 0, sizeof(shipgate_qflags_pkt));
+    pkt->hdr.pkt_len = htons(len);
+    pkt->hdr.pkt_type = htons(SHDR_TYPE_QFLAGS);
+    pkt->hdr.flags = htons(SHDR_RESPONSE);
+    pkt->guildcard = htonl(gc);
+    pkt->block = htonl(block);
+    pkt->quest_id = htonl(qid);
+    pkt->flags = htonl(flags);
+    pkt->count = htonl(count);
+    memcpy(pkt->entries, ents, count * sizeof(shipgate_qflag_ent_t));
+
+    /* Send it away. */
+    return send_crypt(c, len);
+}
+
 /* Send a simple ship control request */
 int send_sctl(ship_t *c, uint32_t ctl, uint32_t acc) {
     shipgate_shipctl_pkt *pkt = (shipgate_shipctl_pkt *)sendbuf;
@@ -0,0 +1,801 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "qflags.h"
+#include "journal.h"
+#include "timer.h"
+
+/* Each player's quest flags are read from the database all at once, the first
+   time any of them is needed, and kept in memory after that. Changes are made
+   in memory and written to the database a batch at a time a few seconds later
+   (or when the player logs off). Like character saves, each change is written
+   to a journal (and synced to disk) before the ship is told that it worked, so
+   nothing is lost if the shipgate crashes before it gets to the database.
+
+   The journal only ever needs to hold the changes that aren't in the database
+   yet, so whenever everything has been written (or the journal gets too big),
+   it is replaced with a new one holding just what's left. */
+
+#define QF_HASH_SIZE        1024
+#define QF_JOURNAL_MAGIC    0x4A4C4651  /* "QFLJ" */
+#define QF_JOURNAL_VERSION  2
+
+/* Kinds of journal records. There's only the one. */
+#define QF_REC_FLAG         1
+
+/* Longest a single row of an insert or delete can be. */
+#define QF_ROW_MAX          48
+
+#define QF_REC_LONG         0x00000001
+#define QF_REC_DELETE       0x00000002
+
+#ifdef PACKED
+#undef PACKED
+#endif
+
+#define PACKED __attribute__((packed))
+
+/* What's stored for a change to a flag. The guildcard and flag id are in the
+   record header. */
+typedef struct qf_rec {
+    uint32_t value;
+    uint32_t ctl;
+} PACKED qf_rec_t;
+
+#undef PACKED
+
+typedef struct qf_flag {
+    uint32_t flag_id;
+    uint32_t value;
+    uint8_t lng;
+    uint8_t deleted;
+    uint8_t dirty;
+} qf_flag_t;
+
+typedef struct qf_entry {
+    TAILQ_ENTRY(qf_entry) lru;
+    TAILQ_ENTRY(qf_entry) dentry;
+    struct qf_entry *hnext;
+    uint32_t gc;
+    int loaded;
+    int drop;
+    int ndirty;
+    time_t dirty_since;
+    qf_flag_t *flags;
+    int count;
+    int size;
+} qf_entry_t;
+
+TAILQ_HEAD(qf_list, qf_entry);
+
+/* What a flag was like before a change that isn't in the journal yet, so the
+   change can be undone if it can't be put there. */
+typedef struct qf_undo {
+    uint32_t value;
+    uint8_t existed;
+    uint8_t deleted;
+    uint8_t dirty;
+    int drop;
+} qf_undo_t;
+
+extern sylverant_dbconn_t conn;
+
+static qf_entry_t *hash[QF_HASH_SIZE];
+static struct qf_list lru = TAILQ_HEAD_INITIALIZER(lru);
+static struct qf_list dirty = TAILQ_HEAD_INITIALIZER(dirty);
+static int entry_count, dirty_flags;
+
+static journal_t *jnl;
+
+static int flush_timer = -1, stats_timer = -1;
+
+static struct {
+    unsigned long reads;
+    unsigned long loads;
+    unsigned long writes;
+    unsigned long absorbed;
+    unsigned long batches;
+    unsigned long rows;
+    unsigned long failed;
+    unsigned long syncs;
+    unsigned long failed_syncs;
+    unsigned long flush_us;
+    unsigned long flush_max_us;
+} stats;
+
+static qf_entry_t *find_entry(uint32_t gc) {
+    qf_entry_t *i = hash[gc & (QF_HASH_SIZE - 1)];
+
+    while(i) {
+        if(i->gc == gc)
+            return i;
+
+        i = i->hnext;
+    }
+
+    return NULL;
+}
+
+static void remove_entry(qf_entry_t *e) {
+    qf_entry_t **i = &hash[e->gc & (QF_HASH_SIZE - 1)];
+
+    while(*i) {
+        if(*i == e) {
+            *i = e->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    if(e->ndirty) {
+        TAILQ_REMOVE(&dirty, e, dentry);
+        dirty_flags -= e->ndirty;
+    }
+
+    TAILQ_REMOVE(&lru, e, lru);
+    --entry_count;
+    free(e->flags);
+    free(e);
+}
+
+/* Find the entry for a guildcard, adding it if it isn't there. */
+static qf_entry_t *get_entry(uint32_t gc) {
+    qf_entry_t *e, *i, *tmp;
+    int b = gc & (QF_HASH_SIZE - 1);
+
+    if((e = find_entry(gc))) {
+        TAILQ_REMOVE(&lru, e, lru);
+        TAILQ_INSERT_TAIL(&lru, e, lru);
+        return e;
+    }
+
+    /* Make room, skipping over anything that hasn't been written yet. */
+    i = TAILQ_FIRST(&lru);
+    while(i && entry_count >= QFLAGS_CACHE_MAX) {
+        tmp = TAILQ_NEXT(i, lru);
+
+        if(!i->ndirty)
+            remove_entry(i);
+
+        i = tmp;
+    }
+
+    if(!(e = (qf_entry_t *)malloc(sizeof(qf_entry_t))))
+        return NULL;
+
+    memset(e, 0, sizeof(qf_entry_t));
+    e->gc = gc;
+    e->hnext = hash[b];
+    hash[b] = e;
+    TAILQ_INSERT_TAIL(&lru, e, lru);
+    ++entry_count;
+
+    return e;
+}
+
+/* Find where a flag is (or would go) in an entry's sorted list. */
+static int flag_pos(qf_entry_t *e, uint32_t flag_id, int lng, int *found) {
+    int lo = 0, hi = e->count, mid;
+    qf_flag_t *f;
+
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        f = &e->flags[mid];
+
+        if(f->lng == lng && f->flag_id == flag_id) {
+            *found = 1;
+            return mid;
+        }
+
+        if(f->lng < lng || (f->lng == lng && f->flag_id < flag_id))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *found = 0;
+    return lo;
+}
+
+static qf_flag_t *add_flag(qf_entry_t *e, uint32_t flag_id, int lng) {
+    qf_flag_t *tmp;
+    int pos, found;
+
+    pos = flag_pos(e, flag_id, lng, &found);
+
+    if(found)
+        return &e->flags[pos];
+
+    if(e->count == e->size) {
+        if(!(tmp = (qf_flag_t *)realloc(e->flags, (e->size + 16) *
+                                        sizeof(qf_flag_t))))
+            return NULL;
+
+        e->flags = tmp;
+        e->size += 16;
+    }
+
+    memmove(&e->flags[pos + 1], &e->flags[pos],
+            (e->count - pos) * sizeof(qf_flag_t));
+    ++e->count;
+
+    tmp = &e->flags[pos];
+    memset(tmp, 0, sizeof(qf_flag_t));
+    tmp->flag_id = flag_id;
+    tmp->lng = (uint8_t)lng;
+
+    return tmp;
+}
+
+/* Make a change to a flag in memory, to be written to the database later. If
+   u is non-NULL, what the flag was like before is stored there. */
+static int apply_change(uint32_t gc, uint32_t flag_id, int lng, int del,
+                        uint32_t value, time_t now, qf_undo_t *u) {
+    qf_entry_t *e;
+    qf_flag_t *f;
+    int pos, found;
+
+    if(!(e = get_entry(gc)))
+        return -1;
+
+    if(u) {
+        pos = flag_pos(e, flag_id, lng, &found);
+        memset(u, 0, sizeof(qf_undo_t));
+        u->existed = (uint8_t)found;
+        u->drop = e->drop;
+
+        if(found) {
+            u->value = e->flags[pos].value;
+            u->deleted = e->flags[pos].deleted;
+            u->dirty = e->flags[pos].dirty;
+        }
+    }
+
+    if(!(f = add_flag(e, flag_id, lng)))
+        return -1;
+
+    f->value = lng ? value : (value & 0xFFFF);
+    f->deleted = (uint8_t)del;
+    e->drop = 0;
+
+    /* If the flag hadn't been written since the last change, this one just
+       replaces it. */
+    if(f->dirty) {
+        ++stats.absorbed;
+        return 0;
+    }
+
+    f->dirty = 1;
+    ++dirty_flags;
+
+    if(!e->ndirty++) {
+        e->dirty_since = now;
+        TAILQ_INSERT_TAIL(&dirty, e, dentry);
+    }
+
+    return 0;
+}
+
+/* Put a flag back how it was before a change that couldn't be journaled.
+   Nothing is written to the database until it's in the journal, so the flag
+   is still just as the change left it. */
+static void undo_change(uint32_t gc, uint32_t flag_id, int lng,
+                        const qf_undo_t *u) {
+    qf_entry_t *e;
+    qf_flag_t *f;
+    int pos, found, was_dirty;
+
+    if(!(e = find_entry(gc)))
+        return;
+
+    pos = flag_pos(e, flag_id, lng, &found);
+
+    if(!found)
+        return;
+
+    f = &e->flags[pos];
+    was_dirty = f->dirty;
+
+    if(!u->existed) {
+        memmove(f, f + 1, (e->count - pos - 1) * sizeof(qf_flag_t));
+        --e->count;
+    }
+    else {
+        f->value = u->value;
+        f->deleted = u->deleted;
+        f->dirty = u->dirty;
+    }
+
+    if(was_dirty && (!u->existed || !u->dirty)) {
+        --dirty_flags;
+
+        if(!--e->ndirty)
+            TAILQ_REMOVE(&dirty, e, dentry);
+    }
+
+    e->drop = u->drop;
+}
+
+/* Read all of a player's flags from the database. Anything that's been changed
+   in memory is newer, so it's kept. */
+static int load_entry(qf_entry_t *e) {
+    char query[384];
+    void *result;
+    char **row;
+    qf_flag_t *f;
+    int found, lng;
+    uint32_t flag_id;
+
+    sprintf(query, "SELECT 0, flag_id, value FROM quest_flags_short WHERE "
+            "guildcard='%u' UNION ALL SELECT 1, flag_id, value FROM "
+            "quest_flags_long WHERE guildcard='%u'", e->gc, e->gc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't read quest flags (%u)\n", e->gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    if(!(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't store quest flags (%u)\n", e->gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return -1;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        lng = (int)strtol(row[0], NULL, 0);
+        flag_id = (uint32_t)strtoul(row[1], NULL, 0);
+
+        flag_pos(e, flag_id, lng, &found);
+        if(found)
+            continue;
+
+        if(!(f = add_flag(e, flag_id, lng))) {
+            debug(DBG_WARN, "Couldn't allocate quest flags (%u)\n", e->gc);
+            sylverant_db_result_free(result);
+            return -1;
+        }
+
+        f->value = (uint32_t)strtoul(row[2], NULL, 0);
+    }
+
+    sylverant_db_result_free(result);
+    e->loaded = 1;
+    ++stats.loads;
+
+    return 0;
+}
+
+/* Write out the changed flags for a batch of players. The rows for each of the
+   four kinds of change go in their own query. */
+static int flush_batch(qf_entry_t **batch, int n) {
+    static const char *heads[4] = {
+        "INSERT INTO quest_flags_short (guildcard, flag_id, value) VALUES ",
+        "INSERT INTO quest_flags_long (guildcard, flag_id, value) VALUES ",
+        "DELETE FROM quest_flags_short WHERE (guildcard, flag_id) IN (",
+        "DELETE FROM quest_flags_long WHERE (guildcard, flag_id) IN ("
+    };
+    static const char *tails[4] = {
+        " ON DUPLICATE KEY UPDATE value=VALUES(value)",
+        " ON DUPLICATE KEY UPDATE value=VALUES(value)",
+        ")",
+        ")"
+    };
+    char *query[4] = { NULL, NULL, NULL, NULL }, *pos[4];
+    int rows[4] = { 0, 0, 0, 0 }, i, j, k, total = 0, rv = -1;
+    struct timespec start, end;
+    unsigned long us;
+    qf_entry_t *e;
+    qf_flag_t *f;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(i = 0; i < n; ++i) {
+        for(j = 0; j < batch[i]->count; ++j) {
+            f = &batch[i]->flags[j];
+
+            if(f->dirty)
+                ++rows[f->lng + (f->deleted ? 2 : 0)];
+        }
+    }
+
+    for(k = 0; k < 4; ++k) {
+        if(!rows[k])
+            continue;
+
+        if(!(query[k] = (char *)malloc(rows[k] * QF_ROW_MAX + 256))) {
+            debug(DBG_WARN, "Couldn't allocate quest flag query\n");
+            goto out;
+        }
+
+        strcpy(query[k], heads[k]);
+        pos[k] = query[k] + strlen(query[k]);
+        rows[k] = 0;
+    }
+
+    for(i = 0; i < n; ++i) {
+        for(j = 0; j < batch[i]->count; ++j) {
+            f = &batch[i]->flags[j];
+
+            if(!f->dirty)
+                continue;
+
+            k = f->lng + (f->deleted ? 2 : 0);
+
+            if(f->deleted)
+                pos[k] += sprintf(pos[k], "%s(%u, %u)", rows[k] ? ", " : "",
+                                  batch[i]->gc, f->flag_id);
+            else
+                pos[k] += sprintf(pos[k], "%s('%u', '%u', '%u')",
+                                  rows[k] ? ", " : "", batch[i]->gc,
+                                  f->flag_id, f->value);
+
+            ++rows[k];
+            ++total;
+        }
+    }
+
+    for(k = 0; k < 4; ++k) {
+        if(!rows[k])
+            continue;
+
+        strcpy(pos[k], tails[k]);
+
+        if(sylverant_db_query(&conn, query[k])) {
+            debug(DBG_WARN, "Couldn't store quest flags\n");
+            debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+            ++stats.failed;
+            goto out;
+        }
+    }
+
+    /* It's all in the database now. Deleted flags don't need to be remembered
+       anymore, since they'd just be read as not being there. */
+    for(i = 0; i < n; ++i) {
+        e = batch[i];
+
+        for(j = 0, k = 0; j < e->count; ++j) {
+            f = &e->flags[j];
+            f->dirty = 0;
+
+            if(!f->deleted)
+                e->flags[k++] = *f;
+        }
+
+        e->count = k;
+        dirty_flags -= e->ndirty;
+        e->ndirty = 0;
+        TAILQ_REMOVE(&dirty, e, dentry);
+
+        if(e->drop)
+            remove_entry(e);
+    }
+
+    ++stats.batches;
+    stats.rows += total;
+    rv = 0;
+
+out:
+    for(k = 0; k < 4; ++k) {
+        free(query[k]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    us = (unsigned long)((end.tv_sec - start.tv_sec) * 1000000 +
+                         (end.tv_nsec - start.tv_nsec) / 1000);
+    stats.flush_us += us;
+
+    if(us > stats.flush_max_us)
+        stats.flush_max_us = us;
+
+    return rv;
+}
+
+/* Move a player whose changes couldn't be written to the back of the line, so
+   they don't hold up everyone else. They're tried again once they've waited
+   as long as a new change would. */
+static void park_entry(qf_entry_t *e) {
+    debug(DBG_WARN, "Couldn't store %d quest flag changes for %u, will try "
+          "again later\n", e->ndirty, e->gc);
+
+    e->dirty_since = time(NULL);
+    TAILQ_REMOVE(&dirty, e, dentry);
+    TAILQ_INSERT_TAIL(&dirty, e, dentry);
+}
+
+/* Write out everything that's been waiting since before the cutoff (or all of
+   it, with a cutoff of 0). */
+static int flush_dirty(time_t cutoff) {
+    static qf_entry_t *batch[QFLAGS_BATCH_ROWS];
+    qf_entry_t *e, *last;
+    int n, rows, i, ok, done = 0, rv = 0;
+
+    /* Changes can't go to the database before they're in the journal, or they
+       couldn't be undone if that fails. */
+    qflags_sync();
+
+    /* Anyone that gets parked goes after this, so stop here to only try each
+       player once. */
+    last = TAILQ_LAST(&dirty, qf_list);
+
+    while(!done && (e = TAILQ_FIRST(&dirty))) {
+        if(cutoff && e->dirty_since > cutoff)
+            break;
+
+        n = rows = 0;
+
+        while(e && n < QFLAGS_BATCH_ROWS &&
+              (!n || rows + e->ndirty <= QFLAGS_BATCH_ROWS) &&
+              (!cutoff || e->dirty_since <= cutoff)) {
+            batch[n++] = e;
+            rows += e->ndirty;
+
+            if(e == last) {
+                done = 1;
+                break;
+            }
+
+            e = TAILQ_NEXT(e, dentry);
+        }
+
+        if(!flush_batch(batch, n))
+            continue;
+
+        /* Something in the batch was bad, so write each player on their own
+           to find out who, and get the rest written anyway. */
+        for(i = 0, ok = 0; i < n; ++i) {
+            if(n > 1 && !flush_batch(&batch[i], 1)) {
+                ++ok;
+                continue;
+            }
+
+            park_entry(batch[i]);
+        }
+
+        rv = -1;
+
+        /* If none of it worked, it's likely the database that's the problem,
+           so don't keep at it until next time. */
+        if(!ok)
+            break;
+    }
+
+    return rv;
+}
+
+static void make_rec(qf_rec_t *r, int lng, int del, uint32_t value) {
+    r->value = value;
+    r->ctl = (lng ? QF_REC_LONG : 0) | (del ? QF_REC_DELETE : 0);
+}
+
+/* Put a change from the journal left from the last run back into memory. */
+static int replay_rec(const journal_rec_t *hdr, const uint8_t *data) {
+    const qf_rec_t *r = (const qf_rec_t *)data;
+
+    if(hdr->type != QF_REC_FLAG || hdr->len != sizeof(qf_rec_t))
+        return -1;
+
+    return apply_change(hdr->guildcard, hdr->key, r->ctl & QF_REC_LONG,
+                        (r->ctl & QF_REC_DELETE) ? 1 : 0, r->value, time(NULL),
+                        NULL);
+}
+
+static void undo_rec(const journal_rec_t *hdr, const uint8_t *data,
+                     void *undo) {
+    const qf_rec_t *r = (const qf_rec_t *)data;
+
+    undo_change(hdr->guildcard, hdr->key, (r->ctl & QF_REC_LONG) ? 1 : 0,
+                (const qf_undo_t *)undo);
+    ++stats.failed_syncs;
+}
+
+/* Write all the changes that aren't in the database yet to a new journal. */
+static int rewrite_flags(journal_t *j) {
+    qf_entry_t *e;
+    qf_flag_t *f;
+    qf_rec_t r;
+    int i;
+
+    TAILQ_FOREACH(e, &dirty, dentry) {
+        for(i = 0; i < e->count; ++i) {
+            f = &e->flags[i];
+
+            if(!f->dirty)
+                continue;
+
+            make_rec(&r, f->lng, f->deleted, f->value);
+
+            if(journal_put(j, QF_REC_FLAG, e->gc, f->flag_id, &r, sizeof(r)))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+static const journal_ops_t journal_ops = {
+    "quest flag", QF_JOURNAL_MAGIC, QF_JOURNAL_VERSION, sizeof(qf_rec_t),
+    QFLAGS_JOURNAL_MAX, sizeof(qf_undo_t), &replay_rec, NULL, &undo_rec, NULL,
+    &rewrite_flags
+};
+
+static void flush_timer_cb(time_t now, void *data) {
+    (void)data;
+
+    flush_dirty(now - QFLAGS_FLUSH_DELAY);
+    journal_check(jnl, dirty_flags);
+}
+
+static void stats_timer_cb(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    debug(DBG_LOG, "Quest flags: %lu reads (%lu players loaded), %lu writes, "
+          "%lu absorbed, %lu rows stored in %lu batches (avg %.1f rows, "
+          "%.1f ms; max %.1f ms), %lu failed, %lu journal syncs (%lu changes "
+          "undone), %d unwritten, %d players cached\n", stats.reads,
+          stats.loads, stats.writes, stats.absorbed, stats.rows, stats.batches,
+          stats.batches ? (double)stats.rows / stats.batches : 0.0,
+          stats.batches ? stats.flush_us / 1000.0 / stats.batches : 0.0,
+          stats.flush_max_us / 1000.0, stats.failed, stats.syncs,
+          stats.failed_syncs, dirty_flags, entry_count);
+}
+
+int qflags_init(const char *journal) {
+    memset(hash, 0, sizeof(hash));
+    memset(&stats, 0, sizeof(stats));
+    TAILQ_INIT(&lru);
+    TAILQ_INIT(&dirty);
+    entry_count = dirty_flags = 0;
+
+    /* Get whatever was left over into the database before anything else. If
+       that doesn't work, it'll go in the new journal. */
+    if(!(jnl = journal_open(journal, &journal_ops)))
+        return -1;
+
+    flush_dirty(0);
+
+    if(journal_rewrite(jnl))
+        return -1;
+
+    flush_timer = timer_add(1, &flush_timer_cb, NULL);
+    stats_timer = timer_add(QFLAGS_STATS_INTERVAL, &stats_timer_cb, NULL);
+
+    return 0;
+}
+
+void qflags_cleanup(void) {
+    qf_entry_t *e;
+
+    qflags_sync();
+    flush_dirty(0);
+    stats_timer_cb(0, NULL);
+
+    timer_remove(flush_timer);
+    timer_remove(stats_timer);
+    flush_timer = stats_timer = -1;
+
+    /* If everything made it to the database, the journal isn't needed anymore.
+       Otherwise, it'll get replayed on the next startup. */
+    if(dirty_flags)
+        debug(DBG_WARN, "%d quest flag changes left in the journal\n",
+              dirty_flags);
+
+    journal_close(jnl, dirty_flags);
+    jnl = NULL;
+
+    while((e = TAILQ_FIRST(&lru))) {
+        remove_entry(e);
+    }
+}
+
+int qflags_get(uint32_t gc, uint32_t flag_id, int lng, uint32_t *value) {
+    qf_entry_t *e;
+    int pos, found;
+
+    ++stats.reads;
+
+    if(!(e = get_entry(gc)))
+        return QFLAGS_ERROR;
+
+    e->drop = 0;
+
+    if(!e->loaded && load_entry(e))
+        return QFLAGS_ERROR;
+
+    pos = flag_pos(e, flag_id, lng ? 1 : 0, &found);
+
+    if(!found || e->flags[pos].deleted)
+        return QFLAGS_NO_DATA;
+
+    *value = e->flags[pos].value;
+    return QFLAGS_OK;
+}
+
+int qflags_set(uint32_t gc, uint32_t flag_id, int lng, int del,
+               uint32_t value, qflags_cb_t cb, void *cbdata) {
+    qf_undo_t u;
+    qf_rec_t r;
+
+    lng = lng ? 1 : 0;
+
+    if(apply_change(gc, flag_id, lng, del, value, time(NULL), &u))
+        return -1;
+
+    make_rec(&r, lng, del, value);
+
+    if(journal_add(jnl, QF_REC_FLAG, gc, flag_id, &r, sizeof(r), &u, cb,
+                   cbdata)) {
+        undo_change(gc, flag_id, lng, &u);
+        return -1;
+    }
+
+    ++stats.writes;
+
+    return 0;
+}
+
+int qflags_wait(qflags_cb_t cb, void *cbdata) {
+    return journal_wait(jnl, cb, cbdata, 1);
+}
+
+void qflags_sync(void) {
+    /* One write and one sync for everything that came in since last time. */
+    if(journal_sync(jnl))
+        ++stats.syncs;
+
+    journal_check(jnl, dirty_flags);
+}
+
+int qflags_pending(void) {
+    return journal_pending(jnl);
+}
+
+void qflags_flush_gc(uint32_t gc) {
+    qf_entry_t *e;
+
+    if(!(e = find_entry(gc)))
+        return;
+
+    /* The player's last changes have to be in the journal before they can go
+       to the database. */
+    qflags_sync();
+
+    /* Once it's written, there's no need to keep it around. If that doesn't
+       work, it'll get written (and dropped) along with everything else. */
+    e->drop = 1;
+
+    if(!e->ndirty)
+        remove_entry(e);
+    else if(!flush_batch(&e, 1))
+        journal_check(jnl, dirty_flags);
+}
+
+void qflags_flush_all(void) {
+    flush_dirty(0);
+    journal_check(jnl, dirty_flags);
+}
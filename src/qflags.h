@@ -0,0 +1,98 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef QFLAGS_H
+#define QFLAGS_H
+
+#include <stdint.h>
+
+/* How long (in seconds) a changed quest flag is held before it is written to
+   the database. */
+#ifndef QFLAGS_FLUSH_DELAY
+#define QFLAGS_FLUSH_DELAY      5
+#endif
+
+/* Most flags to write in one go. */
+#ifndef QFLAGS_BATCH_ROWS
+#define QFLAGS_BATCH_ROWS       256
+#endif
+
+/* Number of players to keep quest flags in memory for. Those that have changes
+   that haven't been written yet are always kept. */
+#ifndef QFLAGS_CACHE_MAX
+#define QFLAGS_CACHE_MAX        4096
+#endif
+
+/* Once the journal gets this big, it is rewritten with just the changes that
+   aren't in the database yet. */
+#ifndef QFLAGS_JOURNAL_MAX
+#define QFLAGS_JOURNAL_MAX      (4 * 1024 * 1024)
+#endif
+
+/* How often (in seconds) to log quest flag statistics. */
+#ifndef QFLAGS_STATS_INTERVAL
+#define QFLAGS_STATS_INTERVAL   600
+#endif
+
+#define QFLAGS_JOURNAL_DEFAULT  "qflags.journal"
+
+/* Return values for qflags_get(). */
+#define QFLAGS_ERROR            -1  /* Database error */
+#define QFLAGS_OK               0   /* Flag is set */
+#define QFLAGS_NO_DATA          1   /* Flag isn't set */
+
+/* Called once a flag change is safely in the journal (or if that failed). */
+typedef void (*qflags_cb_t)(void *data, int err);
+
+/* Set up the quest flag cache, writing anything left in the journal from the
+   last run to the database. */
+int qflags_init(const char *journal);
+
+/* Write out any changed flags and clean up. Anything that can't be written to
+   the database is left in the journal for next time. */
+void qflags_cleanup(void);
+
+/* Read a quest flag for a guildcard. The player's flags are read from the
+   database the first time any of them is asked for. */
+int qflags_get(uint32_t gc, uint32_t flag_id, int lng, uint32_t *value);
+
+/* Set (or delete) a quest flag for a guildcard. The callback (if there is one)
+   is called once the change is safely in the journal, which happens from
+   qflags_sync(). If it can't be put in the journal, the change is undone
+   before the callback is told about the error. */
+int qflags_set(uint32_t gc, uint32_t flag_id, int lng, int del,
+               uint32_t value, qflags_cb_t cb, void *cbdata);
+
+/* Have the callback called once all of the changes made so far are safely in
+   the journal. */
+int qflags_wait(qflags_cb_t cb, void *cbdata);
+
+/* Write any flag changes to the journal and sync it to disk, then run their
+   callbacks. This is called from the main loop. */
+void qflags_sync(void);
+
+/* Returns non-zero if there are changes waiting for qflags_sync(). */
+int qflags_pending(void);
+
+/* Write a player's changed flags to the database now and forget about them,
+   since they've logged off. */
+void qflags_flush_gc(uint32_t gc);
+
+/* Write all changed flags to the database now. */
+void qflags_flush_all(void);
+
+#endif /* !QFLAGS_H */
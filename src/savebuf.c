@@ -0,0 +1,506 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "savebuf.h"
+#include "blobstore.h"
+#include "history.h"
+#include "codec.h"
+#include "charcache.h"
+#include "journal.h"
+#include "timer.h"
+#include "workq.h"
+#include "workdb.h"
+
+/* Saves are held in memory until they're written to the database, but they're
+   also written to a journal (and synced to disk) before the ship is told that
+   the save worked, so nothing is lost if the shipgate crashes in between.
+
+   The journal only ever needs to hold the saves that aren't in the database
+   yet (including any being written right now), so whenever everything has been
+   written (or the journal gets too big), it is replaced with a new one holding
+   just what's left. */
+
+#define SB_HASH_SIZE        1024
+#define SB_GEN_SIZE         4096
+#define SB_MAX_DATA         16384
+#define SB_JOURNAL_MAGIC    0x4A444353  /* "SCDJ" */
+#define SB_JOURNAL_VERSION  2
+
+/* Kinds of journal records. The slot goes in the record's key. */
+#define SB_REC_SAVE         1
+
+typedef struct sb_entry {
+    TAILQ_ENTRY(sb_entry) dentry;
+    struct sb_entry *hnext;
+    uint32_t gc;
+    uint32_t slot;
+    uint8_t *data;
+    size_t len;
+    time_t dirty_since;
+    int dirty;
+    int inflight;
+} sb_entry_t;
+
+TAILQ_HEAD(sb_dirty_list, sb_entry);
+
+typedef struct sb_store {
+    uint32_t gc;
+    uint32_t slot;
+    int codec;
+    uint8_t *data;
+    size_t len;
+    uint8_t *enc;
+    size_t enc_len;
+    int blob;
+    int err;
+    uint8_t hash[BLOB_HASH_LEN];
+    hist_job_t *hist;
+} sb_store_t;
+
+static sb_entry_t *hash[SB_HASH_SIZE];
+
+/* Save generations, kept by hash rather than by character so they don't need
+   to be cleaned up. Two characters sharing one just means a read now and then
+   is thought to be out of date when it isn't. */
+static uint32_t gens[SB_GEN_SIZE];
+static struct sb_dirty_list dirty = TAILQ_HEAD_INITIALIZER(dirty);
+static int entry_count;
+
+static journal_t *jnl;
+
+static int flush_timer = -1, stats_timer = -1;
+
+static struct {
+    unsigned long saves;
+    unsigned long absorbed;
+    unsigned long stored;
+    unsigned long failed;
+    unsigned long syncs;
+} stats;
+
+static inline uint32_t *gen_slot(uint32_t gc, uint32_t slot) {
+    return &gens[(gc * 31 + slot) & (SB_GEN_SIZE - 1)];
+}
+
+static sb_entry_t *find_entry(uint32_t gc, uint32_t slot) {
+    sb_entry_t *i = hash[gc & (SB_HASH_SIZE - 1)];
+
+    while(i) {
+        if(i->gc == gc && i->slot == slot)
+            return i;
+
+        i = i->hnext;
+    }
+
+    return NULL;
+}
+
+static void remove_entry(sb_entry_t *e) {
+    sb_entry_t **i = &hash[e->gc & (SB_HASH_SIZE - 1)];
+
+    while(*i) {
+        if(*i == e) {
+            *i = e->hnext;
+            break;
+        }
+
+        i = &(*i)->hnext;
+    }
+
+    if(e->dirty)
+        TAILQ_REMOVE(&dirty, e, dentry);
+
+    --entry_count;
+    free(e->data);
+    free(e);
+}
+
+/* Put a save into the buffer as the newest data for that character. */
+static int buffer_put(uint32_t gc, uint32_t slot, const void *data, size_t len,
+                      time_t now) {
+    sb_entry_t *e;
+    uint8_t *buf;
+    int bucket = gc & (SB_HASH_SIZE - 1);
+
+    if(!(buf = (uint8_t *)malloc(len)))
+        return -1;
+
+    if(!(e = find_entry(gc, slot))) {
+        if(!(e = (sb_entry_t *)malloc(sizeof(sb_entry_t)))) {
+            free(buf);
+            return -1;
+        }
+
+        memset(e, 0, sizeof(sb_entry_t));
+        e->gc = gc;
+        e->slot = slot;
+        e->hnext = hash[bucket];
+        hash[bucket] = e;
+        ++entry_count;
+    }
+
+    memcpy(buf, data, len);
+    free(e->data);
+    e->data = buf;
+    e->len = len;
+    ++*gen_slot(gc, slot);
+
+    /* If there was already a save waiting, this one replaces it. */
+    if(e->dirty) {
+        ++stats.absorbed;
+    }
+    else {
+        e->dirty = 1;
+        e->dirty_since = now;
+        TAILQ_INSERT_TAIL(&dirty, e, dentry);
+    }
+
+    return 0;
+}
+
+/* Put a save from the journal left from the last run back into the buffer. */
+static int replay_rec(const journal_rec_t *hdr, const uint8_t *data) {
+    if(hdr->type != SB_REC_SAVE)
+        return -1;
+
+    /* Make sure these get written out right away. */
+    return buffer_put(hdr->guildcard, hdr->key, data, hdr->len, 0);
+}
+
+/* Buffer a save once it's in the journal. */
+static int apply_rec(const journal_rec_t *hdr, const uint8_t *data) {
+    return buffer_put(hdr->guildcard, hdr->key, data, hdr->len, time(NULL));
+}
+
+/* Write all the saves that aren't in the database yet to a new journal. */
+static int rewrite_saves(journal_t *j) {
+    sb_entry_t *e;
+    int i;
+
+    for(i = 0; i < SB_HASH_SIZE; ++i) {
+        for(e = hash[i]; e; e = e->hnext) {
+            if(journal_put(j, SB_REC_SAVE, e->gc, e->slot, e->data, e->len))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+static const journal_ops_t journal_ops = {
+    "save", SB_JOURNAL_MAGIC, SB_JOURNAL_VERSION, SB_MAX_DATA,
+    SAVEBUF_JOURNAL_MAX, 0, &replay_rec, &apply_rec, NULL, NULL,
+    &rewrite_saves
+};
+
+/* Compress and store a save, along with its history, on the worker for the
+   character. */
+static void store_write(void *d) {
+    sb_store_t *st = (sb_store_t *)d;
+    sylverant_dbconn_t *db;
+    char hex[BLOB_HASH_HEX_LEN + 1], size[16];
+    char *query;
+
+    st->err = 1;
+
+    if(codec_encode(st->data, st->len, &st->enc, &st->enc_len, &st->codec))
+        debug(DBG_WARN, "Couldn't compress character data (%u: %u)\n",
+              st->gc, st->slot);
+
+    /* If there's a blob store, the data goes there and the database just gets
+       the hash. If that fails, it goes in the database like it used to. */
+    if(blob_enabled()) {
+        if(st->enc)
+            st->blob = !blob_store(st->enc, st->enc_len, st->hash);
+        else
+            st->blob = !blob_store(st->data, st->len, st->hash);
+    }
+
+    if(!(db = workdb_conn()))
+        return;
+
+    if(!(query = (char *)malloc(st->len * 2 + 512)))
+        return;
+
+    if(st->enc)
+        sprintf(size, "'%u'", (unsigned)st->len);
+    else
+        strcpy(size, "NULL");
+
+    if(st->blob) {
+        blob_hash_hex(st->hash, hex);
+        sprintf(query, "INSERT INTO character_data(guildcard, slot, size, "
+                "codec, data, blob_hash) VALUES ('%u', '%u', %s, '%d', NULL, "
+                "'%s'", st->gc, st->slot, size, st->codec, hex);
+    }
+    else {
+        sprintf(query, "INSERT INTO character_data(guildcard, slot, size, "
+                "codec, data, blob_hash) VALUES ('%u', '%u', %s, '%d', '",
+                st->gc, st->slot, size, st->codec);
+
+        if(st->enc)
+            sylverant_db_escape_str(db, query + strlen(query),
+                                    (char *)st->enc, st->enc_len);
+        else
+            sylverant_db_escape_str(db, query + strlen(query),
+                                    (char *)st->data, st->len);
+
+        strcat(query, "', NULL");
+    }
+
+    strcat(query, ") ON DUPLICATE KEY UPDATE size=VALUES(size), "
+           "codec=VALUES(codec), data=VALUES(data), "
+           "blob_hash=VALUES(blob_hash)");
+
+    if(sylverant_db_query(db, query)) {
+        debug(DBG_WARN, "Couldn't save character data (%u: %u)\n", st->gc,
+              st->slot);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(db));
+        free(query);
+        return;
+    }
+
+    free(query);
+    st->err = 0;
+    hist_write(st->hist, db, st->enc, st->enc_len, st->codec,
+               st->blob ? st->hash : NULL);
+}
+
+static void store_done(void *d) {
+    sb_store_t *st = (sb_store_t *)d;
+    sb_entry_t *e;
+    int err = st->err;
+
+    if(err) {
+        ++stats.failed;
+    }
+    else {
+        /* It's likely to be asked for again soon, so keep it around. */
+        ccache_put(st->gc, st->slot, st->data, st->len);
+        ++*gen_slot(st->gc, st->slot);
+        ++stats.stored;
+    }
+
+    hist_end(st->hist);
+
+    e = find_entry(st->gc, st->slot);
+    e->inflight = 0;
+
+    /* If it failed and nothing newer has come in, put it back to try again
+       later. */
+    if(err && !e->dirty) {
+        e->dirty = 1;
+        e->dirty_since = time(NULL);
+        TAILQ_INSERT_TAIL(&dirty, e, dentry);
+    }
+
+    if(!e->dirty)
+        remove_entry(e);
+
+    journal_check(jnl, entry_count);
+
+    free(st->enc);
+    free(st->data);
+    free(st);
+}
+
+/* Start writing a buffered save to the database. */
+static void flush_entry(sb_entry_t *e) {
+    sb_store_t *st;
+
+    /* If there's already a write going for this character, this one will get
+       picked up once that's done. */
+    if(!e->dirty || e->inflight)
+        return;
+
+    if(!(st = (sb_store_t *)malloc(sizeof(sb_store_t))))
+        return;
+
+    memset(st, 0, sizeof(sb_store_t));
+
+    if(!(st->data = (uint8_t *)malloc(e->len))) {
+        free(st);
+        return;
+    }
+
+    st->gc = e->gc;
+    st->slot = e->slot;
+    st->len = e->len;
+    memcpy(st->data, e->data, e->len);
+
+    TAILQ_REMOVE(&dirty, e, dentry);
+    e->dirty = 0;
+    e->inflight = 1;
+    st->hist = hist_begin(e->gc, e->slot, "", e->data, e->len);
+
+    /* If it can't be handed off, leave it to be tried again on the next
+       flush. */
+    if(workq_submit(e->gc, &store_write, &store_done, st)) {
+        e->inflight = 0;
+        e->dirty = 1;
+        TAILQ_INSERT_HEAD(&dirty, e, dentry);
+        hist_end(st->hist);
+        free(st->data);
+        free(st);
+    }
+}
+
+static void flush_timer_cb(time_t now, void *data) {
+    sb_entry_t *e, *tmp;
+
+    (void)data;
+
+    e = TAILQ_FIRST(&dirty);
+    while(e) {
+        tmp = TAILQ_NEXT(e, dentry);
+
+        if(e->dirty_since + SAVEBUF_FLUSH_DELAY > now)
+            break;
+
+        flush_entry(e);
+        e = tmp;
+    }
+
+    journal_check(jnl, entry_count);
+}
+
+static void stats_timer_cb(time_t now, void *data) {
+    (void)now;
+    (void)data;
+
+    debug(DBG_LOG, "Character saves: %lu received, %lu absorbed (%.1f%%), "
+          "%lu stored, %lu failed, %lu journal syncs, %d buffered\n",
+          stats.saves, stats.absorbed, stats.saves ?
+          100.0 * stats.absorbed / stats.saves : 0.0, stats.stored,
+          stats.failed, stats.syncs, entry_count);
+}
+
+int savebuf_init(const char *journal) {
+    memset(hash, 0, sizeof(hash));
+    memset(&stats, 0, sizeof(stats));
+    TAILQ_INIT(&dirty);
+    entry_count = 0;
+
+    /* Everything recovered goes into a new journal, which replaces the old
+       one. */
+    if(!(jnl = journal_open(journal, &journal_ops)))
+        return -1;
+
+    if(journal_rewrite(jnl))
+        return -1;
+
+    flush_timer = timer_add(1, &flush_timer_cb, NULL);
+    stats_timer = timer_add(SAVEBUF_STATS_INTERVAL, &stats_timer_cb, NULL);
+
+    return 0;
+}
+
+void savebuf_cleanup(void) {
+    sb_entry_t *e;
+    int i;
+
+    savebuf_sync();
+    stats_timer_cb(0, NULL);
+
+    timer_remove(flush_timer);
+    timer_remove(stats_timer);
+    flush_timer = stats_timer = -1;
+
+    /* If everything made it to the database, then the journal isn't needed
+       anymore. Otherwise, it'll get replayed on the next startup. */
+    if(entry_count)
+        debug(DBG_WARN, "%d character saves left in the journal\n",
+              entry_count);
+
+    journal_close(jnl, entry_count);
+    jnl = NULL;
+
+    for(i = 0; i < SB_HASH_SIZE; ++i) {
+        while((e = hash[i])) {
+            remove_entry(e);
+        }
+    }
+}
+
+int savebuf_save(uint32_t gc, uint32_t slot, const void *data, size_t len,
+                 savebuf_cb_t cb, void *cbdata) {
+    /* It doesn't go in the buffer until it's in the journal. */
+    if(journal_add(jnl, SB_REC_SAVE, gc, slot, data, len, NULL, cb, cbdata))
+        return -1;
+
+    ++stats.saves;
+
+    return 0;
+}
+
+int savebuf_get(uint32_t gc, uint32_t slot, const uint8_t **data, size_t *len) {
+    sb_entry_t *e;
+
+    if(!(e = find_entry(gc, slot)))
+        return -1;
+
+    *data = e->data;
+    *len = e->len;
+    return 0;
+}
+
+uint32_t savebuf_generation(uint32_t gc, uint32_t slot) {
+    return *gen_slot(gc, slot);
+}
+
+void savebuf_sync(void) {
+    /* One write and one sync for everything that came in since last time. */
+    if(journal_sync(jnl))
+        ++stats.syncs;
+
+    journal_check(jnl, entry_count);
+}
+
+int savebuf_pending(void) {
+    return journal_pending(jnl);
+}
+
+void savebuf_flush_gc(uint32_t gc) {
+    sb_entry_t *e = hash[gc & (SB_HASH_SIZE - 1)];
+
+    while(e) {
+        if(e->gc == gc)
+            flush_entry(e);
+
+        e = e->hnext;
+    }
+}
+
+void savebuf_flush_all(void) {
+    sb_entry_t *e, *tmp;
+
+    e = TAILQ_FIRST(&dirty);
+    while(e) {
+        tmp = TAILQ_NEXT(e, dentry);
+        flush_entry(e);
+        e = tmp;
+    }
+}
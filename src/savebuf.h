@@ -0,0 +1,83 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SAVEBUF_H
+#define SAVEBUF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* How long (in seconds) a character save is held before it is written to the
+   database. Any saves of the same character in that time replace it. */
+#ifndef SAVEBUF_FLUSH_DELAY
+#define SAVEBUF_FLUSH_DELAY     10
+#endif
+
+/* Once the journal gets this big, it is rewritten with just the saves that
+   aren't in the database yet. */
+#ifndef SAVEBUF_JOURNAL_MAX
+#define SAVEBUF_JOURNAL_MAX     (16 * 1024 * 1024)
+#endif
+
+/* How often (in seconds) to log save statistics. */
+#ifndef SAVEBUF_STATS_INTERVAL
+#define SAVEBUF_STATS_INTERVAL  600
+#endif
+
+#define SAVEBUF_JOURNAL_DEFAULT "cdata.journal"
+
+/* Called once a save is safely in the journal (or if that failed). */
+typedef void (*savebuf_cb_t)(void *data, int err);
+
+/* Set up the save buffer, replaying anything left in the journal from the last
+   run. */
+int savebuf_init(const char *journal);
+
+/* Clean up the save buffer. Anything that hasn't been written to the database
+   is left in the journal for next time. */
+void savebuf_cleanup(void);
+
+/* Buffer a character save. The callback is called once the data is safely in
+   the journal, which happens from savebuf_sync(). The save is only buffered
+   (and seen by savebuf_get()) once that has worked. */
+int savebuf_save(uint32_t gc, uint32_t slot, const void *data, size_t len,
+                 savebuf_cb_t cb, void *cbdata);
+
+/* Look up buffered character data that hasn't made it to the database yet.
+   Returns 0 and fills in data and len if found. The data is only valid until
+   the next call into the save buffer. */
+int savebuf_get(uint32_t gc, uint32_t slot, const uint8_t **data, size_t *len);
+
+/* Get the save generation of a character. This changes whenever a newer save
+   is buffered or stored, so anyone that read the character from the database
+   can tell if what they got might be out of date by the time they use it. */
+uint32_t savebuf_generation(uint32_t gc, uint32_t slot);
+
+/* Write any buffered saves to the journal and sync it to disk, then run their
+   callbacks. This is called from the main loop. */
+void savebuf_sync(void);
+
+/* Returns non-zero if there are saves waiting for savebuf_sync(). */
+int savebuf_pending(void);
+
+/* Start writing all buffered saves for a guildcard to the database now. */
+void savebuf_flush_gc(uint32_t gc);
+
+/* Start writing all buffered saves to the database now. */
+void savebuf_flush_all(void);
+
+#endif /* !SAVEBUF_H */
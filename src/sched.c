@@ -0,0 +1,390 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+
+#include "sched.h"
+#include "timer.h"
+
+/* Each ship's packets are kept in one queue, in the order they arrived, since
+   a lot of them depend on the ones before (saving and loading a character,
+   setting and reading a quest flag, and so on). It's the ships that get
+   scheduled: a ship waits in the queue for the most urgent class of anything
+   it has queued, and gets one packet handled each time it comes up. That way
+   a ship with something urgent waiting gets to it sooner, but never by
+   skipping over what it sent first. */
+
+/* Handling times are kept in buckets by powers of two of microseconds. */
+#define SCHED_BUCKETS       32
+
+typedef struct sched_pkt {
+    STAILQ_ENTRY(sched_pkt) qentry;
+    int cls;
+    struct timespec queued;
+    uint8_t pkt[];
+} sched_pkt_t;
+
+STAILQ_HEAD(sched_queue, sched_pkt);
+
+struct sched_ship {
+    TAILQ_ENTRY(sched_ship) qentry;
+    ship_t *c;
+    int cls;
+    int counts[SCHED_CLASSES];
+    struct sched_queue pkts;
+};
+
+TAILQ_HEAD(sched_ship_queue, sched_ship);
+
+static struct sched_class {
+    const char *name;
+    int weight;
+    uint64_t slo;
+    struct sched_ship_queue queue;
+    int depth;
+
+    /* Statistics, reset each time they're logged. */
+    unsigned long handled;
+    unsigned long missed;
+    int max_depth;
+    uint64_t max_time;
+    unsigned long hist[SCHED_BUCKETS];
+} classes[SCHED_CLASSES] = {
+    { "interactive", SCHED_WEIGHT_INTERACTIVE, SCHED_SLO_INTERACTIVE * 1000 },
+    { "normal", SCHED_WEIGHT_NORMAL, SCHED_SLO_NORMAL * 1000 },
+    { "bulk", SCHED_WEIGHT_BULK, SCHED_SLO_BULK * 1000 }
+};
+
+static int queued_count;
+static int stats_timer = -1;
+
+/* Figure out which class a packet belongs to. Returns -1 for packets that
+   have to be handled right away. */
+static int pkt_class(shipgate_hdr_t *pkt) {
+    uint16_t type = ntohs(pkt->pkt_type);
+    uint16_t flags = ntohs(pkt->flags);
+
+    switch(type) {
+        /* The login has to be done before anything else, pings are how we
+           tell the ship is still there, and streamed messages go through
+           here again once they're put back together. */
+        case SHDR_TYPE_LOGIN6:
+        case SHDR_TYPE_PING:
+        case SHDR_TYPE_STREAM:
+            return -1;
+
+        /* Logins, searches, forwarded packets, and things a player is
+           waiting on. */
+        case SHDR_TYPE_DC:
+        case SHDR_TYPE_PC:
+        case SHDR_TYPE_BB:
+        case SHDR_TYPE_USRLOGIN:
+        case SHDR_TYPE_TLOGIN:
+        case SHDR_TYPE_CDATA:
+        case SHDR_TYPE_CREQ:
+        case SHDR_TYPE_QFLAG_SET:
+        case SHDR_TYPE_QFLAG_GET:
+        case SHDR_TYPE_QFLAGS:
+        case SHDR_TYPE_GCBAN:
+        case SHDR_TYPE_IPBAN:
+        case SHDR_TYPE_KICK:
+        case SHDR_TYPE_GLOBALMSG:
+        case SHDR_TYPE_SHIP_CTL:
+            return SCHED_INTERACTIVE;
+
+        /* Backups, kill counts, and other bookkeeping. */
+        case SHDR_TYPE_CBKUP:
+        case SHDR_TYPE_MKILL:
+        case SHDR_TYPE_BCLIENTS:
+        case SHDR_TYPE_SCHUNK:
+        case SHDR_TYPE_SDATA:
+            return SCHED_BULK;
+    }
+
+    /* Responses to something we forwarded are someone waiting on a reply. */
+    if(flags & SHDR_RESPONSE)
+        return SCHED_INTERACTIVE;
+
+    /* Everything else is presence (block logins, lobby changes, friends) and
+       user settings. */
+    return SCHED_NORMAL;
+}
+
+static uint64_t elapsed_us(const struct timespec *start,
+                           const struct timespec *end) {
+    int64_t us = (int64_t)(end->tv_sec - start->tv_sec) * 1000000 +
+        (end->tv_nsec - start->tv_nsec) / 1000;
+
+    return us > 0 ? (uint64_t)us : 0;
+}
+
+static void record_time(struct sched_class *cl, uint64_t us) {
+    int b = 0;
+
+    while(b < SCHED_BUCKETS - 1 && (us >> (b + 1))) {
+        ++b;
+    }
+
+    ++cl->hist[b];
+    ++cl->handled;
+
+    if(us > cl->slo)
+        ++cl->missed;
+
+    if(us > cl->max_time)
+        cl->max_time = us;
+}
+
+/* Estimate a percentile (in milliseconds) from a class' histogram, using the
+   top of the bucket it falls in. */
+static double percentile(struct sched_class *cl, int pct) {
+    unsigned long want, seen = 0;
+    int b;
+
+    if(!cl->handled)
+        return 0.0;
+
+    want = (cl->handled * pct + 99) / 100;
+
+    for(b = 0; b < SCHED_BUCKETS; ++b) {
+        seen += cl->hist[b];
+
+        if(seen >= want)
+            break;
+    }
+
+    return (double)((uint64_t)2 << b) / 1000.0;
+}
+
+static void stats_timer_cb(time_t now, void *data) {
+    struct sched_class *cl;
+    int i;
+
+    (void)now;
+    (void)data;
+
+    for(i = 0; i < SCHED_CLASSES; ++i) {
+        cl = &classes[i];
+
+        debug(DBG_LOG, "Scheduler (%s): %lu handled, p50 %.1fms, p99 %.1fms, "
+              "max %.1fms, %lu over %lums, most queued %d\n", cl->name,
+              cl->handled, percentile(cl, 50), percentile(cl, 99),
+              cl->max_time / 1000.0, cl->missed,
+              (unsigned long)(cl->slo / 1000), cl->max_depth);
+
+        cl->handled = cl->missed = 0;
+        cl->max_time = 0;
+        cl->max_depth = cl->depth;
+        memset(cl->hist, 0, sizeof(cl->hist));
+    }
+}
+
+int sched_init(void) {
+    int i;
+
+    for(i = 0; i < SCHED_CLASSES; ++i) {
+        TAILQ_INIT(&classes[i].queue);
+        classes[i].depth = 0;
+    }
+
+    queued_count = 0;
+    stats_timer = timer_add(SCHED_STATS_INTERVAL, &stats_timer_cb, NULL);
+
+    return 0;
+}
+
+/* Put a ship in the queue for the most urgent class it has waiting, if it
+   isn't already there. */
+static void enqueue_ship(struct sched_ship *s) {
+    int i;
+
+    for(i = 0; i < SCHED_CLASSES && !s->counts[i]; ++i) {
+    }
+
+    if(i == s->cls)
+        return;
+
+    if(s->cls >= 0)
+        TAILQ_REMOVE(&classes[s->cls].queue, s, qentry);
+
+    s->cls = i < SCHED_CLASSES ? i : -1;
+
+    if(s->cls >= 0)
+        TAILQ_INSERT_TAIL(&classes[s->cls].queue, s, qentry);
+}
+
+static void free_ship(struct sched_ship *s) {
+    sched_pkt_t *p;
+
+    while((p = STAILQ_FIRST(&s->pkts))) {
+        STAILQ_REMOVE_HEAD(&s->pkts, qentry);
+        --classes[p->cls].depth;
+        --queued_count;
+        free(p);
+    }
+
+    if(s->cls >= 0)
+        TAILQ_REMOVE(&classes[s->cls].queue, s, qentry);
+
+    s->c->sched = NULL;
+    s->c->sched_bytes = 0;
+    free(s);
+}
+
+void sched_cleanup(void) {
+    struct sched_ship *s;
+    int i;
+
+    if(stats_timer != -1) {
+        timer_remove(stats_timer);
+        stats_timer = -1;
+    }
+
+    /* Ships with nothing queued aren't in any of the queues, and are cleaned
+       up when they're dropped. */
+    for(i = 0; i < SCHED_CLASSES; ++i) {
+        while((s = TAILQ_FIRST(&classes[i].queue))) {
+            free_ship(s);
+        }
+
+        classes[i].depth = 0;
+    }
+
+    queued_count = 0;
+}
+
+int sched_submit(ship_t *c, shipgate_hdr_t *pkt) {
+    uint16_t len = ntohs(pkt->pkt_len);
+    struct sched_class *cl;
+    struct sched_ship *s = c->sched;
+    sched_pkt_t *p;
+    int cls;
+
+    if((cls = pkt_class(pkt)) < 0)
+        return process_ship_pkt(c, pkt);
+
+    if(!s) {
+        if(!(s = (struct sched_ship *)malloc(sizeof(struct sched_ship)))) {
+            debug(DBG_WARN, "Couldn't queue packet from %s\n", c->name);
+            return -1;
+        }
+
+        memset(s, 0, sizeof(struct sched_ship));
+        s->c = c;
+        s->cls = -1;
+        STAILQ_INIT(&s->pkts);
+        c->sched = s;
+    }
+
+    if(!(p = (sched_pkt_t *)malloc(sizeof(sched_pkt_t) + len))) {
+        debug(DBG_WARN, "Couldn't queue packet from %s\n", c->name);
+        return -1;
+    }
+
+    p->cls = cls;
+    clock_gettime(CLOCK_MONOTONIC, &p->queued);
+    memcpy(p->pkt, pkt, len);
+    STAILQ_INSERT_TAIL(&s->pkts, p, qentry);
+    ++s->counts[cls];
+    enqueue_ship(s);
+
+    cl = &classes[cls];
+
+    if(++cl->depth > cl->max_depth)
+        cl->max_depth = cl->depth;
+
+    c->sched_bytes += len;
+    ++queued_count;
+
+    return 0;
+}
+
+/* Handle the next packet from the ship at the front of a class' queue. */
+static void run_one(struct sched_class *cl) {
+    struct sched_ship *s = TAILQ_FIRST(&cl->queue);
+    sched_pkt_t *p = STAILQ_FIRST(&s->pkts);
+    ship_t *c = s->c;
+    struct timespec done;
+
+    /* Take the ship out while its packet is handled, then put it back at the
+       end of whichever queue it belongs in now. */
+    TAILQ_REMOVE(&cl->queue, s, qentry);
+    s->cls = -1;
+    STAILQ_REMOVE_HEAD(&s->pkts, qentry);
+    --s->counts[p->cls];
+    --classes[p->cls].depth;
+    --queued_count;
+    c->sched_bytes -= ntohs(((shipgate_hdr_t *)p->pkt)->pkt_len);
+
+    /* Don't bother with anything else from a ship that's being dropped. */
+    if(!c->disconnected) {
+        if(process_ship_pkt(c, (shipgate_hdr_t *)p->pkt))
+            c->disconnected = 1;
+
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        record_time(&classes[p->cls], elapsed_us(&p->queued, &done));
+    }
+
+    enqueue_ship(s);
+    free(p);
+}
+
+int sched_run(void) {
+    int budget = SCHED_BATCH, i, n, ran;
+
+    while(budget > 0 && queued_count) {
+        ran = 0;
+
+        /* Go through the classes in order, taking up to each one's weight
+           worth of packets. */
+        for(i = 0; i < SCHED_CLASSES && budget > 0; ++i) {
+            for(n = 0; n < classes[i].weight && budget > 0 &&
+                !TAILQ_EMPTY(&classes[i].queue); ++n) {
+                run_one(&classes[i]);
+                --budget;
+                ++ran;
+            }
+        }
+
+        if(!ran)
+            break;
+    }
+
+    return queued_count != 0;
+}
+
+int sched_pending(void) {
+    return queued_count != 0;
+}
+
+int sched_ship_full(ship_t *c) {
+    return c->sched_bytes >= SCHED_SHIP_MAX;
+}
+
+void sched_drop(ship_t *c) {
+    if(c->sched)
+        free_ship(c->sched);
+
+    c->sched_bytes = 0;
+}
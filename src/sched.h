@@ -0,0 +1,101 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "shipgate.h"
+
+/* Classes of work, from most to least urgent. */
+#define SCHED_INTERACTIVE       0
+#define SCHED_NORMAL            1
+#define SCHED_BULK              2
+#define SCHED_CLASSES           3
+
+/* How many packets of each class get handled for every round through the
+   queues, so bulk work still moves along when there's a lot of everything. */
+#ifndef SCHED_WEIGHT_INTERACTIVE
+#define SCHED_WEIGHT_INTERACTIVE    8
+#endif
+
+#ifndef SCHED_WEIGHT_NORMAL
+#define SCHED_WEIGHT_NORMAL         4
+#endif
+
+#ifndef SCHED_WEIGHT_BULK
+#define SCHED_WEIGHT_BULK           1
+#endif
+
+/* Most packets to handle each time through the main loop, so that reading from
+   the ships (and everything else the loop does) isn't held up too long. */
+#ifndef SCHED_BATCH
+#define SCHED_BATCH                 64
+#endif
+
+/* Target time (in milliseconds) from a packet arriving until it's handled, for
+   each class. Packets that take longer are counted in the statistics. */
+#ifndef SCHED_SLO_INTERACTIVE
+#define SCHED_SLO_INTERACTIVE       20
+#endif
+
+#ifndef SCHED_SLO_NORMAL
+#define SCHED_SLO_NORMAL            100
+#endif
+
+#ifndef SCHED_SLO_BULK
+#define SCHED_SLO_BULK              2000
+#endif
+
+/* Stop reading from a ship once this many bytes of its packets are waiting. */
+#ifndef SCHED_SHIP_MAX
+#define SCHED_SHIP_MAX              (256 * 1024)
+#endif
+
+/* How often (in seconds) to log scheduling statistics. */
+#ifndef SCHED_STATS_INTERVAL
+#define SCHED_STATS_INTERVAL        600
+#endif
+
+/* Set up the scheduler. */
+int sched_init(void);
+
+/* Clean up the scheduler, throwing away anything still queued. */
+void sched_cleanup(void);
+
+/* Hand off a packet from a ship. Packets that can't wait (logins and pings)
+   are handled right away, and everything else is copied and queued behind
+   anything else from the same ship. Returns the handler's result for packets
+   handled right away, 0 when queued, or -1 on error. */
+int sched_submit(ship_t *c, shipgate_hdr_t *pkt);
+
+/* Handle queued packets, from the ships with the most urgent ones first (each
+   ship's packets are always handled in the order they arrived). This is called
+   from the main loop. Ships whose handlers fail are marked as disconnected.
+   Returns non-zero if there's still more waiting. */
+int sched_run(void);
+
+/* Returns non-zero if there are packets waiting to be handled. */
+int sched_pending(void);
+
+/* Returns non-zero if so much is queued from a ship that it shouldn't be read
+   from until some of it is handled. */
+int sched_ship_full(ship_t *c);
+
+/* Throw away anything queued from a ship that's going away. */
+void sched_drop(ship_t *c);
+
+#endif /* !SCHED_H */
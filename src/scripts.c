@@ -28,6 +28,7 @@
 #include <libxml/tree.h>
 
 #include "scripts.h"
+#include "stream.h"
 
 #ifdef ENABLE_LUA
 #include <lua.h>
@@ -155,7 +156,9 @@ static int ship_script_add(xmlChar *file, xmlChar *remote, int mod,
         len = ftell(fp);
         fseek(fp, 0, SEEK_SET);
 
-        if(len > 32768) {
+        /* Ships that don't support streaming can only get scripts that fit in
+           a packet, but that's checked when sending it. */
+        if(len > STREAM_MAX_SIZE - sizeof(shipgate_schunk_pkt)) {
             debug(DBG_WARN, "Script file '%s' is too long\n", file);
             fclose(fp);
             return -3;
@@ -29,12 +29,9 @@
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
 
-#include <zlib.h>
-
 #include <sylverant/debug.h>
 #include <sylverant/database.h>
 #include <sylverant/mtwist.h>
-#include <sylverant/md5.h>
 
 #ifdef ENABLE_LUA
 #include <lua.h>
@@ -44,6 +41,25 @@
 
 #include "ship.h"
 #include "shipgate.h"
+#include "mail.h"
+#include "accounts.h"
+#include "codec.h"
+#include "workq.h"
+#include "workdb.h"
+#include "savebuf.h"
+#include "charcache.h"
+#include "blobstore.h"
+#include "history.h"
+#include "stream.h"
+#include "bkcache.h"
+#include "sched.h"
+#include "auth.h"
+#include "tokens.h"
+#include "events.h"
+#include "kills.h"
+#include "leaders.h"
+#include "qflags.h"
+#include "bbstate.h"
 
 #define CLIENT_PRIV_LOCAL_GM    0x00000001
 #define CLIENT_PRIV_GLOBAL_GM   0x00000002
@@ -70,15 +86,15 @@ extern iconv_t ic_8859_to_utf8;
 extern gnutls_certificate_credentials_t tls_cred;
 extern gnutls_priority_t tls_prio;
 
-/* Events... */
-extern uint32_t event_count;
-extern monster_event_t *events;
-
 /* Scripts */
 extern uint32_t script_count;
 extern ship_script_t *scripts;
 
+/* Character data prefetching */
+extern int cdata_prefetch_enabled;
+
 static uint8_t recvbuf[65536];
+static uint32_t next_conn_id = 1;
 
 /* Find a ship by its id */
 static ship_t *find_ship(uint16_t id) {
@@ -132,42 +148,6 @@ static inline void parse_ipv6(uint64_t hi, uint64_t lo, uint8_t buf[16]) {
     buf[15] = (uint8_t)lo;
 }
 
-static monster_event_t *find_current_event(uint8_t difficulty, uint8_t ver,
-                                           int any) {
-    uint32_t i;
-    uint8_t questing;
-    time_t now;
-
-    /* For now, just reject any challenge/battle mode updates... We don't care
-       about them at all. */
-    if(ver & 0xC0)
-        return NULL;
-
-    now = time(NULL);
-    questing = ver & 0x20;
-    ver &= 0x07;
-
-    for(i = 0; i < event_count; ++i) {
-        /* Skip all quests that don't meet the requirements passed in. */
-        if(now > events[i].end_time || now < events[i].start_time)
-            continue;
-
-        if(!any) {
-            if(!(events[i].versions & (1 << ver)))
-                continue;
-            if(!(events[i].difficulties & (1 << difficulty)))
-                continue;
-            if(!events[i].allow_quests && questing)
-                continue;
-        }
-
-        /* If we get here, then the event is valid, return it. */
-        return events + i;
-    }
-
-    return NULL;
-}
-
 static ship_script_t *find_script(const char *fn, int module) {
 #ifdef ENABLE_LUA
     uint32_t i;
@@ -256,6 +236,11 @@ ship_t *create_connection_tls(int sock, struct sockaddr *addr, socklen_t size) {
 
     /* Store basic parameters in the client structure. */
     rv->sock = sock;
+    rv->conn_id = next_conn_id++;
+
+    if(!next_conn_id)
+        next_conn_id = 1;
+
     rv->last_message = time(NULL);
     memcpy(&rv->conn_addr, addr, size);
 
@@ -384,6 +369,17 @@ err:
     return NULL;
 }
 
+ship_t *find_ship_by_conn_id(uint32_t id) {
+    ship_t *i;
+
+    TAILQ_FOREACH(i, &ships, qentry) {
+        if(i->conn_id == id)
+            return i->disconnected ? NULL : i;
+    }
+
+    return NULL;
+}
+
 /* Destroy a connection, closing the socket and removing it from the list. */
 void destroy_connection(ship_t *c) {
     char query[256];
@@ -446,9 +442,27 @@ void destroy_connection(ship_t *c) {
         free(c->sendbuf);
     }
 
+    if(c->frstatus) {
+        free(c->frstatus);
+    }
+
+    stream_cleanup(c);
+    sched_drop(c);
     free(c);
 }
 
+/* Send out any friend login/logout messages that were queued up while handling
+   the current packet. */
+static void flush_friend_messages(void) {
+    ship_t *i;
+
+    TAILQ_FOREACH(i, &ships, qentry) {
+        if(i->frstatus_count && send_friend_messages(i)) {
+            debug(DBG_WARN, "Couldn't send friend messages to %s\n", i->name);
+        }
+    }
+}
+
 /* Handle a ship's login response. */
 static int handle_shipgate_login6t(ship_t *c, shipgate_login6_reply_pkt *pkt) {
     char query[512];
@@ -643,141 +657,66 @@ static size_t strlen16(const uint16_t *str) {
 }
 
 static int save_mail(uint32_t gc, uint32_t from, void *pkt, int version) {
-    char msg[512], name[64];
-    static char query[2048];
-    void *result;
-    char **row;
-    size_t in, out, nmlen;
-    ICONV_CONST char *inptr;
-    char *outptr;
+    uint32_t acc;
+    int enc;
     dc_simple_mail_pkt *dcpkt = (dc_simple_mail_pkt *)pkt;
     pc_simple_mail_pkt *pcpkt = (pc_simple_mail_pkt *)pkt;
     bb_simple_mail_pkt *bbpkt = (bb_simple_mail_pkt *)pkt;
 
     /* See if the user is registered first. */
-    sprintf(query, "SELECT account_id FROM guildcards WHERE guildcard='%u'",
-            gc);
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "save_mail: cannot query for account: %s\n",
-              sylverant_db_error(&conn));
-        return 0;
-    }
-
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "save_mail: Cannot fetch result: %s\n",
-              sylverant_db_error(&conn));
-        return 0;
-    }
+    switch(acct_lookup(gc, &acc, NULL)) {
+        case ACCT_OK:
+            break;
 
-    /* Grab the result set */
-    if(!(row = sylverant_db_result_fetch(result))) {
-        debug(DBG_WARN, "save_mail: Invalid guildcard: %u (sent by %u)\n",
-              gc, from);
-        sylverant_db_result_free(result);
-        return 0;
-    }
+        case ACCT_NO_GUILDCARD:
+            debug(DBG_WARN, "save_mail: Invalid guildcard: %u (sent by %u)\n",
+                  gc, from);
+            return 0;
 
-    /* Is there an account_id associated with the guildcard? */
-    if(row[0] == NULL) {
-        /* No account associated with the guildcard, so we're done. */
-        sylverant_db_result_free(result);
-        return 0;
+        default:
+            /* No account associated with the guildcard (or we couldn't check),
+               so we're done. */
+            return 0;
     }
 
-    /* We're done with the result set, so clean it up. */
-    sylverant_db_result_free(result);
-
-    /* Convert the message to UTF-8 for storage. */
+    /* Queue the message up to be stored. The mail writer takes care of
+       converting it to UTF-8 and putting it in the database. */
     switch(version) {
         case VERSION_DC:
         case VERSION_GC:
         case VERSION_EP3:
             dcpkt->stuff[144] = 0;
-            in = strlen(dcpkt->stuff);
-            out = 511;
-            inptr = dcpkt->stuff;
-            outptr = msg;
 
-            if(inptr[0] == '\t' && inptr[1] == 'J')
-                iconv(ic_sjis_to_utf8, &inptr, &in, &outptr, &out);
+            if(dcpkt->stuff[0] == '\t' && dcpkt->stuff[1] == 'J')
+                enc = MAIL_TEXT_SJIS;
             else
-                iconv(ic_8859_to_utf8, &inptr, &in, &outptr, &out);
+                enc = MAIL_TEXT_8859;
 
-            msg[511 - out] = 0;
-            memcpy(name, dcpkt->name, 16);
-            name[16] = 0;
-            nmlen = strlen(name);
-            break;
+            mail_queue(gc, from, acc, dcpkt->name, strnlen(dcpkt->name, 16),
+                       MAIL_TEXT_RAW, dcpkt->stuff, strlen(dcpkt->stuff), enc);
+            return 0;
 
         case VERSION_PC:
             pcpkt->stuff[288] = 0;
             pcpkt->stuff[289] = 0;
-            in = strlen16((uint16_t *)pcpkt->stuff) * 2;
-            out = 511;
-            inptr = (char *)pcpkt->stuff;
-            outptr = msg;
-
-            iconv(ic_utf16_to_utf8, &inptr, &in, &outptr, &out);
-
-            msg[511 - out] = 0;
-
-            in = (strlen16(pcpkt->name) * 2);
-            nmlen = 0x40;
-            inptr = (char *)pcpkt->name;
-            outptr = name;
-
-            iconv(ic_utf16_to_utf8, &inptr, &in, &outptr, &nmlen);
-            nmlen = 64 - nmlen;
-            name[nmlen] = 0;
-            break;
+            mail_queue(gc, from, acc, pcpkt->name, strlen16(pcpkt->name) * 2,
+                       MAIL_TEXT_UTF16, pcpkt->stuff,
+                       strlen16((uint16_t *)pcpkt->stuff) * 2,
+                       MAIL_TEXT_UTF16);
+            return 0;
 
         case VERSION_BB:
             bbpkt->unk2[0] = 0;
             bbpkt->unk2[1] = 0;
-            in = strlen16(bbpkt->message) * 2;
-            out = 511;
-            inptr = (char *)bbpkt->message;
-            outptr = msg;
-
-            iconv(ic_utf16_to_utf8, &inptr, &in, &outptr, &out);
-
-            msg[511 - out] = 0;
-
-            in = (strlen16(bbpkt->name) * 2) - 4;
-            nmlen = 0x40;
-            inptr = (char *)&bbpkt->name[2];
-            outptr = name;
-
-            iconv(ic_utf16_to_utf8, &inptr, &in, &outptr, &nmlen);
-            nmlen = 64 - nmlen;
-            name[nmlen] = 0;
-            break;
-
-        default:
-            /* XXXX */
+            mail_queue(gc, from, acc, &bbpkt->name[2],
+                       (strlen16(bbpkt->name) * 2) - 4, MAIL_TEXT_UTF16,
+                       bbpkt->message, strlen16(bbpkt->message) * 2,
+                       MAIL_TEXT_UTF16);
             return 0;
     }
 
-    /* Fill in the query. */
-    sprintf(query, "INSERT INTO simple_mail(recipient, sender, sent_time, "
-            "sender_name, message) VALUES ('%u', '%u', UNIX_TIMESTAMP(), '", gc,
-            from);
-    sylverant_db_escape_str(&conn, query + strlen(query), name, nmlen);
-
-    strcat(query, "', '");
-    sylverant_db_escape_str(&conn, query + strlen(query), msg, 511 - out);
-    strcat(query, "');");
-
-    /* Execute the query on the db. */
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't save simple mail (to: %" PRIu32 " from: %"
-              PRIu32 ")\n", gc, from);
-        debug(DBG_WARN, "    %s\n", sylverant_db_error(&conn));
-        return 0;
-    }
-
-    /* And... we're done! */
+    debug(DBG_WARN, "save_mail: Unknown mail version %d (to: %" PRIu32
+          " from: %" PRIu32 ")\n", version, gc, from);
     return 0;
 }
 
@@ -1310,41 +1249,77 @@ out:
     return 0;
 }
 
+/* A Blue Burst change that's waiting to be journaled. If that doesn't work,
+   the ship is sent an error with a copy of what it sent. */
+typedef struct bbstate_job {
+    uint32_t conn_id;
+    uint16_t type;
+    uint16_t flags;
+    int len;
+    uint8_t data[];
+} bbstate_job_t;
+
+static bbstate_job_t *bbstate_job(ship_t *c, uint16_t type, uint16_t flags,
+                                  const void *data, int len) {
+    bbstate_job_t *job;
+
+    if(!(job = (bbstate_job_t *)malloc(sizeof(bbstate_job_t) + len))) {
+        debug(DBG_WARN, "Couldn't allocate Blue Burst job\n");
+        return NULL;
+    }
+
+    job->conn_id = c->conn_id;
+    job->type = type;
+    job->flags = flags;
+    job->len = len;
+    memcpy(job->data, data, len);
+
+    return job;
+}
+
+static void bbstate_saved(void *d, int err) {
+    bbstate_job_t *job = (bbstate_job_t *)d;
+    ship_t *c;
+
+    if(err && (c = find_ship_by_conn_id(job->conn_id))) {
+        if(send_error(c, job->type, job->flags, ERR_BAD_ERROR, job->data,
+                      job->len))
+            c->disconnected = 1;
+    }
+
+    free(job);
+}
+
 /* Handle a Blue Burst user's request to add a guildcard to their list */
 static int handle_bb_gcadd(ship_t *c, shipgate_fw_9_pkt *pkt) {
     bb_guildcard_add_pkt *gc = (bb_guildcard_add_pkt *)pkt->pkt;
     uint16_t len = LE16(gc->hdr.pkt_len);
     uint32_t sender = ntohl(pkt->guildcard);
     uint32_t fr_gc = LE32(gc->guildcard);
-    char query[1024];
-    char name[97];
-    char team_name[65];
-    char text[373];
+    bbstate_job_t *job;
 
     /* Make sure the packet is sane */
     if(len != 0x0110) {
         return -1;
     }
 
-    /* Escape all the strings first */
-    sylverant_db_escape_str(&conn, name, (char *)gc->name, 48);
-    sylverant_db_escape_str(&conn, team_name, (char *)gc->team_name, 32);
-    sylverant_db_escape_str(&conn, text, (char *)gc->text, 176);
-
-    /* Add the entry in the db... */
-    sprintf(query, "INSERT INTO blueburst_guildcards (guildcard, friend_gc, "
-            "name, team_name, text, language, section_id, class) VALUES ('%"
-            PRIu32 "', '%" PRIu32 "', '%s', '%s', '%s', '%" PRIu8 "', '%"
-            PRIu8 "', '%" PRIu8 "') ON DUPLICATE KEY UPDATE "
-            "name=VALUES(name), text=VALUES(text), language=VALUES(language), "
-            "section_id=VALUES(section_id), class=VALUES(class)", sender,
-            fr_gc, name, team_name, text, gc->language, gc->section,
-            gc->char_class);
+    if(!(job = bbstate_job(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE, gc,
+                           len))) {
+        send_error(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE,
+                   ERR_BAD_ERROR, (uint8_t *)gc, len);
+        return 0;
+    }
 
-    if(sylverant_db_query(&conn, query)) {
+    /* Add the entry to their list. It gets written to the db later, if it
+       actually changed anything, and the ship only hears back if it can't be
+       journaled. */
+    if(bbstate_gc_add(sender, fr_gc, (uint8_t *)gc->name,
+                      (uint8_t *)gc->team_name, (uint8_t *)gc->text,
+                      gc->language, gc->section, gc->char_class,
+                      &bbstate_saved, job)) {
         debug(DBG_WARN, "Couldn't add bb guildcard (%" PRIu32 ": %" PRIu32
               ")\n", sender, fr_gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        free(job);
 
         send_error(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE,
                    ERR_BAD_ERROR, (uint8_t *)gc, len);
@@ -1361,21 +1336,12 @@ static int handle_bb_gcdel(ship_t *c, shipgate_fw_9_pkt *pkt) {
     uint16_t len = LE16(gc->hdr.pkt_len);
     uint32_t sender = ntohl(pkt->guildcard);
     uint32_t fr_gc = LE32(gc->guildcard);
-    char query[256];
 
     if(len != 0x000C) {
         return -1;
     }
 
-    /* Build the query and run it */
-    sprintf(query, "CALL blueburst_guildcard_delete('%" PRIu32 "', '%" PRIu32
-            "')", sender, fr_gc);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't delete bb guildcard (%" PRIu32 ": %" PRIu32
-              ")\n", sender, fr_gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
+    if(bbstate_gc_del(sender, fr_gc)) {
         send_error(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE,
                    ERR_BAD_ERROR, (uint8_t *)gc, len);
         return 0;
@@ -1392,21 +1358,12 @@ static int handle_bb_gcsort(ship_t *c, shipgate_fw_9_pkt *pkt) {
     uint32_t sender = ntohl(pkt->guildcard);
     uint32_t fr_gc1 = LE32(gc->guildcard1);
     uint32_t fr_gc2 = LE32(gc->guildcard2);
-    char query[256];
 
     if(len != 0x0010) {
         return -1;
     }
 
-    /* Build the query and run it */
-    sprintf(query, "CALL blueburst_guildcard_sort('%" PRIu32 "', '%" PRIu32
-            "', '%" PRIu32 "')", sender, fr_gc1, fr_gc2);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't sort bb guildcards (%" PRIu32 ": %" PRIu32
-              " - %" PRIu32 ")\n", sender, fr_gc1, fr_gc2);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
+    if(bbstate_gc_sort(sender, fr_gc1, fr_gc2)) {
         send_error(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE,
                    ERR_BAD_ERROR, (uint8_t *)gc, len);
         return 0;
@@ -1497,8 +1454,7 @@ static int handle_bb_set_comment(ship_t *c, shipgate_fw_9_pkt *pkt) {
     uint16_t pkt_len = LE16(gc->hdr.pkt_len);
     uint32_t sender = ntohl(pkt->guildcard);
     uint32_t fr_gc = LE32(gc->guildcard);
-    char query[512];
-    char comment[0x88 * 4 + 1];
+    bbstate_job_t *job;
     int len = 0;
 
     if(pkt_len != 0x00BC) {
@@ -1510,17 +1466,18 @@ static int handle_bb_set_comment(ship_t *c, shipgate_fw_9_pkt *pkt) {
     memset(&gc->text[len], 0, (0x88 - len) * 2);
     len = (len + 1) * 2;
 
-    sylverant_db_escape_str(&conn, comment, (char *)gc->text, len);
-
-    /* Build the query and run it */
-    sprintf(query, "UPDATE blueburst_guildcards SET comment='%s' WHERE "
-            "guildcard='%" PRIu32"' AND friend_gc='%" PRIu32 "'", comment,
-            sender, fr_gc);
+    if(!(job = bbstate_job(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE, gc,
+                           len))) {
+        send_error(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE,
+                   ERR_BAD_ERROR, (uint8_t *)gc, len);
+        return 0;
+    }
 
-    if(sylverant_db_query(&conn, query)) {
+    if(bbstate_gc_comment(sender, fr_gc, (uint8_t *)gc->text, len,
+                          &bbstate_saved, job)) {
         debug(DBG_WARN, "Couldn't update guildcard comment (%" PRIu32 ": %"
               PRIu32 ")\n", sender, fr_gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        free(job);
 
         send_error(c, SHDR_TYPE_BB, SHDR_RESPONSE | SHDR_FAILURE,
                    ERR_BAD_ERROR, (uint8_t *)gc, len);
@@ -1610,202 +1567,558 @@ static int handle_bb(ship_t *c, shipgate_fw_9_pkt *pkt) {
     }
 }
 
-/* Handle a ship's save character data packet. */
-static int handle_cdata(ship_t *c, shipgate_char_data_pkt *pkt) {
-    uint32_t gc, slot;
-    uint16_t len = ntohs(pkt->hdr.pkt_len) - sizeof(shipgate_char_data_pkt);
-    static char query[16384];
-    Bytef *cmp_buf;
-    uLong cmp_sz;
-    int compressed = ~Z_OK;
+/* Character data saves and loads are split up between the main thread and the
+   worker threads. Compression and decompression happen on a worker, while the
+   database work and the response to the ship happen back on the main thread.
+   Everything for one guildcard is kept in order by using the guildcard as the
+   work queue key, so a load always sees any save submitted before it. Regular
+   saves go through the save buffer (savebuf.c) instead, and loads check there
+   before going to the database. */
+typedef struct cdata_job {
+    uint32_t conn_id;
+    uint16_t type;
+    uint32_t gc;
+    uint32_t slot;
+    uint32_t block;
+    char name[32];
+    uint8_t resp[8];
+    int codec;
+    int err;
+    uint8_t *enc;
+    size_t enc_len;
+    int enc_mapped;
+    int blob;
+    uint8_t hash[BLOB_HASH_LEN];
+    int back;
+    hist_chain_t *chain;
+    hist_job_t *hist;
+    uint64_t raw_hash;
+    uint32_t gen;
+    uint8_t *data;
+    size_t len;
+} cdata_job_t;
 
-    gc = ntohl(pkt->guildcard);
-    slot = ntohl(pkt->slot);
+static cdata_job_t *cdata_job_new(ship_t *c, uint16_t type, uint32_t gc,
+                                  uint32_t slot, uint32_t block,
+                                  const void *resp) {
+    cdata_job_t *job;
 
-    /* Is it a Blue Burst character or not? */
-    if(len > 1056) {
-        len = sizeof(sylverant_bb_db_char_t);
-    }
-    else {
-        len = 1052;
+    if(!(job = (cdata_job_t *)malloc(sizeof(cdata_job_t)))) {
+        debug(DBG_WARN, "Couldn't allocate character data job\n");
+        debug(DBG_WARN, "%s\n", strerror(errno));
+        return NULL;
     }
 
-    /* Delete any character data already exising in that slot. */
-    sprintf(query, "DELETE FROM character_data WHERE guildcard='%u' AND "
-            "slot='%u'", gc, slot);
+    memset(job, 0, sizeof(cdata_job_t));
+    job->conn_id = c->conn_id;
+    job->type = type;
+    job->gc = gc;
+    job->slot = slot;
+    job->block = block;
+    memcpy(job->resp, resp, 8);
 
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't remove old character data (%u: %u)\n",
-              gc, slot);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    return job;
+}
 
-        send_error(c, SHDR_TYPE_CDATA, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+static void cdata_job_free(cdata_job_t *job) {
+    /* Data read from the blob store is used right where it's mapped. */
+    if(!job->enc_mapped)
+        free(job->enc);
+
+    if(job->chain)
+        hist_chain_free(job->chain);
+
+    hist_end(job->hist);
+    free(job->data);
+    free(job);
+}
+
+/* Send the response for a finished job, if the ship is still around. */
+static void cdata_job_respond(cdata_job_t *job, uint16_t flags, uint32_t err) {
+    ship_t *c = find_ship_by_conn_id(job->conn_id);
+
+    if(c && send_error(c, job->type, SHDR_RESPONSE | flags, err, job->resp, 8))
+        c->disconnected = 1;
+}
+
+/* Compress and store a character backup, along with its history (on a worker
+   thread). If compressing fails for some reason, it just gets stored
+   uncompressed. */
+static void cdata_store(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
+    sylverant_dbconn_t *db;
+    char name2[65], hex[BLOB_HASH_HEX_LEN + 1], size[16];
+    const uint8_t *data;
+    size_t len;
+    int codec;
+    char *query;
+
+    job->err = 1;
+
+    if(codec_encode(job->data, job->len, &job->enc, &job->enc_len,
+                    &job->codec))
+        debug(DBG_WARN, "Couldn't compress character data (%u: %u)\n",
+              job->gc, job->slot);
+
+    if(blob_enabled()) {
+        if(job->enc)
+            job->blob = !blob_store(job->enc, job->enc_len, job->hash);
+        else
+            job->blob = !blob_store(job->data, job->len, job->hash);
     }
 
-    /* Compress the character data */
-    cmp_sz = compressBound((uLong)len);
+    if(!(db = workdb_conn()))
+        return;
+
+    data = job->enc ? job->enc : job->data;
+    len = job->enc ? job->enc_len : job->len;
+    codec = job->enc ? job->codec : CODEC_NONE;
+
+    if(!(query = (char *)malloc(len * 2 + 512)))
+        return;
+
+    sylverant_db_escape_str(db, name2, job->name, strlen(job->name));
 
-    if((cmp_buf = (Bytef *)malloc(cmp_sz))) {
-        compressed = compress2(cmp_buf, &cmp_sz, (Bytef *)pkt->data,
-                               (uLong)len, 9);
+    if(job->enc)
+        sprintf(size, "'%u'", (unsigned)job->len);
+    else
+        strcpy(size, "NULL");
+
+    if(job->blob) {
+        blob_hash_hex(job->hash, hex);
+        sprintf(query, "INSERT INTO character_backup(guildcard, size, codec, "
+                "raw_hash, name, data, blob_hash) VALUES ('%u', %s, '%d', "
+                "'%llu', '%s', NULL, '%s'", job->gc, size, codec,
+                (unsigned long long)job->raw_hash, name2, hex);
     }
+    else {
+        sprintf(query, "INSERT INTO character_backup(guildcard, size, codec, "
+                "raw_hash, name, data, blob_hash) VALUES ('%u', %s, '%d', "
+                "'%llu', '%s', '", job->gc, size, codec,
+                (unsigned long long)job->raw_hash, name2);
+        sylverant_db_escape_str(db, query + strlen(query), (char *)data, len);
+        strcat(query, "', NULL");
+    }
+
+    /* The size and codec have to be updated along with the data, otherwise an
+       old row could end up being decoded with the wrong codec. */
+    strcat(query, ") ON DUPLICATE KEY UPDATE size=VALUES(size), "
+           "codec=VALUES(codec), raw_hash=VALUES(raw_hash), "
+           "data=VALUES(data), blob_hash=VALUES(blob_hash)");
+
+    if(sylverant_db_query(db, query)) {
+        debug(DBG_WARN, "Couldn't save character backup (%u: %s)\n", job->gc,
+              job->name);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(db));
+        free(query);
+        return;
+    }
+
+    free(query);
+    job->err = 0;
+    hist_write(job->hist, db, job->enc, job->enc_len, job->codec,
+               job->blob ? job->hash : NULL);
+}
+
+/* Respond to a stored character backup (on the main thread). */
+static void cdata_stored(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
 
-    /* Build up the store query for it. */
-    if(compressed == Z_OK && cmp_sz < len) {
-        sprintf(query, "INSERT INTO character_data(guildcard, slot, size, "
-                "data) VALUES ('%u', '%u', '%u', '", gc, slot,
-                (unsigned)len);
-        sylverant_db_escape_str(&conn, query + strlen(query), (char *)cmp_buf,
-                                cmp_sz);
+    bkcache_end(job->gc, job->name, !job->err);
+
+    if(job->err) {
+        cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
     }
     else {
-        sprintf(query, "INSERT INTO character_data(guildcard, slot, data) "
-                "VALUES ('%u', '%u', '", gc, slot);
-        sylverant_db_escape_str(&conn, query + strlen(query), (char *)pkt->data,
-                                len);
+        /* Return success (yeah, bad use of this function, but whatever). */
+        cdata_job_respond(job, 0, ERR_NO_ERROR);
     }
 
-    strcat(query, "')");
-    free(cmp_buf);
+    cdata_job_free(job);
+}
 
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't save character data (%u: %u)\n", gc, slot);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+/* Respond to a character save once it's safely in the journal. */
+static void cdata_saved(void *d, int err) {
+    cdata_job_t *job = (cdata_job_t *)d;
 
-        send_error(c, SHDR_TYPE_CDATA, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+    if(err)
+        cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+    else
+        cdata_job_respond(job, 0, ERR_NO_ERROR);
+
+    cdata_job_free(job);
+}
+
+/* Decompress character data (on a worker thread). */
+static void cdata_decode(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
+    size_t sz = job->len;
+
+    if(!(job->data = (uint8_t *)malloc(sz))) {
+        job->err = -1;
+        return;
     }
 
-    /* Return success (yeah, bad use of this function, but whatever). */
-    return send_error(c, SHDR_TYPE_CDATA, SHDR_RESPONSE, ERR_NO_ERROR,
-                      (uint8_t *)&pkt->guildcard, 8);
+    if(codec_decode(job->codec, job->enc, job->enc_len, job->data, sz,
+                    &job->len)) {
+        debug(DBG_WARN, "Couldn't decode character data (%u: %u, codec: %s)\n",
+              job->gc, job->slot, codec_name(job->codec));
+        job->err = -1;
+    }
 }
 
-static int handle_cbkup_req(ship_t *c, shipgate_char_bkup_pkt *pkt, uint32_t gc,
-                            const char name[], uint32_t block) {
+/* Send decompressed character data back to the ship (on the main thread). */
+static void cdata_send(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
+    ship_t *c;
+
+    if(job->err) {
+        cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+        cdata_job_free(job);
+        return;
+    }
+
+    /* Keep regular character data around in case it gets asked for again
+       soon (like if the player changes ships). Old versions don't go in the
+       cache, since they aren't what's stored anymore. Neither does anything
+       that was read before a newer save came in, since the cache might have
+       that save in it already. */
+    if(job->type == SHDR_TYPE_CREQ && !job->back &&
+       job->gen == savebuf_generation(job->gc, job->slot))
+        ccache_put(job->gc, job->slot, job->data, job->len);
+
+    if((c = find_ship_by_conn_id(job->conn_id))) {
+        if(send_cdata(c, job->gc, job->slot, job->data, (int)job->len,
+                      job->block))
+            c->disconnected = 1;
+    }
+
+    cdata_job_free(job);
+}
+
+/* Fill in a job from a stored character data row. The columns starting at col
+   are data, size, codec and blob_hash. If the data is in the blob store, it's
+   decoded straight out of the mapped segment rather than copied. */
+static int cdata_load_row(cdata_job_t *job, char **row, unsigned long *len,
+                          int col) {
+    const uint8_t *data = (const uint8_t *)row[col];
+    size_t dlen = (size_t)len[col];
+    uint8_t hash[BLOB_HASH_LEN];
+
+    if(row[col + 3]) {
+        if(blob_hash_parse(row[col + 3], hash) ||
+           blob_get(hash, &data, &dlen)) {
+            debug(DBG_WARN, "Missing blob for character data (%u: %u): %s\n",
+                  job->gc, job->slot, row[col + 3]);
+            return -1;
+        }
+
+        job->enc = (uint8_t *)data;
+        job->enc_mapped = 1;
+    }
+    else if(!data) {
+        debug(DBG_WARN, "Empty character data (%u: %u)\n", job->gc,
+              job->slot);
+        return -1;
+    }
+    else {
+        if(!(job->enc = (uint8_t *)malloc(dlen))) {
+            debug(DBG_WARN, "Couldn't allocate memory for character data\n");
+            debug(DBG_WARN, "%s\n", strerror(errno));
+            return -1;
+        }
+
+        memcpy(job->enc, data, dlen);
+    }
+
+    /* Older rows don't have a codec, so figure it out from the size column in
+       that case. */
+    job->codec = codec_from_row(row[col + 2], row[col + 1]);
+    job->enc_len = dlen;
+    job->len = (job->codec == CODEC_NONE || !row[col + 1]) ? dlen :
+        (size_t)atoi(row[col + 1]);
+
+    return 0;
+}
+
+/* Read stored character data from the database (on the main thread) and hand
+   it off to be decompressed. */
+static void cdata_fetch(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
     char query[256];
     char name2[65];
-    uint8_t *data;
     void *result;
     char **row;
     unsigned long *len;
-    int sz, rv;
-    uLong sz2, csz;
 
     /* Build the query asking for the data. */
-    sylverant_db_escape_str(&conn, name2, name, strlen(name));
-    sprintf(query, "SELECT data, size FROM character_backup WHERE "
-            "guildcard='%u' AND name='%s'", gc, name2);
+    if(job->type == SHDR_TYPE_CBKUP) {
+        sylverant_db_escape_str(&conn, name2, job->name, strlen(job->name));
+        sprintf(query, "SELECT data, size, codec, blob_hash FROM "
+                "character_backup WHERE "
+                "guildcard='%u' AND name='%s'", job->gc, name2);
+    }
+    else {
+        sprintf(query, "SELECT data, size, codec, blob_hash FROM "
+                "character_data WHERE "
+                "guildcard='%u' AND slot='%u'", job->gc, job->slot);
+        job->gen = savebuf_generation(job->gc, job->slot);
+    }
 
     if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't fetch character backup (%u: %s)\n", gc, name);
+        debug(DBG_WARN, "Couldn't fetch character data (%u: %u)\n", job->gc,
+              job->slot);
         debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+        goto err;
     }
 
     /* Grab the data we got. */
     if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch character backup (%u: %s)\n", gc, name);
+        debug(DBG_WARN, "Couldn't fetch character data (%u: %u)\n", job->gc,
+              job->slot);
         debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+        goto err;
     }
 
     if((row = sylverant_db_result_fetch(result)) == NULL) {
         sylverant_db_result_free(result);
-        debug(DBG_WARN, "No saved character backup (%u: %s)\n", gc, name);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        debug(DBG_WARN, "No saved character data (%u: %u)\n", job->gc,
+              job->slot);
 
-        send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_CREQ_NO_DATA, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+        cdata_job_respond(job, SHDR_FAILURE, ERR_CREQ_NO_DATA);
+        cdata_job_free(job);
+        return;
     }
 
     /* Grab the length of the character data */
     if(!(len = sylverant_db_result_lengths(result))) {
         sylverant_db_result_free(result);
-        debug(DBG_WARN, "Couldn't get length of character backup\n");
+        debug(DBG_WARN, "Couldn't get length of character data\n");
         debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        goto err;
+    }
 
-        send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+    /* Copy out what we need so the result can be freed before the data gets
+       decompressed. */
+    if(cdata_load_row(job, row, len, 0)) {
+        sylverant_db_result_free(result);
+        goto err;
     }
 
-    /* Grab the data from the result */
-    sz = (int)len[0];
+    sylverant_db_result_free(result);
 
-    if(row[1]) {
-        sz2 = (uLong)atoi(row[1]);
-        csz = (uLong)sz;
+    if(workq_submit(job->gc, &cdata_decode, &cdata_send, job))
+        goto err;
 
-        data = (uint8_t *)malloc(sz2);
-        if(!data) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Couldn't allocate mem for uncompressed backup\n");
-            debug(DBG_WARN, "%s\n", strerror(errno));
-            sylverant_db_result_free(result);
+    return;
 
-            send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                       ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-            return 0;
-        }
+err:
+    cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+    cdata_job_free(job);
+}
 
-        /* Decompress it */
-        if(uncompress((Bytef *)data, &sz2, (Bytef *)row[0], csz) != Z_OK) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Couldn't decompress backup\n");
-            sylverant_db_result_free(result);
+/* Rebuild an old version of a character (on a worker thread). */
+static void cdata_hist_rebuild(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
 
-            send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                       ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-            return 0;
-        }
+    if(hist_rebuild(job->chain, &job->data, &job->len))
+        job->err = -1;
+}
+
+/* Read what's needed for an old version of a character from the history (on
+   the main thread) and hand it off to be rebuilt. */
+static void cdata_hist_fetch(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
 
-        sz = sz2;
+    if(!(job->chain = hist_fetch(job->gc, job->slot, job->name, job->back))) {
+        debug(DBG_WARN, "No character history (%u: %u, %d back)\n", job->gc,
+              job->slot, job->back);
+        cdata_job_respond(job, SHDR_FAILURE, ERR_CREQ_NO_DATA);
+        cdata_job_free(job);
+        return;
     }
-    else {
-        data = (uint8_t *)malloc(sz);
-        if(!data) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Couldn't allocate memory for character backup\n");
-            debug(DBG_WARN, "%s\n", strerror(errno));
-            sylverant_db_result_free(result);
 
-            send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                       ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-            return 0;
+    if(workq_submit(job->gc, &cdata_hist_rebuild, &cdata_send, job)) {
+        cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+        cdata_job_free(job);
+    }
+}
+
+/* Maximum number of logins that can have prefetches waiting at once. */
+#ifndef CDATA_PREFETCH_MAX
+#define CDATA_PREFETCH_MAX  64
+#endif
+
+static int prefetch_pending;
+
+/* Put prefetched character data in the cache (on the main thread), unless
+   there's a newer save waiting to be written or one came in since it was
+   read. */
+static void cdata_prefetched(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d;
+    const uint8_t *data;
+    size_t len;
+
+    if(!job->err && job->gen == savebuf_generation(job->gc, job->slot) &&
+       savebuf_get(job->gc, job->slot, &data, &len))
+        ccache_prefetch(job->gc, job->slot, job->data, job->len);
+
+    cdata_job_free(job);
+}
+
+/* Read all of a guildcard's characters from the database (on the main thread)
+   and hand them off to be decompressed. */
+static void cdata_prefetch_fetch(void *d) {
+    cdata_job_t *job = (cdata_job_t *)d, *job2;
+    char query[256];
+    void *result;
+    char **row;
+    unsigned long *len;
+    uint32_t slot;
+
+    --prefetch_pending;
+
+    sprintf(query, "SELECT slot, data, size, codec, blob_hash FROM "
+            "character_data WHERE guildcard='%u'", job->gc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't prefetch character data (%u)\n", job->gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        cdata_job_free(job);
+        return;
+    }
+
+    if((result = sylverant_db_result_store(&conn)) == NULL) {
+        debug(DBG_WARN, "Couldn't prefetch character data (%u)\n", job->gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        cdata_job_free(job);
+        return;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        if(!(len = sylverant_db_result_lengths(result)))
+            break;
+
+        slot = (uint32_t)strtoul(row[0], NULL, 0);
+
+        /* Don't bother if we've already got it. */
+        if(ccache_has(job->gc, slot))
+            continue;
+
+        if(!(job2 = (cdata_job_t *)malloc(sizeof(cdata_job_t))))
+            break;
+
+        memset(job2, 0, sizeof(cdata_job_t));
+        job2->gc = job->gc;
+        job2->slot = slot;
+        job2->gen = savebuf_generation(job->gc, slot);
+
+        if(cdata_load_row(job2, row, len, 1)) {
+            free(job2);
+            continue;
         }
 
-        memcpy(data, row[0], len[0]);
+        if(workq_submit(job->gc, &cdata_decode, &cdata_prefetched, job2))
+            cdata_job_free(job2);
     }
 
     sylverant_db_result_free(result);
+    cdata_job_free(job);
+}
 
-    /* Send the data back to the ship. */
-    rv = send_cdata(c, gc, (uint32_t)-1, data, sz, block);
+/* Start loading a player's characters into the cache when they log in, since
+   the ship will most likely ask for one of them shortly after. */
+static void cdata_prefetch(uint32_t gc) {
+    cdata_job_t *job;
 
-    /* Clean up and finish */
-    free(data);
-    return rv;
+    if(!cdata_prefetch_enabled || !ccache_enabled() ||
+       prefetch_pending >= CDATA_PREFETCH_MAX)
+        return;
+
+    if(!(job = (cdata_job_t *)malloc(sizeof(cdata_job_t))))
+        return;
+
+    memset(job, 0, sizeof(cdata_job_t));
+    job->gc = gc;
+    ++prefetch_pending;
+
+    /* Like with a regular load, go through the work queue first so that any
+       earlier saves for this guildcard are stored before the query. */
+    if(workq_submit(gc, NULL, &cdata_prefetch_fetch, job)) {
+        --prefetch_pending;
+        cdata_job_free(job);
+    }
+}
+
+/* Handle a ship's save character data packet. */
+static int handle_cdata(ship_t *c, shipgate_char_data_pkt *pkt) {
+    uint32_t gc, slot;
+    uint16_t len = ntohs(pkt->hdr.pkt_len) - sizeof(shipgate_char_data_pkt);
+    cdata_job_t *job;
+
+    gc = ntohl(pkt->guildcard);
+    slot = ntohl(pkt->slot);
+
+    /* Is it a Blue Burst character or not? */
+    if(len > 1056) {
+        len = sizeof(sylverant_bb_db_char_t);
+    }
+    else {
+        len = 1052;
+    }
+
+    /* Put it in the save buffer. The ship gets its response once the save is
+       in the journal, and it gets written to the database a little later, so
+       that if another save comes in soon after, only that one is written. */
+    if(!(job = cdata_job_new(c, SHDR_TYPE_CDATA, gc, slot, 0,
+                             &pkt->guildcard)) ||
+       savebuf_save(gc, slot, pkt->data, len, &cdata_saved, job)) {
+        debug(DBG_WARN, "Couldn't buffer character data (%u: %u)\n", gc,
+              slot);
+        free(job);
+        send_error(c, SHDR_TYPE_CDATA, SHDR_RESPONSE | SHDR_FAILURE,
+                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
+        return 0;
+    }
+
+    return 0;
+}
+
+static int handle_cbkup_req(ship_t *c, shipgate_char_bkup_pkt *pkt, uint32_t gc,
+                            const char name[], uint32_t block) {
+    cdata_job_t *job;
+
+    if(!(job = cdata_job_new(c, SHDR_TYPE_CBKUP, gc, (uint32_t)-1, block,
+                             &pkt->guildcard))) {
+        send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
+                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
+        return 0;
+    }
+
+    strcpy(job->name, name);
+
+    /* For newer ships, the version field of the header says how many versions
+       back to go, with 0 being the current backup. */
+    if(c->proto_ver >= 23)
+        job->back = pkt->hdr.version;
+
+    /* This doesn't need to do anything on the worker, but going through it
+       makes sure any earlier saves for this guildcard are stored first. */
+    if(workq_submit(gc, NULL, job->back ? &cdata_hist_fetch : &cdata_fetch,
+                    job)) {
+        cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+        cdata_job_free(job);
+    }
+
+    return 0;
 }
 
 static int handle_cbkup(ship_t *c, shipgate_char_bkup_pkt *pkt) {
-    static char query[16384];
     uint32_t gc, block;
     uint16_t len = ntohs(pkt->hdr.pkt_len) - sizeof(shipgate_char_bkup_pkt);
-    char name[32], name2[65];
-    Bytef *cmp_buf;
-    uLong cmp_sz;
-    int compressed = ~Z_OK;
+    char name[32];
+    cdata_job_t *job;
+    uint64_t hash;
 
     gc = ntohl(pkt->guildcard);
     block = ntohl(pkt->block);
@@ -1825,174 +2138,207 @@ static int handle_cbkup(ship_t *c, shipgate_char_bkup_pkt *pkt) {
         len = 1052;
     }
 
-    sylverant_db_escape_str(&conn, name2, name, strlen(name));
+    /* If it's the same as what's already stored, there's nothing to do. */
+    hash = bkcache_hash(pkt->data, len);
 
-    /* Compress the character data */
-    cmp_sz = compressBound((uLong)len);
-
-    if((cmp_buf = (Bytef *)malloc(cmp_sz))) {
-        compressed = compress2(cmp_buf, &cmp_sz, (Bytef *)pkt->data,
-                               (uLong)len, 9);
+    if(bkcache_same(gc, name, hash)) {
+        return send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE, ERR_NO_ERROR,
+                          (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* Build up the store query for it. */
-    if(compressed == Z_OK && cmp_sz < len) {
-        sprintf(query, "INSERT INTO character_backup(guildcard, size, name, "
-                "data) VALUES ('%u', '%u', '%s', '", gc, (unsigned)len, name2);
-        sylverant_db_escape_str(&conn, query + strlen(query), (char *)cmp_buf,
-                                cmp_sz);
-    }
-    else {
-        sprintf(query, "INSERT INTO character_backup(guildcard, name, data) "
-                "VALUES ('%u', '%s', '", gc, name2);
-        sylverant_db_escape_str(&conn, query + strlen(query), (char *)pkt->data,
-                                len);
+    if(!(job = cdata_job_new(c, SHDR_TYPE_CBKUP, gc, (uint32_t)-1, block,
+                             &pkt->guildcard)) ||
+       !(job->data = (uint8_t *)malloc(len))) {
+        free(job);
+        send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
+                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
+        return 0;
     }
 
-    strcat(query, "') ON DUPLICATE KEY UPDATE data=VALUES(data)");
-    free(cmp_buf);
+    strcpy(job->name, name);
+    memcpy(job->data, pkt->data, len);
+    job->len = len;
+    job->raw_hash = hash;
 
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't save character backup (%u: %s)\n", gc, name);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    bkcache_begin(gc, name, hash);
+    job->hist = hist_begin(gc, (uint32_t)-1, name, job->data, len);
 
-        send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+    if(workq_submit(gc, &cdata_store, &cdata_stored, job)) {
+        bkcache_end(gc, name, 0);
+        cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+        cdata_job_free(job);
     }
 
-    /* Return success (yeah, bad use of this function, but whatever). */
-    return send_error(c, SHDR_TYPE_CBKUP, SHDR_RESPONSE, ERR_NO_ERROR,
-                      (uint8_t *)&pkt->guildcard, 8);
+    return 0;
 }
 
 /* Handle a ship's character data request packet. */
 static int handle_creq(ship_t *c, shipgate_char_req_pkt *pkt) {
     uint32_t gc, slot;
-    char query[256];
-    uint8_t *data;
-    void *result;
-    char **row;
-    unsigned long *len;
-    int sz, rv;
-    uLong sz2, csz;
+    cdata_job_t *job;
+    const uint8_t *data;
+    size_t len;
 
     gc = ntohl(pkt->guildcard);
     slot = ntohl(pkt->slot);
 
-    /* Build the query asking for the data. */
-    sprintf(query, "SELECT data, size FROM character_data WHERE guildcard='%u' "
-            "AND slot='%u'", gc, slot);
+    /* Asking for an old version of the character? For newer ships, the version
+       field of the header says how many saves back to go. */
+    if(c->proto_ver >= 23 && pkt->hdr.version) {
+        if(!(job = cdata_job_new(c, SHDR_TYPE_CREQ, gc, slot, 0,
+                                 &pkt->guildcard))) {
+            send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
+                       ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
+            return 0;
+        }
 
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't fetch character data (%u: %u)\n", gc, slot);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        job->back = pkt->hdr.version;
+
+        if(workq_submit(gc, NULL, &cdata_hist_fetch, job)) {
+            cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+            cdata_job_free(job);
+        }
 
-        send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
         return 0;
     }
 
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch character data (%u: %u)\n", gc, slot);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    /* If there's a save that hasn't made it to the database yet, then that's
+       the newest data, so send it back directly. */
+    if(!savebuf_get(gc, slot, &data, &len)) {
+        return send_cdata(c, gc, slot, (void *)data, (int)len, 0);
+    }
 
+    /* Likewise, if it was saved or loaded recently, it might be cached. */
+    if(!ccache_get(gc, slot, &data, &len)) {
+        return send_cdata(c, gc, slot, (void *)data, (int)len, 0);
+    }
+
+    if(!(job = cdata_job_new(c, SHDR_TYPE_CREQ, gc, slot, 0,
+                             &pkt->guildcard))) {
         send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
                    ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
         return 0;
     }
 
-    if((row = sylverant_db_result_fetch(result)) == NULL) {
-        sylverant_db_result_free(result);
-        debug(DBG_WARN, "No saved character data (%u: %u)\n", gc, slot);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_CREQ_NO_DATA, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
+    if(workq_submit(gc, NULL, &cdata_fetch, job)) {
+        cdata_job_respond(job, SHDR_FAILURE, ERR_BAD_ERROR);
+        cdata_job_free(job);
     }
 
-    /* Grab the length of the character data */
-    if(!(len = sylverant_db_result_lengths(result))) {
-        sylverant_db_result_free(result);
-        debug(DBG_WARN, "Couldn't get length of character data\n");
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    return 0;
+}
 
-        send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
-                   ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-        return 0;
-    }
+/* Handle a client login request coming from a ship. */
+typedef struct usrlogin_job {
+    uint32_t conn_id;
+    uint32_t gc;
+    uint32_t block;
+    uint32_t account_id;
+    uint8_t resp[8];
+    char username[32];
+    char priv[16];
+    char stored[AUTH_HASH_MAX];
+} usrlogin_job_t;
 
-    /* Grab the data from the result */
-    sz = (int)len[0];
+static void usrlogin_error(usrlogin_job_t *job, uint32_t err) {
+    ship_t *c = find_ship_by_conn_id(job->conn_id);
 
-    if(row[1]) {
-        sz2 = (uLong)atoi(row[1]);
-        csz = (uLong)sz;
+    if(c && send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE, err, job->resp, 8))
+        c->disconnected = 1;
+}
 
-        data = (uint8_t *)malloc(sz2);
-        if(!data) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Couldn't allocate for uncompressed data\n");
-            debug(DBG_WARN, "%s\n", strerror(errno));
-            sylverant_db_result_free(result);
+/* Replace a password hash with a new one, as long as nobody's changed the
+   password in the meantime. */
+static void usrlogin_rehash(usrlogin_job_t *job, const char *new_hash) {
+    char query[640], esc[AUTH_HASH_MAX * 2 + 1], esc2[AUTH_HASH_MAX * 2 + 1];
 
-            send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
-                       ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-            return 0;
-        }
+    sylverant_db_escape_str(&conn, esc, new_hash, strlen(new_hash));
+    sylverant_db_escape_str(&conn, esc2, job->stored, strlen(job->stored));
+    sprintf(query, "UPDATE account_data SET password='%s' WHERE "
+            "account_id='%u' AND password='%s'", esc, job->account_id, esc2);
 
-        /* Decompress it */
-        if(uncompress((Bytef *)data, &sz2, (Bytef *)row[0], csz) != Z_OK) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Couldn't decompress data\n");
-            sylverant_db_result_free(result);
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't update password hash (user: %s)\n",
+              job->username);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    }
+}
 
-            send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
-                       ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-            return 0;
-        }
+/* Finish up a user login once the password has been checked (on the main
+   thread). */
+static void usrlogin_checked(int result, const char *new_hash, void *d) {
+    usrlogin_job_t *job = (usrlogin_job_t *)d;
+    ship_t *c;
+    uint32_t priv;
 
-        sz = sz2;
+    if(result == AUTH_ERROR) {
+        usrlogin_error(job, ERR_BAD_ERROR);
+        goto out;
+    }
+    else if(result != AUTH_OK) {
+        debug(DBG_LOG, "Failed login - bad password (user: %s, gc: %u)\n",
+              job->username, job->gc);
+        usrlogin_error(job, ERR_USRLOGIN_BAD_CRED);
+        goto out;
     }
-    else {
-        data = (uint8_t *)malloc(sz);
-        if(!data) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Couldn't allocate for character data\n");
-            debug(DBG_WARN, "%s\n", strerror(errno));
-            sylverant_db_result_free(result);
 
-            send_error(c, SHDR_TYPE_CREQ, SHDR_RESPONSE | SHDR_FAILURE,
-                       ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-            return 0;
-        }
+    if(new_hash)
+        usrlogin_rehash(job, new_hash);
+
+    /* Grab the privilege level out of the packet */
+    errno = 0;
+    priv = (uint32_t)strtoul(job->priv, NULL, 0);
 
-        memcpy(data, row[0], len[0]);
+    if(errno != 0) {
+        usrlogin_error(job, ERR_USRLOGIN_BAD_PRIVS);
+        goto out;
     }
 
-    sylverant_db_result_free(result);
+    /* Filter out any privileges that don't make sense. Can't have global GM
+       without local GM support. Also, anyone set as a root this way must have
+       BOTH root bits set, not just one! */
+    if(((priv & CLIENT_PRIV_GLOBAL_GM) && !(priv & CLIENT_PRIV_LOCAL_GM)) ||
+       ((priv & CLIENT_PRIV_GLOBAL_ROOT) && !(priv & CLIENT_PRIV_LOCAL_ROOT)) ||
+       ((priv & CLIENT_PRIV_LOCAL_ROOT) && !(priv & CLIENT_PRIV_GLOBAL_ROOT))) {
+        debug(DBG_WARN, "Invalid privileges for user %s: %02x\n",
+              job->username, priv);
+        usrlogin_error(job, ERR_USRLOGIN_BAD_PRIVS);
+        goto out;
+    }
 
-    /* Send the data back to the ship. */
-    rv = send_cdata(c, gc, slot, data, sz, 0);
+    /* Remember their privileges, so we don't have to look them up again if
+       they decide to do something that needs them. */
+    acct_cache_set(job->gc, job->account_id, priv);
 
-    /* Clean up and finish */
-    free(data);
-    return rv;
+    /* The ship will probably ask for their character data soon. */
+    cdata_prefetch(job->gc);
+
+    /* If the ship went away while we were checking, there's nobody to tell. */
+    if(!(c = find_ship_by_conn_id(job->conn_id)))
+        goto out;
+
+    /* The privilege field went to 32-bits in version 18. */
+    if(c->proto_ver < 18) {
+        priv &= (CLIENT_PRIV_LOCAL_GM | CLIENT_PRIV_GLOBAL_GM |
+                 CLIENT_PRIV_LOCAL_ROOT | CLIENT_PRIV_GLOBAL_ROOT);
+    }
+
+    /* Send a success message. */
+    if(send_usrloginreply(c, job->gc, job->block, 1, priv))
+        c->disconnected = 1;
+
+out:
+    free(job);
 }
 
-/* Handle a client login request coming from a ship. */
 static int handle_usrlogin(ship_t *c, shipgate_usrlogin_req_pkt *pkt) {
     uint32_t gc, block;
     char query[256];
     void *result;
     char **row;
-    int i;
-    unsigned char hash[16];
     char esc[65];
     uint16_t len;
-    uint32_t priv;
+    usrlogin_job_t *job;
 
     /* Check the sanity of the packet. Disconnect the ship if there's some odd
        issue with the packet's sanity. */
@@ -2013,9 +2359,9 @@ static int handle_usrlogin(ship_t *c, shipgate_usrlogin_req_pkt *pkt) {
     block = ntohl(pkt->block);
 
     /* Build the query asking for the data. */
-    sprintf(query, "SELECT password, regtime, privlevel FROM guildcards "
-            "NATURAL JOIN account_data WHERE guildcard='%u' AND username='%s'",
-            gc, esc);
+    sprintf(query, "SELECT password, regtime, privlevel, account_id FROM "
+            "guildcards NATURAL JOIN account_data WHERE guildcard='%u' AND "
+            "username='%s'", gc, esc);
 
     if(sylverant_db_query(&conn, query)) {
         debug(DBG_WARN, "Couldn't lookup account data (user: %s, gc: %u)\n",
@@ -2045,151 +2391,72 @@ static int handle_usrlogin(ship_t *c, shipgate_usrlogin_req_pkt *pkt) {
                           ERR_USRLOGIN_BAD_CRED, (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* Check the password. */
-    sprintf(query, "%s_%s_salt", pkt->password, row[1]);
-    md5((unsigned char *)query, strlen(query), hash);
-
-    query[0] = '\0';
-    for(i = 0; i < 16; ++i) {
-        sprintf(query, "%s%02x", query, hash[i]);
-    }
-
-    for(i = 0; i < strlen(row[0]); ++i) {
-        row[0][i] = tolower(row[0][i]);
-    }
-
-    if(strcmp(row[0], query)) {
-        debug(DBG_LOG, "Failed login - bad password (user: %s, gc: %u)\n",
+    if(!row[0] || strlen(row[0]) >= AUTH_HASH_MAX || !row[1] || !row[2] ||
+       strlen(row[2]) >= 16 || !row[3] ||
+       !(job = (usrlogin_job_t *)malloc(sizeof(usrlogin_job_t)))) {
+        debug(DBG_WARN, "Couldn't set up login (user: %s, gc: %u)\n",
               pkt->username, gc);
         sylverant_db_result_free(result);
 
-        return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE,
-                          ERR_USRLOGIN_BAD_CRED, (uint8_t *)&pkt->guildcard, 8);
-    }
-
-    /* Grab the privilege level out of the packet */
-    errno = 0;
-    priv = (uint32_t)strtoul(row[2], NULL, 0);
-
-    if(errno != 0) {
-        return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE,
-                          ERR_USRLOGIN_BAD_PRIVS, (uint8_t *)&pkt->guildcard,
-                          8);
+        return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE, ERR_BAD_ERROR,
+                          (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* Filter out any privileges that don't make sense. Can't have global GM
-       without local GM support. Also, anyone set as a root this way must have
-       BOTH root bits set, not just one! */
-    if(((priv & CLIENT_PRIV_GLOBAL_GM) && !(priv & CLIENT_PRIV_LOCAL_GM)) ||
-       ((priv & CLIENT_PRIV_GLOBAL_ROOT) && !(priv & CLIENT_PRIV_LOCAL_ROOT)) ||
-       ((priv & CLIENT_PRIV_LOCAL_ROOT) && !(priv & CLIENT_PRIV_GLOBAL_ROOT))) {
-        debug(DBG_WARN, "Invalid privileges for user %u: %02x\n", pkt->username,
-              priv);
-        sylverant_db_result_free(result);
-
-        return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE,
-                          ERR_USRLOGIN_BAD_PRIVS, (uint8_t *)&pkt->guildcard,
-                          8);
-    }
+    memset(job, 0, sizeof(usrlogin_job_t));
+    job->conn_id = c->conn_id;
+    job->gc = gc;
+    job->block = block;
+    job->account_id = (uint32_t)strtoul(row[3], NULL, 0);
+    memcpy(job->resp, &pkt->guildcard, 8);
+    strcpy(job->username, pkt->username);
+    strcpy(job->priv, row[2]);
+    strcpy(job->stored, row[0]);
 
-    /* The privilege field went to 32-bits in version 18. */
-    if(c->proto_ver < 18) {
-        priv &= (CLIENT_PRIV_LOCAL_GM | CLIENT_PRIV_GLOBAL_GM |
-                 CLIENT_PRIV_LOCAL_ROOT | CLIENT_PRIV_GLOBAL_ROOT);
-    }
-
-    /* We're done if we got this far. */
+    /* Check the password on an auth thread, since newer hashes are slow on
+       purpose. The rest of the login is done once that's finished. */
+    auth_check(gc, pkt->password, row[1], row[0], &usrlogin_checked, job);
     sylverant_db_result_free(result);
 
-    /* Send a success message. */
-    return send_usrloginreply(c, gc, block, 1, priv);
+    return 0;
 }
 
 /* Handle a ban request coming from a ship. */
 static int handle_ban(ship_t *c, shipgate_ban_req_pkt *pkt, uint16_t type) {
     uint32_t req, target, until;
     char query[1024];
-    void *result;
-    char **row;
-    int account_id;
-    int priv, priv2;
+    uint32_t account_id, priv, priv2;
+    int rv;
 
     req = ntohl(pkt->req_gc);
     target = ntohl(pkt->target);
     until = ntohl(pkt->until);
 
     /* Make sure the requester has permission. */
-    sprintf(query, "SELECT account_id, privlevel FROM guildcards NATURAL JOIN "
-            "account_data WHERE guildcard='%u' AND privlevel>'2'", req);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't fetch account data (%u)\n", req);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return send_error(c, type, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->req_gc, 16);
-    }
-
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch account data (%u)\n", req);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
+    if((rv = acct_lookup_priv(req, &account_id, &priv)) == ACCT_ERROR)
         return send_error(c, type, SHDR_FAILURE, ERR_BAD_ERROR,
                           (uint8_t *)&pkt->req_gc, 16);
-    }
 
-    if((row = sylverant_db_result_fetch(result)) == NULL) {
-        sylverant_db_result_free(result);
+    if(rv != ACCT_OK || priv <= 2) {
         debug(DBG_WARN, "No account data or not gm (%u)\n", req);
 
         return send_error(c, type, SHDR_FAILURE, ERR_BAN_NOT_GM,
                           (uint8_t *)&pkt->req_gc, 16);
     }
 
-    /* We've verified they're legit, continue on. */
-    account_id = atoi(row[0]);
-    priv = atoi(row[1]);
-    sylverant_db_result_free(result);
-
     /* Make sure the user isn't trying to ban someone with a higher privilege
        level than them... */
-    sprintf(query, "SELECT privlevel FROM guildcards NATURAL JOIN account_data "
-            "WHERE guildcard='%u'", target);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't fetch account data (%u)\n", target);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
+    if((rv = acct_lookup_priv(target, NULL, &priv2)) == ACCT_ERROR)
         return send_error(c, type, SHDR_FAILURE, ERR_BAD_ERROR,
                           (uint8_t *)&pkt->req_gc, 16);
-    }
 
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch account data (%u)\n", target);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    if(rv == ACCT_OK && priv2 >= priv) {
+        debug(DBG_WARN, "Attempt by %u to ban %u overturned by privilege\n",
+              req, target);
 
-        return send_error(c, type, SHDR_FAILURE, ERR_BAD_ERROR,
+        return send_error(c, type, SHDR_FAILURE, ERR_BAN_PRIVILEGE,
                           (uint8_t *)&pkt->req_gc, 16);
     }
 
-    if((row = sylverant_db_result_fetch(result))) {
-        priv2 = atoi(row[0]);
-
-        if(priv2 >= priv) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Attempt by %u to ban %u overturned by privilege\n",
-                  req, target);
-
-            return send_error(c, type, SHDR_FAILURE, ERR_BAN_PRIVILEGE,
-                              (uint8_t *)&pkt->req_gc, 16);
-        }
-    }
-
-    /* We're done with that... */
-    sylverant_db_result_free(result);
-
     /* Build up the ban insert query. */
     sprintf(query, "INSERT INTO bans(enddate, setby, reason) VALUES "
             "('%u', '%u', '", until, account_id);
@@ -2249,7 +2516,9 @@ static int handle_blocklogin(ship_t *c, shipgate_block_login_pkt *pkt) {
     size_t in, out;
     ICONV_CONST char *inptr;
     char *outptr;
-    monster_event_t *ev;
+    monster_event_t *ev, **evs;
+    uint32_t evc, j;
+    int notified;
     const char *tbl_nm = "online_clients";
 
     /* Is the name a Blue Burst-style (UTF-16) name or not? */
@@ -2334,12 +2603,13 @@ static int handle_blocklogin(ship_t *c, shipgate_block_login_pkt *pkt) {
         c2 = find_ship(ship_id);
 
         if(c2) {
-            send_friend_message(c2, 1, gc2, bl2, gc, bl, c->key_idx, name,
-                                row[3]);
+            queue_friend_message(c2, 1, gc2, bl2, gc, bl, c->key_idx, name,
+                                 row[3]);
         }
     }
 
     sylverant_db_result_free(result);
+    flush_friend_messages();
 
 skip_friends:
     /* See what options we have to deliver to the user */
@@ -2380,54 +2650,12 @@ skip_friends:
 
 skip_opts:
     /* See if the user has an account or not. */
-    sprintf(query, "SELECT account_id FROM guildcards WHERE guildcard='%"
-            PRIu32 "'", gc);
-
-    /* Query for any results */
-    if(sylverant_db_query(&conn, query)) {
-        /* Silently fail here (to the ship anyway), since this doesn't spell
-           doom at all for the logged in user (although, it might spell some
-           inconvenience, potentially) */
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    if(acct_lookup(gc, &acc, NULL) != ACCT_OK)
         goto skip_mail;
-    }
 
-    /* Grab any results we got */
-    if(!(result = sylverant_db_result_store(&conn))) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        goto skip_mail;
-    }
-
-    /* Find the account_id, if any. */
-    if(!(row = sylverant_db_result_fetch(result)) || !row[0])
-        goto skip_mail;
-
-    acc = (uint32_t)strtoul(row[0], NULL, 0);
-    sylverant_db_result_free(result);
-
-    /* See whether the user has any saved mail. */
-    sprintf(query, "SELECT COUNT(*) FROM simple_mail INNER JOIN guildcards ON "
-            "simple_mail.recipient = guildcards.guildcard WHERE "
-            "guildcards.account_id='%" PRIu32 "' AND simple_mail.status='0'",
-            acc);
-
-    /* Query for any results */
-    if(sylverant_db_query(&conn, query)) {
-        /* Silently fail here (to the ship anyway), since this doesn't spell
-           doom for the logged in user */
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        goto skip_mail;
-    }
-
-    /* Grab any results we got */
-    if(!(result = sylverant_db_result_store(&conn))) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        goto skip_mail;
-    }
-
-    /* Look at the number from the result set. */
-    row = sylverant_db_result_fetch(result);
-    opt = (uint32_t)strtoul(row[0], NULL, 0);
+    /* See whether the user has any saved mail. Marking the mail as notified in
+       the database is done later in a batch. */
+    opt = mail_count_take(acc);
 
     /* Do they have any mail waiting for them? */
     if(opt) {
@@ -2441,76 +2669,23 @@ skip_opts:
         send_simple_mail(c, gc, bl, 2, "Sys.Message", query);
     }
 
-    sylverant_db_result_free(result);
-
-    /* Set the flag to say that the user has been notified about any messages
-       that happen to have been mentioned above. There would be a potentially
-       race condition here between the select above and the update here, if we
-       were multithreaded. However, shipgate isn't multithreaded, and even if it
-       were, I don't think anyone will really care if the count up there is off
-       by that slight of an amount... */
-    sprintf(query, "UPDATE simple_mail INNER JOIN guildcards ON "
-            "simple_mail.recipient = guildcards.guildcard SET "
-            "simple_mail.status='2' WHERE guildcards.account_id='%" PRIu32
-            "' AND simple_mail.status='0'", acc);
-
-    /* Do the update. */
-    if(sylverant_db_query(&conn, query)) {
-        /* Silently fail here (to the ship anyway), since this doesn't spell
-           doom for the logged in user */
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        goto skip_mail;
-    }
-
 skip_mail:
-    /* If there's an event ongoing, make sure the user isn't disqualified (or
-       has already been nofified of their disqualification).
-       TODO: Figure out a better way of searching, since this limits us to one
-             ongoing event at a time... */
-    if(!(ev = find_current_event(0, 0, 1)))
-        goto skip_event;
-
-    /* See if they're disqualified (and haven't been notified). */
-    sprintf(query, "SELECT account_id FROM monster_event_disq WHERE "
-            "account_id='%" PRIu32 "' AND event_id='%" PRIu32 "' AND flags='0'",
-            acc, ev->event_id);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't query if disqualified (%" PRIu32 ")\n", acc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        goto skip_event;
-    }
-
-    /* Grab any data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't store disqualification (%" PRIu32 ")\n", acc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        goto skip_event;
-    }
-
-    /* If there's a result row, then they're disqualified... */
-    if((row = sylverant_db_result_fetch(result)) && row[0]) {
-        send_simple_mail(c, gc, bl, 2, "Sys.Message", "You have been "
-                         "disqualified from the current event for violating "
-                         "the rules of the event.");
-
-        sprintf(query, "UPDATE monster_event_disq SET flags='1' WHERE "
-                "event_id='%" PRIu32 "' AND account_id='%" PRIu32 "'",
-                ev->event_id, acc);
-
-        /* Do the update. */
-        if(sylverant_db_query(&conn, query)) {
-            /* Silently fail here (to the ship anyway), since this doesn't spell
-               doom for the logged in user */
-            debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    /* For each event going on, make sure the user isn't disqualified (or has
+       already been nofified of their disqualification). */
+    evc = events_find_all(&evs);
+
+    for(j = 0; j < evc; ++j) {
+        ev = evs[j];
+
+        /* See if they're disqualified (and haven't been notified). */
+        if(events_disqualified(ev->event_id, acc, &notified) && !notified) {
+            sprintf(query, "You have been disqualified from the %.40s event "
+                    "for violating the rules of the event.", ev->event_title);
+            send_simple_mail(c, gc, bl, 2, "Sys.Message", query);
+            events_disq_notified(ev->event_id, acc);
         }
     }
 
-    /* We don't actually care about the content of the row... If we get this
-       far, then we should be good to go... */
-    sylverant_db_result_free(result);
-
-skip_event:
     /* Skip the client's blocklist if the ship is running earlier than protocol
        version 19. */
     if(c->proto_ver < 19)
@@ -2589,6 +2764,12 @@ static int handle_blocklogout(ship_t *c, shipgate_block_login_pkt *pkt) {
     gc = ntohl(pkt->guildcard);
     bl = ntohl(pkt->blocknum);
 
+    /* They're done playing for now, so don't wait to write out their last
+       save, quest flags, or Blue Burst options. */
+    savebuf_flush_gc(gc);
+    qflags_flush_gc(gc);
+    bbstate_flush_gc(gc);
+
     /* Is this a transient client (that is to say someone on the PC NTE)? */
     if(gc >= 500 && gc < 600) {
         /* Delete the client from the transient_clients table */
@@ -2642,12 +2823,13 @@ static int handle_blocklogout(ship_t *c, shipgate_block_login_pkt *pkt) {
         c2 = find_ship(ship_id);
 
         if(c2) {
-            send_friend_message(c2, 0, gc2, bl2, gc, bl, c->key_idx, name,
-                                row[3]);
+            queue_friend_message(c2, 0, gc2, bl2, gc, bl, c->key_idx, name,
+                                 row[3]);
         }
     }
 
     sylverant_db_result_free(result);
+    flush_friend_messages();
 
     /* We're done (no need to tell the ship on success) */
     return 0;
@@ -2877,80 +3059,38 @@ static int handle_kick(ship_t *c, shipgate_kick_pkt *pkt) {
     void *result;
     char **row;
     ship_t *c2;
-    int priv, priv2;
+    uint32_t priv, priv2;
+    int rv;
 
     /* Parse out what we care about */
     gcr = ntohl(pkt->requester);
     gc = ntohl(pkt->guildcard);
 
     /* Make sure the requester is a GM */
-    sprintf(query, "SELECT privlevel FROM account_data NATURAL JOIN guildcards "
-            "WHERE privlevel>'1' AND guildcard='%u'", gcr);
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    if((rv = acct_lookup_priv(gcr, NULL, &priv)) == ACCT_ERROR)
         return 0;
-    }
 
-    /* Grab the data from the DB */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch GM data (%u)\n", gcr);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return 0;
-    }
-
-    /* Make sure we actually have a row, if not the ship is possibly trying to
-       trick us into giving someone without GM privileges GM abilities... */
-    if((row = sylverant_db_result_fetch(result)) == NULL) {
-        sylverant_db_result_free(result);
+    /* If they're not, the ship is possibly trying to trick us into giving
+       someone without GM privileges GM abilities... */
+    if(rv != ACCT_OK || priv <= 1) {
         debug(DBG_WARN, "Failed kick - not gm (gc: %u ship: %hu)\n", gcr,
               c->key_idx);
 
         return -1;
     }
 
-    /* Grab the privilege level of the GM doing the kick */
-    priv = atoi(row[0]);
-
-    /* We're done with the data we got */
-    sylverant_db_result_free(result);
-
     /* Make sure the user isn't trying to kick someone with a higher privilege
        level than them... */
-    sprintf(query, "SELECT privlevel FROM guildcards NATURAL JOIN account_data "
-            "WHERE guildcard='%u'", gc);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't fetch account data (%u)\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
+    if((rv = acct_lookup_priv(gc, NULL, &priv2)) == ACCT_ERROR)
         return 0;
-    }
 
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch account data (%u)\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    if(rv == ACCT_OK && priv2 >= priv) {
+        debug(DBG_WARN, "Attempt by %u to kick %u overturned by priv\n",
+              gcr, gc);
 
         return 0;
     }
 
-    /* See if we got anything */
-    if((row = sylverant_db_result_fetch(result))) {
-        priv2 = atoi(row[0]);
-
-        if(priv2 >= priv) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Attempt by %u to kick %u overturned by priv\n",
-                  gcr, gc);
-
-            return 0;
-        }
-    }
-
-    /* We're done with that... */
-    sylverant_db_result_free(result);
-
     /* Now that we're done with that, work on the kick */
     sprintf(query, "SELECT ship_id, block FROM online_clients WHERE "
             "guildcard='%u'", gc);
@@ -3069,12 +3209,10 @@ static int handle_frlist_req(ship_t *c, shipgate_friend_list_req *pkt) {
 }
 
 static int handle_globalmsg(ship_t *c, shipgate_global_msg_pkt *pkt) {
-    uint32_t gcr;
+    uint32_t gcr, priv;
     uint16_t text_len;
-    char query[256];
-    void *result;
-    char **row;
     ship_t *i;
+    int rv;
 
     /* Parse out what we really need */
     gcr = ntohl(pkt->requester);
@@ -3087,34 +3225,18 @@ static int handle_globalmsg(ship_t *c, shipgate_global_msg_pkt *pkt) {
     }
 
     /* Make sure the requester is a GM */
-    sprintf(query, "SELECT privlevel FROM account_data NATURAL JOIN guildcards "
-            "WHERE privlevel>'1' AND guildcard='%u'", gcr);
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    if((rv = acct_lookup_priv(gcr, NULL, &priv)) == ACCT_ERROR)
         return 0;
-    }
 
-    /* Grab the data from the DB */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch GM data (%u)\n", gcr);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return 0;
-    }
-
-    /* Make sure we actually have a row, if not the ship is possibly trying to
-       trick us into giving someone without GM privileges GM abilities... */
-    if((row = sylverant_db_result_fetch(result)) == NULL) {
-        sylverant_db_result_free(result);
+    /* If they're not, the ship is possibly trying to trick us into giving
+       someone without GM privileges GM abilities... */
+    if(rv != ACCT_OK || priv <= 1) {
         debug(DBG_WARN, "Failed global msg - not gm (gc: %u ship: %hu)\n", gcr,
               c->key_idx);
 
         return -1;
     }
 
-    /* We're done with that... */
-    sylverant_db_result_free(result);
-
     /* Send the packet along to all the ships that support it */
     TAILQ_FOREACH(i, &ships, qentry) {
         if(send_global_msg(i, gcr, pkt->text, text_len)) {
@@ -3192,166 +3314,63 @@ static int handle_useropt(ship_t *c, shipgate_user_opt_pkt *pkt) {
 }
 
 static int handle_bbopt_req(ship_t *c, shipgate_bb_opts_req_pkt *pkt) {
-    char query[1024];
     uint32_t gc, block;
-    void *result;
-    char **row;
     sylverant_bb_db_opts_t opts;
 
     /* Parse out the guildcard */
     gc = ntohl(pkt->guildcard);
     block = ntohl(pkt->block);
 
-    /* Build the db query */
-    sprintf(query, "SELECT options FROM blueburst_options WHERE guildcard='%"
-            PRIu32 "'", gc);
-
-    /* Execute the query */
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        return send_error(c, SHDR_TYPE_BBOPTS, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 8);
-    }
-
-    if(!(result = sylverant_db_result_store(&conn))) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        return send_error(c, SHDR_TYPE_BBOPTS, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 8);
-    }
-
-    if(!(row = sylverant_db_result_fetch(result))) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        sylverant_db_result_free(result);
+    /* They're only read from the db the first time they're asked for */
+    if(bbstate_get_opts(gc, &opts)) {
         return send_error(c, SHDR_TYPE_BBOPTS, SHDR_FAILURE, ERR_BAD_ERROR,
                           (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* Send the packet */
-    memcpy(&opts, row[0], sizeof(sylverant_bb_db_opts_t));
-    send_bb_opts(c, gc, block, &opts);
-
-    sylverant_db_result_free(result);
-    return 0;
-}
-
-static int handle_bbopts(ship_t *c, shipgate_bb_opts_pkt *pkt) {
-    static char query[sizeof(sylverant_bb_db_opts_t) * 2 + 256];
-    uint32_t gc;
-
-    /* Parse out the guildcard */
-    gc = ntohl(pkt->guildcard);
-
-    /* Build the db query */
-    strcpy(query, "UPDATE blueburst_options SET options='");
-    sylverant_db_escape_str(&conn, query + strlen(query), (char *)&pkt->opts,
-                            sizeof(sylverant_bb_db_opts_t));
-    sprintf(query + strlen(query), "' WHERE guildcard='%" PRIu32 "'", gc);
-
-    /* Execute the query */
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        return send_error(c, SHDR_TYPE_BBOPTS, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 8);
-    }
-
-    return 0;
-}
-
-static int handle_mkill(ship_t *c, shipgate_mkill_pkt *pkt) {
-    char query[256];
-    uint32_t gc, ct, acc;
-    int i;
-    void *result;
-    char **row;
-    monster_event_t *ev;
-
-    /* Ignore any packets that aren't version 1 or later. They're useless. */
-    if(pkt->hdr.version < 1)
-        return 0;
-
-    /* See if there's an event currently running, otherwise we can safely drop
-       any monster kill packets we get. */
-    if(!(ev = find_current_event(pkt->difficulty, pkt->version, 0)))
-        return 0;
-
-    /* Parse out the guildcard */
-    gc = ntohl(pkt->guildcard);
-
-    /* Find the user's account id */
-    sprintf(query, "SELECT account_id FROM guildcards WHERE guildcard='%"
-            PRIu32 "'", gc);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't fetch account data (%" PRIu32 ")\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 16);
-    }
-
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch account data (%" PRIu32 ")\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 8);
-    }
-
-    if((row = sylverant_db_result_fetch(result)) == NULL) {
-        sylverant_db_result_free(result);
-        debug(DBG_WARN, "Couldn't fetch account data (%" PRIu32 ")\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 8);
-    }
-
-    /* If their account id in the table is NULL, then bail. No need to report an
-       error for this. */
-    if(!row[0]) {
-        sylverant_db_result_free(result);
-        return 0;
-    }
-
-    /* We've verified they've got an account, continue on. */
-    acc = atoi(row[0]);
-    sylverant_db_result_free(result);
+    /* Send the packet */
+    send_bb_opts(c, gc, block, &opts);
+    return 0;
+}
 
-    /* Make sure they're not disqualified from the event... */
-    sprintf(query, "SELECT account_id FROM monster_event_disq WHERE "
-            "account_id='%" PRIu32 "' AND event_id='%" PRIu32 "'", acc,
-            ev->event_id);
+static int handle_bbopts(ship_t *c, shipgate_bb_opts_pkt *pkt) {
+    uint32_t gc;
+    bbstate_job_t *job;
 
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't query if disqualified (%" PRIu32 ")\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    /* Parse out the guildcard */
+    gc = ntohl(pkt->guildcard);
 
-        return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 16);
+    if(!(job = bbstate_job(c, SHDR_TYPE_BBOPTS, SHDR_FAILURE, &pkt->guildcard,
+                           8))) {
+        return send_error(c, SHDR_TYPE_BBOPTS, SHDR_FAILURE, ERR_BAD_ERROR,
+                          (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* Grab any data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't store disqualification (%" PRIu32 ")\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE, ERR_BAD_ERROR,
+    /* Nothing gets written if they haven't changed. Otherwise, the ship only
+       hears back if the change can't be journaled. */
+    if(bbstate_set_opts(gc, &pkt->opts, &bbstate_saved, job)) {
+        free(job);
+        return send_error(c, SHDR_TYPE_BBOPTS, SHDR_FAILURE, ERR_BAD_ERROR,
                           (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* If there's a result row, then they're disqualified... */
-    if((row = sylverant_db_result_fetch(result)) && row[0]) {
+    return 0;
+}
+
+/* Record the kills from a monster kill update for one event. Returns 0 on
+   success, or -1 on an error. */
+static int mkill_record(shipgate_mkill_pkt *pkt, monster_event_t *ev,
+                        uint32_t gc, uint32_t acc) {
+    uint32_t ct;
+    int i;
+
+    /* Make sure they're not disqualified from the event... */
+    if(events_disqualified(ev->event_id, acc, NULL)) {
         debug(DBG_LOG, "Rejecting monster kill update for disqualified player "
-              "%" PRIu32 " (gc %" PRIu32 ")\n", acc, gc);
-        sylverant_db_result_free(result);
+              "%" PRIu32 " (gc %" PRIu32 ", event %" PRIu32 ")\n", acc, gc,
+              ev->event_id);
         return 0;
     }
 
-    /* We don't actually care about the content of the row... If we get this
-       far, then we should be good to go... */
-    sylverant_db_result_free(result);
-
     /* Are we recording all monsters, or just a few? */
     if(ev->monster_count) {
         for(i = 0; i < ev->monster_count; ++i) {
@@ -3363,20 +3382,11 @@ static int handle_mkill(ship_t *c, shipgate_mkill_pkt *pkt) {
             if(!ct || pkt->episode != ev->monsters[i].episode)
                 continue;
 
-            sprintf(query, "INSERT INTO monster_kills (event_id, account_id, "
-                    " guildcard, episode, difficulty, enemy, count) VALUES('%"
-                    PRIu32 "', '%" PRIu32 "', '%" PRIu32 "', '%u', '%u', '%d', "
-                    "'%" PRIu32"') ON DUPLICATE KEY UPDATE "
-                    "count=count+VALUES(count)", ev->event_id, acc, gc,
-                    (unsigned int)pkt->episode, (unsigned int)pkt->difficulty,
-                    ev->monsters[i].monster, ct);
-
-            /* Execute the query */
-            if(sylverant_db_query(&conn, query)) {
-                debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-                return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE,
-                                  ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 8);
-            }
+            if(kills_add(ev->event_id, acc, gc, pkt->episode,
+                         pkt->difficulty, ev->monsters[i].monster, ct))
+                return -1;
+
+            leaders_add(ev->event_id, acc, gc, ev->monsters[i].monster, ct);
         }
 
         return 0;
@@ -3389,20 +3399,55 @@ static int handle_mkill(ship_t *c, shipgate_mkill_pkt *pkt) {
         if(!ct)
             continue;
 
-        sprintf(query, "INSERT INTO monster_kills (event_id, account_id, "
-                " guildcard, episode, difficulty, enemy, count) VALUES('%"
-                PRIu32 "', '%" PRIu32 "', '%" PRIu32 "', '%u', '%u', '%d', "
-                "'%" PRIu32"') ON DUPLICATE KEY UPDATE "
-                "count=count+VALUES(count)", ev->event_id, acc, gc,
-                (unsigned int)pkt->episode, (unsigned int)pkt->difficulty,
-                i, ct);
+        if(kills_add(ev->event_id, acc, gc, pkt->episode, pkt->difficulty,
+                     i, ct))
+            return -1;
 
-        /* Execute the query */
-        if(sylverant_db_query(&conn, query)) {
-            debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        leaders_add(ev->event_id, acc, gc, i, ct);
+    }
+
+    return 0;
+}
+
+static int handle_mkill(ship_t *c, shipgate_mkill_pkt *pkt) {
+    uint32_t gc, acc, count, i;
+    monster_event_t **evs;
+
+    /* Ignore any packets that aren't version 1 or later. They're useless. */
+    if(pkt->hdr.version < 1)
+        return 0;
+
+    /* See if there are any events currently running that this counts for,
+       otherwise we can safely drop any monster kill packets we get. */
+    if(!(count = events_find(pkt->difficulty, pkt->version, &evs)))
+        return 0;
+
+    /* Parse out the guildcard */
+    gc = ntohl(pkt->guildcard);
+
+    /* Find the user's account id */
+    switch(acct_lookup(gc, &acc, NULL)) {
+        case ACCT_OK:
+            break;
+
+        case ACCT_UNREGISTERED:
+            /* If they don't have an account, then bail. No need to report an
+               error for this. */
+            return 0;
+
+        default:
+            debug(DBG_WARN, "Couldn't fetch account data (%" PRIu32 ")\n", gc);
+            return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE, ERR_BAD_ERROR,
+                              (uint8_t *)&pkt->guildcard, 8);
+    }
+
+    kills_packet();
+
+    /* The kills count for every event going on that they qualify for. */
+    for(i = 0; i < count; ++i) {
+        if(mkill_record(pkt, evs[i], gc, acc))
             return send_error(c, SHDR_TYPE_MKILL, SHDR_FAILURE, ERR_BAD_ERROR,
                               (uint8_t *)&pkt->guildcard, 8);
-        }
     }
 
     return 0;
@@ -3411,25 +3456,10 @@ static int handle_mkill(ship_t *c, shipgate_mkill_pkt *pkt) {
 /* Handle a token-based user login request. */
 static int handle_tlogin(ship_t *c, shipgate_usrlogin_req_pkt *pkt) {
     uint32_t gc, block;
-    char query[256];
-    void *result;
-    char **row;
-    char esc[65], esc2[65];
     uint16_t len;
     uint32_t priv;
     uint32_t account_id;
-
-    /* Clear old requests from the table. */
-    sprintf(query, "DELETE FROM login_tokens WHERE req_time + INTERVAL 10 "
-            "MINUTE < NOW()");
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't clear old tokens!\n");
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 8);
-    }
+    int rv;
 
     /* Check the sanity of the packet. Disconnect the ship if there's some odd
        issue with the packet's sanity. */
@@ -3444,39 +3474,18 @@ static int handle_tlogin(ship_t *c, shipgate_usrlogin_req_pkt *pkt) {
         return -1;
     }
 
-    /* Escape the username and grab the data we need. */
-    sylverant_db_escape_str(&conn, esc, pkt->username, strlen(pkt->username));
-    sylverant_db_escape_str(&conn, esc2, pkt->password, strlen(pkt->password));
     gc = ntohl(pkt->guildcard);
     block = ntohl(pkt->block);
 
-    /* Build the query asking for the data. */
-    sprintf(query, "SELECT privlevel, account_id FROM account_data NATURAL "
-            "JOIN guildcards NATURAL JOIN login_tokens WHERE guildcard='%u' "
-            "AND username='%s' AND token='%s'",
-            gc, esc, esc2);
-
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't lookup account data (user: %s, gc: %u)\n",
-              pkt->username, gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-
-        return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE, ERR_BAD_ERROR,
-                          (uint8_t *)&pkt->guildcard, 8);
-    }
-
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch account data (user: %s, gc: %u)\n",
-              pkt->username, gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    /* Expired tokens are cleared out in the background, so this is just a
+       lookup (and usually doesn't even need the database). */
+    rv = token_check(gc, pkt->username, pkt->password, &account_id, &priv);
 
+    if(rv == TOKEN_ERROR) {
         return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE, ERR_BAD_ERROR,
                           (uint8_t *)&pkt->guildcard, 8);
     }
-
-    if((row = sylverant_db_result_fetch(result)) == NULL) {
-        sylverant_db_result_free(result);
+    else if(rv != TOKEN_OK) {
         debug(DBG_LOG, "Failed token login (user: %s, gc: %u)\n",
               pkt->username, gc);
 
@@ -3484,43 +3493,28 @@ static int handle_tlogin(ship_t *c, shipgate_usrlogin_req_pkt *pkt) {
                           ERR_USRLOGIN_BAD_CRED, (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* Grab the privilege level out of the packet */
-    errno = 0;
-    priv = (uint32_t)strtoul(row[0], NULL, 0);
-
-    if(errno != 0) {
-        return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE,
-                          ERR_USRLOGIN_BAD_PRIVS, (uint8_t *)&pkt->guildcard,
-                          8);
-    }
-
-    account_id = (uint32_t)strtoul(row[1], NULL, 0);
-
     /* Filter out any privileges that don't make sense. Can't have global GM
        without local GM support. Also, anyone set as a root this way must have
        BOTH root bits set, not just one! */
     if(((priv & CLIENT_PRIV_GLOBAL_GM) && !(priv & CLIENT_PRIV_LOCAL_GM)) ||
        ((priv & CLIENT_PRIV_GLOBAL_ROOT) && !(priv & CLIENT_PRIV_LOCAL_ROOT)) ||
        ((priv & CLIENT_PRIV_LOCAL_ROOT) && !(priv & CLIENT_PRIV_GLOBAL_ROOT))) {
-        debug(DBG_WARN, "Invalid privileges for user %u: %02x\n", pkt->username,
-              priv);
-        sylverant_db_result_free(result);
+        debug(DBG_WARN, "Invalid privileges for user %s: %02x\n",
+              pkt->username, priv);
 
         return send_error(c, SHDR_TYPE_USRLOGIN, SHDR_FAILURE, ERR_BAD_ERROR,
                           (uint8_t *)&pkt->guildcard, 8);
     }
 
-    /* We're done if we got this far. */
-    sylverant_db_result_free(result);
+    /* Remember their privileges, so we don't have to look them up again if
+       they decide to do something that needs them. */
+    acct_cache_set(gc, account_id, priv);
 
-    /* Delete the request. */
-    sprintf(query, "DELETE FROM login_tokens WHERE account_id='%u'",
-            account_id);
+    /* The ship will probably ask for their character data soon. */
+    cdata_prefetch(gc);
 
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Couldn't clear spent token!\n");
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-    }
+    /* Delete the request. */
+    token_spent(account_id);
 
     /* The privilege field went to 32-bits in version 18. */
     if(c->proto_ver < 18) {
@@ -3578,63 +3572,74 @@ static int handle_sdata(ship_t *s, shipgate_sdata_pkt *pkt) {
                           pkt->data, SCRIPT_ARG_END);
 }
 
-static int handle_qflag_set(ship_t *c, shipgate_qflag_pkt *pkt) {
-    char query[1024];
-    uint32_t gc, block, flag_id, value, qid, ctl;
-
-    /* Parse out the packet data */
-    gc = ntohl(pkt->guildcard);
-    block = ntohl(pkt->block);
-    flag_id = ntohl(pkt->flag_id);
-    ctl = flag_id & 0xFFFF0000;
-    flag_id = (flag_id & 0x0000FFFF) | (ntohs(pkt->flag_id_hi) << 16);
-    qid = ntohl(pkt->quest_id);
-    value = ntohl(pkt->value);
+/* A quest flag change that's waiting to be journaled before it's answered. */
+typedef struct qflag_job {
+    uint32_t conn_id;
+    uint32_t gc;
+    uint32_t block;
+    uint32_t flag_id;
+    uint32_t qid;
+    uint32_t value;
+    uint32_t ctl;
+    uint8_t resp[16];
+} qflag_job_t;
+
+/* Respond to a quest flag change once it's safely in the journal. */
+static void qflag_saved(void *d, int err) {
+    qflag_job_t *job = (qflag_job_t *)d;
+    ship_t *c = find_ship_by_conn_id(job->conn_id);
+    int rv;
+
+    if(c) {
+        if(err)
+            rv = send_error(c, SHDR_TYPE_QFLAG_SET, SHDR_FAILURE,
+                            ERR_BAD_ERROR, job->resp, 16);
+        else
+            rv = send_qflag(c, SHDR_TYPE_QFLAG_SET, job->gc, job->block,
+                            job->flag_id, job->qid, job->value, job->ctl);
 
-    /* Build the db query */
-    if(!(ctl & QFLAG_DELETE_FLAG)) {
-        if(!(ctl & QFLAG_LONG_FLAG)) {
-            sprintf(query, "INSERT INTO quest_flags_short (guildcard, flag_id, "
-                    " value) VALUES('%" PRIu32 "', '%" PRIu32 "', '%" PRIu32
-                    "') ON DUPLICATE KEY UPDATE value=VALUES(value)", gc,
-                    flag_id, value & 0xFFFF);
-        }
-        else {
-            sprintf(query, "INSERT INTO quest_flags_long (guildcard, flag_id, "
-                    " value) VALUES('%" PRIu32 "', '%" PRIu32 "', '%" PRIu32
-                    "') ON DUPLICATE KEY UPDATE value=VALUES(value)", gc,
-                    flag_id, value);
-        }
+        if(rv)
+            c->disconnected = 1;
     }
-    else {
-        if(!(ctl & QFLAG_LONG_FLAG)) {
-            sprintf(query, "DELETE FROM quest_flags_short WHERE guildcard='%"
-                    PRIu32 "' AND flag_id='%" PRIu32 "'", gc,
-                    flag_id);
-        }
-        else {
-            sprintf(query, "DELETE FROM quest_flags_long WHERE guildcard='%"
-                    PRIu32 "' AND flag_id='%" PRIu32 "'", gc,
-                    flag_id);
-        }
+
+    free(job);
+}
+
+static int handle_qflag_set(ship_t *c, shipgate_qflag_pkt *pkt) {
+    qflag_job_t *job;
+    uint32_t flag_id;
+
+    if(!(job = (qflag_job_t *)malloc(sizeof(qflag_job_t)))) {
+        debug(DBG_WARN, "Couldn't allocate quest flag job\n");
+        return send_error(c, SHDR_TYPE_QFLAG_SET, SHDR_FAILURE,
+                          ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 16);
     }
 
-    /* Execute the query */
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    /* Parse out the packet data */
+    job->conn_id = c->conn_id;
+    job->gc = ntohl(pkt->guildcard);
+    job->block = ntohl(pkt->block);
+    flag_id = ntohl(pkt->flag_id);
+    job->ctl = flag_id & 0xFFFF0000;
+    job->flag_id = (flag_id & 0x0000FFFF) | (ntohs(pkt->flag_id_hi) << 16);
+    job->qid = ntohl(pkt->quest_id);
+    job->value = ntohl(pkt->value);
+    memcpy(job->resp, &pkt->guildcard, 16);
+
+    /* The response is sent once the change is in the journal. */
+    if(qflags_set(job->gc, job->flag_id, job->ctl & QFLAG_LONG_FLAG,
+                  job->ctl & QFLAG_DELETE_FLAG, job->value, &qflag_saved,
+                  job)) {
+        free(job);
         return send_error(c, SHDR_TYPE_QFLAG_SET, SHDR_FAILURE,
                           ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 16);
     }
 
-    return send_qflag(c, SHDR_TYPE_QFLAG_SET, gc, block, flag_id, qid,
-                      value, ctl);
+    return 0;
 }
 
 static int handle_qflag_get(ship_t *c, shipgate_qflag_pkt *pkt) {
-    char query[1024];
     uint32_t gc, block, flag_id, value, qid, ctl;
-    void *result;
-    char **row;
 
     /* Parse out the packet data */
     gc = ntohl(pkt->guildcard);
@@ -3652,42 +3657,153 @@ static int handle_qflag_get(ship_t *c, shipgate_qflag_pkt *pkt) {
                           ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 16);
     }
 
-    /* Build the db query */
-    if(!(ctl & QFLAG_LONG_FLAG)) {
-        sprintf(query, "SELECT value FROM quest_flags_short WHERE guildcard='%"
-                PRIu32 "' AND flag_id='%" PRIu32 "'", gc, flag_id);
+    switch(qflags_get(gc, flag_id, ctl & QFLAG_LONG_FLAG, &value)) {
+        case QFLAGS_OK:
+            break;
+
+        case QFLAGS_NO_DATA:
+            return send_error(c, SHDR_TYPE_QFLAG_GET, SHDR_FAILURE,
+                              ERR_QFLAG_NO_DATA, (uint8_t *)&pkt->guildcard,
+                              16);
+
+        default:
+            return send_error(c, SHDR_TYPE_QFLAG_GET, SHDR_FAILURE,
+                              ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 16);
     }
-    else {
-        sprintf(query, "SELECT value FROM quest_flags_long WHERE guildcard='%"
-                PRIu32 "' AND flag_id='%" PRIu32 "'", gc, flag_id);
+
+    return send_qflag(c, SHDR_TYPE_QFLAG_GET, gc, block, flag_id, qid,
+                      value, ctl);
+}
+
+/* A bulk quest flag change that's waiting to be journaled before it's
+   answered. The entries are kept in network byte order, ready to send back. */
+typedef struct qflags_job {
+    uint32_t conn_id;
+    uint32_t gc;
+    uint32_t block;
+    uint32_t qid;
+    uint32_t flags;
+    uint32_t count;
+    shipgate_qflag_ent_t entries[];
+} qflags_job_t;
+
+/* Respond to a bulk quest flag change once all of it is in the journal. */
+static void qflags_bulk_saved(void *d, int err) {
+    qflags_job_t *job = (qflags_job_t *)d;
+    ship_t *c = find_ship_by_conn_id(job->conn_id);
+    uint32_t i;
+
+    if(c) {
+        if(err) {
+            for(i = 0; i < job->count; ++i) {
+                if(!job->entries[i].error)
+                    job->entries[i].error = htonl(ERR_BAD_ERROR);
+            }
+        }
+
+        if(send_qflags(c, job->gc, job->block, job->qid, job->flags,
+                       job->entries, job->count))
+            c->disconnected = 1;
     }
 
-    /* Execute the query */
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        return send_error(c, SHDR_TYPE_QFLAG_GET, SHDR_FAILURE,
-                          ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 16);
+    free(job);
+}
+
+static int handle_qflags(ship_t *c, shipgate_qflags_pkt *pkt) {
+    uint16_t len = ntohs(pkt->hdr.pkt_len);
+    uint32_t count = ntohl(pkt->count), i, flag_id, ctl, value;
+    shipgate_qflag_ent_t *ents;
+    qflags_job_t *job;
+    size_t sz;
+    int rv;
+
+    /* Older ships don't have this packet, so treat it like any other packet
+       that doesn't exist in their version. */
+    if(c->proto_ver < QFLAGS_BULK_PROTO_VER) {
+        debug(DBG_WARN, "%s sent invalid packet: %hu\n", c->name,
+              (uint16_t)SHDR_TYPE_QFLAGS);
+        return -3;
     }
 
-    if(!(result = sylverant_db_result_store(&conn))) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        return send_error(c, SHDR_TYPE_QFLAG_GET, SHDR_FAILURE,
-                          ERR_BAD_ERROR, (uint8_t *)&pkt->guildcard, 16);
+    /* Make sure the packet is sane... */
+    if(len < sizeof(shipgate_qflags_pkt) || count > QFLAGS_BULK_MAX ||
+       len < sizeof(shipgate_qflags_pkt) +
+       count * sizeof(shipgate_qflag_ent_t)) {
+        debug(DBG_WARN, "Ship sent invalid bulk quest flag packet!\n");
+        return send_error(c, SHDR_TYPE_QFLAGS, SHDR_FAILURE, ERR_BAD_ERROR,
+                          (uint8_t *)&pkt->guildcard, 16);
     }
 
-    if(!(row = sylverant_db_result_fetch(result))) {
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        sylverant_db_result_free(result);
-        return send_error(c, SHDR_TYPE_QFLAG_GET, SHDR_FAILURE,
-                          ERR_QFLAG_NO_DATA, (uint8_t *)&pkt->guildcard,
-                          16);
+    sz = sizeof(qflags_job_t) + count * sizeof(shipgate_qflag_ent_t);
+
+    if(!(job = (qflags_job_t *)malloc(sz))) {
+        debug(DBG_WARN, "Couldn't allocate quest flag job\n");
+        return send_error(c, SHDR_TYPE_QFLAGS, SHDR_FAILURE, ERR_BAD_ERROR,
+                          (uint8_t *)&pkt->guildcard, 16);
     }
 
-    value = (uint32_t)strtoul(row[0], NULL, 0);
-    sylverant_db_result_free(result);
+    /* Parse out the packet data */
+    job->conn_id = c->conn_id;
+    job->gc = ntohl(pkt->guildcard);
+    job->block = ntohl(pkt->block);
+    job->qid = ntohl(pkt->quest_id);
+    job->flags = ntohl(pkt->flags);
+    job->count = count;
+    ents = job->entries;
+    memcpy(ents, pkt->entries, count * sizeof(shipgate_qflag_ent_t));
 
-    return send_qflag(c, SHDR_TYPE_QFLAG_GET, gc, block, flag_id, qid,
-                      value, ctl);
+    for(i = 0; i < count; ++i) {
+        flag_id = ntohl(ents[i].flag_id);
+        ctl = ntohl(ents[i].ctl);
+        ents[i].error = 0;
+
+        if(job->flags & QFLAGS_BULK_SET) {
+            value = ntohl(ents[i].value);
+
+            if(qflags_set(job->gc, flag_id, ctl & QFLAG_LONG_FLAG,
+                          ctl & QFLAG_DELETE_FLAG, value, NULL, NULL))
+                ents[i].error = htonl(ERR_BAD_ERROR);
+
+            continue;
+        }
+
+        ents[i].value = 0;
+
+        if((ctl & QFLAG_DELETE_FLAG)) {
+            ents[i].error = htonl(ERR_QFLAG_INVALID_FLAG);
+            continue;
+        }
+
+        switch(qflags_get(job->gc, flag_id, ctl & QFLAG_LONG_FLAG, &value)) {
+            case QFLAGS_OK:
+                ents[i].value = htonl(value);
+                break;
+
+            case QFLAGS_NO_DATA:
+                ents[i].error = htonl(ERR_QFLAG_NO_DATA);
+                break;
+
+            default:
+                ents[i].error = htonl(ERR_BAD_ERROR);
+        }
+    }
+
+    /* Reads are answered right away. Changes are answered all together once
+       they're in the journal, so there's only one sync for the whole lot. */
+    if((job->flags & QFLAGS_BULK_SET)) {
+        if(!qflags_wait(&qflags_bulk_saved, job))
+            return 0;
+
+        for(i = 0; i < count; ++i) {
+            ents[i].error = htonl(ERR_BAD_ERROR);
+        }
+    }
+
+    rv = send_qflags(c, job->gc, job->block, job->qid, job->flags, ents,
+                     count);
+    free(job);
+
+    return rv;
 }
 
 static int handle_sctl_uname(ship_t *c, shipgate_sctl_uname_reply_pkt *pkt,
@@ -3912,8 +4028,6 @@ static int handle_ubl_add(ship_t *c, shipgate_ubl_add_pkt *pkt) {
     char query[1024];
     char tmp[33], name[67];
     uint32_t gc, block, blocked, flags, acc;
-    void *result;
-    char **row;
 
     /* Parse out the packet data */
     gc = ntohl(pkt->requester);
@@ -3922,43 +4036,21 @@ static int handle_ubl_add(ship_t *c, shipgate_ubl_add_pkt *pkt) {
     flags = ntohl(pkt->flags);
 
     /* See if the user has an account or not. */
-    sprintf(query, "SELECT account_id FROM guildcards WHERE guildcard='%"
-            PRIu32 "'", gc);
-
-    /* Query for any results */
-    if(sylverant_db_query(&conn, query)) {
-        debug(DBG_WARN, "Cannot query for account data for gc %" PRIu32
-              ": %s\n", gc, sylverant_db_error(&conn));
-        return send_user_error(c, SHDR_TYPE_UBL_ADD, ERR_BAD_ERROR, gc, block,
-                               NULL);
-    }
-
-    /* Grab the data we got. */
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Couldn't fetch account data (%" PRIu32 ")\n", gc);
-        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
-        return send_user_error(c, SHDR_TYPE_UBL_ADD, ERR_BAD_ERROR, gc, block,
-                               NULL);
-    }
+    switch(acct_lookup(gc, &acc, NULL)) {
+        case ACCT_OK:
+            /* We've verified they've got an account, continue on. */
+            break;
 
-    if((row = sylverant_db_result_fetch(result)) == NULL) {
-        debug(DBG_WARN, "No result rows for guild card %" PRIu32 "\n", gc);
-        sylverant_db_result_free(result);
-        return send_user_error(c, SHDR_TYPE_UBL_ADD, ERR_BAD_ERROR, gc, block,
-                               NULL);
-    }
+        case ACCT_UNREGISTERED:
+            return send_user_error(c, SHDR_TYPE_UBL_ADD, ERR_REQ_LOGIN, gc,
+                                   block, NULL);
 
-    /* If their account id in the table is NULL, then bail... */
-    if(!row[0]) {
-        sylverant_db_result_free(result);
-        return send_user_error(c, SHDR_TYPE_UBL_ADD, ERR_REQ_LOGIN, gc, block,
-                               NULL);
+        default:
+            debug(DBG_WARN, "Couldn't fetch account data (%" PRIu32 ")\n", gc);
+            return send_user_error(c, SHDR_TYPE_UBL_ADD, ERR_BAD_ERROR, gc,
+                                   block, NULL);
     }
 
-    /* We've verified they've got an account, continue on. */
-    acc = atoi(row[0]);
-    sylverant_db_result_free(result);
-
     memcpy(tmp, pkt->blocked_name, 32);
     tmp[32] = 0;
     sylverant_db_escape_str(&conn, name, tmp, strlen(tmp));
@@ -4100,6 +4192,9 @@ int process_ship_pkt(ship_t *c, shipgate_hdr_t *pkt) {
         case SHDR_TYPE_QFLAG_GET:
             return handle_qflag_get(c, (shipgate_qflag_pkt *)pkt);
 
+        case SHDR_TYPE_QFLAGS:
+            return handle_qflags(c, (shipgate_qflags_pkt *)pkt);
+
         case SHDR_TYPE_SHIP_CTL:
             return handle_shipctl_reply(c, (shipgate_shipctl_pkt *)pkt,
                                         ntohs(pkt->pkt_len), flags);
@@ -4107,6 +4202,9 @@ int process_ship_pkt(ship_t *c, shipgate_hdr_t *pkt) {
         case SHDR_TYPE_UBL_ADD:
             return handle_ubl_add(c, (shipgate_ubl_add_pkt *)pkt);
 
+        case SHDR_TYPE_STREAM:
+            return stream_handle(c, (shipgate_stream_pkt *)pkt);
+
         default:
             debug(DBG_WARN, "%s sent invalid packet: %hu\n", c->name, type);
             return -3;
@@ -4163,9 +4261,9 @@ int handle_pkt(ship_t *c) {
                 /* Yep, copy it and process it */
                 memcpy(rbp, &c->pkt, 8);
 
-                /* Pass it onto the correct handler. */
+                /* Queue it up to be handled when its turn comes. */
                 c->last_message = time(NULL);
-                rv = process_ship_pkt(c, (shipgate_hdr_t *)rbp);
+                rv = sched_submit(c, (shipgate_hdr_t *)rbp);
 
                 rbp += pkt_sz;
                 sz -= pkt_sz;
@@ -4243,9 +4341,42 @@ static int ship_writeLog_lua(lua_State *l) {
     return 0;
 }
 
+static int ship_eventLeaders_lua(lua_State *l) {
+    const leader_t *list;
+    uint32_t event;
+    int enemy = LEADERS_OVERALL, count, i;
+
+    if(!lua_isinteger(l, 1)) {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    event = (uint32_t)lua_tointeger(l, 1);
+
+    if(lua_isinteger(l, 2))
+        enemy = (int)lua_tointeger(l, 2);
+
+    count = leaders_top(event, enemy, &list);
+    lua_createtable(l, count, 0);
+
+    for(i = 0; i < count; ++i) {
+        lua_createtable(l, 0, 3);
+        lua_pushinteger(l, (lua_Integer)list[i].gc);
+        lua_setfield(l, -2, "guildcard");
+        lua_pushinteger(l, (lua_Integer)list[i].acc);
+        lua_setfield(l, -2, "account");
+        lua_pushinteger(l, (lua_Integer)list[i].kills);
+        lua_setfield(l, -2, "kills");
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
 static const luaL_Reg shiplib[] = {
     { "sendScriptData", ship_sendsdata_lua },
     { "writeLog", ship_writeLog_lua },
+    { "eventLeaders", ship_eventLeaders_lua },
     { NULL, NULL }
 };
 
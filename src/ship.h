@@ -51,6 +51,19 @@ typedef struct friendlist_data {
     char name[32];
 } PACKED friendlist_data_t;
 
+/* This is used for storing friend login/logout messages to be sent to a ship
+   in one batch. */
+typedef struct friend_status {
+    uint32_t dest_guildcard;
+    uint32_t dest_block;
+    uint32_t friend_guildcard;
+    uint32_t friend_ship;
+    uint32_t friend_block;
+    uint32_t on;
+    char friend_name[32];
+    char friend_nick[32];
+} PACKED friend_status_t;
+
 typedef struct event_monster {
     uint16_t monster;
     uint8_t episode;
@@ -71,11 +84,15 @@ typedef struct monster_event {
 
 #undef PACKED
 
+struct stream_state;
+struct sched_ship;
+
 typedef struct ship {
     TAILQ_ENTRY(ship) qentry;
 
     int sock;
     int disconnected;
+    uint32_t conn_id;
     uint32_t flags;
     uint32_t menu;
 
@@ -112,6 +129,14 @@ typedef struct ship {
 
     gnutls_session_t session;
 
+    friend_status_t *frstatus;
+    int frstatus_count;
+    int frstatus_size;
+
+    struct stream_state *streams;
+    struct sched_ship *sched;
+    int sched_bytes;
+
     char name[13];
 } ship_t;
 
@@ -124,9 +149,17 @@ ship_t *create_connection_tls(int sock, struct sockaddr *addr, socklen_t size);
 /* Destroy a connection, closing the socket and removing it from the list. */
 void destroy_connection(ship_t *c);
 
+/* Find a connected ship by its connection id. This is for work that finishes
+   after the packet that started it was handled, since the ship might have
+   disconnected in the meantime. */
+ship_t *find_ship_by_conn_id(uint32_t id);
+
 /* Handle incoming data to the shipgate. */
 int handle_pkt(ship_t *s);
 
+/* Process one ship packet. */
+int process_ship_pkt(ship_t *c, shipgate_hdr_t *pkt);
+
 /* IDs for the ship_metadata table */
 #define SHIP_METADATA_VER_VERSION       1
 #define SHIP_METADATA_VER_FLAGS         2
@@ -53,6 +53,26 @@ int pidfile_remove(struct pidfh *pfh);
 #include "ship.h"
 #include "scripts.h"
 #include "packets.h"
+#include "timer.h"
+#include "mail.h"
+#include "accounts.h"
+#include "codec.h"
+#include "workq.h"
+#include "workdb.h"
+#include "savebuf.h"
+#include "charcache.h"
+#include "blobstore.h"
+#include "history.h"
+#include "stream.h"
+#include "bkcache.h"
+#include "sched.h"
+#include "auth.h"
+#include "tokens.h"
+#include "events.h"
+#include "kills.h"
+#include "leaders.h"
+#include "qflags.h"
+#include "bbstate.h"
 
 #ifndef PID_DIR
 #define PID_DIR "/var/run"
@@ -82,10 +102,7 @@ static gnutls_dh_params_t dh_params;
 
 static volatile sig_atomic_t shutting_down = 0;
 static volatile sig_atomic_t resend_scripts = 0;
-
-/* Events... */
-uint32_t event_count;
-monster_event_t *events;
+static volatile sig_atomic_t reload_caches = 0;
 
 static const char *config_file = NULL;
 static const char *custom_dir = NULL;
@@ -93,6 +110,16 @@ static int dont_daemonize = 0;
 static const char *pidfile_name = NULL;
 static struct pidfh *pf = NULL;
 static const char *runas_user = RUNAS_DEFAULT;
+static int worker_threads = WORKQ_THREADS;
+static const char *journal_file = SAVEBUF_JOURNAL_DEFAULT;
+static const char *qflag_journal = QFLAGS_JOURNAL_DEFAULT;
+static const char *bb_journal = BBSTATE_JOURNAL_DEFAULT;
+static size_t cache_size = CCACHE_SIZE_DEFAULT;
+static const char *blob_dir = NULL;
+static int history_keep = HISTORY_KEEP_DEFAULT;
+static int auth_threads = AUTH_THREADS;
+static const char *auth_hash = NULL;
+int cdata_prefetch_enabled = 1;
 
 extern ship_script_t *scripts;
 extern uint32_t script_count;
@@ -128,15 +155,55 @@ static void print_help(const char *bin) {
            "-P filename     Use the specified name for the pid file to write\n"
            "                instead of the default.\n"
            "-U username     Run as the specified user instead of '%s'\n"
+           "--cdata-codec c Compress newly saved character data with the\n"
+           "                specified codec (none, zlib, zstd, zstd+dict).\n"
+           "                The default is zlib.\n"
+           "--cdata-dict fn Load a zstd dictionary from the specified file.\n"
+           "                May be given more than once, the first dictionary\n"
+           "                is used for compressing new data.\n"
+           "--workers n     Use n threads for compressing and decompressing\n"
+           "                character data (default: %d). With 0, it is all\n"
+           "                done on the main thread.\n"
+           "--cdata-journal path\n"
+           "                Use the specified path for the character save\n"
+           "                journal (default: %s).\n"
+           "--qflag-journal path\n"
+           "                Use the specified path for the quest flag journal\n"
+           "                (default: %s).\n"
+           "--bb-journal path\n"
+           "                Use the specified path for the Blue Burst options\n"
+           "                and guildcard journal (default: %s).\n"
+           "--cdata-cache bytes\n"
+           "                Use up to the specified amount of memory for\n"
+           "                caching recently used characters (default: %d).\n"
+           "                With 0, the cache is disabled.\n"
+           "--no-cdata-prefetch\n"
+           "                Don't load characters into the cache when players\n"
+           "                log in.\n"
+           "--blob-dir path Store character data in a blob store in the\n"
+           "                specified directory instead of in the database.\n"
+           "--cdata-history n\n"
+           "                Keep n old versions of each character and backup\n"
+           "                (default: %d). With 0, no history is kept.\n"
+           "--auth-workers n\n"
+           "                Use n threads for checking passwords (default: %d).\n"
+           "                With 0, it is done on the main thread.\n"
+           "--auth-hash s   Rehash passwords with the specified crypt(3)\n"
+           "                setting (like $2b$ or $6$) when users log in.\n"
+           "                Only use this if everything else that checks\n"
+           "                passwords understands the new hashes.\n"
            "--help          Print this help and exit\n\n"
            "Note that if more than one verbosity level is specified, the last\n"
            "one specified will be used. The default is --verbose.\n", bin,
-           RUNAS_DEFAULT);
+           RUNAS_DEFAULT, WORKQ_THREADS, SAVEBUF_JOURNAL_DEFAULT,
+           QFLAGS_JOURNAL_DEFAULT, BBSTATE_JOURNAL_DEFAULT, CCACHE_SIZE_DEFAULT,
+           HISTORY_KEEP_DEFAULT, AUTH_THREADS);
 }
 
 /* Parse any command-line arguments passed in. */
 static void parse_command_line(int argc, char *argv[]) {
     int i;
+    const char *codec = NULL;
 
     for(i = 1; i < argc; ++i) {
         if(!strcmp(argv[i], "--version")) {
@@ -193,6 +260,109 @@ static void parse_command_line(int argc, char *argv[]) {
 
             runas_user = argv[++i];
         }
+        else if(!strcmp(argv[i], "--cdata-codec")) {
+            if(i == argc - 1) {
+                printf("--cdata-codec requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            codec = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--cdata-dict")) {
+            if(i == argc - 1) {
+                printf("--cdata-dict requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            if(codec_load_dict(argv[++i]))
+                exit(EXIT_FAILURE);
+        }
+        else if(!strcmp(argv[i], "--workers")) {
+            if(i == argc - 1) {
+                printf("--workers requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            worker_threads = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--cdata-journal")) {
+            if(i == argc - 1) {
+                printf("--cdata-journal requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            journal_file = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--qflag-journal")) {
+            if(i == argc - 1) {
+                printf("--qflag-journal requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            qflag_journal = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--bb-journal")) {
+            if(i == argc - 1) {
+                printf("--bb-journal requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            bb_journal = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--cdata-cache")) {
+            if(i == argc - 1) {
+                printf("--cdata-cache requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            cache_size = (size_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "--no-cdata-prefetch")) {
+            cdata_prefetch_enabled = 0;
+        }
+        else if(!strcmp(argv[i], "--blob-dir")) {
+            if(i == argc - 1) {
+                printf("--blob-dir requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            blob_dir = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--cdata-history")) {
+            if(i == argc - 1) {
+                printf("--cdata-history requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            history_keep = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--auth-workers")) {
+            if(i == argc - 1) {
+                printf("--auth-workers requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            auth_threads = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--auth-hash")) {
+            if(i == argc - 1) {
+                printf("--auth-hash requires an argument!\n\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            auth_hash = argv[++i];
+        }
         else if(!strcmp(argv[i], "--help")) {
             print_help(argv[0]);
             exit(EXIT_SUCCESS);
@@ -203,6 +373,12 @@ static void parse_command_line(int argc, char *argv[]) {
             exit(EXIT_FAILURE);
         }
     }
+
+    /* Set the codec last, since it may depend on the dictionaries. */
+    if(codec && codec_set_default(codec_by_name(codec))) {
+        printf("Unsupported character data codec: %s\n", codec);
+        exit(EXIT_FAILURE);
+    }
 }
 
 /* Load the configuration file and print out parameters with DBG_LOG. */
@@ -245,204 +421,84 @@ static void cleanup_gnutls() {
     gnutls_global_deinit();
 }
 
-static void free_events() {
-    uint32_t i;
+static void open_db() {
+    debug(DBG_LOG, "Connecting to the database...\n");
 
-    for(i = 0; i < event_count; ++i) {
-        free(events[i].monsters);
+    if(sylverant_db_open(&cfg->dbcfg, &conn)) {
+        debug(DBG_ERROR, "Can't connect to the database\n");
+        exit(EXIT_FAILURE);
     }
 
-    free(events);
-}
-
-static int read_events_table() {
-    void *result;
-    char **row;
-    long long row_count, i, row_count2, j;
-    char query[256];
-
-    debug(DBG_LOG, "Reading events from the database...\n");
-    if(sylverant_db_query(&conn, "SELECT event_id, title, start_time, "
-                                 "end_time, difficulties, versions, "
-                                 "allow_quests FROM monster_events WHERE "
-                                 "end_time > UNIX_TIMESTAMP() ORDER BY "
-                                 "start_time")) {
-        debug(DBG_WARN, "Couldn't fetch events from database!\n");
-        return -1;
+    debug(DBG_LOG, "Clearing online_ships...\n");
+    if(sylverant_db_query(&conn, "DELETE FROM online_ships")) {
+        debug(DBG_ERROR, "Error clearing online_ships\n");
+        exit(EXIT_FAILURE);
     }
 
-    if((result = sylverant_db_result_store(&conn)) == NULL) {
-        debug(DBG_WARN, "Could not store results of event select!\n");
-        return -1;
+    debug(DBG_LOG, "Clearing online_clients...\n");
+    if(sylverant_db_query(&conn, "DELETE FROM online_clients")) {
+        debug(DBG_ERROR, "Error clearing online_clients\n");
+        exit(EXIT_FAILURE);
     }
 
-    /* Make sure we have something. */
-    row_count = sylverant_db_result_rows(result);
-    if(row_count < 0) {
-        debug(DBG_WARN, "Couldn't fetch event count!\n");
-        sylverant_db_result_free(result);
-        return -1;
-    }
-    else if(!row_count) {
-        debug(DBG_LOG, "No events in database.\n");
-        sylverant_db_result_free(result);
-        return 0;
+    if(sylverant_db_query(&conn, "DELETE FROM transient_clients")) {
+        debug(DBG_ERROR, "Error clearing transient_clients\n");
+        exit(EXIT_FAILURE);
     }
 
-    /* Allocate space for the events... */
-    events = (monster_event_t *)malloc(row_count * sizeof(monster_event_t));
-    if(!events) {
-        debug(DBG_WARN, "Error allocating memory for events!\n");
-        sylverant_db_result_free(result);
-        return -1;
+    if(events_init()) {
+        exit(EXIT_FAILURE);
     }
 
-    memset(events, 0, row_count * sizeof(monster_event_t));
-    event_count = (uint32_t)row_count;
-
-    /* Save each one. */
-    i = 0;
-    while((row = sylverant_db_result_fetch(result))) {
-        /* This shouldn't ever happen... but whatever, doesn't hurt to check. */
-        if(i >= row_count) {
-            debug(DBG_WARN, "Got more result rows than expected?!\n");
-            sylverant_db_result_free(result);
-            free(events);
-            return -1;
-        }
-
-        /* Copy the data over. */
-        events[i].event_id = strtoul(row[0], NULL, 0);
-        events[i].start_time = strtoul(row[2], NULL, 0);
-        events[i].end_time = strtoul(row[3], NULL, 0);
-        events[i].difficulties = (uint8_t)strtoul(row[4], NULL, 0);
-        events[i].versions = (uint8_t)strtoul(row[5], NULL, 0);
-        events[i].allow_quests = (uint8_t)strtoul(row[6], NULL, 0);
-
-        if(!(events[i].event_title = strdup(row[1]))) {
-            debug(DBG_WARN, "Error copying event title!\n");
-            sylverant_db_result_free(result);
-            free(events);
-            return -1;
-        }
-
-        ++i;
+    if(kills_init()) {
+        exit(EXIT_FAILURE);
     }
 
-    sylverant_db_result_free(result);
-
-    if(i < row_count) {
-        debug(DBG_WARN, "Got less result rows than expected?!\n");
-        free(events);
-        return -1;
+    if(leaders_init()) {
+        exit(EXIT_FAILURE);
     }
 
-    /* Run through each event and read the monster lists... */
-    for(i = 0; i < row_count; ++i) {
-        sprintf(query, "SELECT monster_type, episode FROM "
-                       "monster_event_monsters WHERE event_id= '%" PRIu32 "'",
-                events[i].event_id);
-
-        if(sylverant_db_query(&conn, query)) {
-            debug(DBG_WARN, "Couldn't fetch monsters from database!\n");
-            free_events();
-            return -1;
-        }
-
-        if((result = sylverant_db_result_store(&conn)) == NULL) {
-            debug(DBG_WARN, "Could not store results of monster select!");
-            free_events();
-            return -1;
-        }
-
-        /* Make sure we have something. */
-        row_count2 = sylverant_db_result_rows(result);
-        events[i].monster_count = (uint32_t)row_count2;
-
-        debug(DBG_LOG, "Event ID %" PRIu32 " (%s) - %" PRIu32 " enemies.\n",
-              events[i].event_id, events[i].event_title,
-              events[i].monster_count);
-
-        if(row_count2 == 0) {
-            sylverant_db_result_free(result);
-            continue;
-        }
-        /* This shouldn't happen, but check anyway... */
-        else if(row_count2 < 0 || row_count2 > 256) {
-            sylverant_db_result_free(result);
-            debug(DBG_WARN, "Got less than zero monsters in event?!\n");
-            free_events();
-            return -1;
-        }
-
-        /* Allocate space for the monsters... */
-        events[i].monsters =
-            (event_monster_t *)malloc(row_count2 * sizeof(event_monster_t));
-        if(!events[i].monsters) {
-            debug(DBG_WARN, "Error allocating memory for monsters!\n");
-            sylverant_db_result_free(result);
-            free_events();
-            return -1;
-        }
-
-        memset(events[i].monsters, 0, row_count2 * sizeof(event_monster_t));
-
-        j = 0;
-        while((row = sylverant_db_result_fetch(result))) {
-            /* Once again, shouldn't happen, but check anyway... */
-            if(j >= row_count2) {
-                debug(DBG_WARN, "Got more result rows than expected?!\n");
-                sylverant_db_result_free(result);
-                free_events();
-                return -1;
-            }
-
-            events[i].monsters[j].monster = (uint16_t)strtoul(row[0], NULL, 0);
-            events[i].monsters[j].episode = (uint8_t)strtoul(row[1], NULL, 0);
-            ++j;
-        }
+    if(mail_init()) {
+        exit(EXIT_FAILURE);
+    }
 
-        sylverant_db_result_free(result);
+    if(acct_init()) {
+        exit(EXIT_FAILURE);
+    }
 
-        /* Same warning about it shouldn't happen applies here... */
-        if(j < row_count2) {
-            debug(DBG_WARN, "Got less result rows than expected?!\n");
-            free_events();
-            return -1;
-        }
+    if(token_init()) {
+        exit(EXIT_FAILURE);
     }
 
-    debug(DBG_LOG, "Read %" PRIu32 " events successfully.\n", event_count);
+    if(ccache_init(cache_size)) {
+        exit(EXIT_FAILURE);
+    }
 
-    return 0;
-}
+    if(blob_dir && blob_open(blob_dir)) {
+        exit(EXIT_FAILURE);
+    }
 
-static void open_db() {
-    debug(DBG_LOG, "Connecting to the database...\n");
+    if(hist_init(history_keep)) {
+        exit(EXIT_FAILURE);
+    }
 
-    if(sylverant_db_open(&cfg->dbcfg, &conn)) {
-        debug(DBG_ERROR, "Can't connect to the database\n");
+    if(bkcache_init()) {
         exit(EXIT_FAILURE);
     }
 
-    debug(DBG_LOG, "Clearing online_ships...\n");
-    if(sylverant_db_query(&conn, "DELETE FROM online_ships")) {
-        debug(DBG_ERROR, "Error clearing online_ships\n");
+    if(sched_init()) {
         exit(EXIT_FAILURE);
     }
 
-    debug(DBG_LOG, "Clearing online_clients...\n");
-    if(sylverant_db_query(&conn, "DELETE FROM online_clients")) {
-        debug(DBG_ERROR, "Error clearing online_clients\n");
+    if(savebuf_init(journal_file)) {
         exit(EXIT_FAILURE);
     }
 
-    if(sylverant_db_query(&conn, "DELETE FROM transient_clients")) {
-        debug(DBG_ERROR, "Error clearing transient_clients\n");
+    if(qflags_init(qflag_journal)) {
         exit(EXIT_FAILURE);
     }
 
-    if(read_events_table()) {
+    if(bbstate_init(bb_journal)) {
         exit(EXIT_FAILURE);
     }
 }
@@ -454,7 +510,7 @@ void run_server(int tsock, int tsock6) {
 #endif
     struct sockaddr_in addr;
     struct sockaddr_in6 addr6;
-    int asock;
+    int asock, wfd, rv;
     socklen_t len;
     struct timeval timeout;
     fd_set readfds, writefds;
@@ -468,8 +524,6 @@ void run_server(int tsock, int tsock6) {
         FD_ZERO(&readfds);
         FD_ZERO(&writefds);
         nfds = 0;
-        timeout.tv_sec = 30;
-        timeout.tv_usec = 0;
         now = time(NULL);
 
         if(shutting_down) {
@@ -477,6 +531,31 @@ void run_server(int tsock, int tsock6) {
             return;
         }
 
+        /* Throw away anything we've cached from the database if asked. */
+        if(reload_caches) {
+            debug(DBG_LOG, "Reloading cached data\n");
+            reload_caches = 0;
+            acct_cache_reload();
+            ccache_clear();
+            events_reload();
+        }
+
+        /* Run anything that's scheduled to happen now and figure out how long
+           we can wait before the next thing needs to be done. */
+        timers_run(now);
+        timeout.tv_sec = timers_next(now, 30);
+        timeout.tv_usec = 0;
+
+        /* Handle whatever the ships have sent that's waiting its turn. */
+        sched_run();
+
+        /* Get any character saves, quest flag changes, and Blue Burst changes
+           from the last time around safely onto disk, which sends the
+           responses for them. */
+        savebuf_sync();
+        qflags_sync();
+        bbstate_sync();
+
         /* Fill the sockets into the fd_set so we can use select below. */
         i = TAILQ_FIRST(&ships);
         while(i) {
@@ -496,7 +575,20 @@ void run_server(int tsock, int tsock6) {
                 i->last_ping = now;
             }
 
-            FD_SET(i->sock, &readfds);
+            /* Send the next piece of any big message going to the ship. If
+               there's room to send more, don't wait around in select. */
+            if((rv = stream_pump(i)) < 0) {
+                i->disconnected = 1;
+            }
+            else if(rv) {
+                timeout.tv_sec = 0;
+            }
+
+            /* Don't read any more from a ship that's sent more than we've been
+               able to get to yet. */
+            if(!sched_ship_full(i)) {
+                FD_SET(i->sock, &readfds);
+            }
 
             if(i->sendbuf_cur) {
                 FD_SET(i->sock, &writefds);
@@ -505,7 +597,8 @@ void run_server(int tsock, int tsock6) {
             nfds = nfds > i->sock ? nfds : i->sock;
 
             /* Check GnuTLS' buffer for the connection. */
-            if(gnutls_record_check_pending(i->session)) {
+            if(!sched_ship_full(i) &&
+               gnutls_record_check_pending(i->session)) {
                 if(handle_pkt(i)) {
                     i->disconnected = 1;
                 }
@@ -527,6 +620,20 @@ void run_server(int tsock, int tsock6) {
 
         resend_scripts = 0;
 
+        /* If any saves came in from data GnuTLS had buffered, don't make them
+           wait for their responses, and don't wait around if there's still
+           more for the scheduler to do. */
+        if(savebuf_pending() || qflags_pending() || bbstate_pending() ||
+           sched_pending()) {
+            timeout.tv_sec = 0;
+        }
+
+        /* Watch for work finished by the worker threads. */
+        if((wfd = workq_fd()) > -1) {
+            FD_SET(wfd, &readfds);
+            nfds = nfds > wfd ? nfds : wfd;
+        }
+
         /* Add the main listening sockets to the read fd_set */
         if(tsock > -1) {
             FD_SET(tsock, &readfds);
@@ -539,6 +646,12 @@ void run_server(int tsock, int tsock6) {
         }
 
         if(select(nfds + 1, &readfds, &writefds, NULL, &timeout) > 0) {
+            /* Finish up anything the worker threads are done with first, since
+               that might queue up more data to send to the ships. */
+            if(wfd > -1 && FD_ISSET(wfd, &readfds)) {
+                workq_complete();
+            }
+
             /* Check each ship's socket for activity. */
             TAILQ_FOREACH(i, &ships, qentry) {
                 if(i->disconnected) {
@@ -787,6 +900,7 @@ static void sigusr2_hnd(int signum, siginfo_t *inf, void *ptr) {
     cleanup_scripts();
     init_scripts();
     resend_scripts = 1;
+    reload_caches = 1;
 }
 
 /* Install any handlers for signals we care about */
@@ -840,7 +954,7 @@ static void install_signal_handlers() {
         fprintf(stderr, "Can't set SIGUSR1 handler.\n");
     }
 
-    /* Set up the SIGUSR2 handler to reload scripts... */
+    /* Set up the SIGUSR2 handler to reload scripts and cached data... */
     sigemptyset(&sa.sa_mask);
     sa.sa_handler = NULL;
     sa.sa_sigaction = &sigusr2_hnd;
@@ -1049,17 +1163,52 @@ restart:
     /* Clean up the DB now that we've done everything else that might fail... */
     open_db();
 
+    /* Start up the worker threads. */
+    if(workq_init(worker_threads)) {
+        pidfile_remove(pf);
+        exit(EXIT_FAILURE);
+    }
+
+    if(auth_init(auth_threads, auth_hash)) {
+        workq_cleanup();
+        pidfile_remove(pf);
+        exit(EXIT_FAILURE);
+    }
+
     /* Run the shipgate server. */
     run_server(tsock, tsock6);
 
-    /* Clean up. */
+    /* Clean up. This handles anything the ships sent that's still queued and
+       finishes any outstanding saves first, so it has to be done before the
+       database is closed. */
+    while(sched_run()) {
+    }
+
+    savebuf_flush_all();
+    kills_cleanup();
+    leaders_cleanup();
+    qflags_cleanup();
+    bbstate_cleanup();
+    workq_cleanup();
+    auth_cleanup();
+    savebuf_cleanup();
+    sched_cleanup();
+    hist_cleanup();
+    bkcache_cleanup();
+    blob_close();
     close(tsock);
     close(tsock6);
     cleanup_scripts();
-    free_events();
+    mail_cleanup();
+    acct_cleanup();
+    token_cleanup();
+    ccache_cleanup();
+    timers_cleanup();
+    events_cleanup();
     iconv_close(ic_utf8_to_utf16);
     iconv_close(ic_utf16_to_utf8);
     sylverant_db_close(&conn);
+    workdb_cleanup();
     cleanup_gnutls();
     sylverant_free_config(cfg);
 
@@ -1069,6 +1218,9 @@ restart:
         goto restart;
     }
 
+    /* The dictionaries were loaded from the command line, so they need to stay
+       around if we're restarting. */
+    codec_cleanup();
     free(initial_path);
     pidfile_remove(pf);
 
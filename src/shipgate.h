@@ -29,7 +29,7 @@
 
 /* Minimum and maximum supported protocol ship<->shipgate protocol versions */
 #define SHIPGATE_MINIMUM_PROTO_VER 12
-#define SHIPGATE_MAXIMUM_PROTO_VER 19
+#define SHIPGATE_MAXIMUM_PROTO_VER 23
 
 #ifdef PACKED
 #undef PACKED
@@ -195,7 +195,10 @@ typedef struct shipgate_char_data {
 } PACKED shipgate_char_data_pkt;
 
 /* A packet sent from clients to save their character backup or to request that
-   the gate send it back to them. */
+   the gate send it back to them. On a request (with no data) from a ship using
+   protocol version 23 or newer, the version field of the header says how many
+   versions back in the backup's history to go, with 0 being the current one.
+   It is ignored for older ships. */
 typedef struct shipgate_char_bkup {
     shipgate_hdr_t hdr;
     uint32_t guildcard;
@@ -204,7 +207,10 @@ typedef struct shipgate_char_bkup {
     uint8_t data[];
 } PACKED shipgate_char_bkup_pkt;
 
-/* A packet sent to request saved character data. */
+/* A packet sent to request saved character data. As with backup requests, a
+   ship using protocol version 23 or newer can ask for an older save of the
+   character by setting the version field of the header to how many saves back
+   to go. */
 typedef struct shipgate_char_req {
     shipgate_hdr_t hdr;
     uint32_t guildcard;
@@ -272,6 +278,18 @@ typedef struct shipgate_friend_login_4 {
     char friend_nick[32];
 } PACKED shipgate_friend_login_4_pkt;
 
+/* Packet used to tell a ship about a batch of friend logins/logouts at once.
+   This replaces the above packet for protocol version 20 and newer. */
+typedef struct shipgate_friend_status {
+    shipgate_hdr_t hdr;
+    uint32_t count;
+    uint32_t reserved;
+    friend_status_t entries[];
+} PACKED shipgate_friend_status_pkt;
+
+/* Maximum number of entries in one of the above packets. */
+#define FRSTATUS_MAX_ENTRIES    512
+
 /* Packet to update a user's friendlist (used for either add or remove) */
 typedef struct shipgate_friend_upd {
     shipgate_hdr_t hdr;
@@ -440,6 +458,30 @@ typedef struct shipgate_qflag {
     uint32_t value;
 } PACKED shipgate_qflag_pkt;
 
+/* One quest flag in the packet below. The ctl field takes the same bits that
+   get ORed into the flag_id in the packet above. */
+typedef struct shipgate_qflag_ent {
+    uint32_t flag_id;
+    uint32_t ctl;
+    uint32_t value;
+    uint32_t error;
+} PACKED shipgate_qflag_ent_t;
+
+/* Packet used to read or set a bunch of quest flags for one player at once
+   (protocol version 22 and newer). The reply is the same packet with
+   SHDR_RESPONSE set and the value (for a read) and error code of each flag
+   filled in. Changes are only answered once they're safely stored. */
+typedef struct shipgate_qflags {
+    shipgate_hdr_t hdr;
+    uint32_t guildcard;
+    uint32_t block;
+    uint32_t quest_id;
+    uint32_t flags;
+    uint32_t count;
+    uint32_t reserved;
+    shipgate_qflag_ent_t entries[];
+} PACKED shipgate_qflags_pkt;
+
 /* Packet used for ship control. */
 typedef struct shipgate_shipctl {
     shipgate_hdr_t hdr;
@@ -516,6 +558,21 @@ typedef struct shipgate_ubl_add {
     uint8_t reserved[7];
 } PACKED shipgate_ubl_add_pkt;
 
+/* Packet used to carry one piece of a message that is too big to send in one
+   go (protocol version 21 and newer). The message itself is a complete packet,
+   header and all, except that the pkt_len in its header is meaningless -- the
+   total_len here is its real length. Each piece is acknowledged by sending the
+   same packet back with SHDR_RESPONSE set, no data, and seq set to the next
+   piece expected. */
+typedef struct shipgate_stream {
+    shipgate_hdr_t hdr;
+    uint32_t stream_id;
+    uint32_t seq;
+    uint32_t total_len;
+    uint32_t offset;
+    uint8_t data[];
+} PACKED shipgate_stream_pkt;
+
 #undef PACKED
 
 /* The requisite message for the msg field of the shipgate_login_pkt. */
@@ -569,6 +626,9 @@ static const char shipgate_login_msg[] =
 #define SHDR_TYPE_SHIP_CTL  0x0030      /* Ship control packet */
 #define SHDR_TYPE_UBLOCKS   0x0031      /* User blocklist */
 #define SHDR_TYPE_UBL_ADD   0x0032      /* User blocklist add */
+#define SHDR_TYPE_FRSTATUS  0x0033      /* Batched friend logins/logouts */
+#define SHDR_TYPE_STREAM    0x0034      /* Piece of a streamed message */
+#define SHDR_TYPE_QFLAGS    0x0035      /* Read/set several quest flags */
 
 /* Flags that can be set in the login packet */
 #define LOGIN_FLAG_GMONLY   0x00000001  /* Only Global GMs are allowed */
@@ -662,6 +722,15 @@ static const char shipgate_login_msg[] =
 #define QFLAG_LONG_FLAG         0x80000000
 #define QFLAG_DELETE_FLAG       0x40000000  /* Only valid on a set */
 
+/* Flags for the bulk quest flag packet. */
+#define QFLAGS_BULK_SET         0x00000001  /* Set the flags (otherwise read) */
+
+/* Most quest flags in one bulk quest flag packet. */
+#define QFLAGS_BULK_MAX         512
+
+/* First protocol version with the bulk quest flag packet. */
+#define QFLAGS_BULK_PROTO_VER   22
+
 /* Ship control types. */
 #define SCTL_TYPE_UNAME         0x00000001
 #define SCTL_TYPE_VERSION       0x00000002
@@ -720,6 +789,17 @@ int send_friend_message(ship_t *c, int on, uint32_t dest_gc,
                         uint32_t friend_block, uint32_t friend_ship,
                         const char *friend_name, const char *nickname);
 
+/* Queue a friend login/logout message for the ship. Ships that support it will
+   get all queued messages in one packet from send_friend_messages(), others
+   get the message sent immediately with send_friend_message(). */
+int queue_friend_message(ship_t *c, int on, uint32_t dest_gc,
+                         uint32_t dest_block, uint32_t friend_gc,
+                         uint32_t friend_block, uint32_t friend_ship,
+                         const char *friend_name, const char *nickname);
+
+/* Send any queued friend login/logout messages to the ship. */
+int send_friend_messages(ship_t *c);
+
 /* Send a kick packet */
 int send_kick(ship_t *c, uint32_t requester, uint32_t user, uint32_t block,
               const char *reason);
@@ -763,10 +843,24 @@ int send_sset(ship_t *c, uint32_t action, ship_script_t *scr);
 int send_sdata(ship_t *c, uint32_t gc, uint32_t block, uint32_t event,
                const uint8_t *data, uint32_t len);
 
+/* Send one piece of a streamed message to a ship. */
+int send_stream_chunk(ship_t *c, uint32_t id, uint32_t seq, uint32_t total,
+                      uint32_t offset, const void *data, uint16_t len);
+
+/* Acknowledge (or reject) pieces of a streamed message from a ship. */
+int send_stream_ack(ship_t *c, uint32_t id, uint32_t seq, uint32_t offset,
+                    int fail);
+
 /* Send a quest flag response */
 int send_qflag(ship_t *c, uint16_t type, uint32_t gc, uint32_t block,
                uint32_t fid, uint32_t qid, uint32_t value, uint32_t ctl);
 
+/* Send a bulk quest flag response. The entries should already be in network
+   byte order. */
+int send_qflags(ship_t *c, uint32_t gc, uint32_t block, uint32_t qid,
+                uint32_t flags, const shipgate_qflag_ent_t *ents,
+                uint32_t count);
+
 /* Send a simple ship control request */
 int send_sctl(ship_t *c, uint32_t ctl, uint32_t acc);
 
@@ -0,0 +1,351 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+
+#include "stream.h"
+#include "sched.h"
+
+/* Messages are streamed one at a time per ship, in the order they were queued,
+   so they arrive in the same order they would have without streaming. Other
+   packets can go out between the pieces though. */
+typedef struct stream_out {
+    STAILQ_ENTRY(stream_out) qentry;
+    uint32_t id;
+    uint32_t total;
+    uint32_t sent;
+    uint32_t next_seq;
+    uint32_t acked;
+    FILE *fp;
+    size_t head_len;
+    uint8_t head[];
+} stream_out_t;
+
+STAILQ_HEAD(stream_out_list, stream_out);
+
+typedef struct stream_in {
+    uint32_t id;
+    uint32_t total;
+    uint32_t received;
+    uint32_t next_seq;
+    uint8_t *buf;
+} stream_in_t;
+
+struct stream_state {
+    struct stream_out_list out;
+    uint32_t next_id;
+    stream_in_t in[STREAM_MAX_INCOMING];
+};
+
+int stream_supported(ship_t *c) {
+    return c->proto_ver >= STREAM_PROTO_VER;
+}
+
+static struct stream_state *get_state(ship_t *c) {
+    struct stream_state *st;
+
+    if(c->streams)
+        return c->streams;
+
+    if(!(st = (struct stream_state *)malloc(sizeof(struct stream_state))))
+        return NULL;
+
+    memset(st, 0, sizeof(struct stream_state));
+    STAILQ_INIT(&st->out);
+    st->next_id = 1;
+    c->streams = st;
+
+    return st;
+}
+
+static stream_out_t *new_stream(ship_t *c, size_t len, size_t total) {
+    struct stream_state *st;
+    stream_out_t *s;
+
+    if(total > STREAM_MAX_SIZE) {
+        debug(DBG_WARN, "Message for %s is too big to stream (%lu bytes)\n",
+              c->name, (unsigned long)total);
+        return NULL;
+    }
+
+    if(!(st = get_state(c)) ||
+       !(s = (stream_out_t *)malloc(sizeof(stream_out_t) + len))) {
+        debug(DBG_WARN, "Couldn't allocate stream for %s\n", c->name);
+        return NULL;
+    }
+
+    memset(s, 0, sizeof(stream_out_t));
+    s->id = st->next_id++;
+    s->total = (uint32_t)total;
+    STAILQ_INSERT_TAIL(&st->out, s, qentry);
+
+    return s;
+}
+
+static void free_stream(stream_out_t *s) {
+    if(s->fp)
+        fclose(s->fp);
+
+    free(s);
+}
+
+int stream_send_mem(ship_t *c, const void *head, size_t head_len,
+                    const void *body, size_t body_len) {
+    stream_out_t *s;
+
+    if(!(s = new_stream(c, head_len + body_len, head_len + body_len)))
+        return -1;
+
+    s->head_len = head_len + body_len;
+    memcpy(s->head, head, head_len);
+    memcpy(s->head + head_len, body, body_len);
+
+    return 0;
+}
+
+int stream_send_file(ship_t *c, const void *head, size_t head_len,
+                     const char *fn, uint32_t body_len) {
+    stream_out_t *s;
+    FILE *fp;
+
+    if(!(fp = fopen(fn, "rb"))) {
+        debug(DBG_ERROR, "Cannot open file to stream: %s\n", fn);
+        return -1;
+    }
+
+    if(!(s = new_stream(c, head_len, head_len + body_len))) {
+        fclose(fp);
+        return -1;
+    }
+
+    s->fp = fp;
+    s->head_len = head_len;
+    memcpy(s->head, head, head_len);
+
+    return 0;
+}
+
+int stream_pump(ship_t *c) {
+    struct stream_state *st = c->streams;
+    stream_out_t *s;
+    uint8_t buf[STREAM_CHUNK_SIZE];
+    size_t len, n = 0;
+
+    if(!st || !(s = STAILQ_FIRST(&st->out)))
+        return 0;
+
+    /* Let anything else already queued go out first, and don't get too far
+       ahead of the ship. */
+    if(c->sendbuf_cur || s->next_seq - s->acked >= STREAM_WINDOW)
+        return 0;
+
+    len = s->total - s->sent;
+
+    if(len > STREAM_CHUNK_SIZE)
+        len = STREAM_CHUNK_SIZE;
+
+    /* Grab what's left of the head, then read the rest from the file. */
+    if(s->sent < s->head_len) {
+        n = s->head_len - s->sent;
+
+        if(n > len)
+            n = len;
+
+        memcpy(buf, s->head + s->sent, n);
+    }
+
+    if(n < len && fread(buf + n, 1, len - n, s->fp) != len - n) {
+        debug(DBG_ERROR, "File being streamed to %s changed length\n",
+              c->name);
+        STAILQ_REMOVE_HEAD(&st->out, qentry);
+        free_stream(s);
+        return -1;
+    }
+
+    if(send_stream_chunk(c, s->id, s->next_seq, s->total, s->sent, buf,
+                         (uint16_t)len))
+        return -1;
+
+    s->sent += len;
+    ++s->next_seq;
+
+    /* Once it's all sent, move on to the next one. */
+    if(s->sent == s->total) {
+        STAILQ_REMOVE_HEAD(&st->out, qentry);
+        free_stream(s);
+
+        if(!(s = STAILQ_FIRST(&st->out)))
+            return 0;
+    }
+
+    return s->next_seq - s->acked < STREAM_WINDOW;
+}
+
+/* Handle an acknowledgement from the ship for a stream we're sending. */
+static int handle_ack(ship_t *c, shipgate_stream_pkt *pkt, uint16_t flags) {
+    struct stream_state *st = c->streams;
+    uint32_t id = ntohl(pkt->stream_id), seq = ntohl(pkt->seq);
+    stream_out_t *s;
+
+    if(!st)
+        return 0;
+
+    STAILQ_FOREACH(s, &st->out, qentry) {
+        if(s->id == id)
+            break;
+    }
+
+    /* Acks for streams that are done sending don't matter. */
+    if(!s)
+        return 0;
+
+    if(flags & SHDR_FAILURE) {
+        debug(DBG_WARN, "%s rejected streamed message %u\n", c->name, id);
+        STAILQ_REMOVE(&st->out, s, stream_out, qentry);
+        free_stream(s);
+        return 0;
+    }
+
+    if(seq > s->acked && seq <= s->next_seq)
+        s->acked = seq;
+
+    return 0;
+}
+
+static void free_incoming(stream_in_t *in) {
+    free(in->buf);
+    memset(in, 0, sizeof(stream_in_t));
+}
+
+int stream_handle(ship_t *c, shipgate_stream_pkt *pkt) {
+    uint16_t flags = ntohs(pkt->hdr.flags);
+    uint16_t len = ntohs(pkt->hdr.pkt_len);
+    uint32_t id, seq, total, offset;
+    struct stream_state *st;
+    stream_in_t *in = NULL, *empty = NULL;
+    shipgate_hdr_t *hdr;
+    int i, rv;
+
+    if(len < sizeof(shipgate_stream_pkt)) {
+        debug(DBG_WARN, "%s sent short stream packet\n", c->name);
+        return -1;
+    }
+
+    if(flags & SHDR_RESPONSE)
+        return handle_ack(c, pkt, flags);
+
+    if(!(st = get_state(c)))
+        return -1;
+
+    len -= sizeof(shipgate_stream_pkt);
+    id = ntohl(pkt->stream_id);
+    seq = ntohl(pkt->seq);
+    total = ntohl(pkt->total_len);
+    offset = ntohl(pkt->offset);
+
+    for(i = 0; i < STREAM_MAX_INCOMING; ++i) {
+        if(st->in[i].buf && st->in[i].id == id)
+            in = &st->in[i];
+        else if(!st->in[i].buf && !empty)
+            empty = &st->in[i];
+    }
+
+    /* Is this the start of a new message? Anything too big to be handled is
+       turned away before any of it is buffered. */
+    if(!in && !seq) {
+        if(!empty || total < sizeof(shipgate_hdr_t) ||
+           total > STREAM_MAX_IN_SIZE ||
+           !(empty->buf = (uint8_t *)malloc(total))) {
+            debug(DBG_WARN, "Rejecting streamed message from %s (%u bytes)\n",
+                  c->name, total);
+            return send_stream_ack(c, id, seq, offset, 1);
+        }
+
+        in = empty;
+        in->id = id;
+        in->total = total;
+    }
+
+    /* Make sure it's the piece we were expecting. */
+    if(!in || seq != in->next_seq || offset != in->received ||
+       total != in->total || len > in->total - in->received) {
+        debug(DBG_WARN, "%s sent bad stream piece (%u: %u)\n", c->name, id,
+              seq);
+
+        if(in)
+            free_incoming(in);
+
+        return send_stream_ack(c, id, seq, offset, 1);
+    }
+
+    memcpy(in->buf + in->received, pkt->data, len);
+    in->received += len;
+    ++in->next_seq;
+
+    /* Let the ship know it can keep going. */
+    if(in->received != in->total) {
+        if(!(in->next_seq % (STREAM_WINDOW / 2)))
+            return send_stream_ack(c, id, in->next_seq, in->received, 0);
+
+        return 0;
+    }
+
+    if(send_stream_ack(c, id, in->next_seq, in->received, 0))
+        return -1;
+
+    /* Fill in the real length and queue it like a normal packet. */
+    hdr = (shipgate_hdr_t *)in->buf;
+
+    if(ntohs(hdr->pkt_type) == SHDR_TYPE_STREAM) {
+        debug(DBG_WARN, "%s streamed an unsupported message\n", c->name);
+        free_incoming(in);
+        return 0;
+    }
+
+    hdr->pkt_len = htons((uint16_t)in->total);
+    rv = sched_submit(c, hdr);
+    free_incoming(in);
+
+    return rv;
+}
+
+void stream_cleanup(ship_t *c) {
+    struct stream_state *st = c->streams;
+    stream_out_t *s;
+    int i;
+
+    if(!st)
+        return;
+
+    while((s = STAILQ_FIRST(&st->out))) {
+        STAILQ_REMOVE_HEAD(&st->out, qentry);
+        free_stream(s);
+    }
+
+    for(i = 0; i < STREAM_MAX_INCOMING; ++i) {
+        free(st->in[i].buf);
+    }
+
+    free(st);
+    c->streams = NULL;
+}
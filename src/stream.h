@@ -0,0 +1,80 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "shipgate.h"
+
+/* First protocol version that supports streamed messages. */
+#define STREAM_PROTO_VER        21
+
+/* Size of the data in each piece of a stream. Messages bigger than this are
+   streamed to ships that support it. */
+#ifndef STREAM_CHUNK_SIZE
+#define STREAM_CHUNK_SIZE       4096
+#endif
+
+/* Number of pieces that can be sent before waiting for an acknowledgement. */
+#ifndef STREAM_WINDOW
+#define STREAM_WINDOW           8
+#endif
+
+/* Largest message that can be streamed either way. */
+#ifndef STREAM_MAX_SIZE
+#define STREAM_MAX_SIZE         (1024 * 1024)
+#endif
+
+/* Largest message a ship can stream to us. None of the handlers deal with
+   messages bigger than a packet could be. */
+#define STREAM_MAX_IN_SIZE      0xFFFF
+
+/* Number of messages a ship can be streaming to us at once. */
+#define STREAM_MAX_INCOMING     4
+
+/* Returns non-zero if the ship supports streamed messages. */
+int stream_supported(ship_t *c);
+
+/* Queue a message to be streamed to a ship. The head is the start of the
+   message (its header and fixed fields) and the body is the rest of it. Both
+   are copied. */
+int stream_send_mem(ship_t *c, const void *head, size_t head_len,
+                    const void *body, size_t body_len);
+
+/* Queue a message to be streamed to a ship, where the body is read from a file
+   a piece at a time as it's sent. */
+int stream_send_file(ship_t *c, const void *head, size_t head_len,
+                     const char *fn, uint32_t body_len);
+
+/* Send the next piece of the ship's current stream, if there's room for it.
+   This is called from the main loop, and only sends anything once everything
+   else queued for the ship is sent, so other packets don't wait behind a big
+   message. Returns 1 if there's more that can be sent right away, 0 if not, or
+   -1 on error. */
+int stream_pump(ship_t *c);
+
+/* Handle a stream packet from a ship. Complete messages are handed off to be
+   processed like any other packet. */
+int stream_handle(ship_t *c, shipgate_stream_pkt *pkt);
+
+/* Clean up any streams for a ship that's going away. */
+void stream_cleanup(ship_t *c);
+
+#endif /* !STREAM_H */
@@ -0,0 +1,109 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include <sylverant/debug.h>
+
+#include "timer.h"
+
+typedef struct sg_timer {
+    timer_cb_t cb;
+    void *data;
+    time_t interval;
+    time_t next;
+} sg_timer_t;
+
+static sg_timer_t timers[MAX_TIMERS];
+
+static int timer_insert(time_t interval, time_t when, timer_cb_t cb,
+                        void *data) {
+    int i;
+
+    for(i = 0; i < MAX_TIMERS; ++i) {
+        if(!timers[i].cb) {
+            timers[i].cb = cb;
+            timers[i].data = data;
+            timers[i].interval = interval;
+            timers[i].next = when;
+            return i;
+        }
+    }
+
+    debug(DBG_WARN, "Out of timer slots!\n");
+    return -1;
+}
+
+int timer_add(time_t interval, timer_cb_t cb, void *data) {
+    if(interval <= 0 || !cb)
+        return -1;
+
+    return timer_insert(interval, time(NULL) + interval, cb, data);
+}
+
+int timer_add_at(time_t when, timer_cb_t cb, void *data) {
+    if(!cb)
+        return -1;
+
+    return timer_insert(0, when, cb, data);
+}
+
+void timer_remove(int id) {
+    if(id >= 0 && id < MAX_TIMERS)
+        timers[id].cb = NULL;
+}
+
+void timers_run(time_t now) {
+    int i;
+    timer_cb_t cb;
+
+    for(i = 0; i < MAX_TIMERS; ++i) {
+        if(!(cb = timers[i].cb) || timers[i].next > now)
+            continue;
+
+        /* Reschedule (or clear) the timer before calling the callback, so that
+           the callback is free to add or remove timers itself. */
+        if(timers[i].interval)
+            timers[i].next = now + timers[i].interval;
+        else
+            timers[i].cb = NULL;
+
+        cb(now, timers[i].data);
+    }
+}
+
+time_t timers_next(time_t now, time_t max) {
+    int i;
+    time_t rv = max;
+
+    for(i = 0; i < MAX_TIMERS; ++i) {
+        if(!timers[i].cb)
+            continue;
+
+        if(timers[i].next <= now)
+            return 0;
+
+        if(timers[i].next - now < rv)
+            rv = timers[i].next - now;
+    }
+
+    return rv;
+}
+
+void timers_cleanup(void) {
+    memset(timers, 0, sizeof(timers));
+}
@@ -0,0 +1,50 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <time.h>
+
+/* Maximum number of timers that can be registered at once. */
+#define MAX_TIMERS      32
+
+/* Callback for when a timer fires. */
+typedef void (*timer_cb_t)(time_t now, void *data);
+
+/* Register a timer that fires every interval seconds. Returns the id of the
+   timer, or -1 on error. */
+int timer_add(time_t interval, timer_cb_t cb, void *data);
+
+/* Register a timer that fires once at the given time. Returns the id of the
+   timer, or -1 on error. */
+int timer_add_at(time_t when, timer_cb_t cb, void *data);
+
+/* Remove a timer that was previously registered. */
+void timer_remove(int id);
+
+/* Run any timers that have expired. This is called from the main loop. */
+void timers_run(time_t now);
+
+/* Figure out how long the main loop can sleep before the next timer fires,
+   capping the result at max seconds. */
+time_t timers_next(time_t now, time_t max);
+
+/* Remove all registered timers. */
+void timers_cleanup(void);
+
+#endif /* !TIMER_H */
@@ -0,0 +1,210 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "tokens.h"
+#include "timer.h"
+
+/* Tokens are made by the website, so new ones can show up at any time. Those
+   that were there at the last sweep are answered from memory, and anything
+   else is looked up in the database. Either way, expired tokens are never
+   accepted, even if the sweep hasn't gotten to them yet. */
+
+#define TOKEN_HASH_SIZE     1024
+
+typedef struct token_entry {
+    struct token_entry *hnext;
+    uint32_t gc;
+    uint32_t acc;
+    uint32_t priv;
+    int spent;
+    time_t expires;
+    char username[32];
+    char token[32];
+} token_entry_t;
+
+extern sylverant_dbconn_t conn;
+
+static token_entry_t *entries;
+static int entry_count;
+static token_entry_t *hash[TOKEN_HASH_SIZE];
+static int sweep_timer = -1;
+
+static void clear_cache(void) {
+    free(entries);
+    entries = NULL;
+    entry_count = 0;
+    memset(hash, 0, sizeof(hash));
+}
+
+/* Clear out expired tokens and reload the cache with the rest. */
+static void sweep(time_t now, void *data) {
+    char query[512];
+    void *result;
+    char **row;
+    token_entry_t *e;
+    long left;
+    int b;
+
+    (void)data;
+
+    if(!now)
+        now = time(NULL);
+
+    /* This is a range on req_time, rather than a calculation on it, so it can
+       use the index. */
+    sprintf(query, "DELETE FROM login_tokens WHERE req_time < NOW() - "
+            "INTERVAL %d MINUTE", TOKEN_LIFETIME);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't clear old tokens!\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    }
+
+    clear_cache();
+
+    /* The expiration time is figured from the database's clock, in case it
+       doesn't quite match ours. */
+    sprintf(query, "SELECT guildcard, account_id, privlevel, username, token, "
+            "TIMESTAMPDIFF(SECOND, NOW(), req_time + INTERVAL %d MINUTE) "
+            "FROM login_tokens NATURAL JOIN account_data NATURAL JOIN "
+            "guildcards WHERE req_time >= NOW() - INTERVAL %d MINUTE LIMIT %d",
+            TOKEN_LIFETIME, TOKEN_LIFETIME, TOKEN_CACHE_MAX);
+
+    if(sylverant_db_query(&conn, query) ||
+       !(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't load login tokens\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return;
+    }
+
+    if(!(entries = (token_entry_t *)malloc(TOKEN_CACHE_MAX *
+                                           sizeof(token_entry_t)))) {
+        debug(DBG_WARN, "Couldn't allocate token cache\n");
+        sylverant_db_result_free(result);
+        return;
+    }
+
+    while((row = sylverant_db_result_fetch(result))) {
+        if(!row[3] || !row[4] || strlen(row[3]) > 31 || strlen(row[4]) > 31)
+            continue;
+
+        if((left = strtol(row[5], NULL, 0)) <= 0)
+            continue;
+
+        e = &entries[entry_count++];
+        e->gc = (uint32_t)strtoul(row[0], NULL, 0);
+        e->acc = (uint32_t)strtoul(row[1], NULL, 0);
+        e->priv = (uint32_t)strtoul(row[2], NULL, 0);
+        e->spent = 0;
+        e->expires = now + left;
+        strcpy(e->username, row[3]);
+        strcpy(e->token, row[4]);
+
+        b = e->gc & (TOKEN_HASH_SIZE - 1);
+        e->hnext = hash[b];
+        hash[b] = e;
+    }
+
+    sylverant_db_result_free(result);
+}
+
+int token_init(void) {
+    sweep(0, NULL);
+    sweep_timer = timer_add(TOKEN_SWEEP_INTERVAL, &sweep, NULL);
+
+    return 0;
+}
+
+void token_cleanup(void) {
+    timer_remove(sweep_timer);
+    sweep_timer = -1;
+    clear_cache();
+}
+
+int token_check(uint32_t gc, const char *username, const char *token,
+                uint32_t *acc, uint32_t *priv) {
+    token_entry_t *e = hash[gc & (TOKEN_HASH_SIZE - 1)];
+    char query[384], esc[65], esc2[65];
+    void *result;
+    char **row;
+
+    while(e) {
+        if(e->gc == gc && !strcmp(e->username, username) &&
+           !strcmp(e->token, token)) {
+            if(e->spent || e->expires <= time(NULL))
+                return TOKEN_BAD;
+
+            *acc = e->acc;
+            *priv = e->priv;
+            return TOKEN_OK;
+        }
+
+        e = e->hnext;
+    }
+
+    /* Not one we know about, so it's probably new since the last sweep. */
+    sylverant_db_escape_str(&conn, esc, username, strlen(username));
+    sylverant_db_escape_str(&conn, esc2, token, strlen(token));
+    sprintf(query, "SELECT privlevel, account_id FROM account_data NATURAL "
+            "JOIN guildcards NATURAL JOIN login_tokens WHERE guildcard='%u' "
+            "AND username='%s' AND token='%s' AND req_time >= NOW() - "
+            "INTERVAL %d MINUTE", gc, esc, esc2, TOKEN_LIFETIME);
+
+    if(sylverant_db_query(&conn, query) ||
+       !(result = sylverant_db_result_store(&conn))) {
+        debug(DBG_WARN, "Couldn't lookup token (user: %s, gc: %u)\n",
+              username, gc);
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+        return TOKEN_ERROR;
+    }
+
+    if(!(row = sylverant_db_result_fetch(result))) {
+        sylverant_db_result_free(result);
+        return TOKEN_BAD;
+    }
+
+    *priv = (uint32_t)strtoul(row[0], NULL, 0);
+    *acc = (uint32_t)strtoul(row[1], NULL, 0);
+    sylverant_db_result_free(result);
+
+    return TOKEN_OK;
+}
+
+void token_spent(uint32_t acc) {
+    char query[128];
+    int i;
+
+    for(i = 0; i < entry_count; ++i) {
+        if(entries[i].acc == acc)
+            entries[i].spent = 1;
+    }
+
+    sprintf(query, "DELETE FROM login_tokens WHERE account_id='%u'", acc);
+
+    if(sylverant_db_query(&conn, query)) {
+        debug(DBG_WARN, "Couldn't clear spent token!\n");
+        debug(DBG_WARN, "%s\n", sylverant_db_error(&conn));
+    }
+}
@@ -0,0 +1,57 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include <stdint.h>
+
+/* How long (in minutes) a login token is good for after it's requested. */
+#define TOKEN_LIFETIME          10
+
+/* How often (in seconds) expired tokens are cleared out of the database and
+   the cache of current ones is reloaded. */
+#ifndef TOKEN_SWEEP_INTERVAL
+#define TOKEN_SWEEP_INTERVAL    30
+#endif
+
+/* Most tokens to keep in the cache. Any others are looked up in the database
+   when they're used. */
+#ifndef TOKEN_CACHE_MAX
+#define TOKEN_CACHE_MAX         4096
+#endif
+
+/* Return values for token_check(). */
+#define TOKEN_ERROR             -1  /* Database error */
+#define TOKEN_OK                0   /* Token is good */
+#define TOKEN_BAD               1   /* No such token (or it's expired) */
+
+/* Set up the token cache and start sweeping expired tokens. */
+int token_init(void);
+
+/* Clean up the token cache. */
+void token_cleanup(void);
+
+/* Check a login token for a user, filling in their account and privilege
+   level if it's good. */
+int token_check(uint32_t gc, const char *username, const char *token,
+                uint32_t *acc, uint32_t *priv);
+
+/* Remove a user's tokens once one of them has been used. */
+void token_spent(uint32_t acc);
+
+#endif /* !TOKENS_H */
@@ -0,0 +1,85 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <sylverant/config.h>
+#include <sylverant/debug.h>
+#include <sylverant/database.h>
+
+#include "workdb.h"
+
+extern sylverant_config_t *cfg;
+
+static pthread_key_t conn_key;
+static pthread_once_t conn_once = PTHREAD_ONCE_INIT;
+static int conn_key_ok;
+
+static void close_conn(void *data) {
+    sylverant_dbconn_t *c = (sylverant_dbconn_t *)data;
+
+    sylverant_db_close(c);
+    free(c);
+}
+
+static void make_conn_key(void) {
+    if(pthread_key_create(&conn_key, &close_conn))
+        debug(DBG_ERROR, "Cannot create worker database key\n");
+    else
+        conn_key_ok = 1;
+}
+
+sylverant_dbconn_t *workdb_conn(void) {
+    sylverant_dbconn_t *c;
+
+    pthread_once(&conn_once, &make_conn_key);
+
+    if(!conn_key_ok)
+        return NULL;
+
+    if((c = (sylverant_dbconn_t *)pthread_getspecific(conn_key)))
+        return c;
+
+    if(!(c = (sylverant_dbconn_t *)malloc(sizeof(sylverant_dbconn_t)))) {
+        debug(DBG_WARN, "Couldn't allocate worker database connection\n");
+        return NULL;
+    }
+
+    if(sylverant_db_open(&cfg->dbcfg, c)) {
+        debug(DBG_WARN, "Worker can't connect to the database\n");
+        free(c);
+        return NULL;
+    }
+
+    if(pthread_setspecific(conn_key, c)) {
+        close_conn(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void workdb_cleanup(void) {
+    sylverant_dbconn_t *c;
+
+    if(conn_key_ok &&
+       (c = (sylverant_dbconn_t *)pthread_getspecific(conn_key))) {
+        pthread_setspecific(conn_key, NULL);
+        close_conn(c);
+    }
+}
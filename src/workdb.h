@@ -0,0 +1,34 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKDB_H
+#define WORKDB_H
+
+#include <sylverant/database.h>
+
+/* Get the database connection for the calling thread, connecting the first
+   time it's needed. A connection can't be shared between threads, so each
+   worker gets its own, and it's closed when the worker exits. Returns NULL if
+   it can't connect (it'll try again next time). */
+sylverant_dbconn_t *workdb_conn(void);
+
+/* Close the calling thread's connection, if it has one. Work is done on the
+   main thread when there are no workers, and nothing closes its connection
+   when it exits, so this is called at shutdown. */
+void workdb_cleanup(void);
+
+#endif /* !WORKDB_H */
@@ -0,0 +1,298 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include <sylverant/debug.h>
+
+#include "workq.h"
+
+typedef struct workq_job {
+    STAILQ_ENTRY(workq_job) qentry;
+    workq_fn_t work;
+    workq_fn_t done;
+    void *data;
+} workq_job_t;
+
+STAILQ_HEAD(workq_list, workq_job);
+
+/* Each worker has its own queue, and work is assigned to a worker by its key.
+   That keeps everything for one key in order without any extra bookkeeping. */
+typedef struct workq_worker {
+    pthread_t thd;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    struct workq_list queue;
+    int shutdown;
+} workq_worker_t;
+
+/* Pools all share the same completion queue, so the main thread only has one
+   thing to watch. */
+typedef struct workq_pool {
+    workq_worker_t workers[WORKQ_MAX_THREADS];
+    int worker_count;
+} workq_pool_t;
+
+static workq_pool_t pools[WORKQ_MAX_POOLS];
+static int pool_count;
+static int total_workers;
+
+static pthread_mutex_t done_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct workq_list done_queue = STAILQ_HEAD_INITIALIZER(done_queue);
+static int done_pipe[2] = { -1, -1 };
+
+static void *worker_thd(void *arg) {
+    workq_worker_t *w = (workq_worker_t *)arg;
+    workq_job_t *job;
+    int wake;
+
+    for(;;) {
+        pthread_mutex_lock(&w->mtx);
+
+        while(STAILQ_EMPTY(&w->queue) && !w->shutdown) {
+            pthread_cond_wait(&w->cv, &w->mtx);
+        }
+
+        /* Only exit once the queue is drained. */
+        if(!(job = STAILQ_FIRST(&w->queue))) {
+            pthread_mutex_unlock(&w->mtx);
+            break;
+        }
+
+        STAILQ_REMOVE_HEAD(&w->queue, qentry);
+        pthread_mutex_unlock(&w->mtx);
+
+        if(job->work)
+            job->work(job->data);
+
+        /* Hand it back to the main thread, waking it up if the completion queue
+           was empty (otherwise it's already been woken up). */
+        pthread_mutex_lock(&done_mtx);
+        wake = STAILQ_EMPTY(&done_queue);
+        STAILQ_INSERT_TAIL(&done_queue, job, qentry);
+        pthread_mutex_unlock(&done_mtx);
+
+        if(wake && write(done_pipe[1], "", 1) < 0 && errno != EAGAIN)
+            debug(DBG_WARN, "Couldn't signal work completion: %s\n",
+                  strerror(errno));
+    }
+
+    return NULL;
+}
+
+static int start_pool(workq_pool_t *p, int threads) {
+    workq_worker_t *w;
+    int i;
+
+    if(threads > WORKQ_MAX_THREADS)
+        threads = WORKQ_MAX_THREADS;
+
+    p->worker_count = 0;
+
+    if(threads <= 0)
+        return 0;
+
+    if(done_pipe[0] == -1) {
+        if(pipe(done_pipe)) {
+            debug(DBG_ERROR, "Cannot create work queue pipe: %s\n",
+                  strerror(errno));
+            return -1;
+        }
+
+        fcntl(done_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(done_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    for(i = 0; i < threads; ++i) {
+        w = &p->workers[i];
+        pthread_mutex_init(&w->mtx, NULL);
+        pthread_cond_init(&w->cv, NULL);
+        STAILQ_INIT(&w->queue);
+        w->shutdown = 0;
+
+        if(pthread_create(&w->thd, NULL, &worker_thd, w)) {
+            debug(DBG_ERROR, "Cannot start worker thread\n");
+            pthread_mutex_destroy(&w->mtx);
+            pthread_cond_destroy(&w->cv);
+            return -1;
+        }
+
+        ++p->worker_count;
+        ++total_workers;
+    }
+
+    return 0;
+}
+
+int workq_init(int threads) {
+    pool_count = 1;
+    total_workers = 0;
+
+    if(start_pool(&pools[WORKQ_POOL_DEFAULT], threads)) {
+        workq_cleanup();
+        return -1;
+    }
+
+    if(total_workers)
+        debug(DBG_LOG, "Started %d worker threads\n", total_workers);
+
+    return 0;
+}
+
+int workq_pool_add(int threads) {
+    int id;
+
+    if(pool_count == WORKQ_MAX_POOLS) {
+        debug(DBG_ERROR, "Too many worker pools\n");
+        return -1;
+    }
+
+    id = pool_count++;
+
+    if(start_pool(&pools[id], threads))
+        return -1;
+
+    if(pools[id].worker_count)
+        debug(DBG_LOG, "Started %d worker threads in pool %d\n",
+              pools[id].worker_count, id);
+
+    return id;
+}
+
+void workq_cleanup(void) {
+    workq_pool_t *p;
+    int i, j;
+
+    for(j = 0; j < pool_count; ++j) {
+        p = &pools[j];
+
+        for(i = 0; i < p->worker_count; ++i) {
+            pthread_mutex_lock(&p->workers[i].mtx);
+            p->workers[i].shutdown = 1;
+            pthread_cond_signal(&p->workers[i].cv);
+            pthread_mutex_unlock(&p->workers[i].mtx);
+        }
+    }
+
+    for(j = 0; j < pool_count; ++j) {
+        p = &pools[j];
+
+        for(i = 0; i < p->worker_count; ++i) {
+            pthread_join(p->workers[i].thd, NULL);
+            pthread_mutex_destroy(&p->workers[i].mtx);
+            pthread_cond_destroy(&p->workers[i].cv);
+        }
+
+        p->worker_count = 0;
+    }
+
+    pool_count = 0;
+    total_workers = 0;
+
+    /* Finish up anything the workers left for us. Since there are no workers
+       anymore, anything submitted from here runs right away. */
+    workq_complete();
+
+    if(done_pipe[0] != -1) {
+        close(done_pipe[0]);
+        close(done_pipe[1]);
+        done_pipe[0] = done_pipe[1] = -1;
+    }
+}
+
+int workq_fd(void) {
+    return total_workers ? done_pipe[0] : -1;
+}
+
+int workq_submit(uint32_t key, workq_fn_t work, workq_fn_t done, void *data) {
+    return workq_submit_pool(WORKQ_POOL_DEFAULT, key, work, done, data);
+}
+
+int workq_submit_pool(int pool, uint32_t key, workq_fn_t work,
+                      workq_fn_t done, void *data) {
+    workq_pool_t *p = NULL;
+    workq_job_t *job;
+    workq_worker_t *w;
+
+    if(pool >= 0 && pool < pool_count)
+        p = &pools[pool];
+
+    /* With no workers, just do it all now. */
+    if(!p || !p->worker_count) {
+        if(work)
+            work(data);
+
+        if(done)
+            done(data);
+
+        return 0;
+    }
+
+    /* Doing it now if there's no memory would let it jump ahead of anything
+       already queued for the same key, so leave it up to the caller. */
+    if(!(job = (workq_job_t *)malloc(sizeof(workq_job_t)))) {
+        debug(DBG_WARN, "Couldn't allocate work queue job\n");
+        return -1;
+    }
+
+    job->work = work;
+    job->done = done;
+    job->data = data;
+
+    w = &p->workers[key % p->worker_count];
+
+    pthread_mutex_lock(&w->mtx);
+    STAILQ_INSERT_TAIL(&w->queue, job, qentry);
+    pthread_cond_signal(&w->cv);
+    pthread_mutex_unlock(&w->mtx);
+
+    return 0;
+}
+
+void workq_complete(void) {
+    struct workq_list list;
+    workq_job_t *job;
+    char buf[64];
+
+    /* Clear out the wakeup pipe first, so that anything finished after we grab
+       the queue below will wake us up again. */
+    if(done_pipe[0] != -1) {
+        while(read(done_pipe[0], buf, sizeof(buf)) > 0) {
+        }
+    }
+
+    pthread_mutex_lock(&done_mtx);
+    STAILQ_INIT(&list);
+    STAILQ_CONCAT(&list, &done_queue);
+    pthread_mutex_unlock(&done_mtx);
+
+    while((job = STAILQ_FIRST(&list))) {
+        STAILQ_REMOVE_HEAD(&list, qentry);
+
+        if(job->done)
+            job->done(job->data);
+
+        free(job);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+    Sylverant Shipgate
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include <stdint.h>
+
+/* Default number of worker threads for CPU-heavy work (like compressing
+   character data). */
+#ifndef WORKQ_THREADS
+#define WORKQ_THREADS       2
+#endif
+
+#define WORKQ_MAX_THREADS   32
+
+/* Most pools of worker threads that can be set up, including the default one
+   started by workq_init(). */
+#define WORKQ_MAX_POOLS     4
+
+/* The default pool. */
+#define WORKQ_POOL_DEFAULT  0
+
+typedef void (*workq_fn_t)(void *data);
+
+/* Start up the worker threads. If threads is 0, all work is done immediately
+   on the calling thread instead. */
+int workq_init(int threads);
+
+/* Start up another pool of worker threads, for work that shouldn't have to
+   wait behind what's submitted to the default pool. Returns the id of the pool
+   to pass to workq_submit_pool(), or -1 on error. If threads is 0, work for the
+   pool is done immediately on the calling thread instead. */
+int workq_pool_add(int threads);
+
+/* Finish all outstanding work (including running the completion functions) and
+   shut down the worker threads in all pools. */
+void workq_cleanup(void);
+
+/* Get the file descriptor that becomes readable when there is completed work
+   waiting to be handled by workq_complete(), or -1 if there are no worker
+   threads. */
+int workq_fd(void);
+
+/* Queue up some work. The work function is run on a worker thread, then the
+   done function is run on the main thread from workq_complete(). Either may be
+   NULL. Work submitted with the same key is run (and completed) in the order it
+   was submitted. Returns -1 if the work couldn't be queued, in which case
+   neither function is run and the caller still owns data. */
+int workq_submit(uint32_t key, workq_fn_t work, workq_fn_t done, void *data);
+
+/* Queue up some work to a specific pool, otherwise like workq_submit(). */
+int workq_submit_pool(int pool, uint32_t key, workq_fn_t work,
+                      workq_fn_t done, void *data);
+
+/* Run the done functions for any work that has been finished. */
+void workq_complete(void);
+
+#endif /* !WORKQ_H */